@@ -47,6 +47,17 @@ async function createIndexes() {
         await db.collection('meter_readings').createIndex({ serial_number: 1, timestamp: -1 });
         await db.collection('meter_readings').createIndex({ timestamp: -1 });
 
+        // Indexes cho meter_phase_readings collection (từng pha của tủ 3 pha)
+        await db.collection('meter_phase_readings').createIndex({ serial_number: 1, phase: 1, timestamp: -1 });
+
+        // Mỗi số thứ tự (seq) chỉ lưu một lần: bản gửi lại của thiết bị bị bỏ qua
+        const sequenced = { unique: true, partialFilterExpression: { seq: { $exists: true } } };
+        await db.collection('meter_readings').createIndex({ serial_number: 1, seq: 1 }, sequenced);
+        await db.collection('meter_phase_readings').createIndex({ serial_number: 1, seq: 1 }, sequenced);
+
+        // Indexes cho delivery_gaps collection (các khoảng seq bị thiếu)
+        await db.collection('delivery_gaps').createIndex({ serial_number: 1, from: 1 });
+
         console.log('MongoDB indexes created successfully');
     } catch (error) {
         console.error('Error creating indexes:', error);
@@ -92,11 +103,23 @@ async function getMeterReadingsCollection() {
     return database.collection('meter_readings');
 }
 
+async function getMeterPhaseReadingsCollection() {
+    const database = await getDB();
+    return database.collection('meter_phase_readings');
+}
+
+async function getDeliveryGapsCollection() {
+    const database = await getDB();
+    return database.collection('delivery_gaps');
+}
+
 module.exports = {
     connectToMongoDB,
     getDB,
     closeConnection,
     getUsersCollection,
     getDevicesCollection,
-    getMeterReadingsCollection
+    getMeterReadingsCollection,
+    getMeterPhaseReadingsCollection,
+    getDeliveryGapsCollection
 };
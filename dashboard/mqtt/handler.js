@@ -1,7 +1,12 @@
 // mqtt/handler.js
 const mqtt = require('mqtt');
 const moment = require('moment');
-const { getDevicesCollection, getMeterReadingsCollection } = require('../db/mongodb');
+const {
+    getDevicesCollection,
+    getMeterReadingsCollection,
+    getMeterPhaseReadingsCollection,
+    getDeliveryGapsCollection
+} = require('../db/mongodb');
 const { broadcastToClients } = require('../ws/websocket');
 require('dotenv').config();
 
@@ -24,6 +29,11 @@ function initMQTT() {
                 //console.log('Subscribed to meter data topics');
             }
         });
+        mqttClient.subscribe('meter/+/bin', (err) => {
+            if (!err) {
+                //console.log('Subscribed to binary meter data topics');
+            }
+        });
         mqttClient.subscribe('meter/+/status', (err) => {
             if (!err) {
                 //console.log('Subscribed to meter status topics');
@@ -38,14 +48,24 @@ function initMQTT() {
 
     mqttClient.on('message', async (topic, message) => {
         try {
-            const data = JSON.parse(message.toString());
             const topicParts = topic.split('/');
+            const binary = topicParts[0] === 'meter' && topicParts[2] === 'bin';
+            const data = binary ? decodeBinaryPayload(message) : JSON.parse(message.toString());
 
-            if (topicParts[0] === 'meter' && topicParts[2] === 'data') {
+            if (topicParts[0] === 'meter' && (topicParts[2] === 'data' || binary)) {
                 const deviceId = topicParts[1];
                 await storeDeviceInfo(data, deviceId);
-                await storeMeterReading(data, deviceId);
-                broadcastToClients(data);
+                if (Array.isArray(data.readings)) {
+                    await storeBatch(data, deviceId);
+                } else if (data.phase) {
+                    // Per-phase reading of a 3-phase panel; the panel total arrives as a normal reading
+                    await storePhaseReading(data, deviceId);
+                } else {
+                    await storeMeterReading(data, deviceId);
+                }
+                if (!Array.isArray(data.readings)) {
+                    broadcastToClients(data);
+                }
             } else if (topicParts[0] === 'firmware' && topicParts[1] === 'test' && topicParts[2] === 'device') {
                 const deviceId = topicParts[3];
                 console.log(`Received test message for device ${deviceId}: ${data.message}`);
@@ -76,6 +96,10 @@ async function storeDeviceInfo(data, deviceId) {
     if (firmware_version) {
         updateFields.firmware_version = firmware_version;
     }
+    if (data.heartbeat) {
+        // Device reports on change only; it stays silent at most this many seconds
+        updateFields.heartbeat_interval = data.heartbeat;
+    }
     const now = new Date();
 
     try {
@@ -96,28 +120,331 @@ async function storeDeviceInfo(data, deviceId) {
     }
 }
 
+// Binary payload (firmware include/BinaryPayload.h), decoded into the same
+// shape as a JSON batch message
+const BINARY_VERSION = 1;
+const BINARY_READING_BYTES = 53;
+
+function decodeBinaryPayload(buffer) {
+    let offset = 0;
+    const u8 = () => buffer.readUInt8((offset += 1) - 1);
+    const u16 = () => buffer.readUInt16LE((offset += 2) - 2);
+    const u32 = () => buffer.readUInt32LE((offset += 4) - 4);
+    // All-ones marks a value the device did not have
+    const scaled = (value, invalid, scale) => (value === invalid ? null : value / scale);
+    const u16s = (scale) => scaled(u16(), 0xFFFF, scale);
+    const u32s = (scale) => scaled(u32(), 0xFFFFFFFF, scale);
+
+    const version = u8();
+    if (version !== BINARY_VERSION) {
+        throw new Error(`Unsupported binary payload version ${version}`);
+    }
+    const flags = u8();
+    const data = {};
+    if (flags & 0x01) {
+        data.heartbeat = u16();
+    }
+    const serialLength = u8();
+    data.serial_number = buffer.toString('utf8', offset, offset + serialLength);
+    offset += serialLength;
+    const count = u8();
+    if (flags & 0x02) {
+        data.readings = decodeDeltaReadings(buffer, offset, count);
+        return data;
+    }
+    if (buffer.length < offset + count * BINARY_READING_BYTES) {
+        throw new Error('Truncated binary payload');
+    }
+
+    data.readings = [];
+    for (let i = 0; i < count; i++) {
+        const epoch = u32();
+        const seq = u32();
+        const phase = u8();
+        const readingFlags = u8();
+        const reading = {
+            samples: u16(),
+            voltage: u16s(10),
+            voltage_min: u16s(10),
+            voltage_max: u16s(10),
+            current: u32s(1000),
+            current_min: u32s(1000),
+            current_max: u32s(1000),
+            power: u32s(10),
+            power_min: u32s(10),
+            power_max: u32s(10),
+            energy: u32s(1000),
+            energy_delta: u32s(1000),
+            frequency: u16s(10),
+            pf: scaled(u8(), 0xFF, 100),
+            alarm: (readingFlags & 0x01) !== 0
+        };
+        if (phase) {
+            reading.phase = phase;
+        }
+        if (seq) {
+            reading.seq = seq;
+        }
+        if (epoch) {
+            reading.timestamp = new Date(epoch * 1000).toISOString();
+        }
+        data.readings.push(reading);
+    }
+    return data;
+}
+
+// Delta-coded readings of a binary batch (firmware include/DeltaCodec.h):
+// every field is the zigzag varint difference to the previous reading of
+// the same phase, or to the reading just before for a phase's first one
+const DELTA_MEASUREMENTS = [
+    ['voltage', 100], ['current', 10000], ['power', 100], ['energy', 1000], ['frequency', 100], ['pf', 1000],
+    ['voltage_min', 10], ['voltage_max', 10], ['current_min', 1000], ['current_max', 1000],
+    ['power_min', 10], ['power_max', 10], ['energy_delta', 1000]
+];
+const DELTA_STREAMS = 4;
+
+function decodeDeltaReadings(buffer, offset, count) {
+    // Values can exceed 32 bits, so plain arithmetic instead of bit operators
+    const varint = () => {
+        let value = 0;
+        for (let scale = 1; ; scale *= 128) {
+            if (offset >= buffer.length) {
+                throw new Error('Truncated binary payload');
+            }
+            const b = buffer[offset++];
+            value += (b % 128) * scale;
+            if (b < 128) {
+                return value;
+            }
+        }
+    };
+    const zigzag = () => {
+        const value = varint();
+        return value % 2 ? -(value + 1) / 2 : value / 2;
+    };
+
+    const previous = [];
+    let lastStream = -1;
+    const readings = [];
+    for (let i = 0; i < count; i++) {
+        const header = varint();
+        const phase = varint();
+        const stream = phase < DELTA_STREAMS ? phase : 0;
+        const reference = previous[stream] || previous[lastStream] || new Array(3 + DELTA_MEASUREMENTS.length).fill(0);
+        const fields = reference.slice();
+        // Header bit m + 1 set: measurement m is NAN on the device and not sent
+        const missing = (m) => Math.floor(header / 2 ** (m + 1)) % 2 === 1;
+        fields[0] += zigzag();
+        fields[1] += zigzag();
+        fields[2] += zigzag();
+        DELTA_MEASUREMENTS.forEach((_, m) => {
+            if (!missing(m)) {
+                fields[3 + m] += zigzag();
+            }
+        });
+        previous[stream] = fields;
+        lastStream = stream;
+
+        const reading = { samples: fields[1] };
+        DELTA_MEASUREMENTS.forEach(([name, scale], m) => {
+            reading[name] = missing(m) ? null : fields[3 + m] / scale;
+        });
+        reading.alarm = header % 2 === 1;
+        if (phase) {
+            reading.phase = phase;
+        }
+        if (fields[2]) {
+            reading.seq = fields[2];
+        }
+        if (fields[0]) {
+            reading.timestamp = new Date(fields[0] * 1000).toISOString();
+        }
+        readings.push(reading);
+    }
+    return readings;
+}
+
+// Min/max over the device's publish window; older firmware sends single samples
+function windowFields(data) {
+    return {
+        voltage_min: data.voltage_min ?? data.voltage,
+        voltage_max: data.voltage_max ?? data.voltage,
+        current_min: data.current_min ?? data.current,
+        current_max: data.current_max ?? data.current,
+        power_min: data.power_min ?? data.power,
+        power_max: data.power_max ?? data.power,
+        energy_delta: data.energy_delta ?? null
+    };
+}
+
+function readingDoc(data, deviceId) {
+    const { serial_number, voltage, current, power, energy, frequency, pf, alarm, samples, seq, timestamp } = data;
+    return {
+        device_id: deviceId,
+        ...(seq ? { seq } : {}),
+        serial_number,
+        voltage,
+        current,
+        power,
+        energy,
+        frequency,
+        pf,
+        alarm,
+        samples: samples || 1,
+        ...windowFields(data),
+        timestamp: timestamp ? new Date(timestamp) : new Date()
+    };
+}
+
 async function storeMeterReading(data, deviceId) {
-    const { serial_number, voltage, current, power, energy, timestamp } = data;
+    const { serial_number, voltage, current, power, energy, frequency, pf } = data;
     console.log(`Received data from device ${deviceId} | Serial: ${serial_number}`);
-    console.log(`Voltage: ${voltage} V | Current: ${current} A | Power: ${power} W | Energy: ${energy} kWh`);
+    console.log(`Voltage: ${voltage} V | Current: ${current} A | Power: ${power} W | Energy: ${energy} kWh | Frequency: ${frequency} Hz | PF: ${pf}`);
 
     try {
         const readingsCollection = await getMeterReadingsCollection();
-        await readingsCollection.insertOne({
-            device_id: deviceId,
-            serial_number,
-            voltage,
-            current,
-            power,
-            energy,
-            timestamp: timestamp ? new Date(timestamp) : new Date()
-        });
+        const duplicates = await insertReadings(readingsCollection, [readingDoc(data, deviceId)]);
         console.log(`Stored reading for device ${deviceId}`);
+        await trackSequence(serial_number, data.seq ? [data.seq] : [], duplicates);
     } catch (error) {
         console.error('Error storing meter reading:', error);
     }
 }
 
+async function storePhaseReading(data, deviceId) {
+    try {
+        const phaseCollection = await getMeterPhaseReadingsCollection();
+        const duplicates = await insertReadings(phaseCollection, [{ ...readingDoc(data, deviceId), phase: data.phase }]);
+        await trackSequence(data.serial_number, data.seq ? [data.seq] : [], duplicates);
+    } catch (error) {
+        console.error('Error storing phase reading:', error);
+    }
+}
+
+// Several readings in one message: shared fields once, one insertMany per collection
+async function storeBatch(data, deviceId) {
+    const { readings, ...shared } = data;
+    const entries = readings.map((reading) => ({ ...shared, ...reading }));
+    const totals = entries.filter((entry) => !entry.phase).map((entry) => readingDoc(entry, deviceId));
+    const phases = entries.filter((entry) => entry.phase)
+        .map((entry) => ({ ...readingDoc(entry, deviceId), phase: entry.phase }));
+    console.log(`Received ${entries.length} readings from device ${deviceId} | Serial: ${shared.serial_number}`);
+
+    try {
+        let duplicates = 0;
+        if (totals.length) {
+            const readingsCollection = await getMeterReadingsCollection();
+            duplicates += await insertReadings(readingsCollection, totals);
+        }
+        if (phases.length) {
+            const phaseCollection = await getMeterPhaseReadingsCollection();
+            duplicates += await insertReadings(phaseCollection, phases);
+        }
+        console.log(`Stored ${entries.length - duplicates} readings for device ${deviceId}`);
+        await trackSequence(shared.serial_number, entries.filter((entry) => entry.seq).map((entry) => entry.seq), duplicates);
+    } catch (error) {
+        console.error('Error storing batched readings:', error);
+    }
+    entries.forEach((entry) => broadcastToClients(entry));
+}
+
+// Inserts readings, skipping those already stored: a device resends a batch
+// whose acknowledgement it missed, and the unique {serial_number, seq} index
+// turns the second copy into a duplicate-key error. Returns how many were skipped.
+async function insertReadings(collection, docs) {
+    try {
+        await collection.insertMany(docs, { ordered: false });
+        return 0;
+    } catch (error) {
+        const writeErrors = error.writeErrors ? [].concat(error.writeErrors) : [];
+        if (!writeErrors.length || writeErrors.some((writeError) => writeError.code !== DUPLICATE_KEY)) {
+            throw error;
+        }
+        return writeErrors.length;
+    }
+}
+
+const DUPLICATE_KEY = 11000;
+// Firmware reserves sequence numbers in blocks of this size; after a restart
+// numbering continues at the next multiple, skipping the rest of the block
+const SEQ_BLOCK = 1024;
+
+// Delivery accounting per device: highest seq seen, readings received,
+// duplicates, and a delivery_gaps entry for every run of numbers skipped.
+// A late reading (backlog resent after a newer one) counts as recovered in
+// the gap it fills, once: the gap keeps the numbers it got back in
+// `received`. A late number a gap already has, or that falls in none, is a
+// duplicate; the unique {serial_number, seq} index has counted it on insert.
+// A gap that ends where a block starts after a restart is marked so, as
+// those numbers were never used.
+async function trackSequence(serialNumber, seqs, duplicates) {
+    if (!serialNumber || !seqs.length) {
+        return;
+    }
+    try {
+        const sorted = [...new Set(seqs)].sort((a, b) => a - b);
+        const devicesCollection = await getDevicesCollection();
+        const result = await devicesCollection.findOneAndUpdate(
+            { serial_number: serialNumber },
+            {
+                $max: { seq_max: sorted[sorted.length - 1] },
+                $min: { seq_first: sorted[0] },
+                $inc: { readings_received: seqs.length - duplicates, duplicates }
+            },
+            { upsert: true, returnDocument: 'before' }
+        );
+        const prevMax = result.value && result.value.seq_max;
+        if (!prevMax) {
+            return;
+        }
+
+        const gaps = [];
+        const late = [];
+        let expected = prevMax + 1;
+        sorted.forEach((seq) => {
+            if (seq < expected) {
+                if (seq <= prevMax) {
+                    late.push(seq);
+                }
+                return;
+            }
+            if (seq > expected) {
+                gaps.push({
+                    serial_number: serialNumber,
+                    from: expected,
+                    to: seq - 1,
+                    reason: seq % SEQ_BLOCK === 0 ? 'restart' : 'missing',
+                    detected_at: new Date(),
+                    recovered: 0,
+                    received: []
+                });
+            }
+            expected = seq + 1;
+        });
+        if (!gaps.length && !late.length) {
+            return;
+        }
+
+        const gapsCollection = await getDeliveryGapsCollection();
+        if (gaps.length) {
+            await gapsCollection.insertMany(gaps);
+            console.warn(`Device ${serialNumber}: missing seq ${gaps.map((gap) => `${gap.from}-${gap.to}`).join(', ')}`);
+        }
+        if (late.length) {
+            // Conditional on membership, so a seq resent twice, or by two
+            // messages handled at once, is recovered only by the first
+            await gapsCollection.bulkWrite(late.map((seq) => ({
+                updateOne: {
+                    filter: { serial_number: serialNumber, from: { $lte: seq }, to: { $gte: seq }, received: { $ne: seq } },
+                    update: { $addToSet: { received: seq }, $inc: { recovered: 1 } }
+                }
+            })), { ordered: false });
+        }
+    } catch (error) {
+        console.error('Error tracking sequence numbers:', error);
+    }
+}
+
 function publishFirmwareUpdateOTA(serialNumber, OTAurl) {
     const topic = `firmwareUpdateOTA/device/${serialNumber}`;
     const payload = JSON.stringify({ OTAurl: OTAurl });
@@ -3,6 +3,18 @@ const { getDevicesCollection, getMeterReadingsCollection } = require('../db/mong
 const { authenticateToken } = require('../middleware/auth');
 const router = express.Router();
 
+/**
+ * Thiết bị báo theo thay đổi (deadband) có thể im lặng tới heartbeat_interval giây,
+ * chỉ coi là offline khi quá 2 lần khoảng đó mà không có tin nào
+ */
+function withOnlineStatus(device) {
+    if (!device.heartbeat_interval || !device.last_seen) {
+        return device;
+    }
+    const silence = Date.now() - new Date(device.last_seen).getTime();
+    return { ...device, online: silence <= 2 * device.heartbeat_interval * 1000 };
+}
+
 /**
  * Lấy tất cả thiết bị của user hiện tại
  */
@@ -13,7 +25,7 @@ router.get('/', authenticateToken, async (req, res) => {
             .find({ username: req.user.username })
             .sort({ last_seen: -1 })
             .toArray();
-        res.json(devices);
+        res.json(devices.map(withOnlineStatus));
     } catch (error) {
         console.error('Get devices error:', error);
         return res.status(500).json({ error: error.message });
@@ -59,7 +71,7 @@ router.get('/by-serial/:serial_number', authenticateToken, async (req, res) => {
             return res.status(404).json({ error: 'Device not found or access denied' });
         }
 
-        res.json(device);
+        res.json(withOnlineStatus(device));
     } catch (error) {
         console.error('Get device by serial error:', error);
         return res.status(500).json({ error: error.message });
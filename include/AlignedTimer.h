@@ -0,0 +1,35 @@
+#ifndef ALIGNEDTIMER_H
+#define ALIGNEDTIMER_H
+
+#include <Arduino.h>
+
+// Fires on wall-clock multiples of its period (UTC), plus an offset: with
+// a period of 10 s at :00, :10, :20 ... on every device, however long each
+// pass of loop() took. Until the clock is set it fires every period from
+// the first call instead, and moves onto the boundaries once it is.
+class AlignedTimer
+{
+public:
+    AlignedTimer();
+
+    // Starts over on the next boundary; the offset is taken modulo the
+    // period. A period of 0 is refused (false) and the timer keeps its own.
+    bool set(unsigned long periodMs, unsigned long offsetMs = 0);
+    unsigned long period() const { return periodMs; }
+    // True once per period, on the first call at or after the boundary;
+    // boundaries missed meanwhile are skipped
+    bool due(unsigned long now);
+    // millis() of the boundary due() last fired for, the latest passed
+    unsigned long boundary() const { return firedAt; }
+
+private:
+    int64_t boundaryAfter(int64_t epochMs) const;
+
+    unsigned long periodMs;
+    unsigned long offsetMs;
+    int64_t next;          // wall-clock ms of the next boundary, 0 = not found yet
+    bool started;          // fired at least once, without the clock
+    unsigned long firedAt;
+};
+
+#endif // ALIGNEDTIMER_H
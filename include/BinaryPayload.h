@@ -0,0 +1,56 @@
+#ifndef BINARYPAYLOAD_H
+#define BINARYPAYLOAD_H
+
+#include <Arduino.h>
+#include "types/DataTypes.h"
+
+// Compact telemetry encoding, published on meter/<device_id>/bin instead
+// of the JSON on meter/<device_id>/data. All integers are little-endian.
+//
+// Message:
+//   u8  version (VERSION)
+//   u8  flags          bit0: heartbeat follows
+//                      bit1: readings are delta coded (DeltaCodec.h)
+//   u16 heartbeat      seconds, only with flag bit0
+//   u8  serial length, then the serial number bytes
+//   u8  reading count, then the readings
+//
+// A batch (more than one reading) is delta coded, see DeltaCodec.h. A
+// single reading takes READING_BYTES in the PZEM's own resolution:
+//   u32 epoch          wall-clock seconds at acquisition, 0 = not known
+//   u32 seq            per device sequence number, 0 = none
+//   u8  phase          0 = single meter / panel total
+//   u8  flags          bit0: alarm
+//   u16 samples
+//   u16 voltage, voltage_min, voltage_max        0.1 V
+//   u32 current, current_min, current_max        mA
+//   u32 power, power_min, power_max              0.1 W
+//   u32 energy, energy_delta                     Wh
+//   u16 frequency                                0.1 Hz
+//   u8  pf                                       0.01
+//
+// A field whose value is not available (NAN) holds the all-ones value of
+// its width.
+class BinaryPayload
+{
+public:
+    static const uint8_t VERSION = 1;
+    static const uint8_t FLAG_HEARTBEAT = 0x01;
+    static const uint8_t FLAG_DELTA = 0x02;
+    static const uint8_t FLAG_ALARM = 0x01;
+    static const size_t READING_BYTES = 53;
+    static constexpr size_t MAX_SERIAL = 32; // constexpr: min() takes it by reference
+    static const size_t HEADER_BYTES = 5 + MAX_SERIAL; // largest header
+
+    // Encodes `count` readings into `out`; returns the length, 0 if they do not fit
+    static size_t encode(const String &serialNumber, unsigned long heartbeatSeconds,
+                         const MeterReadings *readings, uint8_t count, uint8_t *out, size_t size);
+
+private:
+    static uint8_t *put8(uint8_t *p, uint8_t value);
+    static uint8_t *put16(uint8_t *p, uint16_t value);
+    static uint8_t *put32(uint8_t *p, uint32_t value);
+    static uint32_t scaled(float value, float scale, uint32_t invalid);
+};
+
+#endif // BINARYPAYLOAD_H
@@ -0,0 +1,56 @@
+#ifndef COMMANDPROCESSOR_H
+#define COMMANDPROCESSOR_H
+
+#include <Arduino.h>
+#include "ConfigManager.h"
+#include "DataSender.h"
+
+// Commands received on meter/<id>/control, a flat JSON object:
+//   {"command":"update_config","key":"reading_interval","value":5000}
+//   {"command":"set_sample_interval","value":1000}
+//   {"command":"set_publish_interval","value":10000}
+//   {"command":"flush_backlog"}
+//   {"command":"snapshot"}
+//   {"command":"reset_config"}
+//   {"command":"reboot"}
+// Each one is answered on meter/<id>/response with
+//   {"command":"...","id":...,"ok":true} or {...,"ok":false,"error":"..."}
+// where "id" echoes the request's own "id", if it had one. The payload is
+// parsed where MqttClient received it (JsonReader); the reply is written
+// into a fixed buffer.
+class CommandProcessor
+{
+public:
+    CommandProcessor(ConfigManager &configManager, DataSender &dataSender);
+    // Registers with the DataSender
+    void begin();
+    void handle(uint8_t *payload, unsigned int length);
+    // Carries out what has to wait for the reply to go out (reboot)
+    void loop();
+    // True once after a snapshot command: publish the current readings now
+    bool takeSnapshotRequest();
+
+private:
+    struct Value;
+    bool updateConfig(const char *key, const Value &value, const char *&error);
+    static bool atolChecked(const char *text, long &value);
+    void respond(const char *command, bool ok, const char *error, long pending);
+
+    static const uint16_t MIN_SAMPLE_INTERVAL = 200; // ms, one PZEM transaction per slave
+    static const unsigned long REBOOT_DELAY = 1000;  // ms for the reply to leave
+    static const uint8_t ID_SIZE = 40;
+    static const uint8_t MAX_COMMAND_LENGTH = 24; // longer than any command name
+    static const uint16_t RESPONSE_SIZE = 192;
+
+    ConfigManager &configManager;
+    DataSender &dataSender;
+    bool snapshotRequested;
+    bool rebootPending;
+    unsigned long rebootAt;
+    // The request's "id", as a string or a whole number
+    char id[ID_SIZE];
+    bool idIsNumber;
+    char response[RESPONSE_SIZE];
+};
+
+#endif // COMMANDPROCESSOR_H
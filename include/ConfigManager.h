@@ -4,17 +4,58 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <LittleFS.h>
+#include <functional>
+#include "types/DataTypes.h"
 
 struct MeterConfig {
     String mqtt_server;
     int mqtt_port;
     String device_id;
     String serial_number;
-    int reading_interval;
+    int reading_interval;  // publish period (ms)
+    int sample_interval;   // PZEM sample period (ms), averaged until the next publish
+    int publish_offset;    // ms after each wall-clock publish boundary before publishing
     String wifi_ssid;
     String wifi_password;
     String mqtt_username;
     String mqtt_password;
+    String pzem_addresses; // "1,2,3" for one PZEM per phase, empty = single PZEM
+    bool report_by_exception;
+    float deadband_voltage;      // V
+    float deadband_voltage_pct;
+    float deadband_current;      // A
+    float deadband_current_pct;
+    float deadband_power;        // W
+    float deadband_power_pct;
+    int heartbeat_interval;      // ms
+    int backlog_days;            // flash backlog capacity while the broker is unreachable
+    int drain_rate;              // backlog readings resent per second after reconnecting
+    int batch_size;              // readings per MQTT message
+    String payload_format;       // "json" or "binary"
+    bool mqtt_tls;               // MQTT over TLS (port 8883)
+    String mqtt_fingerprint;     // SHA-1 of the broker certificate, hex
+    String mqtt_pubkey;          // or the broker's public key, PEM
+};
+
+// Groups of settings, as bits of the `changed` mask passed to change listeners
+enum ConfigChange : uint32_t
+{
+    CONFIG_MQTT_SERVER = 1 << 0,      // mqtt_server, mqtt_port
+    CONFIG_MQTT_AUTH = 1 << 1,        // mqtt_username, mqtt_password
+    CONFIG_MQTT_TLS = 1 << 2,         // mqtt_tls, mqtt_fingerprint, mqtt_pubkey
+    CONFIG_DEVICE_ID = 1 << 3,
+    CONFIG_SERIAL_NUMBER = 1 << 4,
+    CONFIG_SAMPLE_INTERVAL = 1 << 5,
+    CONFIG_READING_INTERVAL = 1 << 6,
+    CONFIG_PZEM_ADDRESSES = 1 << 7,
+    CONFIG_REPORT_POLICY = 1 << 8,    // report_by_exception, deadbands, heartbeat_interval
+    CONFIG_BACKLOG_DAYS = 1 << 9,
+    CONFIG_DRAIN_RATE = 1 << 10,
+    CONFIG_BATCH_SIZE = 1 << 11,
+    CONFIG_PAYLOAD_FORMAT = 1 << 12,
+    CONFIG_WIFI = 1 << 13,            // wifi_ssid, wifi_password
+    CONFIG_PUBLISH_OFFSET = 1 << 14,
+    CONFIG_ALL = 0xFFFFFFFF
 };
 
 class ConfigManager {
@@ -22,11 +63,24 @@ public:
     ConfigManager();
     bool loadConfig();
     bool saveConfig();
+    // False for an unknown key, a value out of range or a failed save;
+    // lastError() says which. The config keeps its previous value.
     bool updateConfig(const String& key, const String& value);
     bool updateConfig(const String& key, int value);
+    const char *lastError() const { return failure; }
     MeterConfig getConfig();
     void printConfig();
     bool resetToDefaults();
+
+    // Settings changed by the web page or an MQTT command reach the
+    // subsystems through listeners, without a reboot. Changes accumulate
+    // and applyChanges() hands them over, from a point of loop() where
+    // nothing is half done (never from the web or MQTT handler that made
+    // them). Each listener is called once with the groups of its `mask`
+    // that changed; after loadConfig() that is all of them.
+    typedef std::function<void(const MeterConfig &config, uint32_t changed)> ChangeListener;
+    void onChange(uint32_t mask, ChangeListener listener);
+    void applyChanges();
     
     // Helper methods
     String getMqttServer() { return config.mqtt_server; }
@@ -34,12 +88,55 @@ public:
     String getDeviceId() { return config.device_id; }
     String getSerialNumber() { return config.serial_number; }
     int getReadingInterval() { return config.reading_interval; }
+    int getSampleInterval() { return config.sample_interval; }
+    int getPublishOffset() { return config.publish_offset; }
+    String getPzemAddresses() { return config.pzem_addresses; }
+    ReportPolicy getReportPolicy();
+    int getBacklogDays() { return config.backlog_days; }
+    int getDrainRate() { return config.drain_rate; }
+    int getBatchSize() { return config.batch_size; }
+    bool getMqttTls() { return config.mqtt_tls; }
+    String getMqttFingerprint() { return config.mqtt_fingerprint; }
+    String getMqttPubkey() { return config.mqtt_pubkey; }
+    PayloadFormat getPayloadFormat() { return config.payload_format == "binary" ? PAYLOAD_BINARY : PAYLOAD_JSON; }
 
 private:
     MeterConfig config;
     const char* CONFIG_FILE = "/config.json";
     
-    void setDefaults();
+    static void setDefaults(MeterConfig &config);
+    bool commit(const MeterConfig &before, const String &key, const String &value);
+    const char *rangeError(const MeterConfig &config, const char *&key);
+    static uint32_t changesBetween(const MeterConfig &a, const MeterConfig &b);
+
+    // Limits of the numeric settings, checked on every update and on load
+    struct IntRange
+    {
+        const char *key;
+        int MeterConfig::*field;
+        int min;
+        int max;
+    };
+    struct FloatRange
+    {
+        const char *key;
+        float MeterConfig::*field;
+        float max;
+    };
+    static const IntRange INT_RANGES[];
+    static const FloatRange FLOAT_RANGES[];
+    const char *failure;
+    char failureText[64];
+
+    struct Listener
+    {
+        uint32_t mask;
+        ChangeListener callback;
+    };
+    static const uint8_t MAX_LISTENERS = 6;
+    Listener listeners[MAX_LISTENERS];
+    uint8_t listenerCount;
+    uint32_t changes; // not applied yet
 };
 
 #endif // CONFIGMANAGER_H 
\ No newline at end of file
@@ -2,27 +2,90 @@
 #define DATASENDER_H
 
 #include <Arduino.h>
-#include <PubSubClient.h>
+#include <LittleFS.h>
 #include <WiFiClient.h>
+#include <WiFiClientSecureBearSSL.h>
+#include "DeltaCodec.h"
+#include "JsonWriter.h"
+#include "MqttClient.h"
+#include "SegmentLog.h"
 #include "types/DataTypes.h"
 
 class DataSender
 {
 public:
+    struct Stats
+    {
+        uint32_t queued;    // readings handed over for publishing
+        uint32_t delivered; // readings whose PUBACK arrived
+        uint32_t requeued;  // readings in flight when the connection dropped, moved to flash
+    };
+
+    // Called with the payload of every message on meter/<id>/control; the
+    // payload may be modified in place
+    typedef std::function<void(uint8_t *payload, unsigned int length)> CommandHandler;
+
     DataSender();
     void setup();
+    // Connection, acknowledgements, control messages and the batch hold;
+    // call on every loop() pass
     void loop();
-    void sendData(float voltage, float current, float power, float energy);
+    void sendData(const MeterReadings &readings);
+    // Resends the flash backlog while connected, paced by drain_rate
     void sendBufferedData();
-    void addToBuffer(float voltage, float current, float power, float energy);
+    void addToBuffer(const MeterReadings *readings, uint8_t count);
     bool isConnected();
+    // Reconnects only if the broker, the credentials or the device ID changed
     void updateConfig(const char *mqttServer, int mqttPort, const char *deviceId, const char *serialNumber, const char *mqttPassword, const char *mqttUser); // sửa hàm này
+    // MQTT over TLS, the broker pinned by its public key (PEM) or else by
+    // the SHA-1 fingerprint of its certificate; with neither it is not
+    // authenticated. Reconnects.
+    void setTls(bool enabled, const String &fingerprint, const String &publicKey);
+    void setReportPolicy(const ReportPolicy &policy) { reportPolicy = policy; }
+    // Sizes the flash backlog to hold `days` of readings at the given publish rate
+    void setBacklogDays(int days, unsigned long publishIntervalMs, uint8_t streams);
+    uint32_t backlogPending() const { return backlog.pending(); }
+    // Backlog resend rate once the broker is back (readings per second)
+    void setDrainRate(uint16_t readingsPerSecond) { drainRate = readingsPerSecond ? readingsPerSecond : 1; }
+    // Up to `size` readings per MQTT message; below BATCH_MAX_HOLD between
+    // publishes, live readings are held back to fill a batch
+    void setBatchSize(uint8_t size, unsigned long publishIntervalMs);
+    void setPayloadFormat(PayloadFormat format) { payloadFormat = format; }
+    unsigned long suppressedReports() const { return suppressed; }
+    const Stats &stats() const { return deliveryStats; }
+    void setCommandHandler(CommandHandler handler) { commandHandler = handler; }
+    // Replies to a control command on meter/<id>/response, at QoS 0
+    bool publishResponse(const char *payload, size_t length);
+    // Resends the flash backlog without the drain_rate pacing until it is empty
+    void flushBacklog() { flushing = true; }
+    // Publishes the readings held back for batching now
+    void flushBatch();
 
 private:
     void reconnect();
-    String getTimestamp();
-    String createPayload(String serial_number, float voltage, float current, float power, float energy);
+    void restartConnection();
+    unsigned long scheduleReconnect();
+    void prepareTls();
+    void reportHandshake();
+    void buildTopics();
+    static void formatTimestamp(uint32_t epoch, char *out, size_t size);
+    bool waitingForClock() const;
+    size_t createPayload(const MeterReadings *readings, uint8_t &count);
+    void addReadingFields(JsonWriter &json, const MeterReadings &readings);
+    struct InFlight;
+    uint8_t publishBatch(const MeterReadings *readings, uint8_t count, InFlight &slot, bool dup = false);
+    InFlight *freeSlot(uint8_t reserve);
+    void commitSlot();
+    void onPublishAck(uint16_t packetId);
+    void releaseAcked();
+    void abandonInFlight();
+    bool storedInFlight() const;
     void callback(char *topic, byte *payload, unsigned int length);
+    bool shouldReport(MeterReadings &readings);
+    void loadSeq();
+    void reserveSeq();
+    static bool outside(float value, float reference, const Deadband &band);
+    uint8_t readStored(SegmentLog::Position &pos, MeterReadings *readings, uint8_t capacity, uint16_t &records);
 
     String mqttServer;
     int mqttPort;
@@ -32,23 +95,138 @@ private:
     String mqttUser;     // thêm thuộc tính này
     // thêm thuộc tính này
     WiFiClient wifiClient;
-    PubSubClient client;
+    MqttClient client;
+
+    // TLS: BearSSL's default buffers take about 17 KB per connection; when
+    // the broker accepts the max fragment length extension they shrink to
+    // TLS_RX_BUFFER / TLS_TX_BUFFER. The session is kept between
+    // connections so that a reconnect resumes it instead of doing the full
+    // handshake (RSA / ECDHE, several seconds on the ESP8266).
+    static const uint16_t TLS_FRAGMENT = 512;   // records the broker is asked to keep to
+    static const int TLS_RX_BUFFER = 1024;      // a fragment and the record overhead
+    static const int TLS_TX_BUFFER = 512;
+    static const unsigned long TLS_TIMEOUT = 5000; // handshake
+    BearSSL::WiFiClientSecure secureClient;
+    BearSSL::Session tlsSession;
+    BearSSL::PublicKey brokerKey;
+    bool tls;
+    bool tlsProbed; // max fragment length asked once per boot
+    uint8_t tlsSessionId[32]; // before the attempt, tells a resumed session from a new one
+    uint8_t tlsSessionIdLength;
+
+    // Readings that could not be published wait on flash (store-and-forward),
+    // one log record per batch: [RECORD_VERSION][count][delta-coded readings]
+    static const uint8_t RECORD_VERSION = 1;
+    static const uint8_t RECORD_UPTIME = 2; // as RECORD_VERSION, epoch holds seconds since boot
+    static const uint8_t STORED_READING_BYTES = 47; // per reading with the record overhead at batch_size 1 (--bench=codec)
+    SegmentLog backlog;
+    uint32_t backlogCapacity;
+    DeltaCodec storedCodec; // of the record being written or read, kept off the stack
+    SegmentLog::Position bootPosition; // records from here on were written since boot
+    // Readings are held on flash while the clock is not set, this long after boot at most
+    static const unsigned long CLOCK_WAIT = 300000;
+
+    // Token bucket pacing the backlog resend, in thousandths of a reading
+    static const uint8_t DRAIN_PER_PASS = 2; // messages resent per sendBufferedData() call at most
+    static const uint8_t DRAIN_BURST = 10;   // bucket size in readings, at least MAX_BATCH
+    uint16_t drainRate;
+    uint32_t drainTokens;
+    unsigned long lastDrainRefill;
+    bool draining;
+    bool flushing; // flush_backlog command: no pacing until the backlog is empty
+
+    // Several readings per message, serial_number/device_id sent once
+    static const uint8_t MAX_BATCH = 8;
+    static const unsigned long BATCH_MAX_HOLD = 10000; // ms a live reading may wait for its batch
+    uint8_t batchSize;
+    unsigned long batchHold;
+    MeterReadings batch[MAX_BATCH]; // live readings waiting to be published
+    uint8_t batchCount;
+    unsigned long batchStartedAt;
+    // Backlog readings being resent; the log is read ahead of its read
+    // position, which only moves on PUBACK
+    SegmentLog::Position drainNext;           // next record to read
+    MeterReadings drainBatch[MAX_BATCH];
+    SegmentLog::Position drainEnd[MAX_BATCH]; // log position after the record of each drained reading
+    uint16_t drainRecords[MAX_BATCH];         // log records read from drainNext up to and with that record
+    uint8_t drainCount;
+    uint8_t drainSent;                        // of drainBatch, already published
+    uint16_t drainAttributed;                 // of drainRecords, already assigned to a message
+    // End of the furthest record published since boot: a message that starts
+    // before it is a resend (the connection dropped first) and carries DUP
+    SegmentLog::Position publishedEnd;
 
-    static const int BUFFER_SIZE = 10;
-    struct BufferedData
+    // Every message is published at QoS 1 and waits in this window, in
+    // publish order, until its PUBACK. Live readings are kept here and go
+    // to flash if the connection drops first; backlog records only leave
+    // the log on their PUBACK, in order.
+    static const uint8_t MAX_IN_FLIGHT = 4;       // one is kept for live readings
+    static const unsigned long ACK_TIMEOUT = 15000; // ms; then the connection is reset
+    struct InFlight
     {
-        float voltage;
-        float current;
-        float power;
-        float energy;
-        unsigned long timestamp;
+        uint16_t packetId;
+        bool acked;
+        unsigned long sentAt;
+        uint8_t count;
+        bool stored;                       // resent from the backlog
+        SegmentLog::Position end;          // stored: acknowledge the log up to here
+        uint16_t records;                  // stored: log records completed by this message, may be 0
+        MeterReadings readings[MAX_BATCH]; // live: what goes to flash if never acknowledged
     };
-    BufferedData dataBuffer[BUFFER_SIZE];
-    int bufferIndex;
-    int bufferCount;
+    InFlight inFlight[MAX_IN_FLIGHT]; // ring buffer
+    uint8_t inFlightHead;
+    uint8_t inFlightCount;
+    Stats deliveryStats;
 
-    unsigned long lastReconnectAttempt = 0;
-    const unsigned long RECONNECT_INTERVAL = 5000; // 5 seconds
+    PayloadFormat payloadFormat;
+
+    // Publish path without heap allocations: topics are built when the
+    // config changes and payloads are written into one static buffer
+    static const uint8_t TOPIC_SIZE = 64;
+    static const uint16_t PAYLOAD_SIZE = 2048; // bounds the batch: about 6 JSON window readings
+    char dataTopic[TOPIC_SIZE];
+    char binTopic[TOPIC_SIZE];
+    char controlTopic[TOPIC_SIZE];
+    char responseTopic[TOPIC_SIZE];
+    uint8_t payload[PAYLOAD_SIZE];
+
+    // Report-by-exception state per stream: [0] = total / single, [1..3] = phases
+    static const uint8_t REPORT_STREAMS = 4;
+    ReportPolicy reportPolicy;
+    MeterReadings lastReported[REPORT_STREAMS];
+    unsigned long lastReportAt[REPORT_STREAMS];
+    bool hasReported[REPORT_STREAMS];
+    float pendingEnergy[REPORT_STREAMS]; // kWh of windows that were not sent
+    unsigned long suppressed;
+
+    CommandHandler commandHandler;
+
+    // Every reading handed over gets the next sequence number, so the
+    // backend can tell a lost reading from one never taken. Numbers are
+    // reserved on flash SEQ_BLOCK at a time, one write per block; after a
+    // restart numbering goes on at the next multiple of SEQ_BLOCK and the
+    // rest of the block is never used.
+    static const uint32_t SEQ_BLOCK = 1024;
+    uint32_t nextSeq;
+    uint32_t seqReserved; // first number of the next block
+    File seqFile;
+
+    // Reconnect with capped exponential backoff and full jitter: attempt n
+    // waits a random time below min(RECONNECT_MAX, RECONNECT_MIN << n), so
+    // meters that lost the broker at the same moment do not come back in
+    // lockstep. Attempts never block for long (MqttClient).
+    enum Link
+    {
+        LINK_WAITING,    // until the next attempt is due
+        LINK_CONNECTING,
+        LINK_UP
+    };
+    static const unsigned long RECONNECT_MIN = 5000;
+    static const unsigned long RECONNECT_MAX = 300000;
+    Link link;
+    uint8_t reconnectAttempts;
+    unsigned long reconnectFrom;
+    unsigned long reconnectDelay;
 };
 
 #endif // DATASENDER_H
\ No newline at end of file
@@ -0,0 +1,14 @@
+#ifndef DEBUGSERIAL_H
+#define DEBUGSERIAL_H
+
+#include <Arduino.h>
+
+// Port used for log output. With PZEM_HW_UART the PZEM owns UART0
+// (swapped to D7/D8), so logs go out on UART1 TX (D4) instead.
+#ifdef PZEM_HW_UART
+#define DebugSerial Serial1
+#else
+#define DebugSerial Serial
+#endif
+
+#endif // DEBUGSERIAL_H
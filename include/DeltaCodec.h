@@ -0,0 +1,63 @@
+#ifndef DELTACODEC_H
+#define DELTACODEC_H
+
+#include <Arduino.h>
+#include "types/DataTypes.h"
+
+// Delta coding of a run of readings, used for batched binary payloads and
+// for the records of the flash backlog.
+//
+// Every value is turned into an integer at the resolution of the JSON
+// payload (voltage 0.01 V, current 0.1 mA, power 0.01 W, energy Wh, ...)
+// and written as the zigzag varint of its difference to the previous
+// reading of the same phase. The first reading of a phase in a run is
+// relative to the reading just before it, whatever its phase (the phases
+// of a panel share voltage, frequency and time); the first reading of a
+// run is relative to zero, i.e. absolute. Consecutive windows differ
+// little and energy only grows, so most fields take one or two bytes.
+//
+// Reading:
+//   varint   bit0 alarm, bit1.. one bit per measurement that is NAN (not written)
+//   varint   phase
+//   zigzag   epoch, samples, seq
+//   zigzag   voltage, current, power, energy, frequency, pf,
+//            voltage_min, voltage_max, current_min, current_max,
+//            power_min, power_max, energy_delta
+//
+// A varint holds 7 bits per byte, least significant group first, high bit
+// set on all bytes but the last; zigzag maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+class DeltaCodec
+{
+public:
+    static const uint8_t MEASUREMENTS = 13;
+    // header, phase, epoch, samples, seq, measurements at their longest
+    static const size_t MAX_READING_BYTES = 2 + 2 + 5 + 3 + 5 + MEASUREMENTS * 5;
+
+    DeltaCodec() { reset(); }
+
+    // Starts a new run: the next reading of every phase is written in full
+    void reset();
+    // Appends one reading to `out`; returns its length, 0 if it does not fit
+    size_t encode(const MeterReadings &readings, uint8_t *out, size_t size);
+    // Reads one reading; returns the bytes used, 0 on truncated or invalid data
+    size_t decode(const uint8_t *in, size_t size, MeterReadings &readings);
+
+private:
+    static const uint8_t STREAMS = 4; // phase 0..3
+    static const uint8_t HEAD_FIELDS = 3; // epoch, samples, seq
+    static const uint8_t FIELDS = HEAD_FIELDS + MEASUREMENTS;
+    static const uint8_t SEQ_FIELD = 2;
+
+    static uint8_t stream(uint8_t phase) { return phase < STREAMS ? phase : 0; }
+    const int64_t *reference(uint8_t stream) const;
+    static uint8_t *putVarint(uint8_t *p, const uint8_t *end, uint64_t value);
+    static const uint8_t *getVarint(const uint8_t *p, const uint8_t *end, uint64_t &value);
+    static uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+    static int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+    int64_t previous[STREAMS][FIELDS];
+    bool seen[STREAMS];
+    int8_t lastStream; // -1 at the start of a run
+};
+
+#endif // DELTACODEC_H
@@ -0,0 +1,62 @@
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+#include <Arduino.h>
+
+// Reads a flat JSON object in the buffer it was received in, without
+// copying it or touching the heap; control commands come through it
+// instead of a String and a JsonDocument. Strings are unescaped in place
+// and NUL-terminated where their closing quote was, so key() and string()
+// point into the buffer and stay valid until it is reused. Nested objects
+// and arrays are not supported and count as syntax errors, as does
+// anything but white space after the object.
+class JsonReader
+{
+public:
+    enum Type
+    {
+        NONE,
+        STRING,
+        NUMBER,
+        BOOLEAN,
+        NULL_VALUE
+    };
+
+    JsonReader(char *buffer, size_t length);
+
+    // Moves to the next member; false at the end of the object or on a
+    // syntax error, which ok() then reports
+    bool next();
+    bool ok() const { return !failed; }
+
+    const char *key() const { return keyText; }
+    Type type() const { return valueType; }
+    const char *string() const { return valueType == STRING ? valueText : ""; }
+    bool boolean() const { return valueType == BOOLEAN && valueText[0] == 't'; }
+    // NUMBER as written, for converting or passing it on as text; false
+    // if it does not fit
+    bool numberText(char *out, size_t size) const;
+
+private:
+    bool fail();
+    void skipSpace();
+    bool consume(char c);
+    bool literal(const char *text);
+    char *readString();
+    bool readNumber();
+    bool digits();
+    bool finish();
+    static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+    char *pos;
+    char *end;
+    bool failed;
+    bool started;
+    bool finished;
+    const char *keyText;
+    Type valueType;
+    const char *valueText;
+    size_t valueLength;
+};
+
+#endif // JSONREADER_H
@@ -0,0 +1,58 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <Arduino.h>
+
+// Writes JSON into a caller-owned buffer without touching the heap; the
+// publish path uses it instead of a JsonDocument and a String. Commas are
+// inserted automatically. When the buffer is too small the writer stops
+// and ok() turns false; mark() / rewind() drop a partly written element.
+class JsonWriter
+{
+public:
+    struct Mark
+    {
+        size_t length;
+        uint8_t depth;
+        bool first;
+    };
+
+    JsonWriter(char *buffer, size_t size);
+
+    void beginObject();
+    void endObject();
+    void beginArray(const char *key);
+    void endArray();
+
+    void field(const char *key, const char *value);
+    void field(const char *key, uint32_t value);
+    void field(const char *key, bool value);
+    // Rounded to `decimals`, trailing zeros dropped; NAN becomes null
+    void field(const char *key, float value, uint8_t decimals);
+
+    Mark mark() const { return {length, depth, first[depth]}; }
+    void rewind(const Mark &mark);
+
+    bool ok() const { return !overflow; }
+    size_t size() const { return length; }
+    const char *c_str() const { return buffer; }
+
+private:
+    static const uint8_t MAX_DEPTH = 4;
+
+    void separator();
+    void key(const char *name);
+    void raw(const char *text);
+    void raw(char c);
+    void quoted(const char *text);
+    void number(uint64_t value);
+
+    char *buffer;
+    size_t capacity;
+    size_t length;
+    bool overflow;
+    uint8_t depth;
+    bool first[MAX_DEPTH]; // no element written yet at this level
+};
+
+#endif // JSONWRITER_H
@@ -1,20 +1,88 @@
 #ifndef METER_H
 #define METER_H
 
-#include <PZEM004Tv30.h>
 #include <SoftwareSerial.h>
-#include <time.h>
+#include "AlignedTimer.h"
+#include "PzemModbus.h"
 #include "types/DataTypes.h"
 
+// Polls one or more PZEM-004T v3 on a shared bus. With several slaves
+// (one per phase) they are read back to back in round-robin order; each
+// completed cycle yields per-phase readings plus a combined total.
+//
+// The bus runs either on SoftwareSerial pins or on the hardware UART0,
+// swapped to D7 (RX) / D8 (TX). SoftwareSerial takes an interrupt per RX
+// edge and garbles bytes when WiFi keeps interrupts masked; the UART
+// receives into its FIFO and is not affected.
 class Meter
 {
 public:
+    struct BusStats
+    {
+        unsigned long frames;    // valid replies
+        unsigned long timeouts;  // no (complete) reply
+        unsigned long badFrames; // CRC, framing or exception replies
+    };
+
     Meter(int rxPin, int txPin);
-    void syncTime(); // Add this line
+    explicit Meter(HardwareSerial &uart);
+    ~Meter();
+    // Opens the serial port at 9600 baud; call from setup()
+    void begin();
+
+    // Comma separated Modbus addresses ("1,2,3"); empty = single PZEM on
+    // the general address. Returns false if the list is invalid.
+    bool setAddresses(const String &list);
+    uint8_t slaveCount() const { return slaveTotal; }
+
+    // Drives the PZEM exchange; call on every loop() pass, never blocks
+    void loop();
+    // True once per completed polling cycle (valid or failed)
+    bool readingsReady();
+    // Latest snapshot (combined over all phases); all fields NAN if no slave answered
     MeterReadings getReadings();
+    // Latest snapshot of one slave, phase 1..slaveCount()
+    MeterReadings getPhaseReadings(uint8_t phase);
+    const BusStats &busStats() const { return stats; }
+
+    // Time between the starts of two polling cycles (sample period); once
+    // the clock is set the cycles start on wall-clock multiples of it
+    void setPollInterval(unsigned long ms);
+    unsigned long getPollInterval() const { return pollTimer.period(); }
+
+    static const uint8_t PZEM_ADDRESS = 0xF8;          // general address, single device on the bus
+    static const uint8_t MAX_SLAVES = 3;
+    static const unsigned long POLL_INTERVAL = 1000;   // default ms between polling cycles
+    static constexpr unsigned long MIN_POLL_INTERVAL = 200; // a 3-slave cycle takes ~150 ms
+    static const uint8_t OFFLINE_AFTER_FAILURES = 3;   // consecutive failures before a slave is parked
+    static const uint8_t OFFLINE_PROBE_CYCLES = 10;    // a parked slave is retried once every N cycles
+
 private:
-    SoftwareSerial pzemSerial;
-    PZEM004Tv30 pzem;
+    struct Slave
+    {
+        uint8_t address;
+        MeterReadings readings;
+        uint8_t failures;
+        uint8_t skipCycles;
+    };
+
+    void startCycle();
+    bool requestNext();
+    void record(bool valid);
+    void combine();
+    static void invalidate(MeterReadings &r);
+    static void single(MeterReadings &r); // window fields of a lone sample
+
+    SoftwareSerial *softSerial; // null when the PZEM is on the UART
+    HardwareSerial *hwSerial;
+    PzemModbus modbus;
+    Slave slaves[MAX_SLAVES];
+    uint8_t slaveTotal;
+    int8_t current;       // slave being polled, -1 between cycles
+    MeterReadings readings;
+    bool ready;
+    AlignedTimer pollTimer;
+    BusStats stats;
 };
 
-#endif // METER_H
\ No newline at end of file
+#endif // METER_H
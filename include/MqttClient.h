@@ -0,0 +1,149 @@
+#ifndef MQTTCLIENT_H
+#define MQTTCLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <functional>
+#include <lwip/dns.h>
+
+// Small MQTT 3.1.1 client over any Arduino Client, in place of
+// PubSubClient, which can only publish at QoS 0.
+//
+// publish() at QoS 1 returns a packet identifier right after the PUBLISH
+// is written and does not wait: several messages can be in flight, and
+// the ack callback is called with the identifier when its PUBACK arrives.
+// The client keeps no copy of the payload. Sessions are clean, so what
+// was not acknowledged when the connection dropped has to be published
+// again after reconnecting, with new identifiers and the DUP flag set.
+//
+// connect() does not wait either: it starts the lookup of the broker's
+// name with lwIP's asynchronous DNS client, and loop() opens the TCP
+// connection once the address is known, sends CONNECT and waits for the
+// CONNACK. Only the transport's connect() blocks: the TCP handshake, for
+// TCP_TIMEOUT at most, and the TLS handshake of a secure client.
+//
+// Incoming packets are parsed a few bytes at a time from loop(), into a
+// fixed buffer; a PUBLISH larger than BUFFER_SIZE is skipped. Nothing is
+// allocated on the heap.
+class MqttClient
+{
+public:
+    // Same values as PubSubClient's state()
+    enum State
+    {
+        CONNECTION_TIMEOUT = -4,
+        CONNECTION_LOST = -3,
+        CONNECT_FAILED = -2,
+        DISCONNECTED = -1,
+        CONNECTED = 0
+        // 1..5: CONNACK return code of a refused connection
+    };
+
+    typedef std::function<void(char *topic, uint8_t *payload, unsigned int length)> MessageCallback;
+    typedef std::function<void(uint16_t packetId)> AckCallback;
+
+    static const uint16_t BUFFER_SIZE = 512; // incoming packets
+    static const uint8_t MAX_TOPIC = 64;
+    static const uint8_t MAX_HOST = 253;     // longest DNS name
+    static const uint16_t KEEPALIVE = 15;    // seconds
+    static const unsigned long DNS_TIMEOUT = 10000;
+    static const unsigned long TCP_TIMEOUT = 1000; // the ESP8266 core waits 5 s by default
+    static const unsigned long CONNECT_TIMEOUT = 15000; // CONNECT sent, no CONNACK yet
+
+    explicit MqttClient(Client &client);
+    // Switches to another transport (plain or TLS client); disconnects
+    void setTransport(Client &client, unsigned long connectTimeout = TCP_TIMEOUT);
+
+    // Keeps a copy of `host`; a name longer than MAX_HOST fails connect()
+    void setServer(const char *host, uint16_t port);
+    void setCallback(MessageCallback callback) { messageCallback = callback; }
+    void setAckCallback(AckCallback callback) { ackCallback = callback; }
+
+    // Starts a connection attempt, which loop() carries on; false if it
+    // could not start. The attempt ends with connected() or with
+    // connecting() false and the reason in state().
+    bool connect(const char *clientId, const char *user, const char *password);
+    void disconnect();
+    bool connected();
+    bool connecting() const { return phase == RESOLVING || phase == WAIT_CONNACK; }
+    int state() const { return currentState; }
+    // Time the transport's connect() took in the last attempt (TCP and TLS handshakes)
+    unsigned long connectMs() const { return lastConnectMs; }
+
+    // Moves a connection attempt on, handles incoming packets and the
+    // keepalive; call it every loop() pass
+    bool loop();
+
+    bool subscribe(const char *topic);
+    // Writes a PUBLISH; at QoS 1 `packetId` receives its identifier and
+    // `dup` marks a message sent before without a PUBACK. Returns false if
+    // it could not be written.
+    bool publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, uint16_t *packetId = nullptr,
+                 bool dup = false);
+
+private:
+    static const uint8_t CONNECT = 0x10;
+    static const uint8_t CONNACK = 0x20;
+    static const uint8_t PUBLISH = 0x30;
+    static const uint8_t DUP = 0x08; // PUBLISH flag
+    static const uint8_t PUBACK = 0x40;
+    static const uint8_t SUBSCRIBE = 0x82; // with the reserved bits set
+    static const uint8_t PINGREQ = 0xC0;
+    static const uint8_t PINGRESP = 0xD0;
+    static const uint8_t DISCONNECT = 0xE0;
+
+    enum Phase
+    {
+        IDLE,
+        RESOLVING,    // waiting for DNS
+        WAIT_CONNACK, // TCP connected, CONNECT sent
+        ONLINE
+    };
+
+    enum RxState
+    {
+        RX_HEADER,
+        RX_LENGTH,
+        RX_BODY
+    };
+
+    uint16_t nextPacketId();
+    static size_t putLength(uint8_t *out, size_t length);
+    static size_t putString(uint8_t *out, const char *text);
+    bool send(uint8_t header, const uint8_t *body, size_t length);
+    bool readPacket();
+    void handlePacket();
+    void lost(int reason); // a State or a CONNACK return code
+    void advanceConnect();
+    static void dnsFound(const char *name, const ip_addr_t *ipaddr, void *arg);
+
+    Client *client;
+    char host[MAX_HOST + 1];
+    uint16_t port;
+    MessageCallback messageCallback;
+    AckCallback ackCallback;
+    int currentState;
+    uint16_t lastPacketId;
+
+    Phase phase;
+    unsigned long phaseStartedAt;
+    size_t connectLength; // CONNECT body waiting in buffer while RESOLVING
+    unsigned long lastConnectMs;
+    // Set from the lwIP callback
+    volatile bool resolved;
+    volatile bool resolveFailed;
+    ip_addr_t brokerAddress;
+
+    unsigned long lastOutbound;
+    unsigned long lastInbound;
+    bool pingOutstanding;
+
+    RxState rxState;
+    uint8_t rxHeader;
+    size_t rxLength;
+    uint8_t rxShift;
+    size_t rxPos;
+    uint8_t buffer[BUFFER_SIZE];
+};
+
+#endif // MQTTCLIENT_H
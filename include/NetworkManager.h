@@ -1,7 +1,7 @@
 #ifndef NETWORKMANAGER_H
 #define NETWORKMANAGER_H
 
-#include <WiFiManager.h>
+#include <functional>
 
 class NetworkManager {
 public:
@@ -10,9 +10,21 @@ public:
     bool isConnected();
     bool reconnect();
     bool ensureConnection();
+    // Periodic check that never blocks: the station reconnects by itself.
+    // Only after PORTAL_AFTER without WiFi does it fall back to connect()
+    // (the network or its password changed). That is the one exception:
+    // WiFiManager 0.16 has no non-blocking portal, so loop() stops for up
+    // to the portal timeout and the ESP restarts if nobody configures it.
+    // The onPortal() callback runs first, to put the readings held in RAM
+    // on flash.
+    bool supervise();
+    void onPortal(std::function<void()> callback) { beforePortal = callback; }
 
 private:
-    WiFiManager wm;
+    std::function<void()> beforePortal;
+    static const unsigned long PORTAL_AFTER = 900000; // ms
+    bool down;
+    unsigned long downSince;
 };
 
 #endif // NETWORKMANAGER_H
\ No newline at end of file
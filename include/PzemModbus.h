@@ -0,0 +1,65 @@
+#ifndef PZEMMODBUS_H
+#define PZEMMODBUS_H
+
+#include <Arduino.h>
+
+// Non-blocking Modbus-RTU master for the PZEM-004T v3.
+// readInputRegisters() sends the request and returns at once; poll() is
+// called from loop() and only consumes bytes that have already arrived,
+// so a 9600-baud round trip never stalls the rest of the firmware.
+class PzemModbus
+{
+public:
+    enum Status
+    {
+        IDLE,
+        BUSY,
+        DONE,
+        FAILED
+    };
+
+    enum Error
+    {
+        ERR_NONE,
+        ERR_TIMEOUT,
+        ERR_CRC,
+        ERR_FRAME,
+        ERR_EXCEPTION
+    };
+
+    static const uint8_t FN_READ_INPUT = 0x04;
+    static const unsigned long RESPONSE_TIMEOUT = 100; // ms, same as the PZEM library
+    static const uint8_t MAX_FRAME = 5 + 2 * 10;       // 10 input registers
+
+    PzemModbus(Stream &port);
+
+    // Starts a read of `count` input registers; false while a request is in flight
+    bool readInputRegisters(uint8_t address, uint16_t reg, uint16_t count);
+    Status poll();
+    Status status() const { return _status; }
+    Error lastError() const { return _error; }
+    void reset();
+
+    // Register `index` of the last DONE reply, big-endian on the wire
+    uint16_t reg16(uint8_t index) const;
+    // 32-bit value spread over two registers, low word first
+    uint32_t reg32(uint8_t index) const;
+    uint8_t registerCount() const { return _rxLen > 3 ? _frame[2] / 2 : 0; }
+
+    static uint16_t crc16(const uint8_t *data, size_t len);
+
+private:
+    void fail(Error error);
+
+    Stream &_port;
+    Status _status;
+    Error _error;
+    uint8_t _address;
+    uint8_t _function;
+    uint8_t _expectedLen;
+    uint8_t _frame[MAX_FRAME];
+    uint8_t _rxLen;
+    unsigned long _sentAt;
+};
+
+#endif // PZEMMODBUS_H
@@ -0,0 +1,59 @@
+#ifndef SAMPLEWINDOW_H
+#define SAMPLEWINDOW_H
+
+#include <Arduino.h>
+#include "types/DataTypes.h"
+
+// Collects the readings taken between two publishes so that none of them
+// is thrown away. result() gives min / max / mean of voltage, current and
+// power, the mean frequency and power factor, the energy counted since
+// the previous window and the alarm if any sample raised it.
+//
+// Values are accumulated as integers in the PZEM's own resolution
+// (0.1 V, 1 mA, 0.1 W, 1 Wh), so add() costs the same few integer
+// operations however long the window is; floats only appear in result().
+class SampleWindow
+{
+public:
+    SampleWindow();
+
+    // Invalid readings (NAN voltage) are skipped
+    void add(const MeterReadings &readings);
+    uint16_t count() const { return samples; }
+    MeterReadings result() const;
+    // Wh counted since the previous window, as result().energyDelta
+    uint32_t energyDeltaWh() const;
+    // Starts the next window; the energy delta carries on from the last sample
+    void reset();
+    // Starts over for a different meter: its energy counter is not
+    // comparable with the previous one's
+    void restart();
+
+private:
+    // One quantity in fixed-point units
+    struct Channel
+    {
+        uint64_t sum;
+        uint32_t min;
+        uint32_t max;
+
+        void add(uint32_t value);
+        void reset();
+    };
+
+    static uint32_t toFixed(float value, uint16_t scale);
+
+    Channel voltage;        // 0.1 V
+    Channel current;        // mA
+    Channel power;          // 0.1 W
+    uint64_t frequencySum;  // 0.1 Hz
+    uint64_t pfSum;         // 0.01
+    uint32_t baseEnergy;    // Wh at the end of the previous window
+    uint32_t lastEnergy;    // Wh
+    bool haveBase;
+    bool alarm;
+    MeterReadings last;
+    uint16_t samples;
+};
+
+#endif // SAMPLEWINDOW_H
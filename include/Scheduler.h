@@ -0,0 +1,83 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include <functional>
+
+// Cooperative scheduler for the work done in loop(). Tasks run to
+// completion and must not block. Each run() is one pass: every task that
+// is due runs once, highest priority first and, within a priority, the
+// one whose deadline is nearest. The choice is made again after every
+// task, so a task that falls due during the pass does not wait behind
+// lower ones.
+//
+// A task with period 0 runs on every pass (polling that costs little when
+// there is nothing to do: the PZEM exchange, MQTT); its deadline bounds
+// the gap between two runs. A periodic task is released every period on
+// a fixed grid and its deadline bounds how late a run may start; releases
+// it fell a whole period behind on are skipped, not run back to back.
+// Per task the scheduler keeps the run time (mean, worst), runs over the
+// task's budget, late starts and skipped releases, so both a task that
+// holds up the others and one that is held up show in stats().
+class Scheduler
+{
+public:
+    enum Priority
+    {
+        PRIORITY_HIGH,   // sampling; its timing is the measurement's
+        PRIORITY_NORMAL,
+        PRIORITY_LOW     // runs after everything else that is due
+    };
+
+    typedef std::function<void()> TaskFunction;
+
+    struct TaskStats
+    {
+        const char *name;
+        Priority priority;
+        unsigned long period;   // ms, 0 = every pass
+        unsigned long deadline; // ms
+        uint32_t budget;        // us
+        uint32_t runs;
+        uint64_t totalUs;
+        uint32_t worstUs;
+        uint32_t overruns;      // runs that took longer than the budget
+        uint32_t late;          // runs started after their deadline
+        uint32_t skipped;       // releases dropped, the task being a period behind
+        unsigned long worstWait; // ms from release to start
+    };
+
+    static const uint8_t MAX_TASKS = 10;
+
+    Scheduler();
+
+    // Returns the task's id, -1 if all MAX_TASKS are taken
+    int8_t add(const char *name, Priority priority, unsigned long periodMs, unsigned long deadlineMs,
+               uint32_t budgetUs, TaskFunction task);
+    // One pass; call from loop()
+    void run();
+
+    uint8_t taskCount() const { return count; }
+    const TaskStats &stats(uint8_t id) const { return tasks[id].stats; }
+    uint32_t passes() const { return passCount; }
+    uint32_t worstPassUs() const { return worstPass; }
+
+private:
+    struct Task
+    {
+        TaskFunction function;
+        unsigned long release; // millis() the current run became due
+        uint32_t lastPass;
+        TaskStats stats;
+    };
+
+    Task *next(unsigned long now);
+    void execute(Task &task, unsigned long now);
+
+    Task tasks[MAX_TASKS];
+    uint8_t count;
+    uint32_t passCount;
+    uint32_t worstPass; // us
+};
+
+#endif // SCHEDULER_H
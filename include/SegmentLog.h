@@ -0,0 +1,107 @@
+#ifndef SEGMENTLOG_H
+#define SEGMENTLOG_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+// Append-only record log on LittleFS, used as a store-and-forward queue.
+//
+// Records go into numbered segment files (<dir>/<hex>.seg) of about
+// SEGMENT_BYTES each; segments between the read position and the head are
+// contiguous, so no directory listing is needed at mount. Every record is
+// framed as [length:2][crc32:4][data] and checked on read.
+//
+// Crash safety:
+//  - a torn append at the head fails its CRC; at mount the writer rolls
+//    over to a fresh segment and the reader skips the damaged tail
+//  - the read position lives in two alternating cursor slots, each with
+//    a generation number and CRC; the newest valid slot wins, so a reset
+//    while one slot is being written falls back to the other. It is only
+//    saved every CURSOR_COMMIT_RECORDS acknowledgements (and on a segment
+//    change or when the log drains) to spare the flash, so after a crash
+//    up to that many records can be delivered twice
+//
+// When the log reaches its capacity the oldest segment is dropped, even if
+// it has not been delivered yet.
+class SegmentLog
+{
+public:
+    struct Position
+    {
+        uint32_t segment;
+        uint32_t offset;
+
+        bool before(const Position &other) const
+        {
+            return segment < other.segment || (segment == other.segment && offset < other.offset);
+        }
+    };
+
+    struct Stats
+    {
+        uint32_t appended;
+        uint32_t dropped;  // records lost to the drop-oldest policy
+        uint32_t corrupt;  // records skipped on a CRC or framing error
+    };
+
+    static const uint32_t SEGMENT_BYTES = 8192;    // one littlefs block
+    static const uint16_t MAX_RECORD = 512;
+    static const uint8_t CURSOR_COMMIT_RECORDS = 16;
+
+    SegmentLog();
+
+    // Mounts (or creates) the log in `dir`; the capacity is clamped to what
+    // the filesystem can hold
+    bool begin(const char *dir, uint32_t capacityBytes);
+    void setCapacity(uint32_t capacityBytes);
+    uint32_t capacity() const { return maxSegments * SEGMENT_BYTES; }
+
+    bool append(const uint8_t *data, uint16_t len);
+
+    // Oldest record not acknowledged yet
+    Position readPosition() const { return tail; }
+    // Where the next record will be appended
+    Position writePosition() const { return {head, headBytes}; }
+    // Reads the record at `pos` into `buf` and moves `pos` past it.
+    // Returns false at the end of the log.
+    bool read(Position &pos, uint8_t *buf, uint16_t bufSize, uint16_t &len);
+    // The `records` records before `pos` have been delivered and can be released
+    void acknowledge(const Position &pos, uint16_t records);
+
+    uint32_t pending() const { return pendingRecords; }
+    bool empty() const { return pendingRecords == 0; }
+    const Stats &stats() const { return logStats; }
+
+private:
+    struct Cursor
+    {
+        uint32_t generation;
+        uint32_t segment;
+        uint32_t offset;
+        uint32_t crc;
+    };
+
+    String segmentPath(uint32_t segment) const;
+    String cursorPath(uint8_t slot) const;
+    bool loadCursor();
+    void saveCursor();
+    uint32_t scanSegment(uint32_t segment, uint32_t from, uint32_t &validEnd);
+    void dropOldest();
+    void enforceCapacity();
+
+    static uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+    String dir;
+    bool mounted;
+    uint32_t maxSegments;
+    uint32_t fsLimitSegments;
+    Position tail;        // read position
+    uint32_t head;        // segment being appended to
+    uint32_t headBytes;
+    uint32_t pendingRecords;
+    uint32_t generation;
+    uint8_t unsavedAcks;
+    Stats logStats;
+};
+
+#endif // SEGMENTLOG_H
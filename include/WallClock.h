@@ -0,0 +1,82 @@
+#ifndef WALLCLOCK_H
+#define WALLCLOCK_H
+
+#include <Arduino.h>
+
+// Maps millis() to wall-clock time. Readings are stamped with millis() when
+// they are acquired and only turned into wall-clock time when published or
+// stored, so readings taken before SNTP set the clock still get their true
+// time once it has: the mapping applies backwards to everything acquired
+// since boot.
+//
+// SNTP runs in the background (lwIP) and sets the system clock again every
+// SYNC_INTERVAL; nothing waits for it. Each update anchors the mapping
+// anew. How far the millis() clock had drifted from the previous anchor
+// gives the offset, and offset over interval the crystal's drift, which
+// then corrects the mapping until the next update.
+class WallClock
+{
+public:
+    enum Quality
+    {
+        CLOCK_UNSET,  // no SNTP reply since boot
+        CLOCK_SYNCED,
+        CLOCK_STALE   // no SNTP reply for STALE_AFTER, the time drifts freely
+    };
+
+    static const unsigned long SYNC_INTERVAL = 3600000; // ms between SNTP updates
+
+    WallClock();
+
+    // Starts SNTP without waiting for it; call from setup()
+    void begin();
+    // Takes the updates SNTP made since the last call; call from loop()
+    void loop();
+    // Anchors the mapping at wall-clock `epochMs`, read at millis() `ms`:
+    // what loop() does with an SNTP update. Times before EPOCH_VALID are
+    // ignored.
+    void takeSync(int64_t epochMs, unsigned long ms);
+    bool synced() const { return syncCount > 0; }
+
+    // Wall-clock seconds at `ms` (a millis() of this boot, at most 24 days
+    // away); 0 while the clock is not set
+    uint32_t epochAt(unsigned long ms) const;
+    // Wall-clock seconds `seconds` after boot; 0 while the clock is not set
+    uint32_t epochAtUptime(uint32_t seconds) const;
+    // As epochAt, in ms
+    int64_t epochMillisAt(unsigned long ms) const;
+
+    Quality quality() const;
+    uint32_t syncs() const { return syncCount; }
+    unsigned long sinceSync() const { return millis() - anchorMillis; } // ms
+    // Error of the mapping found by the last update, ms (positive: it was behind)
+    int32_t lastOffset() const { return offsetMs; }
+    // Rate of the millis() clock against SNTP, parts per million (positive: slow)
+    float drift() const { return driftPpm; }
+
+private:
+    int64_t epochMsAt(int64_t elapsedMs) const;
+
+    static const unsigned long STALE_AFTER = 3 * SYNC_INTERVAL;
+    static const unsigned long MIN_DRIFT_INTERVAL = 600000; // ms; shorter, SNTP jitter outweighs the drift
+    static const uint16_t MAX_DRIFT_PPM = 500;              // beyond this the update was a step, not a drift
+    static const uint8_t DRIFT_SMOOTHING = 4;               // each update moves the estimate by 1/4
+    static const uint32_t EPOCH_VALID = 1600000000;         // before this, SNTP has not set the clock
+
+    uint32_t syncCount;
+    int64_t anchorEpochMs; // wall-clock ms at anchorMillis
+    unsigned long anchorMillis;
+    int32_t offsetMs;
+    float driftPpm;
+    bool driftKnown;
+
+    // Set from the SNTP callback, which runs between two loop() passes,
+    // and taken over by loop()
+    volatile bool pending;
+    int64_t pendingEpochMs;
+    unsigned long pendingMillis;
+};
+
+extern WallClock wallClock;
+
+#endif // WALLCLOCK_H
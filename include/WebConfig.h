@@ -5,10 +5,11 @@
 #include <ESP8266WebServer.h>
 #include <ESP8266WiFi.h>
 #include "ConfigManager.h"
+#include "Scheduler.h"
 
 class WebConfig {
 public:
-    WebConfig(ConfigManager& configManager);
+    WebConfig(ConfigManager& configManager, const Scheduler& scheduler);
     void begin();
     void handle();
     void startConfigPortal();
@@ -18,11 +19,13 @@ public:
 private:
     ESP8266WebServer server;
     ConfigManager& configManager;
+    const Scheduler& scheduler;
     bool configPortalActive;
     
     void handleRoot();
     void handleConfig();
     void handleSaveConfig();
+    void saved(bool ok, String &errors);
     void handleReset();
     void handleStatus();
     void handleReboot();
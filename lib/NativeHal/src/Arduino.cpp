@@ -0,0 +1,184 @@
+#include "Arduino.h"
+#include "Hal.h"
+#include "coredecls.h"
+
+#include <unistd.h>
+
+HardwareSerial Serial(0);
+HardwareSerial Serial1(1);
+EspClass ESP;
+
+static uint8_t pinLevels[17];
+static unsigned long randomState = 1;
+
+unsigned long millis()
+{
+    return hal::clock().millis();
+}
+
+unsigned long micros()
+{
+    return hal::clock().micros();
+}
+
+void delay(unsigned long ms)
+{
+    hal::clock().delay((uint32_t)ms);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    hal::clock().delayMicroseconds(us);
+}
+
+void yield()
+{
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    (void)pin;
+    (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin < sizeof(pinLevels))
+        pinLevels[pin] = val;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pin < sizeof(pinLevels) ? pinLevels[pin] : LOW;
+}
+
+long random(long howbig)
+{
+    if (howbig <= 0)
+        return 0;
+    // LCG so simulated runs are reproducible for a given seed
+    randomState = randomState * 1103515245UL + 12345UL;
+    return (long)((randomState >> 16) % (unsigned long)howbig);
+}
+
+long random(long howsmall, long howbig)
+{
+    if (howsmall >= howbig)
+        return howsmall;
+    return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+    randomState = seed;
+}
+
+static std::function<void()> timeSetCallback;
+
+void settimeofday_cb(const std::function<void()> &cb)
+{
+    timeSetCallback = cb;
+}
+
+void configTime(int timezone, int daylightOffset_sec, const char *server1,
+                const char *server2, const char *server3)
+{
+    // The host clock is already NTP-disciplined
+    (void)timezone;
+    (void)daylightOffset_sec;
+    (void)server1;
+    (void)server2;
+    (void)server3;
+    if (timeSetCallback)
+        timeSetCallback();
+}
+
+hal::SerialPort *HardwareSerial::port()
+{
+    if (_uart != 0)
+        return nullptr;
+    return hal::serialFor(_swapped ? 13 : 3);
+}
+
+// Hands the bytes that have left the TX shift register to the port
+void HardwareSerial::transmit()
+{
+    if (_txLen == 0)
+        return;
+    size_t sent = (hal::clock().micros() - _txStartUs) / byteTimeUs();
+    if (sent == 0)
+        return;
+    if (sent > _txLen)
+        sent = _txLen;
+    hal::SerialPort *p = port();
+    if (p)
+        p->write(_tx, sent);
+    memmove(_tx, _tx + sent, _txLen - sent);
+    _txLen -= sent;
+    _txStartUs += sent * byteTimeUs();
+}
+
+int HardwareSerial::available()
+{
+    transmit();
+    hal::SerialPort *p = port();
+    return p ? p->available() : 0;
+}
+
+int HardwareSerial::read()
+{
+    transmit();
+    hal::SerialPort *p = port();
+    int c = p ? p->read() : -1;
+    if (c >= 0)
+        hal::irq().isrNs += RX_ISR_NS_PER_BYTE;
+    return c;
+}
+
+int HardwareSerial::peek()
+{
+    transmit();
+    hal::SerialPort *p = port();
+    return p ? p->peek() : -1;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    if (!port())
+    {
+        // UART0 goes to stdout, UART1 (debug TX) to stderr
+        FILE *out = _uart == 0 ? stdout : stderr;
+        return fwrite(buffer, 1, size, out);
+    }
+
+    transmit();
+    if (_txLen == 0)
+        _txStartUs = hal::clock().micros();
+    for (size_t i = 0; i < size; i++)
+    {
+        // Like the core, wait for room when the FIFO is full
+        while (_txLen == FIFO_SIZE)
+        {
+            hal::clock().delayMicroseconds(byteTimeUs());
+            transmit();
+        }
+        _tx[_txLen++] = buffer[i];
+    }
+    return size;
+}
+
+void EspClass::restart()
+{
+    fflush(stdout);
+    _exit(0);
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+    return hal::FREE_HEAP;
+}
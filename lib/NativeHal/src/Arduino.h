@@ -0,0 +1,116 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+// Host stand-in for the ESP8266 Arduino core. Only the subset the meter
+// firmware touches is provided; timing goes through hal::clock().
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+#include "Hal.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+
+// NodeMCU pin names (GPIO numbers)
+#define D0 16
+#define D1 5
+#define D2 4
+#define D3 0
+#define D4 2
+#define D5 14
+#define D6 12
+#define D7 13
+#define D8 15
+#define LED_BUILTIN 2
+
+#define PROGMEM
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_byte_near(addr) pgm_read_byte(addr)
+
+using std::max;
+using std::min;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+void configTime(int timezone, int daylightOffset_sec, const char *server1,
+                const char *server2 = nullptr, const char *server3 = nullptr);
+
+// UART0 prints to stdout and UART1 (TX only) to stderr, unless a
+// hal::SerialPort is attached to the UART's rx pin: then it talks to that
+// port the way the ESP8266 UART does, with write() returning as soon as
+// the bytes fit in the 128-byte TX FIFO and the bytes reaching the port
+// once they have been clocked out.
+class HardwareSerial : public Stream
+{
+public:
+    explicit HardwareSerial(int uart) : _uart(uart), _baud(115200), _swapped(false), _txLen(0), _txStartUs(0) {}
+    void begin(unsigned long baud) { _baud = baud; }
+    // UART0 only: move RX/TX from GPIO3/GPIO1 to GPIO13/GPIO15 (D7/D8)
+    void swap() { _swapped = _uart == 0 && !_swapped; }
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+
+    static const size_t FIFO_SIZE = 128;
+    static const uint32_t RX_ISR_NS_PER_BYTE = 500; // FIFO drain in the UART ISR (estimate)
+
+private:
+    hal::SerialPort *port();
+    void transmit();
+    uint32_t byteTimeUs() const { return (uint32_t)(10000000UL / _baud); }
+
+    int _uart;
+    unsigned long _baud;
+    bool _swapped;
+    uint8_t _tx[FIFO_SIZE];
+    size_t _txLen;
+    uint32_t _txStartUs;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+class EspClass
+{
+public:
+    void restart();
+    uint32_t getFreeHeap();
+    uint32_t getChipId() { return 0x00C0FFEE; }
+};
+
+extern EspClass ESP;
+
+#endif // ARDUINO_H
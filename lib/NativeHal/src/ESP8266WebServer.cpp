@@ -0,0 +1,40 @@
+#include "ESP8266WebServer.h"
+
+static std::string routeKey(HTTPMethod method, const String &uri)
+{
+    return std::to_string((int)method) + " " + uri.c_str();
+}
+
+void ESP8266WebServer::on(const String &uri, HTTPMethod method, THandlerFunction fn)
+{
+    _routes[routeKey(method, uri)] = fn;
+}
+
+void ESP8266WebServer::send(int code, const char *contentType, const String &content)
+{
+    (void)contentType;
+    _lastCode = code;
+    _lastBody = content;
+}
+
+String ESP8266WebServer::arg(const String &name) const
+{
+    auto it = _args.find(name.c_str());
+    return it == _args.end() ? String() : it->second;
+}
+
+bool ESP8266WebServer::request(HTTPMethod method, const String &uri, const std::map<std::string, String> &args)
+{
+    auto it = _routes.find(routeKey(method, uri));
+    if (it == _routes.end())
+        it = _routes.find(routeKey(HTTP_ANY, uri));
+    if (it == _routes.end())
+    {
+        send(404, "text/plain", "Not found");
+        return false;
+    }
+    _args = args;
+    it->second();
+    _args.clear();
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef ESP8266WEBSERVER_H
+#define ESP8266WEBSERVER_H
+
+#include <Arduino.h>
+#include <functional>
+#include <map>
+
+enum HTTPMethod
+{
+    HTTP_ANY,
+    HTTP_GET,
+    HTTP_POST
+};
+
+// Route table without a listening socket. handleClient() is a no-op so
+// the main loop can be timed without HTTP traffic; request() drives a
+// handler directly when a simulation wants to exercise the web UI.
+class ESP8266WebServer
+{
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    explicit ESP8266WebServer(int port = 80) : _port(port), _lastCode(0) {}
+
+    void on(const String &uri, HTTPMethod method, THandlerFunction fn);
+    void begin() {}
+    void handleClient() {}
+    void send(int code, const char *contentType, const String &content);
+
+    bool hasArg(const String &name) const { return _args.count(name.c_str()) > 0; }
+    String arg(const String &name) const;
+
+    // Host-only helpers
+    bool request(HTTPMethod method, const String &uri, const std::map<std::string, String> &args = {});
+    int lastCode() const { return _lastCode; }
+    const String &lastBody() const { return _lastBody; }
+
+private:
+    int _port;
+    std::map<std::string, THandlerFunction> _routes;
+    std::map<std::string, String> _args;
+    int _lastCode;
+    String _lastBody;
+};
+
+#endif // ESP8266WEBSERVER_H
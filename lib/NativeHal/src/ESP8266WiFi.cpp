@@ -0,0 +1,8 @@
+#include "ESP8266WiFi.h"
+
+ESP8266WiFiClass WiFi;
+
+wl_status_t ESP8266WiFiClass::status()
+{
+    return hal::network().linkUp() ? WL_CONNECTED : WL_DISCONNECTED;
+}
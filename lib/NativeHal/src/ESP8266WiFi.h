@@ -0,0 +1,32 @@
+#ifndef ESP8266WIFI_H
+#define ESP8266WIFI_H
+
+#include <Arduino.h>
+#include "WiFiClient.h"
+
+typedef enum
+{
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+// Station interface; the link state follows hal::network().linkUp()
+class ESP8266WiFiClass
+{
+public:
+    wl_status_t status();
+    String SSID() { return String("native"); }
+    String macAddress() { return String("02:00:00:00:00:01"); }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 0, 0, 0); }
+    IPAddress dnsIP() { return IPAddress(127, 0, 0, 53); }
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif // ESP8266WIFI_H
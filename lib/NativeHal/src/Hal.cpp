@@ -0,0 +1,111 @@
+#include "Hal.h"
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <stdlib.h>
+
+namespace hal
+{
+
+    static uint64_t hostMicros()
+    {
+        using namespace std::chrono;
+        return (uint64_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    SystemClock::SystemClock() : _startUs(hostMicros()) {}
+
+    uint32_t SystemClock::millis()
+    {
+        return (uint32_t)((hostMicros() - _startUs) / 1000);
+    }
+
+    uint32_t SystemClock::micros()
+    {
+        return (uint32_t)(hostMicros() - _startUs);
+    }
+
+    void SystemClock::delay(uint32_t ms)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    void SystemClock::delayMicroseconds(uint32_t us)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+
+    // Function-local so firmware globals can call millis() from their constructors
+    static SystemClock &systemClock()
+    {
+        static SystemClock instance;
+        return instance;
+    }
+
+    static Clock *currentClock = nullptr;
+
+    Clock &clock()
+    {
+        return currentClock ? *currentClock : systemClock();
+    }
+
+    void setClock(Clock *c)
+    {
+        currentClock = c;
+    }
+
+    static PosixNetwork posixNetwork;
+    static Network *currentNetwork = &posixNetwork;
+
+    Network &network()
+    {
+        return *currentNetwork;
+    }
+
+    void setNetwork(Network *n)
+    {
+        currentNetwork = n ? n : &posixNetwork;
+    }
+
+    static std::map<int, SerialPort *> &serialPorts()
+    {
+        static std::map<int, SerialPort *> ports;
+        return ports;
+    }
+
+    void attachSerial(int rxPin, SerialPort *port)
+    {
+        serialPorts()[rxPin] = port;
+    }
+
+    SerialPort *serialFor(int rxPin)
+    {
+        auto it = serialPorts().find(rxPin);
+        return it == serialPorts().end() ? nullptr : it->second;
+    }
+
+    IrqModel &irq()
+    {
+        static IrqModel model;
+        return model;
+    }
+
+    static std::string &fsRootPath()
+    {
+        static std::string root = getenv("METER_FS_ROOT") ? getenv("METER_FS_ROOT") : ".littlefs";
+        return root;
+    }
+
+    const char *fsRoot()
+    {
+        return fsRootPath().c_str();
+    }
+
+    void setFsRoot(const char *path)
+    {
+        fsRootPath() = path;
+    }
+
+} // namespace hal
@@ -0,0 +1,157 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Thin hardware abstraction used by the native (host) build.
+// The Arduino-compatible shims in this library (millis(), SoftwareSerial,
+// LittleFS, WiFiClient, ...) forward to these interfaces, so a simulation
+// can swap in a virtual clock, an emulated PZEM or a fake broker without
+// touching the firmware sources in src/.
+namespace hal
+{
+
+    class Clock
+    {
+    public:
+        virtual ~Clock() {}
+        virtual uint32_t millis() = 0;
+        virtual uint32_t micros() = 0;
+        virtual void delay(uint32_t ms) = 0;
+        virtual void delayMicroseconds(uint32_t us) = 0;
+    };
+
+    // Byte pipe seen by SoftwareSerial / HardwareSerial on the host
+    class SerialPort
+    {
+    public:
+        virtual ~SerialPort() {}
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual size_t write(const uint8_t *data, size_t len) = 0;
+    };
+
+    // One TCP-like connection handed out by Network
+    class Socket
+    {
+    public:
+        virtual ~Socket() {}
+        virtual bool connected() = 0;
+        virtual int available() = 0;
+        virtual int read(uint8_t *buf, size_t len) = 0;
+        virtual size_t write(const uint8_t *data, size_t len) = 0;
+        virtual void close() = 0;
+    };
+
+    class Network
+    {
+    public:
+        virtual ~Network() {}
+        // Returns nullptr when the connection cannot be established
+        virtual Socket *connect(const char *host, uint16_t port) = 0;
+        virtual bool linkUp() = 0;
+    };
+
+    // Wall clock that follows the host clock
+    class SystemClock : public Clock
+    {
+    public:
+        SystemClock();
+        uint32_t millis() override;
+        uint32_t micros() override;
+        void delay(uint32_t ms) override;
+        void delayMicroseconds(uint32_t us) override;
+
+    private:
+        uint64_t _startUs;
+    };
+
+    // Virtual clock for deterministic runs: time only moves when
+    // delay() or advance() is called.
+    class SimClock : public Clock
+    {
+    public:
+        SimClock() : _us(0) {}
+        uint32_t millis() override { return (uint32_t)(_us / 1000); }
+        uint32_t micros() override { return (uint32_t)_us; }
+        void delay(uint32_t ms) override { _us += (uint64_t)ms * 1000; }
+        void delayMicroseconds(uint32_t us) override { _us += us; }
+        void advance(uint32_t us) { _us += us; }
+
+    private:
+        uint64_t _us;
+    };
+
+    // Plain TCP sockets on the host
+    class PosixNetwork : public Network
+    {
+    public:
+        Socket *connect(const char *host, uint16_t port) override;
+        bool linkUp() override { return true; }
+    };
+
+    // WiFi is associated but no host answers (broker or uplink down)
+    class OfflineNetwork : public Network
+    {
+    public:
+        Socket *connect(const char *, uint16_t) override { return nullptr; }
+        bool linkUp() override { return true; }
+    };
+
+    Clock &clock();
+    void setClock(Clock *clock);
+
+    Network &network();
+    void setNetwork(Network *network);
+
+    // SoftwareSerial(rx, tx) and HardwareSerial bind to whatever port is
+    // attached to their rx pin (GPIO3 for UART0, GPIO13 after swap())
+    void attachSerial(int rxPin, SerialPort *port);
+    SerialPort *serialFor(int rxPin);
+
+    // Interrupt behaviour of the device as seen by the serial shims.
+    // WiFi and TCP processing keep interrupts masked for short windows;
+    // SoftwareSerial times its RX edges from a GPIO interrupt, so a window
+    // longer than half a bit shifts an edge and garbles the byte, while the
+    // UART's hardware FIFO rides it out. Serial ISR time is accumulated
+    // in isrNs so benchmarks can add it to the foreground cost.
+    struct IrqModel
+    {
+        float maskRate = 0.0f; // masked windows per second (network load)
+        uint32_t maskUs = 0;   // length of each window
+        uint32_t seed = 1;
+        uint64_t isrNs = 0;
+    };
+    IrqModel &irq();
+
+    // Heap allocations (malloc, calloc, realloc, operator new) made so far,
+    // for checking that a code path is allocation-free. Simulator code that
+    // stands in for hardware or the network (PZEM emulator, fake broker)
+    // runs inside an UncountedAllocations scope, so only the firmware's
+    // own allocations are counted.
+    uint64_t allocations();
+    // Bytes of the counted blocks still allocated, and their highest value
+    // since resetHeapPeak() (glibc only). The host's own footprint says
+    // little about the device's, so ESP.getFreeHeap() reports FREE_HEAP and
+    // umm_free_heap_size_min() lowers it by what was allocated on top of
+    // the heap in use at umm_free_heap_size_min_reset().
+    const size_t FREE_HEAP = 40000; // typical free heap of the firmware on a NodeMCU after WiFi is up
+    size_t heapInUse();
+    size_t heapPeak();
+    void resetHeapPeak();
+    class UncountedAllocations
+    {
+    public:
+        UncountedAllocations();
+        ~UncountedAllocations();
+    };
+
+    // Directory that stands in for the LittleFS partition
+    const char *fsRoot();
+    void setFsRoot(const char *path);
+
+} // namespace hal
+
+#endif // HAL_H
@@ -0,0 +1,224 @@
+#include "Hal.h"
+#include "umm_malloc/umm_malloc.h"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+// Counts heap allocations for hal::allocations(). With glibc the malloc
+// family itself is wrapped, which also covers operator new and
+// ArduinoJson's default allocator; elsewhere only operator new is counted.
+//
+// With glibc the counted blocks are also kept in a table, without
+// allocating, so that freeing one can be told from freeing a block of the
+// simulator: that gives hal::heapInUse() and the umm_malloc statistics.
+// The table assumes a single thread, as the firmware has.
+
+namespace
+{
+    std::atomic<uint64_t> allocationCount(0);
+    thread_local int uncountedDepth = 0;
+
+    inline bool counted()
+    {
+        return uncountedDepth == 0;
+    }
+
+    inline void countAllocation()
+    {
+        if (counted())
+            allocationCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Live counted blocks: linear probing on the address, deletion by backward shift
+    const unsigned TABLE_BITS = 16;
+    const size_t TABLE_SIZE = (size_t)1 << TABLE_BITS;
+    struct Block
+    {
+        void *ptr;
+        size_t size;
+    };
+    Block blocks[TABLE_SIZE];
+    size_t tracked = 0;
+    size_t bytesInUse = 0;
+    size_t peakBytes = 0;
+    size_t ummBaseline = 0; // bytes in use at umm_free_heap_size_min_reset()
+
+    inline size_t slotOf(void *ptr)
+    {
+        return (size_t)(((uint64_t)(uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL >> (64 - TABLE_BITS));
+    }
+
+    void track(void *ptr, size_t size)
+    {
+        // Blocks beyond the table are not seen; the table is far larger than the firmware's heap
+        if (!ptr || !counted() || tracked >= TABLE_SIZE / 2)
+            return;
+        size_t i = slotOf(ptr);
+        while (blocks[i].ptr)
+            i = (i + 1) & (TABLE_SIZE - 1);
+        blocks[i] = {ptr, size};
+        tracked++;
+        bytesInUse += size;
+        if (bytesInUse > peakBytes)
+            peakBytes = bytesInUse;
+    }
+
+    void untrack(void *ptr)
+    {
+        if (!ptr || tracked == 0)
+            return;
+        size_t i = slotOf(ptr);
+        while (blocks[i].ptr != ptr)
+        {
+            if (!blocks[i].ptr)
+                return; // not a counted block
+            i = (i + 1) & (TABLE_SIZE - 1);
+        }
+        bytesInUse -= blocks[i].size;
+        tracked--;
+        // Moves later entries of the probe sequence back into the hole
+        size_t j = i;
+        while (true)
+        {
+            blocks[i].ptr = nullptr;
+            size_t k;
+            do
+            {
+                j = (j + 1) & (TABLE_SIZE - 1);
+                if (!blocks[j].ptr)
+                    return;
+                k = slotOf(blocks[j].ptr);
+            } while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+            blocks[i] = blocks[j];
+            i = j;
+        }
+    }
+} // namespace
+
+namespace hal
+{
+
+    uint64_t allocations()
+    {
+        return allocationCount.load(std::memory_order_relaxed);
+    }
+
+    size_t heapInUse()
+    {
+        return bytesInUse;
+    }
+
+    size_t heapPeak()
+    {
+        return peakBytes;
+    }
+
+    void resetHeapPeak()
+    {
+        peakBytes = bytesInUse;
+    }
+
+    UncountedAllocations::UncountedAllocations()
+    {
+        uncountedDepth++;
+    }
+
+    UncountedAllocations::~UncountedAllocations()
+    {
+        uncountedDepth--;
+    }
+
+} // namespace hal
+
+#ifdef __GLIBC__
+
+extern "C"
+{
+    void *__libc_malloc(size_t size);
+    void *__libc_calloc(size_t count, size_t size);
+    void *__libc_realloc(void *ptr, size_t size);
+    void __libc_free(void *ptr);
+
+    void *malloc(size_t size)
+    {
+        countAllocation();
+        void *ptr = __libc_malloc(size);
+        track(ptr, size);
+        return ptr;
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        countAllocation();
+        void *ptr = __libc_calloc(count, size);
+        track(ptr, count * size);
+        return ptr;
+    }
+
+    void *realloc(void *ptr, size_t size)
+    {
+        countAllocation();
+        untrack(ptr);
+        void *moved = __libc_realloc(ptr, size);
+        track(moved, size);
+        return moved;
+    }
+
+    void free(void *ptr)
+    {
+        untrack(ptr);
+        __libc_free(ptr);
+    }
+}
+
+#else
+
+void *operator new(size_t size)
+{
+    countAllocation();
+    if (void *ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+#endif
+
+// umm_malloc statistics of the ESP8266 core (UMM_STATS_FULL)
+size_t umm_free_heap_size_min()
+{
+    size_t used = peakBytes > ummBaseline ? peakBytes - ummBaseline : 0;
+    return used < hal::FREE_HEAP ? hal::FREE_HEAP - used : 0;
+}
+
+size_t umm_free_heap_size_min_reset()
+{
+    peakBytes = bytesInUse;
+    ummBaseline = bytesInUse;
+    return umm_free_heap_size_min();
+}
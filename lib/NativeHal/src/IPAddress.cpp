@@ -0,0 +1,27 @@
+#include "IPAddress.h"
+
+#include <stdio.h>
+#include <string.h>
+
+IPAddress::IPAddress(const ip_addr_t *addr)
+{
+    // addr is in network byte order: the first octet is the lowest byte in memory
+    memcpy(_bytes, &addr->addr, sizeof(_bytes));
+}
+
+bool IPAddress::operator==(const IPAddress &rhs) const
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (_bytes[i] != rhs._bytes[i])
+            return false;
+    }
+    return true;
+}
+
+String IPAddress::toString() const
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _bytes[0], _bytes[1], _bytes[2], _bytes[3]);
+    return String(buf);
+}
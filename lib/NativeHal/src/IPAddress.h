@@ -0,0 +1,23 @@
+#ifndef IPADDRESS_H
+#define IPADDRESS_H
+
+#include <stdint.h>
+#include "WString.h"
+#include "lwip/ip_addr.h"
+
+class IPAddress
+{
+public:
+    IPAddress() : IPAddress(0, 0, 0, 0) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _bytes{a, b, c, d} {}
+    IPAddress(const ip_addr_t *addr);
+
+    uint8_t operator[](int index) const { return _bytes[index]; }
+    bool operator==(const IPAddress &rhs) const;
+    String toString() const;
+
+private:
+    uint8_t _bytes[4];
+};
+
+#endif // IPADDRESS_H
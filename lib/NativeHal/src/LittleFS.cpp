@@ -0,0 +1,194 @@
+#include "LittleFS.h"
+#include "Hal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FS LittleFS;
+
+File::File(File &&other) : _fp(other._fp), _name(other._name)
+{
+    other._fp = nullptr;
+}
+
+File &File::operator=(File &&other)
+{
+    if (this != &other)
+    {
+        close();
+        _fp = other._fp;
+        _name = other._name;
+        other._fp = nullptr;
+    }
+    return *this;
+}
+
+int File::available()
+{
+    if (!_fp)
+        return 0;
+    return (int)(size() - position());
+}
+
+int File::read()
+{
+    return _fp ? fgetc(_fp) : -1;
+}
+
+int File::peek()
+{
+    if (!_fp)
+        return -1;
+    int c = fgetc(_fp);
+    if (c != EOF)
+        ungetc(c, _fp);
+    return c;
+}
+
+size_t File::read(uint8_t *buf, size_t size)
+{
+    return _fp ? fread(buf, 1, size, _fp) : 0;
+}
+
+size_t File::write(const uint8_t *buf, size_t size)
+{
+    return _fp ? fwrite(buf, 1, size, _fp) : 0;
+}
+
+void File::flush()
+{
+    if (_fp)
+        fflush(_fp);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+    int whence = mode == SeekCur ? SEEK_CUR : mode == SeekEnd ? SEEK_END
+                                                              : SEEK_SET;
+    return _fp && fseek(_fp, (long)pos, whence) == 0;
+}
+
+size_t File::position() const
+{
+    return _fp ? (size_t)ftell(_fp) : 0;
+}
+
+size_t File::size() const
+{
+    if (!_fp)
+        return 0;
+    struct stat st;
+    fflush(_fp);
+    if (fstat(fileno(_fp), &st) != 0)
+        return 0;
+    return (size_t)st.st_size;
+}
+
+void File::close()
+{
+    if (_fp)
+    {
+        fclose(_fp);
+        _fp = nullptr;
+    }
+}
+
+namespace fs
+{
+
+    String FS::hostPath(const char *path)
+    {
+        String p(hal::fsRoot());
+        if (!path || path[0] != '/')
+            p += "/";
+        p += path ? path : "";
+        return p;
+    }
+
+    bool FS::begin()
+    {
+        return ::mkdir(hal::fsRoot(), 0755) == 0 || errno == EEXIST;
+    }
+
+    bool FS::format()
+    {
+        // Only flat files are created by the firmware
+        String cmd = String("rm -rf '") + hal::fsRoot() + "'";
+        return system(cmd.c_str()) == 0 && begin();
+    }
+
+    bool FS::exists(const char *path)
+    {
+        struct stat st;
+        return stat(hostPath(path).c_str(), &st) == 0;
+    }
+
+    File FS::open(const char *path, const char *mode)
+    {
+        // LittleFS "w"/"a" create the file; "r+" must exist like on the device
+        String fopenMode(mode);
+        if (fopenMode.indexOf('b') < 0)
+            fopenMode += "b";
+        FILE *fp = fopen(hostPath(path).c_str(), fopenMode.c_str());
+        if (!fp)
+            return File();
+        return File(fp, String(path));
+    }
+
+    bool FS::remove(const char *path)
+    {
+        return unlink(hostPath(path).c_str()) == 0;
+    }
+
+    bool FS::rename(const char *pathFrom, const char *pathTo)
+    {
+        return ::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str()) == 0;
+    }
+
+    bool FS::mkdir(const char *path)
+    {
+        return ::mkdir(hostPath(path).c_str(), 0755) == 0 || errno == EEXIST;
+    }
+
+    bool FS::rmdir(const char *path)
+    {
+        return ::rmdir(hostPath(path).c_str()) == 0;
+    }
+
+    static size_t usedBytes(const String &dir, size_t blockSize)
+    {
+        size_t used = 0;
+        DIR *d = opendir(dir.c_str());
+        if (!d)
+            return 0;
+        while (struct dirent *entry = readdir(d))
+        {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+                continue;
+            String path = dir + "/" + entry->d_name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0)
+                continue;
+            if (S_ISDIR(st.st_mode))
+                used += usedBytes(path, blockSize);
+            else // littlefs rounds every file up to whole blocks
+                used += (st.st_size + blockSize - 1) / blockSize * blockSize;
+        }
+        closedir(d);
+        return used;
+    }
+
+    bool FS::info(FSInfo &info)
+    {
+        info.totalBytes = 2024 * 1024;
+        info.blockSize = 8192;
+        info.pageSize = 256;
+        info.maxOpenFiles = 5;
+        info.maxPathLength = 32;
+        info.usedBytes = usedBytes(hal::fsRoot(), info.blockSize);
+        return true;
+    }
+
+} // namespace fs
@@ -0,0 +1,86 @@
+#ifndef LITTLEFS_H
+#define LITTLEFS_H
+
+#include <Arduino.h>
+
+enum SeekMode
+{
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+// File on the host filesystem under hal::fsRoot()
+class File : public Stream
+{
+public:
+    File() : _fp(nullptr) {}
+    explicit File(FILE *fp, const String &name) : _fp(fp), _name(name) {}
+    File(const File &) = delete;
+    File &operator=(const File &) = delete;
+    File(File &&other);
+    File &operator=(File &&other);
+    ~File() { close(); }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t *buf, size_t size);
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+    void flush() override;
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    const char *name() const { return _name.c_str(); }
+    void close();
+    operator bool() const { return _fp != nullptr; }
+
+private:
+    FILE *_fp;
+    String _name;
+};
+
+namespace fs
+{
+    struct FSInfo
+    {
+        size_t totalBytes;
+        size_t usedBytes;
+        size_t blockSize;
+        size_t pageSize;
+        size_t maxOpenFiles;
+        size_t maxPathLength;
+    };
+
+    class FS
+    {
+    public:
+        bool begin();
+        void end() {}
+        bool format();
+        bool exists(const char *path);
+        bool exists(const String &path) { return exists(path.c_str()); }
+        File open(const char *path, const char *mode);
+        File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+        bool remove(const char *path);
+        bool remove(const String &path) { return remove(path.c_str()); }
+        bool rename(const char *pathFrom, const char *pathTo);
+        bool mkdir(const char *path);
+        bool rmdir(const char *path);
+        // Sizes of a NodeMCU 4M/2M-FS partition; used bytes are counted under fsRoot()
+        bool info(FSInfo &info);
+
+    private:
+        String hostPath(const char *path);
+    };
+} // namespace fs
+
+using fs::FS;
+using fs::FSInfo;
+
+extern FS LittleFS;
+
+#endif // LITTLEFS_H
@@ -0,0 +1,115 @@
+#include "Hal.h"
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace hal
+{
+
+    class PosixSocket : public Socket
+    {
+    public:
+        explicit PosixSocket(int fd) : _fd(fd) {}
+        ~PosixSocket() override { close(); }
+
+        bool connected() override
+        {
+            if (_fd < 0)
+                return false;
+            uint8_t c;
+            ssize_t n = recv(_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        int available() override
+        {
+            if (_fd < 0)
+                return 0;
+            int n = 0;
+            if (ioctl(_fd, FIONREAD, &n) != 0)
+                return 0;
+            return n;
+        }
+
+        int read(uint8_t *buf, size_t len) override
+        {
+            if (_fd < 0)
+                return -1;
+            ssize_t n = recv(_fd, buf, len, MSG_DONTWAIT);
+            return n > 0 ? (int)n : -1;
+        }
+
+        size_t write(const uint8_t *data, size_t len) override
+        {
+            if (_fd < 0)
+                return 0;
+            ssize_t n = send(_fd, data, len, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                close();
+                return 0;
+            }
+            return (size_t)n;
+        }
+
+        void close() override
+        {
+            if (_fd >= 0)
+            {
+                ::close(_fd);
+                _fd = -1;
+            }
+        }
+
+    private:
+        int _fd;
+    };
+
+    Socket *PosixNetwork::connect(const char *host, uint16_t port)
+    {
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        char portStr[8];
+        snprintf(portStr, sizeof(portStr), "%u", port);
+
+        struct addrinfo *result = nullptr;
+        if (getaddrinfo(host, portStr, &hints, &result) != 0)
+            return nullptr;
+
+        int fd = -1;
+        for (struct addrinfo *ai = result; ai; ai = ai->ai_next)
+        {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0)
+                continue;
+            // Linux applies SO_SNDTIMEO to connect(); 5 s like the ESP8266 core
+            struct timeval tv = {5, 0};
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+            ::close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(result);
+        if (fd < 0)
+            return nullptr;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return new PosixSocket(fd);
+    }
+
+} // namespace hal
@@ -0,0 +1,76 @@
+#include "Print.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (size--)
+    {
+        if (!write(*buffer++))
+            break;
+        n++;
+    }
+    return n;
+}
+
+size_t Print::write(const char *str)
+{
+    if (!str)
+        return 0;
+    return write((const uint8_t *)str, strlen(str));
+}
+
+// Like the ESP8266 core: formatted on the stack, on the heap only when the
+// text is longer than 64 bytes
+size_t Print::printf(const char *format, ...)
+{
+    char stackBuf[64];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(stackBuf, sizeof(stackBuf), format, args);
+    va_end(args);
+    if (len < 0)
+        return 0;
+    if ((size_t)len < sizeof(stackBuf))
+        return write((const uint8_t *)stackBuf, (size_t)len);
+
+    std::vector<char> heapBuf((size_t)len + 1);
+    va_start(args, format);
+    vsnprintf(heapBuf.data(), heapBuf.size(), format, args);
+    va_end(args);
+    return write((const uint8_t *)heapBuf.data(), (size_t)len);
+}
+
+size_t Print::print(long value, int base)
+{
+    if (value < 0 && base == DEC)
+        return write('-') + print((unsigned long)-value, base);
+    return print((unsigned long)value, base);
+}
+
+// Digits are produced on the stack, as the core's printNumber() does
+size_t Print::print(unsigned long value, int base)
+{
+    char buf[8 * sizeof(long) + 1];
+    char *p = buf + sizeof(buf);
+    if (base < 2)
+        base = 10;
+    do
+    {
+        unsigned digit = value % base;
+        *--p = (char)(digit < 10 ? '0' + digit : 'A' + digit - 10);
+        value /= base;
+    } while (value);
+    return write((const uint8_t *)p, buf + sizeof(buf) - p);
+}
+
+size_t Print::print(double value, int digits)
+{
+    char buf[48];
+    int len = snprintf(buf, sizeof(buf), "%.*f", digits, value);
+    return len > 0 ? write((const uint8_t *)buf, len < (int)sizeof(buf) ? (size_t)len : sizeof(buf) - 1) : 0;
+}
@@ -0,0 +1,78 @@
+#include "SoftwareSerial.h"
+
+void SoftwareSerial::begin(unsigned long baud)
+{
+    _baud = baud;
+    _rng = hal::irq().seed;
+    _rxHead = 0;
+    _rxCount = 0;
+}
+
+// Pulls the bytes that have arrived on the wire through the edge ISR model
+void SoftwareSerial::receive()
+{
+    hal::SerialPort *p = port();
+    while (p && p->available() > 0)
+    {
+        uint8_t c = (uint8_t)p->read();
+
+        // Idle high, start bit low, 8 data bits LSB first, stop bit high
+        unsigned edges = 0;
+        int level = 1;
+        for (int bit = -1; bit <= 8; bit++)
+        {
+            int next = bit < 0 ? 0 : bit == 8 ? 1 : (c >> bit) & 1;
+            edges += next != level;
+            level = next;
+        }
+        hal::irq().isrNs += (uint64_t)edges * EDGE_ISR_NS;
+
+        if (garbled())
+            c ^= (uint8_t)(1 << (_rng >> 16) % 8);
+        if (_rxCount < RX_BUFFER_SIZE)
+            _rx[(_rxHead + _rxCount++) % RX_BUFFER_SIZE] = c;
+    }
+}
+
+bool SoftwareSerial::garbled()
+{
+    const hal::IrqModel &irq = hal::irq();
+    uint32_t bitUs = (uint32_t)(1000000UL / _baud);
+    if (irq.maskRate <= 0 || irq.maskUs <= bitUs / 2)
+        return false;
+    // Chance that a masked window opens while this byte is on the wire
+    double p = 1.0 - exp(-irq.maskRate * 10 * bitUs / 1e6);
+    _rng = _rng * 1103515245UL + 12345UL;
+    return (_rng >> 8) % 1000000 < p * 1000000;
+}
+
+int SoftwareSerial::available()
+{
+    receive();
+    return (int)_rxCount;
+}
+
+int SoftwareSerial::read()
+{
+    receive();
+    if (_rxCount == 0)
+        return -1;
+    uint8_t c = _rx[_rxHead];
+    _rxHead = (_rxHead + 1) % RX_BUFFER_SIZE;
+    _rxCount--;
+    return c;
+}
+
+int SoftwareSerial::peek()
+{
+    receive();
+    return _rxCount == 0 ? -1 : _rx[_rxHead];
+}
+
+size_t SoftwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    // 8N1: ten bit times per byte, sent with interrupts off on the device
+    hal::clock().delayMicroseconds((uint32_t)(size * 10000000UL / _baud));
+    hal::SerialPort *p = port();
+    return p ? p->write(buffer, size) : size;
+}
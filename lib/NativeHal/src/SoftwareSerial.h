@@ -0,0 +1,43 @@
+#ifndef SOFTWARESERIAL_H
+#define SOFTWARESERIAL_H
+
+#include <Arduino.h>
+#include "Hal.h"
+
+// Reads and writes whatever hal::SerialPort is attached to the rx pin.
+// With nothing attached the port behaves like an unplugged bus. Like the
+// ESP8266 bit-banged implementation, write() blocks for the time the
+// bytes take on the wire, every RX edge costs an interrupt, and an
+// interrupt-masked window from hal::irq() can garble a byte in flight.
+// Received bytes wait in a fixed RX_BUFFER_SIZE ring; overflow drops them.
+class SoftwareSerial : public Stream
+{
+public:
+    SoftwareSerial(int rxPin, int txPin) : _rxPin(rxPin), _txPin(txPin), _baud(9600), _rng(1), _rxHead(0), _rxCount(0) {}
+    void begin(unsigned long baud);
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+
+    static const uint32_t EDGE_ISR_NS = 3000; // GPIO interrupt + edge timestamp at 80 MHz (estimate)
+    static const size_t RX_BUFFER_SIZE = 64;  // library default
+
+private:
+    hal::SerialPort *port() { return hal::serialFor(_rxPin); }
+    void receive();
+    bool garbled();
+
+    int _rxPin;
+    int _txPin;
+    unsigned long _baud;
+    uint32_t _rng;
+    uint8_t _rx[RX_BUFFER_SIZE];
+    size_t _rxHead;
+    size_t _rxCount;
+};
+
+#endif // SOFTWARESERIAL_H
@@ -0,0 +1,42 @@
+#include "Stream.h"
+#include "Hal.h"
+
+int Stream::timedRead()
+{
+    uint32_t start = hal::clock().millis();
+    do
+    {
+        int c = read();
+        if (c >= 0)
+            return c;
+        // Give simulated peers a chance to produce bytes
+        hal::clock().delay(1);
+    } while (hal::clock().millis() - start < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while (count < length)
+    {
+        int c = timedRead();
+        if (c < 0)
+            break;
+        *buffer++ = (char)c;
+        count++;
+    }
+    return count;
+}
+
+String Stream::readString()
+{
+    String ret;
+    int c = timedRead();
+    while (c >= 0)
+    {
+        ret += (char)c;
+        c = timedRead();
+    }
+    return ret;
+}
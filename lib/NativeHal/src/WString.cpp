@@ -0,0 +1,208 @@
+#include "WString.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static std::string toBase(unsigned long value, unsigned char base)
+{
+    if (base < 2 || base > 36)
+        base = 10;
+    char buf[8 * sizeof(unsigned long) + 1];
+    char *p = &buf[sizeof(buf) - 1];
+    *p = '\0';
+    do
+    {
+        unsigned long digit = value % base;
+        *--p = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+        value /= base;
+    } while (value);
+    return std::string(p);
+}
+
+static std::string signedToBase(long value, unsigned char base)
+{
+    if (value < 0 && base == 10)
+        return "-" + toBase((unsigned long)(-(value + 1)) + 1, base);
+    return toBase((unsigned long)value, base);
+}
+
+String::String(const char *cstr) : _buf(cstr ? cstr : "") {}
+String::String(char c) : _buf(1, c) {}
+String::String(unsigned char value, unsigned char base) : _buf(toBase(value, base)) {}
+String::String(int value, unsigned char base) : _buf(signedToBase(value, base)) {}
+String::String(unsigned int value, unsigned char base) : _buf(toBase(value, base)) {}
+String::String(long value, unsigned char base) : _buf(signedToBase(value, base)) {}
+String::String(unsigned long value, unsigned char base) : _buf(toBase(value, base)) {}
+String::String(float value, unsigned char decimalPlaces) : String((double)value, decimalPlaces) {}
+
+String::String(double value, unsigned char decimalPlaces)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimalPlaces, value);
+    _buf = buf;
+}
+
+String &String::operator=(const char *cstr)
+{
+    _buf = cstr ? cstr : "";
+    return *this;
+}
+
+bool String::reserve(unsigned int size)
+{
+    _buf.reserve(size);
+    return true;
+}
+
+bool String::concat(const String &str)
+{
+    _buf += str._buf;
+    return true;
+}
+
+bool String::concat(const char *cstr)
+{
+    if (!cstr)
+        return false;
+    _buf += cstr;
+    return true;
+}
+
+bool String::concat(const char *cstr, unsigned int length)
+{
+    if (!cstr)
+        return false;
+    _buf.append(cstr, length);
+    return true;
+}
+
+bool String::concat(char c)
+{
+    _buf += c;
+    return true;
+}
+
+bool String::startsWith(const String &prefix) const
+{
+    return _buf.compare(0, prefix._buf.size(), prefix._buf) == 0;
+}
+
+bool String::endsWith(const String &suffix) const
+{
+    return _buf.size() >= suffix._buf.size() &&
+           _buf.compare(_buf.size() - suffix._buf.size(), suffix._buf.size(), suffix._buf) == 0;
+}
+
+char String::charAt(unsigned int index) const
+{
+    return index < _buf.size() ? _buf[index] : '\0';
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const
+{
+    size_t pos = _buf.find(ch, fromIndex);
+    return pos == std::string::npos ? -1 : (int)pos;
+}
+
+int String::indexOf(const String &str, unsigned int fromIndex) const
+{
+    size_t pos = _buf.find(str._buf, fromIndex);
+    return pos == std::string::npos ? -1 : (int)pos;
+}
+
+String String::substring(unsigned int beginIndex) const
+{
+    return substring(beginIndex, length());
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const
+{
+    if (beginIndex > endIndex)
+        std::swap(beginIndex, endIndex);
+    if (beginIndex >= _buf.size())
+        return String();
+    endIndex = std::min(endIndex, length());
+    return String(_buf.substr(beginIndex, endIndex - beginIndex).c_str());
+}
+
+void String::replace(const String &find, const String &replace)
+{
+    if (find._buf.empty())
+        return;
+    size_t pos = 0;
+    while ((pos = _buf.find(find._buf, pos)) != std::string::npos)
+    {
+        _buf.replace(pos, find._buf.size(), replace._buf);
+        pos += replace._buf.size();
+    }
+}
+
+void String::remove(unsigned int index, unsigned int count)
+{
+    if (index < _buf.size())
+        _buf.erase(index, count);
+}
+
+void String::toLowerCase()
+{
+    for (auto &c : _buf)
+        c = (char)tolower((unsigned char)c);
+}
+
+void String::toUpperCase()
+{
+    for (auto &c : _buf)
+        c = (char)toupper((unsigned char)c);
+}
+
+void String::trim()
+{
+    size_t begin = _buf.find_first_not_of(" \t\r\n");
+    size_t end = _buf.find_last_not_of(" \t\r\n");
+    _buf = begin == std::string::npos ? std::string() : _buf.substr(begin, end - begin + 1);
+}
+
+long String::toInt() const
+{
+    return atol(_buf.c_str());
+}
+
+float String::toFloat() const
+{
+    return (float)atof(_buf.c_str());
+}
+
+double String::toDouble() const
+{
+    return atof(_buf.c_str());
+}
+
+String operator+(const String &lhs, const String &rhs)
+{
+    String s(lhs);
+    s.concat(rhs);
+    return s;
+}
+
+String operator+(const String &lhs, const char *rhs)
+{
+    String s(lhs);
+    s.concat(rhs);
+    return s;
+}
+
+String operator+(const char *lhs, const String &rhs)
+{
+    String s(lhs);
+    s.concat(rhs);
+    return s;
+}
+
+String operator+(const String &lhs, char rhs)
+{
+    String s(lhs);
+    s.concat(rhs);
+    return s;
+}
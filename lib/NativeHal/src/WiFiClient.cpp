@@ -0,0 +1,49 @@
+#include "WiFiClient.h"
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+    return connect(ip.toString().c_str(), port);
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+    stop();
+    _socket = hal::network().connect(host, port);
+    return _socket ? 1 : 0;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size)
+{
+    return _socket ? _socket->write(buf, size) : 0;
+}
+
+int WiFiClient::available()
+{
+    return _socket ? _socket->available() : 0;
+}
+
+int WiFiClient::read()
+{
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size)
+{
+    return _socket ? _socket->read(buf, size) : -1;
+}
+
+void WiFiClient::stop()
+{
+    if (_socket)
+    {
+        _socket->close();
+        delete _socket;
+        _socket = nullptr;
+    }
+}
+
+uint8_t WiFiClient::connected()
+{
+    return _socket && _socket->connected() ? 1 : 0;
+}
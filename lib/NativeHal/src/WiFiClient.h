@@ -0,0 +1,36 @@
+#ifndef WIFICLIENT_H
+#define WIFICLIENT_H
+
+#include <Arduino.h>
+#include "Client.h"
+#include "Hal.h"
+
+// Client over a hal::Socket obtained from hal::network()
+class WiFiClient : public Client
+{
+public:
+    WiFiClient() : _socket(nullptr) {}
+    ~WiFiClient() { stop(); }
+    WiFiClient(const WiFiClient &) = delete;
+    WiFiClient &operator=(const WiFiClient &) = delete;
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override { return -1; }
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+    void setNoDelay(bool nodelay) { (void)nodelay; }
+
+private:
+    hal::Socket *_socket;
+};
+
+#endif // WIFICLIENT_H
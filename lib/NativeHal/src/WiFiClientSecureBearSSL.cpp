@@ -0,0 +1,464 @@
+#include "WiFiClientSecureBearSSL.h"
+
+#include <chrono>
+#include <thread>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+namespace
+{
+    const size_t RECORD_OVERHEAD = 325;
+
+    unsigned long realMillis()
+    {
+        using namespace std::chrono;
+        return (unsigned long)duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+
+    SSL_CTX *clientContext()
+    {
+        static SSL_CTX *ctx = nullptr;
+        if (!ctx)
+        {
+            ctx = SSL_CTX_new(TLS_client_method());
+            SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+            SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+            // The peer is checked after the handshake, against the pin
+            SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+        }
+        return ctx;
+    }
+
+    int hexDigit(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // Largest record size the receive buffer holds, as a max fragment length code; 0 = full size
+    uint8_t fragmentCode(int rxSize, size_t &fragment)
+    {
+        static const size_t sizes[] = {4096, 2048, 1024, 512};
+        static const uint8_t codes[] = {TLSEXT_max_fragment_length_4096, TLSEXT_max_fragment_length_2048,
+                                        TLSEXT_max_fragment_length_1024, TLSEXT_max_fragment_length_512};
+        fragment = 0;
+        if (rxSize >= BearSSL::WiFiClientSecure::DEFAULT_RX)
+            return 0;
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            if (sizes[i] + RECORD_OVERHEAD <= (size_t)rxSize)
+            {
+                fragment = sizes[i];
+                return codes[i];
+            }
+        }
+        return 0;
+    }
+} // namespace
+
+namespace BearSSL
+{
+
+    bool PublicKey::parse(const char *pemKey)
+    {
+        hal::UncountedAllocations uncounted;
+        type = NONE;
+        der.clear();
+        BIO *bio = BIO_new_mem_buf(pemKey, -1);
+        EVP_PKEY *key = bio ? PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr) : nullptr;
+        BIO_free(bio);
+        if (!key)
+            return false;
+        int length = i2d_PUBKEY(key, nullptr);
+        if (length > 0)
+        {
+            der.resize(length);
+            uint8_t *p = der.data();
+            i2d_PUBKEY(key, &p);
+            type = EVP_PKEY_base_id(key) == EVP_PKEY_EC ? EC : RSA;
+        }
+        EVP_PKEY_free(key);
+        return type != NONE;
+    }
+
+    Session::Session() : saved(nullptr)
+    {
+        memset(&session, 0, sizeof(session));
+    }
+
+    Session::~Session()
+    {
+        SSL_SESSION_free(saved);
+    }
+
+    WiFiClientSecure::WiFiClientSecure()
+        : socket(nullptr), ssl(nullptr), in(nullptr), out(nullptr), open(false),
+          rxSize(DEFAULT_RX), txSize(DEFAULT_TX), rxBuffer(nullptr), txBuffer(nullptr), rxPos(0), rxLength(0),
+          session(nullptr), insecure(false), useFingerprint(false), fingerprint(), knownKey(nullptr),
+          lastError(0), lastErrorText()
+    {
+        setTimeout(5000);
+    }
+
+    WiFiClientSecure::~WiFiClientSecure()
+    {
+        stop();
+    }
+
+    void WiFiClientSecure::setInsecure()
+    {
+        insecure = true;
+        useFingerprint = false;
+        knownKey = nullptr;
+    }
+
+    bool WiFiClientSecure::setFingerprint(const char *fpStr)
+    {
+        uint8_t parsed[sizeof(fingerprint)];
+        size_t n = 0;
+        for (const char *p = fpStr; *p;)
+        {
+            if (*p == ':' || *p == ' ')
+            {
+                p++;
+                continue;
+            }
+            int high = hexDigit(p[0]);
+            int low = high < 0 ? -1 : hexDigit(p[1]);
+            if (low < 0 || n == sizeof(parsed))
+                return false;
+            parsed[n++] = (uint8_t)(high << 4 | low);
+            p += 2;
+        }
+        if (n != sizeof(parsed))
+            return false;
+        memcpy(fingerprint, parsed, sizeof(fingerprint));
+        useFingerprint = true;
+        insecure = false;
+        knownKey = nullptr;
+        return true;
+    }
+
+    void WiFiClientSecure::setKnownKey(const PublicKey *pk, unsigned usages)
+    {
+        (void)usages;
+        knownKey = pk;
+        insecure = false;
+        useFingerprint = false;
+    }
+
+    void WiFiClientSecure::setBufferSizes(int recv, int xmit)
+    {
+        rxSize = recv < 512 + (int)RECORD_OVERHEAD ? 512 + (int)RECORD_OVERHEAD : recv;
+        txSize = xmit < 512 ? 512 : xmit;
+    }
+
+    int WiFiClientSecure::getLastSSLError(char *dest, size_t len)
+    {
+        if (dest && len > 0)
+            snprintf(dest, len, "%s", lastErrorText);
+        return lastError;
+    }
+
+    void WiFiClientSecure::fail(int code, const char *text)
+    {
+        lastError = code;
+        snprintf(lastErrorText, sizeof(lastErrorText), "%s", text);
+        stop();
+    }
+
+    int WiFiClientSecure::connect(IPAddress ip, uint16_t port)
+    {
+        return connect(ip.toString().c_str(), port);
+    }
+
+    int WiFiClientSecure::connect(const char *host, uint16_t port)
+    {
+        stop();
+        lastError = 0;
+        lastErrorText[0] = '\0';
+        socket = hal::network().connect(host, port);
+        if (!socket)
+        {
+            fail(-1, "TCP connect failed");
+            return 0;
+        }
+        // Per connection, as BearSSL allocates them
+        rxBuffer = new uint8_t[rxSize];
+        txBuffer = new uint8_t[txSize];
+        rxPos = rxLength = 0;
+        return handshake() ? 1 : 0;
+    }
+
+    bool WiFiClientSecure::handshake()
+    {
+        if (!insecure && !useFingerprint && !knownKey)
+        {
+            fail(-2, "no trust anchor, fingerprint or known key");
+            return false;
+        }
+        size_t fragment;
+        uint8_t code = fragmentCode(rxSize, fragment);
+        if (rxSize < DEFAULT_RX && code == 0)
+        {
+            fail(-3, "receive buffer below one record");
+            return false;
+        }
+        {
+            hal::UncountedAllocations uncounted;
+            ssl = SSL_new(clientContext());
+            in = BIO_new(BIO_s_mem());
+            out = BIO_new(BIO_s_mem());
+            SSL_set_bio(ssl, in, out);
+            SSL_set_connect_state(ssl);
+            if (code)
+                SSL_set_tlsext_max_fragment_length(ssl, code);
+            if (session && session->saved)
+                SSL_set_session(ssl, session->saved);
+        }
+
+        unsigned long deadline = realMillis() + getTimeout();
+        while (true)
+        {
+            int result;
+            {
+                hal::UncountedAllocations uncounted;
+                result = SSL_do_handshake(ssl);
+            }
+            if (!flushOutput())
+            {
+                fail(-4, "connection closed during the handshake");
+                return false;
+            }
+            if (result == 1)
+                break;
+            if (SSL_get_error(ssl, result) != SSL_ERROR_WANT_READ || !pullInput(true, deadline))
+            {
+                fail(-5, "handshake failed or timed out");
+                return false;
+            }
+        }
+
+        // BearSSL fails on the first record that does not fit its buffer
+        if (code && SSL_SESSION_get_max_fragment_length(SSL_get_session(ssl)) != code)
+        {
+            fail(-6, "server ignored the max fragment length");
+            return false;
+        }
+        if (!verifyPeer())
+            return false;
+
+        if (session)
+        {
+            hal::UncountedAllocations uncounted;
+            SSL_SESSION_free(session->saved);
+            session->saved = SSL_get1_session(ssl);
+            br_ssl_session_parameters &p = session->session;
+            unsigned int idLength = 0;
+            const unsigned char *id = SSL_SESSION_get_id(session->saved, &idLength);
+            p.session_id_len = idLength < sizeof(p.session_id) ? idLength : sizeof(p.session_id);
+            memcpy(p.session_id, id, p.session_id_len);
+            p.version = SSL_SESSION_get_protocol_version(session->saved);
+            p.cipher_suite = SSL_CIPHER_get_protocol_id(SSL_SESSION_get0_cipher(session->saved));
+            SSL_SESSION_get_master_key(session->saved, p.master_secret, sizeof(p.master_secret));
+        }
+        open = true;
+        return true;
+    }
+
+    bool WiFiClientSecure::verifyPeer()
+    {
+        if (insecure)
+            return true;
+        hal::UncountedAllocations uncounted;
+        X509 *cert = SSL_get1_peer_certificate(ssl);
+        bool ok = false;
+        if (cert && useFingerprint)
+        {
+            uint8_t digest[EVP_MAX_MD_SIZE];
+            unsigned int length = 0;
+            ok = X509_digest(cert, EVP_sha1(), digest, &length) && length == sizeof(fingerprint) &&
+                 memcmp(digest, fingerprint, sizeof(fingerprint)) == 0;
+        }
+        else if (cert && knownKey)
+        {
+            EVP_PKEY *key = X509_get0_pubkey(cert);
+            int length = key ? i2d_PUBKEY(key, nullptr) : 0;
+            if (length > 0 && (size_t)length == knownKey->der.size())
+            {
+                std::vector<uint8_t> der(length);
+                uint8_t *p = der.data();
+                i2d_PUBKEY(key, &p);
+                ok = der == knownKey->der;
+            }
+        }
+        X509_free(cert);
+        if (!ok)
+            fail(-7, useFingerprint ? "certificate fingerprint mismatch" : "server public key mismatch");
+        return ok;
+    }
+
+    // Sends the ciphertext OpenSSL has produced, staged through the transmit buffer
+    bool WiFiClientSecure::flushOutput()
+    {
+        while (BIO_ctrl_pending(out) > 0)
+        {
+            int n = BIO_read(out, txBuffer, txSize);
+            if (n <= 0)
+                break;
+            if (!socket || socket->write(txBuffer, n) != (size_t)n)
+                return false;
+        }
+        return true;
+    }
+
+    // Feeds what the socket has to OpenSSL; with `wait`, waits for at least one byte
+    bool WiFiClientSecure::pullInput(bool wait, unsigned long deadlineMs)
+    {
+        uint8_t chunk[512];
+        bool got = false;
+        while (socket)
+        {
+            int available = socket->available();
+            if (available > 0)
+            {
+                int n = socket->read(chunk, available < (int)sizeof(chunk) ? available : (int)sizeof(chunk));
+                if (n > 0)
+                {
+                    hal::UncountedAllocations uncounted;
+                    BIO_write(in, chunk, n);
+                    got = true;
+                    continue;
+                }
+            }
+            if (got || !wait || !socket->connected() || (long)(realMillis() - deadlineMs) >= 0)
+                break;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        return got;
+    }
+
+    size_t WiFiClientSecure::write(const uint8_t *buf, size_t size)
+    {
+        if (!open || size == 0)
+            return 0;
+        int result;
+        {
+            hal::UncountedAllocations uncounted;
+            result = SSL_write(ssl, buf, (int)size);
+        }
+        if (result <= 0 || !flushOutput())
+        {
+            fail(-8, "write failed");
+            return 0;
+        }
+        return (size_t)result;
+    }
+
+    int WiFiClientSecure::available()
+    {
+        if (!open)
+            return 0;
+        if (rxPos < rxLength)
+            return (int)(rxLength - rxPos);
+        pullInput(false, 0);
+        int n;
+        {
+            hal::UncountedAllocations uncounted;
+            n = SSL_read(ssl, rxBuffer, rxSize);
+        }
+        if (n <= 0)
+        {
+            int error = SSL_get_error(ssl, n);
+            flushOutput();
+            if (error != SSL_ERROR_WANT_READ)
+                fail(-9, "connection closed by the server");
+            return 0;
+        }
+        rxPos = 0;
+        rxLength = n;
+        return n;
+    }
+
+    int WiFiClientSecure::read()
+    {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int WiFiClientSecure::read(uint8_t *buf, size_t size)
+    {
+        if (available() <= 0)
+            return -1;
+        size_t n = rxLength - rxPos < size ? rxLength - rxPos : size;
+        memcpy(buf, rxBuffer + rxPos, n);
+        rxPos += n;
+        return (int)n;
+    }
+
+    uint8_t WiFiClientSecure::connected()
+    {
+        if (!open)
+            return 0;
+        if (rxPos < rxLength)
+            return 1;
+        if (!socket->connected())
+        {
+            stop();
+            return 0;
+        }
+        return 1;
+    }
+
+    void WiFiClientSecure::stop()
+    {
+        {
+            hal::UncountedAllocations uncounted;
+            if (open)
+            {
+                // close_notify, as BearSSL sends; a session closed without
+                // it cannot be resumed
+                SSL_shutdown(ssl);
+                flushOutput();
+            }
+            SSL_free(ssl); // frees the BIOs too
+        }
+        ssl = nullptr;
+        in = out = nullptr;
+        if (socket)
+        {
+            socket->close();
+            delete socket;
+            socket = nullptr;
+        }
+        delete[] rxBuffer;
+        delete[] txBuffer;
+        rxBuffer = txBuffer = nullptr;
+        rxPos = rxLength = 0;
+        open = false;
+    }
+
+    bool WiFiClientSecure::probeMaxFragmentLength(IPAddress ip, uint16_t port, uint16_t len)
+    {
+        return probeMaxFragmentLength(ip.toString().c_str(), port, len);
+    }
+
+    bool WiFiClientSecure::probeMaxFragmentLength(const char *hostname, uint16_t port, uint16_t len)
+    {
+        WiFiClientSecure probe;
+        probe.setInsecure();
+        probe.setBufferSizes(len + RECORD_OVERHEAD, DEFAULT_TX);
+        bool accepted = probe.connect(hostname, port);
+        probe.stop();
+        return accepted;
+    }
+
+} // namespace BearSSL
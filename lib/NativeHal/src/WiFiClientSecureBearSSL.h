@@ -0,0 +1,143 @@
+#ifndef WIFICLIENTSECUREBEARSSL_H
+#define WIFICLIENTSECUREBEARSSL_H
+
+#include <Arduino.h>
+#include <vector>
+#include "Client.h"
+#include "Hal.h"
+
+// The part of the ESP8266 core's BearSSL::WiFiClientSecure the firmware
+// uses, over a hal::Socket. OpenSSL stands in for the BearSSL engine and
+// is held to what BearSSL does: TLS 1.2 at most, resumption by session ID
+// only (no tickets), a smaller receive buffer negotiated with the max
+// fragment length extension, and the broker checked by certificate SHA-1
+// fingerprint or known public key instead of a CA chain.
+//
+// Heap: the I/O buffers sized by setBufferSizes() are allocated per
+// connection as BearSSL does and are counted; OpenSSL's own allocations
+// are not (BearSSL's context and stack come on top on the device).
+// The handshake waits for the network in real time, up to the Stream
+// timeout.
+
+#define BR_KEYTYPE_KEYX 0x10
+#define BR_KEYTYPE_SIGN 0x20
+
+typedef struct
+{
+    unsigned char session_id[32];
+    unsigned char session_id_len;
+    uint16_t version;
+    uint16_t cipher_suite;
+    unsigned char master_secret[48];
+} br_ssl_session_parameters;
+
+typedef struct ssl_ctx_st SSL_CTX;
+typedef struct ssl_st SSL;
+typedef struct ssl_session_st SSL_SESSION;
+typedef struct bio_st BIO;
+
+namespace BearSSL
+{
+
+    class PublicKey
+    {
+    public:
+        PublicKey() {}
+        explicit PublicKey(const char *pemKey) { parse(pemKey); }
+        bool parse(const char *pemKey);
+        bool isRSA() const { return type == RSA; }
+        bool isEC() const { return type == EC; }
+
+    private:
+        friend class WiFiClientSecure;
+        enum Type
+        {
+            NONE,
+            RSA,
+            EC
+        };
+        Type type = NONE;
+        std::vector<uint8_t> der; // SubjectPublicKeyInfo
+    };
+
+    class Session
+    {
+    public:
+        Session();
+        ~Session();
+        Session(const Session &) = delete;
+        Session &operator=(const Session &) = delete;
+        br_ssl_session_parameters *getSession() { return &session; }
+
+    private:
+        friend class WiFiClientSecure;
+        br_ssl_session_parameters session;
+        SSL_SESSION *saved;
+    };
+
+    class WiFiClientSecure : public Client
+    {
+    public:
+        WiFiClientSecure();
+        ~WiFiClientSecure() override;
+        WiFiClientSecure(const WiFiClientSecure &) = delete;
+        WiFiClientSecure &operator=(const WiFiClientSecure &) = delete;
+
+        int connect(IPAddress ip, uint16_t port) override;
+        int connect(const char *host, uint16_t port) override;
+        size_t write(uint8_t c) override { return write(&c, 1); }
+        size_t write(const uint8_t *buf, size_t size) override;
+        using Print::write;
+        int available() override;
+        int read() override;
+        int read(uint8_t *buf, size_t size) override;
+        int peek() override { return -1; }
+        void stop() override;
+        uint8_t connected() override;
+        operator bool() override { return connected(); }
+
+        void setInsecure();
+        bool setFingerprint(const char *fpStr);
+        void setKnownKey(const PublicKey *pk, unsigned usages = BR_KEYTYPE_KEYX | BR_KEYTYPE_SIGN);
+        void setSession(Session *session) { this->session = session; }
+        void setBufferSizes(int recv, int xmit);
+        int getLastSSLError(char *dest = nullptr, size_t len = 0);
+
+        // True if the server accepts a record size of `len` (max fragment length extension)
+        static bool probeMaxFragmentLength(IPAddress ip, uint16_t port, uint16_t len);
+        static bool probeMaxFragmentLength(const char *hostname, uint16_t port, uint16_t len);
+
+        static const int DEFAULT_RX = 16384 + 325; // one full record and its overhead
+        static const int DEFAULT_TX = 597;
+
+    private:
+        bool handshake();
+        bool verifyPeer();
+        bool flushOutput();
+        bool pullInput(bool wait, unsigned long deadlineMs);
+        void fail(int code, const char *text);
+
+        hal::Socket *socket;
+        SSL *ssl;
+        BIO *in;  // ciphertext from the server
+        BIO *out; // ciphertext for the server
+        bool open;
+        int rxSize;
+        int txSize;
+        uint8_t *rxBuffer; // decrypted bytes not read yet
+        uint8_t *txBuffer;
+        size_t rxPos;
+        size_t rxLength;
+
+        Session *session;
+        bool insecure;
+        bool useFingerprint;
+        uint8_t fingerprint[20];
+        const PublicKey *knownKey;
+        int lastError;
+        char lastErrorText[96];
+    };
+
+} // namespace BearSSL
+
+#endif // WIFICLIENTSECUREBEARSSL_H
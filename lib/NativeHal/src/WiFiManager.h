@@ -0,0 +1,17 @@
+#ifndef WIFIMANAGER_H
+#define WIFIMANAGER_H
+
+#include <ESP8266WiFi.h>
+
+// The host is always "associated"; no captive portal is started
+class WiFiManager
+{
+public:
+    void setConfigPortalTimeout(unsigned long seconds) { (void)seconds; }
+    void setConnectTimeout(unsigned long seconds) { (void)seconds; }
+    void setDebugOutput(bool debug) { (void)debug; }
+    bool autoConnect(const char *apName) { (void)apName; return WiFi.status() == WL_CONNECTED; }
+    void resetSettings() {}
+};
+
+#endif // WIFIMANAGER_H
@@ -0,0 +1,16 @@
+#ifndef COREDECLS_H
+#define COREDECLS_H
+
+// Host stand-in for the ESP8266 core's SNTP hooks. The host clock is
+// already NTP-disciplined: configTime() reports it as set right away and
+// there are no later updates.
+
+#include <stdint.h>
+#include <functional>
+
+// Called after SNTP has set the clock
+void settimeofday_cb(const std::function<void()> &cb);
+// Defined by the sketch to change the SNTP update interval
+uint32_t sntp_update_delay_MS_rfc_not_less_than_15000();
+
+#endif // COREDECLS_H
@@ -0,0 +1,20 @@
+#ifndef LWIP_DNS_H
+#define LWIP_DNS_H
+
+#include <stdint.h>
+#include "lwip/ip_addr.h"
+
+// The part of lwIP's DNS client the firmware uses. On the host the lookup
+// is synchronous (getaddrinfo), so dns_gethostbyname() returns ERR_OK or
+// an error and never calls `found`; lwIP does the same for address
+// literals and cached names.
+typedef int8_t err_t;
+#define ERR_OK 0
+#define ERR_INPROGRESS -5
+#define ERR_ARG -16
+
+typedef void (*dns_found_callback)(const char *name, const ip_addr_t *ipaddr, void *callback_arg);
+
+err_t dns_gethostbyname(const char *hostname, ip_addr_t *addr, dns_found_callback found, void *callback_arg);
+
+#endif // LWIP_DNS_H
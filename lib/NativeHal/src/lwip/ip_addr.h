@@ -0,0 +1,12 @@
+#ifndef LWIP_IP_ADDR_H
+#define LWIP_IP_ADDR_H
+
+#include <stdint.h>
+
+// IPv4 only, as in the ESP8266 core's default lwIP build
+typedef struct ip_addr
+{
+    uint32_t addr; // network byte order
+} ip_addr_t;
+
+#endif // LWIP_IP_ADDR_H
@@ -0,0 +1,12 @@
+#ifndef UMM_MALLOC_H
+#define UMM_MALLOC_H
+
+#include <stddef.h>
+
+// Heap statistics of the ESP8266 core's allocator, available there with
+// -D UMM_STATS_FULL. On the host they come from the counted blocks of
+// HeapCounter.cpp.
+size_t umm_free_heap_size_min();
+size_t umm_free_heap_size_min_reset();
+
+#endif // UMM_MALLOC_H
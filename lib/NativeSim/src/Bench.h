@@ -0,0 +1,36 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <Arduino.h>
+#include "PzemEmulator.h"
+
+// Command-line options shared by the firmware run and the benchmarks
+struct SimOptions
+{
+    unsigned long loops = 0; // 0 = run forever
+    unsigned long samples = 1000;
+    bool simClock = false;
+    bool offline = false;
+    bool pzem = false; // attach the emulator to the meter's rx pin
+    PzemEmulator::Config pzemConfig;
+    uint8_t pzemSlaves = 1;  // >1: slaves at addresses 1..N, one per phase
+    uint8_t pzemDead = 0;    // 1..N: that slave never answers
+    float irqRate = -1;      // masked-interrupt windows per second, <0 = default / sweep
+    uint32_t irqMaskUs = 80; // length of each window
+    const char *bench = nullptr;
+};
+
+// Builds the emulated bus described by the --pzem* options
+void configurePzemBus(PzemEmulator &pzem, const SimOptions &options);
+// Matching pzem_addresses value ("" for a single PZEM)
+String pzemAddresses(const SimOptions &options);
+
+// Each benchmark prints its report to stdout and returns the exit code
+int benchAcquisition(const SimOptions &options);
+int benchTransport(const SimOptions &options);
+int benchPublish(const SimOptions &options);
+int benchCodec(const SimOptions &options);
+int benchDelivery(const SimOptions &options);
+int benchTls(const SimOptions &options);
+
+#endif // BENCH_H
@@ -0,0 +1,76 @@
+// Acquisition benchmark: Meter against the PZEM emulator on a virtual
+// clock. Meter::loop() is called once per simulated millisecond, as the
+// firmware's loop() would, until `samples` polling cycles have completed.
+// Reports the cost of a single Meter::loop() call (what the rest of the
+// firmware waits for), lost samples and, on a multi-slave bus, how often
+// each phase was read.
+
+#include <Arduino.h>
+#include "Bench.h"
+#include "Meter.h"
+
+#define BENCH_RX_PIN 100
+#define BENCH_TX_PIN 101
+#define LOOP_PERIOD_US 1000
+
+int benchAcquisition(const SimOptions &options)
+{
+    static hal::SimClock clock;
+    hal::setClock(&clock);
+
+    PzemEmulator pzem(options.pzemConfig);
+    configurePzemBus(pzem, options);
+    hal::attachSerial(BENCH_RX_PIN, &pzem);
+    Meter meter(BENCH_RX_PIN, BENCH_TX_PIN);
+    meter.begin();
+    meter.setPollInterval(Meter::MIN_POLL_INTERVAL);
+    if (!meter.setAddresses(pzemAddresses(options)))
+        return 2;
+    unsigned long phaseOk[Meter::MAX_SLAVES] = {};
+
+    unsigned long ok = 0;
+    unsigned long failed = 0;
+    unsigned long calls = 0;
+    double totalCallUs = 0;
+    uint32_t worstCallUs = 0;
+    uint32_t startedAt = clock.micros();
+    while (ok + failed < options.samples)
+    {
+        uint32_t start = clock.micros();
+        meter.loop();
+        uint32_t us = clock.micros() - start;
+        calls++;
+        totalCallUs += us;
+        if (us > worstCallUs)
+            worstCallUs = us;
+
+        if (meter.readingsReady())
+        {
+            if (isnan(meter.getReadings().voltage))
+                failed++;
+            else
+                ok++;
+            for (uint8_t p = 1; meter.slaveCount() > 1 && p <= meter.slaveCount(); p++)
+            {
+                if (!isnan(meter.getPhaseReadings(p).voltage))
+                    phaseOk[p - 1]++;
+            }
+        }
+        clock.advance(us < LOOP_PERIOD_US ? LOOP_PERIOD_US - us : 0);
+    }
+    double elapsedS = (clock.micros() - startedAt) / 1e6;
+
+    const PzemEmulator::Stats &s = pzem.stats();
+    unsigned long samples = ok + failed;
+    printf("acquisition: %lu samples, %lu ok, %lu failed (%.2f%%)\n",
+           samples, ok, failed, samples ? 100.0 * failed / samples : 0.0);
+    printf("  Meter::loop(): %lu calls, mean %.1f us, worst %.2f ms\n",
+           calls, calls ? totalCallUs / calls : 0.0, worstCallUs / 1000.0);
+    printf("  bus: %u requests, %u replies, %u dropped, %u corrupted\n",
+           s.requests, s.replies, s.dropped, s.corrupted);
+    printf("  throughput: %.2f valid readings/s (poll interval %lu ms)\n",
+           elapsedS > 0 ? ok / elapsedS : 0.0, meter.getPollInterval());
+    for (uint8_t p = 1; meter.slaveCount() > 1 && p <= meter.slaveCount(); p++)
+        printf("  phase %u: %lu/%lu cycles valid\n", p, phaseOk[p - 1], samples);
+    return 0;
+}
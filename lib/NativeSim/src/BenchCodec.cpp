@@ -0,0 +1,216 @@
+// Codec benchmark: window readings recorded from the PZEM emulator the way
+// the firmware takes them (Meter polled every second, SampleWindow closed
+// every 10 s, the panel total plus one stream per slave), one trace per
+// load profile. Each trace is coded in runs of 1 and MAX_BATCH readings,
+// as the flash backlog and batched payloads do. Reports bytes per reading
+// with the fixed binary layout and with DeltaCodec, the flash used per
+// reading by the old raw records and the new ones, and the host time to
+// encode a reading (relative only: the ESP8266 is far slower).
+// Decoding must give back readings that encode to the same bytes; the
+// exit code is 1 if one does not.
+
+#include <Arduino.h>
+#include <chrono>
+#include <vector>
+#include "Bench.h"
+#include "BinaryPayload.h"
+#include "DeltaCodec.h"
+#include "Meter.h"
+#include "SampleWindow.h"
+
+#define BENCH_RX_PIN 100
+#define BENCH_TX_PIN 101
+#define LOOP_PERIOD_US 1000
+#define SAMPLE_INTERVAL_MS 1000
+#define WINDOW_MS 10000
+#define TRACE_EPOCH 1700000000UL
+#define MAX_BATCH 8
+#define LOG_FRAME_BYTES 6    // SegmentLog length + crc
+#define RECORD_HEADER_BYTES 2 // DataSender record version + count
+#define ENCODE_ROUNDS 200
+
+namespace
+{
+
+    struct CodecResult
+    {
+        double fixedBytes;  // per reading
+        double deltaBytes;
+        double oldFlashBytes;
+        double newFlashBytes;
+        double fixedNs;
+        double deltaNs;
+        bool roundTrip;
+    };
+
+    // `windows` publish windows of every stream, in publish order
+    std::vector<MeterReadings> recordTrace(PzemEmulator::LoadProfile profile, const SimOptions &options,
+                                           unsigned long windows)
+    {
+        static hal::SimClock clock;
+        hal::setClock(&clock);
+
+        SimOptions traceOptions = options;
+        traceOptions.pzemConfig.profile = profile;
+        PzemEmulator pzem(traceOptions.pzemConfig);
+        configurePzemBus(pzem, traceOptions);
+        hal::attachSerial(BENCH_RX_PIN, &pzem);
+        Meter meter(BENCH_RX_PIN, BENCH_TX_PIN);
+        meter.begin();
+        meter.setPollInterval(SAMPLE_INTERVAL_MS);
+        meter.setAddresses(pzemAddresses(traceOptions));
+
+        SampleWindow sampleWindows[Meter::MAX_SLAVES + 1];
+        std::vector<MeterReadings> trace;
+        uint32_t startedAt = clock.micros();
+        uint32_t windowStart = startedAt;
+        unsigned long closed = 0;
+        while (closed < windows)
+        {
+            uint32_t start = clock.micros();
+            meter.loop();
+            if (meter.readingsReady() && !isnan(meter.getReadings().voltage))
+            {
+                sampleWindows[0].add(meter.getReadings());
+                for (uint8_t phase = 1; meter.slaveCount() > 1 && phase <= meter.slaveCount(); phase++)
+                    sampleWindows[phase].add(meter.getPhaseReadings(phase));
+            }
+            if (clock.micros() - windowStart >= WINDOW_MS * 1000UL)
+            {
+                for (uint8_t i = 0; i <= Meter::MAX_SLAVES; i++)
+                {
+                    if (sampleWindows[i].count() > 0)
+                    {
+                        MeterReadings r = sampleWindows[i].result();
+                        r.epoch = TRACE_EPOCH + (clock.micros() - startedAt) / 1000000UL;
+                        r.seq = trace.size() + 1; // as DataSender numbers them
+                        trace.push_back(r);
+                    }
+                    sampleWindows[i].reset();
+                }
+                windowStart = clock.micros();
+                closed++;
+            }
+            uint32_t us = clock.micros() - start;
+            clock.advance(us < LOOP_PERIOD_US ? LOOP_PERIOD_US - us : 0);
+        }
+        return trace;
+    }
+
+    // Encodes the trace in runs of `batch`; returns the bytes written
+    size_t encodeDelta(const std::vector<MeterReadings> &trace, size_t batch, std::vector<uint8_t> &out,
+                       std::vector<size_t> &runEnds)
+    {
+        out.assign(trace.size() * DeltaCodec::MAX_READING_BYTES, 0);
+        runEnds.clear();
+        DeltaCodec codec;
+        size_t length = 0;
+        for (size_t i = 0; i < trace.size(); i++)
+        {
+            if (i % batch == 0)
+            {
+                codec.reset();
+                if (i > 0)
+                    runEnds.push_back(length);
+            }
+            length += codec.encode(trace[i], out.data() + length, out.size() - length);
+        }
+        runEnds.push_back(length);
+        return length;
+    }
+
+    // Decodes every run and re-encodes the result, which must give the same bytes
+    bool roundTrip(const std::vector<MeterReadings> &trace, size_t batch, const std::vector<uint8_t> &coded,
+                   const std::vector<size_t> &runEnds)
+    {
+        std::vector<MeterReadings> decoded(trace.size());
+        DeltaCodec codec;
+        size_t offset = 0;
+        for (size_t i = 0; i < trace.size(); i++)
+        {
+            if (i % batch == 0)
+                codec.reset();
+            size_t runEnd = runEnds[i / batch];
+            size_t used = codec.decode(coded.data() + offset, runEnd - offset, decoded[i]);
+            const MeterReadings &a = trace[i];
+            const MeterReadings &b = decoded[i];
+            if (used == 0 || a.epoch != b.epoch || a.phase != b.phase || a.samples != b.samples || a.seq != b.seq || a.alarm != b.alarm)
+                return false;
+            offset += used;
+        }
+        std::vector<uint8_t> again;
+        std::vector<size_t> againEnds;
+        encodeDelta(decoded, batch, again, againEnds);
+        return againEnds == runEnds && std::equal(coded.begin(), coded.begin() + runEnds.back(), again.begin());
+    }
+
+    CodecResult runCodec(const std::vector<MeterReadings> &trace, size_t batch)
+    {
+        using Clock = std::chrono::steady_clock;
+        CodecResult result = {};
+        size_t n = trace.size();
+
+        std::vector<uint8_t> coded;
+        std::vector<size_t> runEnds;
+        size_t deltaLength = encodeDelta(trace, batch, coded, runEnds);
+        size_t runs = runEnds.size();
+        result.fixedBytes = BinaryPayload::READING_BYTES;
+        result.deltaBytes = (double)deltaLength / n;
+        result.oldFlashBytes = 1 + sizeof(MeterReadings) + LOG_FRAME_BYTES;
+        result.newFlashBytes = (double)(deltaLength + runs * (RECORD_HEADER_BYTES + LOG_FRAME_BYTES)) / n;
+        result.roundTrip = roundTrip(trace, batch, coded, runEnds);
+
+        uint8_t fixed[BinaryPayload::HEADER_BYTES + BinaryPayload::READING_BYTES];
+        auto start = Clock::now();
+        size_t sink = 0;
+        for (int round = 0; round < ENCODE_ROUNDS; round++)
+        {
+            for (size_t i = 0; i < n; i++)
+                sink += BinaryPayload::encode("", 0, &trace[i], 1, fixed, sizeof(fixed));
+        }
+        result.fixedNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (ENCODE_ROUNDS * n);
+
+        start = Clock::now();
+        for (int round = 0; round < ENCODE_ROUNDS; round++)
+            sink += encodeDelta(trace, batch, coded, runEnds);
+        result.deltaNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / (ENCODE_ROUNDS * n);
+        if (sink == 0)
+            result.roundTrip = false;
+        return result;
+    }
+
+} // namespace
+
+int benchCodec(const SimOptions &options)
+{
+    static const struct
+    {
+        const char *name;
+        PzemEmulator::LoadProfile profile;
+    } traces[] = {
+        {"constant", PzemEmulator::LOAD_CONSTANT},
+        {"sine", PzemEmulator::LOAD_SINE},
+        {"steps", PzemEmulator::LOAD_STEPS},
+        {"random", PzemEmulator::LOAD_RANDOM},
+    };
+    static const size_t batches[] = {1, MAX_BATCH};
+
+    printf("codec: %lu windows of %u ms per trace, %u slave(s), noise %.3f\n",
+           options.samples, WINDOW_MS, options.pzemSlaves, options.pzemConfig.noise);
+    printf("  trace     batch  fixed B/rd  delta B/rd  ratio  flash B/rd old  new  encode ns/rd fixed  delta\n");
+    bool ok = true;
+    for (const auto &t : traces)
+    {
+        std::vector<MeterReadings> trace = recordTrace(t.profile, options, options.samples);
+        for (size_t batch : batches)
+        {
+            CodecResult r = runCodec(trace, batch);
+            ok = ok && r.roundTrip;
+            printf("  %-9s %5zu  %10.1f  %10.1f  %5.2f  %14.1f %4.1f  %18.0f %6.0f%s\n",
+                   t.name, batch, r.fixedBytes, r.deltaBytes, r.fixedBytes / r.deltaBytes,
+                   r.oldFlashBytes, r.newFlashBytes, r.fixedNs, r.deltaNs,
+                   r.roundTrip ? "" : "  ROUND TRIP FAILED");
+        }
+    }
+    return ok ? 0 : 1;
+}
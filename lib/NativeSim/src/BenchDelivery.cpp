@@ -0,0 +1,185 @@
+// Delivery benchmark: the whole firmware publishing at QoS 1 to the
+// in-process FakeBroker on a virtual clock, with three slaves sampled every
+// 200 ms and published every second. Each scenario configures the broker
+// (PUBACK and CONNACK delay, connection cut on every Nth PUBLISH), runs until
+// `samples` readings were handed to DataSender, then heals the broker,
+// stops new readings and runs until everything is acknowledged.
+// No reading may be lost: every one must have been PUBACKed and seen by
+// the broker at least once (duplicates are allowed at QoS 1). The exit
+// code is 1 otherwise. The slowest loop() pass shows whether reconnecting
+// held up sampling.
+
+#include <Arduino.h>
+#include "Bench.h"
+#include "BinaryPayload.h"
+#include "ConfigManager.h"
+#include "DataSender.h"
+#include "FakeBroker.h"
+
+#define LOOP_PERIOD_US 1000
+#define SETTLE_LIMIT_MS 3600000UL // to deliver what is left once the broker is healthy
+#define NO_READINGS_INTERVAL 3600000
+
+extern ConfigManager configManager;
+extern DataSender dataSender;
+void setup();
+void loop();
+
+namespace
+{
+
+    struct DeliveryScenario
+    {
+        const char *name;
+        uint32_t ackDelayMs;
+        uint32_t connackDelayMs;
+        uint32_t dropEvery;
+    };
+
+    struct DeliveryResult
+    {
+        uint32_t queued;
+        uint32_t delivered;
+        uint32_t received;
+        uint32_t requeued;
+        uint32_t drops;
+        uint32_t connects;
+        uint32_t maxUnacked;
+        uint32_t worstLoopUs;
+        double settleS;
+        bool settled;
+    };
+
+    uint32_t receivedReadings = 0;
+    uint32_t worstLoopUs = 0;
+
+    // Readings in one payload: the count byte of a binary message, the
+    // timestamps of a JSON one
+    void countReadings(const char *topic, const uint8_t *payload, size_t length)
+    {
+        size_t topicLength = strlen(topic);
+        if (topicLength > 4 && strcmp(topic + topicLength - 4, "/bin") == 0)
+        {
+            size_t offset = 2 + ((payload[1] & BinaryPayload::FLAG_HEARTBEAT) ? 2 : 0);
+            offset += 1 + payload[offset];
+            receivedReadings += offset < length ? payload[offset] : 0;
+            return;
+        }
+        static const char key[] = "\"timestamp\"";
+        for (size_t i = 0; i + sizeof(key) - 1 <= length; i++)
+        {
+            if (memcmp(payload + i, key, sizeof(key) - 1) == 0)
+                receivedReadings++;
+        }
+    }
+
+    void step(hal::SimClock &clock)
+    {
+        uint32_t start = clock.micros();
+        loop();
+        uint32_t us = clock.micros() - start;
+        if (us > worstLoopUs)
+            worstLoopUs = us;
+        clock.advance(us < LOOP_PERIOD_US ? LOOP_PERIOD_US - us : 0);
+    }
+
+    DeliveryResult runScenario(hal::SimClock &clock, FakeBroker &broker, const DeliveryScenario &scenario,
+                               unsigned long readings)
+    {
+        DataSender::Stats before = dataSender.stats();
+        uint32_t receivedBefore = receivedReadings;
+        broker.clearStats();
+        worstLoopUs = 0;
+
+        broker.config().ackDelayMs = scenario.ackDelayMs;
+        broker.config().connackDelayMs = scenario.connackDelayMs;
+        broker.config().dropEvery = scenario.dropEvery;
+        configManager.updateConfig("reading_interval", 1000);
+        while (dataSender.stats().queued - before.queued < readings)
+            step(clock);
+
+        // Heal the broker, stop new readings and let the backlog drain
+        broker.config().dropEvery = 0;
+        configManager.updateConfig("reading_interval", NO_READINGS_INTERVAL);
+        uint32_t settleStart = clock.millis();
+        DeliveryResult result = {};
+        while (clock.millis() - settleStart < SETTLE_LIMIT_MS)
+        {
+            step(clock);
+            const DataSender::Stats &s = dataSender.stats();
+            if (dataSender.backlogPending() == 0 && s.delivered - before.delivered >= s.queued - before.queued)
+            {
+                result.settled = true;
+                break;
+            }
+        }
+
+        const DataSender::Stats &after = dataSender.stats();
+        result.queued = after.queued - before.queued;
+        result.delivered = after.delivered - before.delivered;
+        result.requeued = after.requeued - before.requeued;
+        result.received = receivedReadings - receivedBefore;
+        result.drops = broker.stats().dropped;
+        result.connects = broker.stats().connects;
+        result.maxUnacked = broker.stats().maxUnacked;
+        result.worstLoopUs = worstLoopUs;
+        result.settleS = (clock.millis() - settleStart) / 1000.0;
+        return result;
+    }
+
+} // namespace
+
+int benchDelivery(const SimOptions &options)
+{
+    static hal::SimClock clock;
+    static FakeBroker broker;
+    hal::setClock(&clock);
+    hal::setNetwork(&broker);
+    broker.setObserver(countReadings);
+
+    SimOptions busOptions = options;
+    if (busOptions.pzemSlaves < 3)
+        busOptions.pzemSlaves = 3;
+    static PzemEmulator pzem(busOptions.pzemConfig);
+    configurePzemBus(pzem, busOptions);
+#ifdef PZEM_HW_UART
+    hal::attachSerial(D7, &pzem);
+#else
+    hal::attachSerial(D5, &pzem);
+#endif
+
+    setup();
+    configManager.updateConfig("pzem_addresses", pzemAddresses(busOptions));
+    configManager.updateConfig("report_by_exception", 0);
+    configManager.updateConfig("sample_interval", 200);
+    configManager.updateConfig("payload_format", "binary");
+    configManager.updateConfig("batch_size", 8);
+
+    static const DeliveryScenario scenarios[] = {
+        {"clean", 20, 0, 0},
+        {"slow acks", 5000, 0, 0},
+        {"cut every 5", 100, 0, 5},
+        {"cut every 2", 100, 0, 2},
+        {"slow connack", 100, 3000, 5},
+    };
+    const size_t count = sizeof(scenarios) / sizeof(scenarios[0]);
+    DeliveryResult results[count];
+    for (size_t i = 0; i < count; i++)
+        results[i] = runScenario(clock, broker, scenarios[i], options.samples);
+
+    // Firmware logs go to stdout as well; the report comes last
+    printf("\ndelivery: %lu readings per scenario, %u slaves, QoS 1\n", options.samples, busOptions.pzemSlaves);
+    printf("  scenario       ack ms  cuts  connects  queued  delivered  received  requeued  max unacked  settle s  worst loop ms\n");
+    bool ok = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        const DeliveryScenario &scenario = scenarios[i];
+        const DeliveryResult &r = results[i];
+        bool lossless = r.settled && r.delivered >= r.queued && r.received >= r.queued;
+        ok = ok && lossless;
+        printf("  %-13s %7u %5u %9u %7u %10u %9u %9u %12u %9.1f %14.1f%s\n",
+               scenario.name, scenario.ackDelayMs, r.drops, r.connects, r.queued, r.delivered, r.received,
+               r.requeued, r.maxUnacked, r.settleS, r.worstLoopUs / 1000.0, lossless ? "" : "  LOST READINGS");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,135 @@
+// Publish benchmark: the whole firmware (setup() / loop()) against the
+// PZEM emulator and the in-process FakeBroker on a virtual clock, sampling
+// every 200 ms and publishing every second. For each payload format, with
+// batch_size 1 and 8, it warms up (connect, first publishes, lazily
+// created buffers, resending whatever went to flash before the broker was
+// up), then counts the heap allocations made by loop() over the next
+// `samples` messages. The flash resend itself is left out: opening a
+// LittleFS file allocates on the device too.
+// A long-running device must not allocate in that steady state, so the
+// exit code is 1 if any allocation was seen.
+
+#include <Arduino.h>
+#include "Bench.h"
+#include "ConfigManager.h"
+#include "DataSender.h"
+#include "FakeBroker.h"
+
+#define LOOP_PERIOD_US 1000
+#define WARMUP_PUBLISHES 3
+
+extern ConfigManager configManager;
+extern DataSender dataSender;
+void setup();
+void loop();
+
+namespace
+{
+
+    struct PublishScenario
+    {
+        const char *name;
+        const char *format;
+        int batchSize;
+    };
+
+    struct PublishResult
+    {
+        unsigned long loops;
+        uint32_t messages;
+        uint64_t payloadBytes;
+        uint64_t allocations;
+    };
+
+    // Runs loop() until the broker has seen `publishes` more messages
+    void runUntil(hal::SimClock &clock, const FakeBroker &broker, uint32_t publishes, unsigned long &loops)
+    {
+        uint32_t target = broker.stats().publishes + publishes;
+        while (broker.stats().publishes < target)
+        {
+            uint32_t start = clock.micros();
+            loop();
+            uint32_t us = clock.micros() - start;
+            clock.advance(us < LOOP_PERIOD_US ? LOOP_PERIOD_US - us : 0);
+            loops++;
+        }
+    }
+
+    PublishResult runScenario(hal::SimClock &clock, const FakeBroker &broker,
+                              const PublishScenario &scenario, unsigned long messages)
+    {
+        configManager.updateConfig("payload_format", scenario.format);
+        configManager.updateConfig("batch_size", scenario.batchSize);
+        unsigned long loops = 0;
+        runUntil(clock, broker, WARMUP_PUBLISHES, loops);
+        while (dataSender.backlogPending() > 0)
+        {
+            runUntil(clock, broker, 1, loops);
+        }
+
+        PublishResult result = {};
+        uint32_t messagesBefore = broker.stats().publishes;
+        uint64_t bytesBefore = broker.stats().payloadBytes;
+        uint64_t allocationsBefore = hal::allocations();
+        unsigned long loopsBefore = loops;
+        runUntil(clock, broker, messages, loops);
+        result.allocations = hal::allocations() - allocationsBefore;
+        result.loops = loops - loopsBefore;
+        result.messages = broker.stats().publishes - messagesBefore;
+        result.payloadBytes = broker.stats().payloadBytes - bytesBefore;
+        return result;
+    }
+
+} // namespace
+
+int benchPublish(const SimOptions &options)
+{
+    static hal::SimClock clock;
+    static FakeBroker broker;
+    hal::setClock(&clock);
+    hal::setNetwork(&broker);
+
+    static PzemEmulator pzem(options.pzemConfig);
+    configurePzemBus(pzem, options);
+#ifdef PZEM_HW_UART
+    hal::attachSerial(D7, &pzem);
+#else
+    hal::attachSerial(D5, &pzem);
+#endif
+
+    setup();
+    configManager.updateConfig("pzem_addresses", pzemAddresses(options));
+    configManager.updateConfig("report_by_exception", 0);
+    configManager.updateConfig("sample_interval", 200);
+    configManager.updateConfig("reading_interval", 1000);
+
+    static const PublishScenario scenarios[] = {
+        {"json", "json", 1},
+        {"json batched", "json", 8},
+        {"binary", "binary", 1},
+        {"binary batched", "binary", 8},
+    };
+    PublishResult results[sizeof(scenarios) / sizeof(scenarios[0])];
+    uint64_t total = 0;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        results[i] = runScenario(clock, broker, scenarios[i], options.samples);
+        total += results[i].allocations;
+    }
+
+    // Firmware logs go to stdout as well; the report comes last
+    printf("\npublish: %lu messages per format after %u warm-up publishes, %u slave(s)\n",
+           options.samples, WARMUP_PUBLISHES, options.pzemSlaves);
+    printf("  format            loops  messages  bytes/msg  allocations  allocs/msg\n");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+    {
+        const PublishResult &r = results[i];
+        printf("  %-15s %7lu  %8u  %9.1f  %11llu  %10.2f\n",
+               scenarios[i].name, r.loops, r.messages,
+               r.messages ? (double)r.payloadBytes / r.messages : 0.0,
+               (unsigned long long)r.allocations,
+               r.messages ? (double)r.allocations / r.messages : 0.0);
+    }
+    printf("  steady state: %s\n", total == 0 ? "no heap allocations" : "ALLOCATES");
+    return total == 0 ? 0 : 1;
+}
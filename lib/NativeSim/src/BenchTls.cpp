@@ -0,0 +1,214 @@
+// TLS benchmark: MqttClient over BearSSL::WiFiClientSecure, set up as
+// DataSender does for mqtt_tls, connecting `samples` times per scenario to
+// the in-process FakeBroker listening for TLS with dashboard/cert.pem.
+// Scenarios cross the default buffers with the reduced ones negotiated by
+// max fragment length, fingerprint with public-key pinning, and full
+// handshakes with resumed sessions. For each it reports the median time
+// from connect() to the CONNACK (host time: both handshakes run in this
+// process) and the heap high-water mark above idle, which counts the
+// BearSSL I/O buffers; BearSSL's context (about 4 KB) and its stack come
+// on top on the device.
+// Every connection must succeed and resumed scenarios must really resume,
+// while a wrong fingerprint must be refused; the exit code is 1 otherwise.
+
+#include <Arduino.h>
+#include <WiFiClientSecureBearSSL.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include "Bench.h"
+#include "FakeBroker.h"
+#include "MqttClient.h"
+
+#define CERT_FILE "dashboard/cert.pem"
+#define KEY_FILE "dashboard/key.pem"
+#define BROKER_PORT 8883
+#define TLS_FRAGMENT 512  // as DataSender
+#define TLS_RX_BUFFER 1024
+#define TLS_TX_BUFFER 512
+#define TLS_TIMEOUT 5000
+
+namespace
+{
+
+    enum Pin
+    {
+        PIN_FINGERPRINT,
+        PIN_PUBLIC_KEY,
+        PIN_WRONG_FINGERPRINT
+    };
+
+    struct TlsScenario
+    {
+        const char *name;
+        bool smallBuffers;
+        Pin pin;
+        bool resume;
+    };
+
+    struct TlsResult
+    {
+        uint32_t connected;
+        uint32_t resumed;
+        double medianMs;
+        size_t heapPeak;
+    };
+
+    // SHA-1 fingerprint (hex) and public key (PEM) of the broker certificate,
+    // as the user would take them with the openssl command line
+    bool certificatePins(String &fingerprint, String &publicKey)
+    {
+        hal::UncountedAllocations uncounted;
+        FILE *file = fopen(CERT_FILE, "r");
+        if (!file)
+            return false;
+        X509 *cert = PEM_read_X509(file, nullptr, nullptr, nullptr);
+        fclose(file);
+        if (!cert)
+            return false;
+
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int length = 0;
+        X509_digest(cert, EVP_sha1(), digest, &length);
+        char hex[3];
+        for (unsigned int i = 0; i < length; i++)
+        {
+            snprintf(hex, sizeof(hex), "%02x", digest[i]);
+            fingerprint += hex;
+        }
+
+        BIO *bio = BIO_new(BIO_s_mem());
+        PEM_write_bio_PUBKEY(bio, X509_get0_pubkey(cert));
+        char *pem = nullptr;
+        long pemLength = BIO_get_mem_data(bio, &pem);
+        publicKey = String(pem).substring(0, pemLength);
+        BIO_free(bio);
+        X509_free(cert);
+        return true;
+    }
+
+    TlsResult runScenario(FakeBroker &broker, const TlsScenario &scenario, const String &fingerprint,
+                          const BearSSL::PublicKey &publicKey, unsigned long samples)
+    {
+        BearSSL::WiFiClientSecure secure;
+        BearSSL::Session session;
+        MqttClient client(secure);
+        client.setTransport(secure, TLS_TIMEOUT);
+        client.setServer("127.0.0.1", BROKER_PORT);
+        switch (scenario.pin)
+        {
+        case PIN_FINGERPRINT:
+            secure.setFingerprint(fingerprint.c_str());
+            break;
+        case PIN_PUBLIC_KEY:
+            secure.setKnownKey(&publicKey);
+            break;
+        case PIN_WRONG_FINGERPRINT:
+        {
+            String wrong = String(fingerprint[0] == '0' ? "1" : "0") + fingerprint.substring(1);
+            secure.setFingerprint(wrong.c_str());
+            break;
+        }
+        }
+        if (scenario.smallBuffers && BearSSL::WiFiClientSecure::probeMaxFragmentLength("127.0.0.1", BROKER_PORT, TLS_FRAGMENT))
+            secure.setBufferSizes(TLS_RX_BUFFER, TLS_TX_BUFFER);
+        if (scenario.resume)
+        {
+            // The first, full handshake opens the session the others resume
+            secure.setSession(&session);
+            client.connect("bench-tls", "", "");
+            while (client.connecting())
+                client.loop();
+            client.disconnect();
+        }
+
+        TlsResult result = {};
+        std::vector<double> times;
+        broker.clearStats();
+        for (unsigned long i = 0; i < samples; i++)
+        {
+            size_t idle = hal::heapInUse();
+            hal::resetHeapPeak();
+            auto start = std::chrono::steady_clock::now();
+            if (client.connect("bench-tls", "", ""))
+            {
+                while (client.connecting())
+                    client.loop();
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            size_t peak = hal::heapPeak() - idle;
+            if (client.connected())
+            {
+                result.connected++;
+                times.push_back(elapsed.count());
+            }
+            result.heapPeak = std::max(result.heapPeak, peak);
+            client.disconnect();
+        }
+        result.resumed = broker.stats().tlsResumed;
+        if (!times.empty())
+        {
+            std::sort(times.begin(), times.end());
+            result.medianMs = times[times.size() / 2];
+        }
+        return result;
+    }
+
+} // namespace
+
+int benchTls(const SimOptions &options)
+{
+    static FakeBroker broker;
+    if (!broker.setTls(CERT_FILE, KEY_FILE))
+    {
+        fprintf(stderr, "cannot load %s / %s (run from the repository root)\n", CERT_FILE, KEY_FILE);
+        return 2;
+    }
+    hal::setNetwork(&broker);
+    String fingerprint;
+    String publicKeyPem;
+    if (!certificatePins(fingerprint, publicKeyPem))
+    {
+        fprintf(stderr, "cannot read %s\n", CERT_FILE);
+        return 2;
+    }
+    BearSSL::PublicKey publicKey;
+    if (!publicKey.parse(publicKeyPem.c_str()))
+    {
+        fprintf(stderr, "cannot parse the public key of %s\n", CERT_FILE);
+        return 2;
+    }
+
+    static const TlsScenario scenarios[] = {
+        {"default buf, sha1, full", false, PIN_FINGERPRINT, false},
+        {"default buf, sha1, resumed", false, PIN_FINGERPRINT, true},
+        {"1 KB buf, sha1, full", true, PIN_FINGERPRINT, false},
+        {"1 KB buf, sha1, resumed", true, PIN_FINGERPRINT, true},
+        {"1 KB buf, pubkey, full", true, PIN_PUBLIC_KEY, false},
+        {"1 KB buf, pubkey, resumed", true, PIN_PUBLIC_KEY, true},
+        {"wrong sha1", true, PIN_WRONG_FINGERPRINT, false},
+    };
+    const size_t count = sizeof(scenarios) / sizeof(scenarios[0]);
+    TlsResult results[count];
+    for (size_t i = 0; i < count; i++)
+        results[i] = runScenario(broker, scenarios[i], fingerprint, publicKey, options.samples);
+
+    printf("\ntls: %lu connections per scenario, %s\n", options.samples, CERT_FILE);
+    printf("  scenario                    connected  resumed  median ms  heap peak B\n");
+    bool ok = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        const TlsScenario &scenario = scenarios[i];
+        const TlsResult &r = results[i];
+        bool expected = scenario.pin == PIN_WRONG_FINGERPRINT
+                            ? r.connected == 0
+                            : r.connected == options.samples && r.resumed == (scenario.resume ? options.samples : 0);
+        ok = ok && expected;
+        printf("  %-27s %9u %8u %10.2f %12zu%s\n", scenario.name, r.connected, r.resumed, r.medianMs, r.heapPeak,
+               expected ? "" : "  UNEXPECTED");
+    }
+    return ok ? 0 : 1;
+}
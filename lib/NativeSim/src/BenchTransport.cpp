@@ -0,0 +1,110 @@
+// Transport benchmark: the acquisition loop over SoftwareSerial and over
+// the swapped hardware UART0, under increasing simulated network load
+// (hal::irq() masked-interrupt windows). For each run it reports the
+// frame error rate and the CPU time the transport costs per Modbus
+// exchange: time inside Meter::loop() (SoftwareSerial TX is bit-banged
+// with interrupts off) plus the time spent in serial ISRs. Per exchange
+// rather than per cycle, because slaves that keep failing get parked.
+
+#include <Arduino.h>
+#include "Bench.h"
+#include "Meter.h"
+
+#define BENCH_RX_PIN 100
+#define BENCH_TX_PIN 101
+#define UART0_SWAPPED_RX_PIN 13
+#define LOOP_PERIOD_US 1000
+
+namespace
+{
+
+    struct TransportResult
+    {
+        unsigned long cycles;
+        Meter::BusStats bus;
+        double loopUs;
+        double isrUs;
+        double elapsedUs;
+    };
+
+    TransportResult runTransport(bool hardware, float irqRate, const SimOptions &options)
+    {
+        hal::SimClock clock;
+        hal::setClock(&clock);
+        hal::IrqModel &irq = hal::irq();
+        irq.maskRate = irqRate;
+        irq.maskUs = options.irqMaskUs;
+        irq.seed = options.pzemConfig.seed;
+        irq.isrNs = 0;
+
+        // Both transports see the same bus: same seed, same load profile
+        PzemEmulator pzem(options.pzemConfig);
+        configurePzemBus(pzem, options);
+        int rxPin = hardware ? UART0_SWAPPED_RX_PIN : BENCH_RX_PIN;
+        hal::attachSerial(rxPin, &pzem);
+
+        HardwareSerial uart(0);
+        Meter *meter = hardware ? new Meter(uart) : new Meter(BENCH_RX_PIN, BENCH_TX_PIN);
+        meter->begin();
+        meter->setPollInterval(Meter::MIN_POLL_INTERVAL);
+        meter->setAddresses(pzemAddresses(options));
+
+        TransportResult result = {};
+        uint32_t startedAt = clock.micros();
+        while (result.cycles < options.samples)
+        {
+            uint32_t start = clock.micros();
+            meter->loop();
+            uint32_t us = clock.micros() - start;
+            result.loopUs += us;
+            if (meter->readingsReady())
+                result.cycles++;
+            clock.advance(us < LOOP_PERIOD_US ? LOOP_PERIOD_US - us : 0);
+        }
+        result.elapsedUs = clock.micros() - startedAt;
+        result.isrUs = irq.isrNs / 1000.0;
+        result.bus = meter->busStats();
+
+        delete meter;
+        hal::attachSerial(rxPin, nullptr);
+        hal::setClock(nullptr);
+        irq.maskRate = 0;
+        return result;
+    }
+
+    void report(const char *name, float irqRate, const TransportResult &r)
+    {
+        unsigned long exchanges = r.bus.frames + r.bus.timeouts + r.bus.badFrames;
+        printf("  %6.0f  %-15s %7.2f%%  %6lu  %6lu  %9.1f  %9.1f  %6.2f%%\n",
+               irqRate, name,
+               exchanges ? 100.0 * (r.bus.badFrames + r.bus.timeouts) / exchanges : 0.0,
+               r.bus.badFrames, r.bus.timeouts,
+               exchanges ? r.loopUs / exchanges : 0.0,
+               exchanges ? r.isrUs / exchanges : 0.0,
+               r.elapsedUs > 0 ? 100.0 * (r.loopUs + r.isrUs) / r.elapsedUs : 0.0);
+    }
+
+} // namespace
+
+int benchTransport(const SimOptions &options)
+{
+    // Idle, periodic MQTT, web page + MQTT, heavy traffic
+    static const float sweep[] = {0, 2, 10, 50};
+    const float *rates = sweep;
+    size_t rateCount = sizeof(sweep) / sizeof(sweep[0]);
+    if (options.irqRate >= 0)
+    {
+        rates = &options.irqRate;
+        rateCount = 1;
+    }
+
+    printf("transport: %lu cycles per run, %u us masked windows\n",
+           options.samples, (unsigned)options.irqMaskUs);
+    printf("  load/s  transport       frame err     bad timeout  loop us/ex   isr us/ex     cpu\n");
+    for (size_t i = 0; i < rateCount; i++)
+    {
+        report("SoftwareSerial", rates[i], runTransport(false, rates[i], options));
+        report("UART0 (swap)", rates[i], runTransport(true, rates[i], options));
+    }
+    return 0;
+}
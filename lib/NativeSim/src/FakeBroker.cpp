@@ -0,0 +1,295 @@
+#include "FakeBroker.h"
+
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <openssl/ssl.h>
+
+// One client connection: bytes written by the device are parsed into MQTT
+// packets, the replies wait in _out until the device reads them. With TLS
+// the bytes go through an OpenSSL server on memory BIOs first.
+class FakeBroker::Session : public hal::Socket
+{
+public:
+    explicit Session(FakeBroker &broker)
+        : _broker(broker), _open(true), _connackPending(false), _connackDue(0), _tls(nullptr)
+    {
+        if (_broker._tlsContext)
+        {
+            _tls = SSL_new(_broker._tlsContext);
+            SSL_set_bio(_tls, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+            SSL_set_accept_state(_tls);
+        }
+        _broker._sessions.push_back(this);
+    }
+
+    ~Session() override
+    {
+        hal::UncountedAllocations uncounted;
+        // As Mosquitto does, also for a dropped connection: OpenSSL forgets
+        // the session of an SSL freed without it
+        if (_tls && SSL_is_init_finished(_tls))
+            SSL_shutdown(_tls);
+        SSL_free(_tls);
+        std::vector<Session *> &sessions = _broker._sessions;
+        sessions.erase(std::remove(sessions.begin(), sessions.end(), this), sessions.end());
+    }
+
+    bool connected() override { return _open; }
+
+    int available() override
+    {
+        hal::UncountedAllocations uncounted;
+        releaseAcks();
+        return (int)_out.size();
+    }
+
+    int read(uint8_t *buf, size_t len) override
+    {
+        hal::UncountedAllocations uncounted;
+        releaseAcks();
+        if (_out.empty())
+            return -1;
+        size_t n = len < _out.size() ? len : _out.size();
+        memcpy(buf, _out.data(), n);
+        _out.erase(_out.begin(), _out.begin() + n);
+        return (int)n;
+    }
+
+    size_t write(const uint8_t *data, size_t len) override
+    {
+        hal::UncountedAllocations uncounted;
+        if (!_open)
+            return 0;
+        if (_tls)
+            decrypt(data, len);
+        else
+            _in.insert(_in.end(), data, data + len);
+        while (_open && parsePacket())
+        {
+        }
+        return len;
+    }
+
+    void close() override { _open = false; }
+
+    void reply(const std::vector<uint8_t> &packet)
+    {
+        if (!_tls)
+        {
+            _out.insert(_out.end(), packet.begin(), packet.end());
+            return;
+        }
+        SSL_write(_tls, packet.data(), (int)packet.size());
+        sendTls();
+    }
+
+    bool ready() const { return _open && !_connackPending && (!_tls || SSL_is_init_finished(_tls)); }
+
+private:
+    // Runs the handshake, then moves the decrypted bytes to _in
+    void decrypt(const uint8_t *data, size_t len)
+    {
+        BIO_write(SSL_get_rbio(_tls), data, (int)len);
+        if (!SSL_is_init_finished(_tls))
+        {
+            int result = SSL_do_handshake(_tls);
+            sendTls();
+            if (result != 1)
+            {
+                if (SSL_get_error(_tls, result) != SSL_ERROR_WANT_READ)
+                    _open = false;
+                return;
+            }
+            _broker._stats.tlsHandshakes++;
+            if (SSL_session_reused(_tls))
+                _broker._stats.tlsResumed++;
+        }
+        uint8_t chunk[512];
+        int n;
+        while ((n = SSL_read(_tls, chunk, sizeof(chunk))) > 0)
+            _in.insert(_in.end(), chunk, chunk + n);
+        sendTls();
+    }
+
+    void sendTls()
+    {
+        BIO *out = SSL_get_wbio(_tls);
+        uint8_t chunk[512];
+        int n;
+        while (BIO_ctrl_pending(out) > 0 && (n = BIO_read(out, chunk, sizeof(chunk))) > 0)
+            _out.insert(_out.end(), chunk, chunk + n);
+    }
+
+    // Handles the first complete packet in _in; false if there is none yet
+    bool parsePacket()
+    {
+        if (_in.size() < 2)
+            return false;
+        size_t length = 0;
+        size_t pos = 1;
+        for (int shift = 0; pos < _in.size() && shift <= 21; shift += 7)
+        {
+            uint8_t digit = _in[pos++];
+            length |= (size_t)(digit & 0x7F) << shift;
+            if (!(digit & 0x80))
+            {
+                if (_in.size() < pos + length)
+                    return false;
+                handle(_in[0], &_in[pos], length);
+                _in.erase(_in.begin(), _in.begin() + pos + length);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void handle(uint8_t header, const uint8_t *body, size_t length)
+    {
+        switch (header >> 4)
+        {
+        case 1: // CONNECT
+            _broker._stats.connects++;
+            _connackPending = true;
+            _connackDue = hal::clock().millis() + _broker._config.connackDelayMs;
+            releaseAcks();
+            break;
+        case 3: // PUBLISH
+        {
+            const FakeBroker::Config &config = _broker._config;
+            if (config.dropEvery && ++_broker._received % config.dropEvery == 0)
+            {
+                _broker._stats.dropped++;
+                _open = false;
+                break;
+            }
+            uint8_t qos = (header >> 1) & 0x03;
+            size_t topicLength = (size_t)body[0] << 8 | body[1];
+            size_t headerLength = 2 + topicLength + (qos ? 2 : 0);
+            _broker._stats.publishes++;
+            _broker._stats.payloadBytes += length - headerLength;
+            if (_broker._observer)
+            {
+                std::string topic((const char *)body + 2, topicLength);
+                _broker._observer(topic.c_str(), body + headerLength, length - headerLength);
+            }
+            if (qos == 1)
+            {
+                _acks.push_back({hal::clock().millis() + config.ackDelayMs, body[2 + topicLength], body[3 + topicLength]});
+                if (_acks.size() > _broker._stats.maxUnacked)
+                    _broker._stats.maxUnacked = _acks.size();
+                releaseAcks();
+            }
+            break;
+        }
+        case 8: // SUBSCRIBE: grant QoS 0 to every filter
+        {
+            std::vector<uint8_t> suback = {0x90, 0x02, body[0], body[1]};
+            for (size_t pos = 2; pos + 2 < length;)
+            {
+                pos += 2 + ((size_t)body[pos] << 8 | body[pos + 1]) + 1;
+                suback.push_back(0x00);
+                suback[1]++;
+            }
+            reply(suback);
+            break;
+        }
+        case 12: // PINGREQ
+            reply({0xD0, 0x00});
+            break;
+        case 14: // DISCONNECT
+            _open = false;
+            break;
+        }
+    }
+
+    // Sends the CONNACK and PUBACKs that are due, in order
+    void releaseAcks()
+    {
+        uint32_t now = hal::clock().millis();
+        if (_connackPending)
+        {
+            if ((int32_t)(now - _connackDue) < 0)
+                return;
+            reply({0x20, 0x02, 0x00, 0x00});
+            _connackPending = false;
+        }
+        while (_open && !_acks.empty() && (int32_t)(now - _acks.front().due) >= 0)
+        {
+            reply({0x40, 0x02, _acks.front().idHigh, _acks.front().idLow});
+            _acks.pop_front();
+        }
+    }
+
+    struct PendingAck
+    {
+        uint32_t due;
+        uint8_t idHigh;
+        uint8_t idLow;
+    };
+
+    FakeBroker &_broker;
+    bool _open;
+    bool _connackPending;
+    uint32_t _connackDue;
+    std::vector<uint8_t> _in;
+    std::vector<uint8_t> _out;
+    std::deque<PendingAck> _acks;
+    SSL *_tls;
+};
+
+FakeBroker::~FakeBroker()
+{
+    SSL_CTX_free(_tlsContext);
+}
+
+bool FakeBroker::setTls(const char *certFile, const char *keyFile)
+{
+    hal::UncountedAllocations uncounted;
+    SSL_CTX_free(_tlsContext);
+    _tlsContext = SSL_CTX_new(TLS_server_method());
+    static const unsigned char context[] = "FakeBroker";
+    // Session IDs only: BearSSL does not take tickets
+    SSL_CTX_set_options(_tlsContext, SSL_OP_NO_TICKET);
+    SSL_CTX_set_session_id_context(_tlsContext, context, sizeof(context) - 1);
+    if (SSL_CTX_use_certificate_chain_file(_tlsContext, certFile) != 1 ||
+        SSL_CTX_use_PrivateKey_file(_tlsContext, keyFile, SSL_FILETYPE_PEM) != 1)
+    {
+        SSL_CTX_free(_tlsContext);
+        _tlsContext = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void FakeBroker::publish(const char *topic, const uint8_t *payload, size_t length)
+{
+    hal::UncountedAllocations uncounted;
+    size_t topicLength = strlen(topic);
+    size_t remaining = 2 + topicLength + length;
+    std::vector<uint8_t> packet = {0x30};
+    do
+    {
+        uint8_t digit = remaining & 0x7F;
+        remaining >>= 7;
+        packet.push_back(remaining ? digit | 0x80 : digit);
+    } while (remaining);
+    packet.push_back((uint8_t)(topicLength >> 8));
+    packet.push_back((uint8_t)topicLength);
+    packet.insert(packet.end(), topic, topic + topicLength);
+    packet.insert(packet.end(), payload, payload + length);
+    for (Session *session : _sessions)
+    {
+        if (session->ready())
+            session->reply(packet);
+    }
+}
+
+hal::Socket *FakeBroker::connect(const char *host, uint16_t port)
+{
+    hal::UncountedAllocations uncounted;
+    (void)host;
+    (void)port;
+    return new Session(*this);
+}
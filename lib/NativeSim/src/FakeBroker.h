@@ -0,0 +1,73 @@
+#ifndef FAKEBROKER_H
+#define FAKEBROKER_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "Hal.h"
+
+// In-process MQTT 3.1.1 broker for host runs and benchmarks. Installed
+// with hal::setNetwork(), every connect() reaches it regardless of host
+// and port. It accepts CONNECT, SUBSCRIBE, PINGREQ and PUBLISH (QoS 0 and
+// 1) and counts what the device published. publish() sends a message the
+// other way, to every connected device, as for control commands.
+//
+// With setTls() it listens for TLS only, as on port 8883, with the given
+// certificate and key, and resumes sessions by session ID.
+//
+// For delivery tests CONNACK and PUBACKs can be delayed (on the hal clock)
+// and the connection can be cut on every Nth PUBLISH, which is then
+// neither delivered nor acknowledged, as when a link drops mid-transfer.
+class FakeBroker : public hal::Network
+{
+public:
+    struct Config
+    {
+        uint32_t ackDelayMs = 0;
+        uint32_t connackDelayMs = 0;
+        uint32_t dropEvery = 0; // 0 = never
+    };
+
+    struct Stats
+    {
+        uint32_t connects = 0;
+        uint32_t publishes = 0; // delivered
+        uint64_t payloadBytes = 0;
+        uint32_t dropped = 0;   // connections cut
+        uint32_t maxUnacked = 0; // most QoS 1 messages waiting for their PUBACK at once
+        uint32_t tlsHandshakes = 0;
+        uint32_t tlsResumed = 0;
+    };
+
+    // Called with every delivered PUBLISH
+    typedef std::function<void(const char *topic, const uint8_t *payload, size_t length)> Observer;
+
+    FakeBroker() {}
+    ~FakeBroker() override;
+    FakeBroker(const FakeBroker &) = delete;
+    FakeBroker &operator=(const FakeBroker &) = delete;
+
+    hal::Socket *connect(const char *host, uint16_t port) override;
+    bool linkUp() override { return true; }
+
+    // PEM files; false if they cannot be loaded
+    bool setTls(const char *certFile, const char *keyFile);
+    Config &config() { return _config; }
+    void setObserver(Observer observer) { _observer = observer; }
+    const Stats &stats() const { return _stats; }
+    // QoS 0, whatever the device subscribed to
+    void publish(const char *topic, const uint8_t *payload, size_t length);
+    void clearStats() { _stats = Stats(); }
+
+private:
+    class Session;
+
+    Config _config;
+    Observer _observer;
+    Stats _stats;
+    std::vector<Session *> _sessions;
+    uint32_t _received = 0; // PUBLISH packets, for dropEvery
+    struct ssl_ctx_st *_tlsContext = nullptr;
+};
+
+#endif // FAKEBROKER_H
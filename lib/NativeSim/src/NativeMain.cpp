@@ -0,0 +1,213 @@
+// Entry point for `pio run -e native`: runs the firmware's setup()/loop()
+// on the host and reports loop() latency on exit, or runs a benchmark.
+//
+//   program [--loops=N] [--sim-clock] [--offline] [--fs-root=DIR]
+//           [--pzem[=PROFILE]] [--pzem-latency=MS] [--pzem-jitter=MS]
+//           [--pzem-drop=P] [--pzem-crc=P] [--pzem-noise=X] [--pzem-seed=N]
+//           [--pzem-slaves=N] [--pzem-dead=K] [--irq-rate=R] [--irq-mask=US]
+//           [--bench=NAME] [--samples=N]
+//
+// --sim-clock swaps in hal::SimClock (1 ms per idle loop pass) so runs
+// are reproducible and independent of host load. --offline keeps WiFi
+// associated but makes every TCP connect fail, as during a broker outage.
+// --pzem attaches the PZEM-004T emulator to the meter's rx pin (D5);
+// PROFILE is constant, sine, steps or random. --pzem-slaves puts N
+// devices at addresses 1..N on the bus (set pzem_addresses in config.json
+// to match); --pzem-dead makes slave K silent. In a PZEM_HW_UART build the
+// emulator sits on the swapped UART0 rx pin (D7) instead.
+// --irq-rate simulates network load: R windows per second in which the
+// device keeps interrupts masked for --irq-mask microseconds.
+//
+// Benchmarks: acquisition, transport, publish, codec, delivery, tls
+
+#include <Arduino.h>
+#include "Bench.h"
+#include "Hal.h"
+
+void setup();
+void loop();
+
+// Unit tests (test/test_*) bring their own main()
+#ifndef PIO_UNIT_TESTING
+
+static bool optionValue(const char *arg, const char *name, const char **value)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+        return false;
+    *value = arg + len + 1;
+    return true;
+}
+
+static bool parseOptions(int argc, char **argv, SimOptions &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value;
+        if (optionValue(arg, "--loops", &value))
+            options.loops = strtoul(value, nullptr, 10);
+        else if (optionValue(arg, "--samples", &value))
+            options.samples = strtoul(value, nullptr, 10);
+        else if (strcmp(arg, "--sim-clock") == 0)
+            options.simClock = true;
+        else if (strcmp(arg, "--offline") == 0)
+            options.offline = true;
+        else if (optionValue(arg, "--fs-root", &value))
+            hal::setFsRoot(value);
+        else if (optionValue(arg, "--bench", &value))
+            options.bench = value;
+        else if (strcmp(arg, "--pzem") == 0)
+            options.pzem = true;
+        else if (optionValue(arg, "--pzem", &value))
+        {
+            options.pzem = true;
+            if (!PzemEmulator::parseProfile(value, options.pzemConfig.profile))
+                return false;
+        }
+        else if (optionValue(arg, "--pzem-latency", &value))
+            options.pzemConfig.latencyMs = strtoul(value, nullptr, 10);
+        else if (optionValue(arg, "--pzem-jitter", &value))
+            options.pzemConfig.jitterMs = strtoul(value, nullptr, 10);
+        else if (optionValue(arg, "--pzem-drop", &value))
+            options.pzemConfig.dropRate = strtof(value, nullptr);
+        else if (optionValue(arg, "--pzem-crc", &value))
+            options.pzemConfig.crcErrorRate = strtof(value, nullptr);
+        else if (optionValue(arg, "--pzem-noise", &value))
+            options.pzemConfig.noise = strtof(value, nullptr);
+        else if (optionValue(arg, "--pzem-seed", &value))
+            options.pzemConfig.seed = strtoul(value, nullptr, 10);
+        else if (optionValue(arg, "--pzem-slaves", &value))
+            options.pzemSlaves = (uint8_t)strtoul(value, nullptr, 10);
+        else if (optionValue(arg, "--pzem-dead", &value))
+            options.pzemDead = (uint8_t)strtoul(value, nullptr, 10);
+        else if (optionValue(arg, "--irq-rate", &value))
+            options.irqRate = strtof(value, nullptr);
+        else if (optionValue(arg, "--irq-mask", &value))
+            options.irqMaskUs = strtoul(value, nullptr, 10);
+        else
+            return false;
+    }
+    return true;
+}
+
+#endif // PIO_UNIT_TESTING
+
+void configurePzemBus(PzemEmulator &pzem, const SimOptions &options)
+{
+    if (options.pzemSlaves > 1)
+    {
+        pzem.device(0).address = 1;
+        for (uint8_t i = 1; i < options.pzemSlaves; i++)
+        {
+            PzemEmulator::Config config = options.pzemConfig;
+            config.address = i + 1;
+            // Spread the phases so per-phase readings are distinguishable
+            config.baseCurrent *= 1.0f + 0.25f * i;
+            pzem.addDevice(config);
+        }
+    }
+    if (options.pzemDead >= 1 && options.pzemDead <= pzem.deviceCount())
+        pzem.setOnline(options.pzemDead - 1, false);
+}
+
+String pzemAddresses(const SimOptions &options)
+{
+    String list;
+    for (uint8_t i = 1; options.pzemSlaves > 1 && i <= options.pzemSlaves; i++)
+        list += String(i) + (i < options.pzemSlaves ? "," : "");
+    return list;
+}
+
+#ifndef PIO_UNIT_TESTING
+
+static int runBenchmark(const SimOptions &options)
+{
+    if (strcmp(options.bench, "acquisition") == 0)
+        return benchAcquisition(options);
+    if (strcmp(options.bench, "transport") == 0)
+        return benchTransport(options);
+    if (strcmp(options.bench, "publish") == 0)
+        return benchPublish(options);
+    if (strcmp(options.bench, "codec") == 0)
+        return benchCodec(options);
+    if (strcmp(options.bench, "delivery") == 0)
+        return benchDelivery(options);
+    if (strcmp(options.bench, "tls") == 0)
+        return benchTls(options);
+    fprintf(stderr, "unknown benchmark: %s\n", options.bench);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    SimOptions options;
+    static hal::SimClock simClock;
+    static hal::OfflineNetwork offlineNetwork;
+
+    if (!parseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: %s [--loops=N] [--sim-clock] [--offline] [--fs-root=DIR]\n"
+                        "       [--pzem[=constant|sine|steps|random]] [--pzem-latency=MS] [--pzem-jitter=MS]\n"
+                        "       [--pzem-drop=P] [--pzem-crc=P] [--pzem-noise=X] [--pzem-seed=N]\n"
+                        "       [--pzem-slaves=N] [--pzem-dead=K] [--irq-rate=R] [--irq-mask=US]\n"
+                        "       [--bench=acquisition|transport|publish|codec|delivery|tls] [--samples=N]\n",
+                argv[0]);
+        return 2;
+    }
+
+    if (options.simClock)
+        hal::setClock(&simClock);
+    if (options.offline)
+        hal::setNetwork(&offlineNetwork);
+    if (options.irqRate > 0)
+    {
+        hal::irq().maskRate = options.irqRate;
+        hal::irq().maskUs = options.irqMaskUs;
+    }
+
+    if (options.bench)
+        return runBenchmark(options);
+
+    static PzemEmulator pzem(options.pzemConfig);
+    if (options.pzem)
+    {
+        configurePzemBus(pzem, options);
+#ifdef PZEM_HW_UART
+        hal::attachSerial(D7, &pzem);
+#else
+        hal::attachSerial(D5, &pzem);
+#endif
+    }
+
+    setup();
+
+    // Measured on hal::clock(), so blocking delays count under --sim-clock too
+    unsigned long loops = 0;
+    double totalUs = 0;
+    uint32_t worstUs = 0;
+    while (options.loops == 0 || loops < options.loops)
+    {
+        uint32_t start = hal::clock().micros();
+        loop();
+        uint32_t us = hal::clock().micros() - start;
+        totalUs += us;
+        if (us > worstUs)
+            worstUs = us;
+        loops++;
+        if (options.simClock)
+            simClock.advance(1000);
+    }
+
+    fprintf(stderr, "loop(): %lu passes, mean %.1f us, worst %u us\n",
+            loops, loops ? totalUs / loops : 0.0, (unsigned)worstUs);
+    if (options.pzem)
+    {
+        const PzemEmulator::Stats &s = pzem.stats();
+        fprintf(stderr, "pzem: %u requests, %u replies, %u dropped, %u corrupted, %u bad requests\n",
+                s.requests, s.replies, s.dropped, s.corrupted, s.badRequests);
+    }
+    return 0;
+}
+
+#endif // PIO_UNIT_TESTING
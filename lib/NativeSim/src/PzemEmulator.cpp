@@ -0,0 +1,357 @@
+#include "PzemEmulator.h"
+
+#include <math.h>
+#include <string.h>
+
+#define FN_READ_HOLDING 0x03
+#define FN_READ_INPUT 0x04
+#define FN_WRITE_SINGLE 0x06
+#define FN_RESET_ENERGY 0x42
+#define GENERAL_ADDRESS 0xF8
+
+#define EXC_ILLEGAL_FUNCTION 0x01
+#define EXC_ILLEGAL_ADDRESS 0x02
+
+#define INPUT_REGISTER_COUNT 10
+#define DEFAULT_ALARM_THRESHOLD 23000 // 0.1 W units
+
+uint16_t PzemEmulator::crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+    }
+    return crc;
+}
+
+static void appendCrc(std::vector<uint8_t> &frame)
+{
+    uint16_t crc = PzemEmulator::crc16(frame.data(), frame.size());
+    frame.push_back(crc & 0xFF);
+    frame.push_back(crc >> 8);
+}
+
+static void appendU16(std::vector<uint8_t> &frame, uint16_t value)
+{
+    frame.push_back(value >> 8);
+    frame.push_back(value & 0xFF);
+}
+
+// 32-bit values are sent low word first, each word big-endian
+static void appendU32(std::vector<uint8_t> &frame, uint32_t value)
+{
+    appendU16(frame, (uint16_t)(value & 0xFFFF));
+    appendU16(frame, (uint16_t)(value >> 16));
+}
+
+PzemEmulator::PzemEmulator() : PzemEmulator(Config()) {}
+
+PzemEmulator::PzemEmulator(const Config &config)
+    : _lastRxUs(0), _replyPos(0), _replyStartUs(0), _replyByteUs(0),
+      _rng(config.seed ? config.seed : 1), _stats()
+{
+    addDevice(config);
+}
+
+size_t PzemEmulator::addDevice(const Config &config)
+{
+    Device dev;
+    dev.config = config;
+    dev.online = true;
+    dev.energyWh = config.energyWh;
+    dev.lastUpdateMs = hal::clock().millis();
+    dev.walk = 0.0;
+    dev.alarmThreshold = DEFAULT_ALARM_THRESHOLD;
+    _devices.push_back(dev);
+    return _devices.size() - 1;
+}
+
+bool PzemEmulator::parseProfile(const char *name, LoadProfile &profile)
+{
+    if (strcmp(name, "constant") == 0)
+        profile = LOAD_CONSTANT;
+    else if (strcmp(name, "sine") == 0)
+        profile = LOAD_SINE;
+    else if (strcmp(name, "steps") == 0)
+        profile = LOAD_STEPS;
+    else if (strcmp(name, "random") == 0)
+        profile = LOAD_RANDOM;
+    else
+        return false;
+    return true;
+}
+
+uint32_t PzemEmulator::byteTimeUs() const
+{
+    // 8N1: ten bit times per byte
+    uint32_t baud = _devices.empty() ? 9600 : _devices[0].config.baud;
+    return 10000000UL / baud;
+}
+
+float PzemEmulator::uniform()
+{
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return (float)(_rng & 0xFFFFFF) / (float)0x1000000;
+}
+
+int PzemEmulator::available()
+{
+    if (_replyPos >= _reply.size())
+        return 0;
+    int32_t elapsed = (int32_t)(hal::clock().micros() - _replyStartUs);
+    if (elapsed < 0)
+        return 0;
+    size_t sent = (size_t)elapsed / _replyByteUs;
+    if (sent > _reply.size())
+        sent = _reply.size();
+    return sent > _replyPos ? (int)(sent - _replyPos) : 0;
+}
+
+int PzemEmulator::peek()
+{
+    return available() > 0 ? _reply[_replyPos] : -1;
+}
+
+int PzemEmulator::read()
+{
+    return available() > 0 ? _reply[_replyPos++] : -1;
+}
+
+size_t PzemEmulator::expectedRequestLength(uint8_t function) const
+{
+    switch (function)
+    {
+    case FN_READ_HOLDING:
+    case FN_READ_INPUT:
+    case FN_WRITE_SINGLE:
+        return 8;
+    case FN_RESET_ENERGY:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+size_t PzemEmulator::write(const uint8_t *data, size_t len)
+{
+    hal::UncountedAllocations uncounted;
+    uint32_t now = hal::clock().micros();
+    // A gap longer than 3.5 characters starts a new frame
+    if (!_request.empty() && now - _lastRxUs > 4 * byteTimeUs())
+        _request.clear();
+    _lastRxUs = now;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        _request.push_back(data[i]);
+        if (_request.size() < 2)
+            continue;
+        size_t expected = expectedRequestLength(_request[1]);
+        if (expected == 0)
+        {
+            // Unknown function: wait for the line to go idle, like a real
+            // slave that cannot frame the request
+            if (_request.size() >= 8)
+            {
+                _stats.badRequests++;
+                _request.clear();
+            }
+            continue;
+        }
+        if (_request.size() == expected)
+        {
+            handleFrame(_request.data(), _request.size());
+            _request.clear();
+        }
+    }
+    return len;
+}
+
+PzemEmulator::Device *PzemEmulator::findDevice(uint8_t address)
+{
+    for (auto &dev : _devices)
+    {
+        if (!dev.online)
+            continue;
+        if (dev.config.address == address || address == GENERAL_ADDRESS)
+            return &dev;
+    }
+    return nullptr;
+}
+
+void PzemEmulator::handleFrame(const uint8_t *frame, size_t len)
+{
+    _stats.requests++;
+    uint16_t crc = crc16(frame, len - 2);
+    if (frame[len - 2] != (crc & 0xFF) || frame[len - 1] != (crc >> 8))
+    {
+        _stats.badRequests++;
+        return;
+    }
+
+    Device *dev = findDevice(frame[0]);
+    if (!dev)
+        return;
+
+    if (uniform() < dev->config.dropRate)
+    {
+        _stats.dropped++;
+        return;
+    }
+
+    uint8_t function = frame[1];
+    uint16_t reg = (uint16_t)(frame[2] << 8 | frame[3]);
+    uint16_t value = (uint16_t)(frame[4] << 8 | frame[5]);
+    std::vector<uint8_t> reply;
+    reply.push_back(dev->config.address);
+    reply.push_back(function);
+
+    switch (function)
+    {
+    case FN_READ_INPUT:
+    {
+        if (value == 0 || reg + value > INPUT_REGISTER_COUNT)
+        {
+            queueException(*dev, function, EXC_ILLEGAL_ADDRESS);
+            return;
+        }
+        Measurement m = measure(*dev);
+        std::vector<uint8_t> regs;
+        appendU16(regs, (uint16_t)lroundf(m.voltage * 10.0f));
+        appendU32(regs, (uint32_t)lroundf(m.current * 1000.0f));
+        appendU32(regs, (uint32_t)lroundf(m.power * 10.0f));
+        appendU32(regs, m.energyWh);
+        appendU16(regs, (uint16_t)lroundf(m.frequency * 10.0f));
+        appendU16(regs, (uint16_t)lroundf(m.pf * 100.0f));
+        appendU16(regs, m.alarm ? 0xFFFF : 0x0000);
+        reply.push_back((uint8_t)(value * 2));
+        reply.insert(reply.end(), regs.begin() + reg * 2, regs.begin() + (reg + value) * 2);
+        break;
+    }
+    case FN_READ_HOLDING:
+    {
+        // 0x0001 power alarm threshold, 0x0002 slave address
+        if (value == 0 || reg < 1 || reg + value > 3)
+        {
+            queueException(*dev, function, EXC_ILLEGAL_ADDRESS);
+            return;
+        }
+        reply.push_back((uint8_t)(value * 2));
+        for (uint16_t r = reg; r < reg + value; r++)
+            appendU16(reply, r == 1 ? dev->alarmThreshold : dev->config.address);
+        break;
+    }
+    case FN_WRITE_SINGLE:
+    {
+        if (reg == 1)
+            dev->alarmThreshold = value;
+        else if (reg == 2 && value >= 1 && value <= 0xF7)
+            dev->config.address = (uint8_t)value;
+        else
+        {
+            queueException(*dev, function, EXC_ILLEGAL_ADDRESS);
+            return;
+        }
+        // Echo of the request
+        reply.assign(frame, frame + 6);
+        break;
+    }
+    case FN_RESET_ENERGY:
+        dev->energyWh = 0;
+        break;
+    default:
+        queueException(*dev, function, EXC_ILLEGAL_FUNCTION);
+        return;
+    }
+
+    appendCrc(reply);
+    queueReply(*dev, reply);
+}
+
+void PzemEmulator::queueException(Device &dev, uint8_t function, uint8_t code)
+{
+    std::vector<uint8_t> reply;
+    reply.push_back(dev.config.address);
+    reply.push_back(function | 0x80);
+    reply.push_back(code);
+    appendCrc(reply);
+    queueReply(dev, reply);
+}
+
+void PzemEmulator::queueReply(Device &dev, std::vector<uint8_t> reply)
+{
+    if (uniform() < dev.config.crcErrorRate)
+    {
+        reply[reply.size() / 2] ^= 0x10;
+        _stats.corrupted++;
+    }
+
+    uint32_t latencyUs = dev.config.latencyMs * 1000;
+    if (dev.config.jitterMs)
+        latencyUs += (uint32_t)(uniform() * dev.config.jitterMs * 1000);
+
+    _reply = reply;
+    _replyPos = 0;
+    _replyByteUs = byteTimeUs();
+    // The transport hands us the request once it is fully on the wire
+    _replyStartUs = hal::clock().micros() + latencyUs;
+    _stats.replies++;
+}
+
+PzemEmulator::Measurement PzemEmulator::measure(Device &dev)
+{
+    const Config &cfg = dev.config;
+    uint32_t nowMs = hal::clock().millis();
+    double phase = cfg.periodMs ? (double)(nowMs % cfg.periodMs) / cfg.periodMs : 0.0;
+
+    double current = cfg.baseCurrent;
+    switch (cfg.profile)
+    {
+    case LOAD_CONSTANT:
+        break;
+    case LOAD_SINE:
+        current *= 1.0 + 0.5 * sin(2.0 * M_PI * phase);
+        break;
+    case LOAD_STEPS:
+        current *= phase < 0.5 ? 1.0 : 0.1;
+        break;
+    case LOAD_RANDOM:
+        dev.walk += (uniform() - 0.5) * 0.1;
+        if (dev.walk > 0.9)
+            dev.walk = 0.9;
+        if (dev.walk < -0.9)
+            dev.walk = -0.9;
+        current *= 1.0 + dev.walk;
+        break;
+    }
+
+    double voltage = cfg.baseVoltage;
+    if (cfg.noise > 0)
+    {
+        voltage *= 1.0 + (uniform() * 2.0 - 1.0) * cfg.noise;
+        current *= 1.0 + (uniform() * 2.0 - 1.0) * cfg.noise;
+    }
+    if (current < 0)
+        current = 0;
+
+    Measurement m;
+    m.voltage = (float)voltage;
+    m.current = (float)current;
+    m.pf = current > 0 ? cfg.powerFactor : 0.0f;
+    m.power = (float)(voltage * current * m.pf);
+    m.frequency = cfg.frequency;
+
+    // Integrate energy since the previous read at the current power
+    uint32_t elapsedMs = nowMs - dev.lastUpdateMs;
+    dev.lastUpdateMs = nowMs;
+    dev.energyWh += m.power * elapsedMs / 3600000.0;
+    m.energyWh = (uint32_t)dev.energyWh;
+
+    m.alarm = m.power * 10.0f >= dev.alarmThreshold;
+    return m;
+}
@@ -0,0 +1,121 @@
+#ifndef PZEMEMULATOR_H
+#define PZEMEMULATOR_H
+
+#include <stdint.h>
+#include <vector>
+#include "Hal.h"
+
+// Software PZEM-004T v3 bus. Attach it to the meter's rx pin with
+// hal::attachSerial() and it answers Modbus-RTU requests the way the
+// real module does, with configurable timing and failure injection.
+//
+// Supported functions: 0x03 read holding registers (slave address,
+// power alarm threshold), 0x04 read input registers (measurement block
+// 0x0000..0x0009), 0x06 write single register and 0x42 reset energy.
+// Several devices can share the bus, each with its own address; the
+// general address 0xF8 is answered by the first device.
+class PzemEmulator : public hal::SerialPort
+{
+public:
+    enum LoadProfile
+    {
+        LOAD_CONSTANT,
+        LOAD_SINE,   // smooth swing around the base load
+        LOAD_STEPS,  // on/off appliance cycling
+        LOAD_RANDOM  // bounded random walk
+    };
+
+    struct Config
+    {
+        uint8_t address = 0x01;
+        uint32_t baud = 9600;
+        uint32_t latencyMs = 20;      // processing time before the reply starts
+        uint32_t jitterMs = 0;        // extra random latency, 0..jitterMs
+        float dropRate = 0.0f;        // probability a request gets no reply
+        float crcErrorRate = 0.0f;    // probability the reply is corrupted
+        float noise = 0.0f;           // relative noise on voltage and current
+        LoadProfile profile = LOAD_CONSTANT;
+        float baseVoltage = 230.0f;
+        float baseCurrent = 2.0f;     // A
+        float powerFactor = 0.95f;
+        float frequency = 50.0f;
+        uint32_t periodMs = 60000;    // period for sine and steps profiles
+        uint32_t energyWh = 0;        // initial energy counter
+        uint32_t seed = 1;
+    };
+
+    struct Stats
+    {
+        uint32_t requests;
+        uint32_t replies;
+        uint32_t dropped;
+        uint32_t corrupted;
+        uint32_t badRequests;
+    };
+
+    PzemEmulator();
+    explicit PzemEmulator(const Config &config);
+
+    // Adds another slave on the same bus; returns its index
+    size_t addDevice(const Config &config);
+    Config &device(size_t index) { return _devices[index].config; }
+    size_t deviceCount() const { return _devices.size(); }
+    // Makes a device stop answering, as if unplugged
+    void setOnline(size_t index, bool online) { _devices[index].online = online; }
+
+    const Stats &stats() const { return _stats; }
+
+    // hal::SerialPort
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(const uint8_t *data, size_t len) override;
+
+    static bool parseProfile(const char *name, LoadProfile &profile);
+    static uint16_t crc16(const uint8_t *data, size_t len);
+
+private:
+    struct Device
+    {
+        Config config;
+        bool online;
+        double energyWh;
+        uint32_t lastUpdateMs;
+        double walk;
+        uint16_t alarmThreshold;
+    };
+
+    struct Measurement
+    {
+        float voltage;
+        float current;
+        float power;
+        uint32_t energyWh;
+        float frequency;
+        float pf;
+        bool alarm;
+    };
+
+    Device *findDevice(uint8_t address);
+    void handleFrame(const uint8_t *frame, size_t len);
+    void queueReply(Device &dev, std::vector<uint8_t> reply);
+    void queueException(Device &dev, uint8_t function, uint8_t code);
+    Measurement measure(Device &dev);
+    size_t expectedRequestLength(uint8_t function) const;
+    uint32_t byteTimeUs() const;
+    float uniform();
+
+    std::vector<Device> _devices;
+    std::vector<uint8_t> _request;
+    uint32_t _lastRxUs;
+
+    std::vector<uint8_t> _reply;
+    size_t _replyPos;
+    uint32_t _replyStartUs;
+    uint32_t _replyByteUs;
+
+    uint32_t _rng;
+    Stats _stats;
+};
+
+#endif // PZEMEMULATOR_H
@@ -0,0 +1,52 @@
+#include "AlignedTimer.h"
+#include "WallClock.h"
+
+AlignedTimer::AlignedTimer() : periodMs(1000), offsetMs(0), next(0), started(false), firedAt(0)
+{
+}
+
+bool AlignedTimer::set(unsigned long periodMs, unsigned long offsetMs)
+{
+    if (periodMs == 0)
+    {
+        return false;
+    }
+    this->periodMs = periodMs;
+    this->offsetMs = offsetMs % periodMs;
+    next = 0;
+    return true;
+}
+
+int64_t AlignedTimer::boundaryAfter(int64_t epochMs) const
+{
+    return ((epochMs - (int64_t)offsetMs) / (int64_t)periodMs + 1) * (int64_t)periodMs + (int64_t)offsetMs;
+}
+
+bool AlignedTimer::due(unsigned long now)
+{
+    int64_t epochMs = wallClock.epochMillisAt(now);
+    if (epochMs == 0)
+    {
+        if (started && now - firedAt < periodMs)
+        {
+            return false;
+        }
+        started = true;
+        firedAt = now;
+        return true;
+    }
+
+    // First time with the clock, or the clock was set back by more than a period
+    if (next == 0 || next - epochMs > (int64_t)periodMs)
+    {
+        next = boundaryAfter(epochMs);
+    }
+    if (epochMs < next)
+    {
+        return false;
+    }
+    // The last boundary passed, if the call was so late that it skipped some
+    next = boundaryAfter(epochMs);
+    firedAt = now - (unsigned long)(epochMs - (next - (int64_t)periodMs));
+    return true;
+}
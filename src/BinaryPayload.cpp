@@ -0,0 +1,100 @@
+#include "BinaryPayload.h"
+#include "DeltaCodec.h"
+
+uint8_t *BinaryPayload::put8(uint8_t *p, uint8_t value)
+{
+    *p++ = value;
+    return p;
+}
+
+uint8_t *BinaryPayload::put16(uint8_t *p, uint16_t value)
+{
+    *p++ = value & 0xFF;
+    *p++ = value >> 8;
+    return p;
+}
+
+uint8_t *BinaryPayload::put32(uint8_t *p, uint32_t value)
+{
+    p = put16(p, value & 0xFFFF);
+    return put16(p, value >> 16);
+}
+
+// Fixed-point value; `invalid` (the all-ones value of the field) marks NAN
+// and is never produced by a real reading
+uint32_t BinaryPayload::scaled(float value, float scale, uint32_t invalid)
+{
+    if (isnan(value))
+    {
+        return invalid;
+    }
+    if (value <= 0)
+    {
+        return 0;
+    }
+    float fixed = value * scale + 0.5f;
+    return fixed >= (float)invalid ? invalid - 1 : (uint32_t)fixed;
+}
+
+size_t BinaryPayload::encode(const String &serialNumber, unsigned long heartbeatSeconds,
+                             const MeterReadings *readings, uint8_t count, uint8_t *out, size_t size)
+{
+    size_t serialLength = min<size_t>(serialNumber.length(), MAX_SERIAL);
+    bool delta = count > 1;
+    size_t length = 3 + (heartbeatSeconds ? 2 : 0) + serialLength + (delta ? 0 : count * READING_BYTES);
+    if (length > size)
+    {
+        return 0;
+    }
+
+    uint8_t *p = out;
+    p = put8(p, VERSION);
+    p = put8(p, (heartbeatSeconds ? FLAG_HEARTBEAT : 0) | (delta ? FLAG_DELTA : 0));
+    if (heartbeatSeconds)
+    {
+        p = put16(p, min<unsigned long>(heartbeatSeconds, UINT16_MAX));
+    }
+    p = put8(p, serialLength);
+    memcpy(p, serialNumber.c_str(), serialLength);
+    p += serialLength;
+    p = put8(p, count);
+
+    if (delta)
+    {
+        DeltaCodec codec;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            size_t n = codec.encode(readings[i], p, out + size - p);
+            if (n == 0)
+            {
+                return 0;
+            }
+            p += n;
+        }
+        return p - out;
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const MeterReadings &r = readings[i];
+        p = put32(p, r.epoch);
+        p = put32(p, r.seq);
+        p = put8(p, r.phase);
+        p = put8(p, r.alarm ? FLAG_ALARM : 0);
+        p = put16(p, r.samples);
+        p = put16(p, scaled(r.voltage, 10, UINT16_MAX));
+        p = put16(p, scaled(r.voltageMin, 10, UINT16_MAX));
+        p = put16(p, scaled(r.voltageMax, 10, UINT16_MAX));
+        p = put32(p, scaled(r.current, 1000, UINT32_MAX));
+        p = put32(p, scaled(r.currentMin, 1000, UINT32_MAX));
+        p = put32(p, scaled(r.currentMax, 1000, UINT32_MAX));
+        p = put32(p, scaled(r.power, 10, UINT32_MAX));
+        p = put32(p, scaled(r.powerMin, 10, UINT32_MAX));
+        p = put32(p, scaled(r.powerMax, 10, UINT32_MAX));
+        p = put32(p, scaled(r.energy, 1000, UINT32_MAX));
+        p = put32(p, scaled(r.energyDelta, 1000, UINT32_MAX));
+        p = put16(p, scaled(r.frequency, 10, UINT16_MAX));
+        p = put8(p, scaled(r.pf, 100, UINT8_MAX));
+    }
+    return p - out;
+}
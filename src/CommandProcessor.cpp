@@ -0,0 +1,240 @@
+#include "CommandProcessor.h"
+#include "DebugSerial.h"
+#include "JsonReader.h"
+#include "JsonWriter.h"
+
+// A member of the command, kept after the reader has moved on
+struct CommandProcessor::Value
+{
+    JsonReader::Type type;
+    const char *text; // STRING: in the payload; NUMBER: in `number`
+    bool boolean;
+    char number[24];
+};
+
+CommandProcessor::CommandProcessor(ConfigManager &configManager, DataSender &dataSender)
+    : configManager(configManager), dataSender(dataSender), snapshotRequested(false),
+      rebootPending(false), rebootAt(0), idIsNumber(false)
+{
+    id[0] = '\0';
+}
+
+void CommandProcessor::begin()
+{
+    dataSender.setCommandHandler([this](uint8_t *payload, unsigned int length)
+                                 { this->handle(payload, length); });
+}
+
+void CommandProcessor::handle(uint8_t *payload, unsigned int length)
+{
+    JsonReader reader((char *)payload, length);
+    const char *command = "";
+    const char *key = nullptr;
+    Value value = {JsonReader::NONE, "", false, {0}};
+    const char *error = nullptr;
+    id[0] = '\0';
+    idIsNumber = false;
+    while (reader.next())
+    {
+        if (strcmp(reader.key(), "command") == 0)
+        {
+            command = reader.string();
+        }
+        else if (strcmp(reader.key(), "key") == 0)
+        {
+            key = reader.string();
+        }
+        else if (strcmp(reader.key(), "id") == 0)
+        {
+            idIsNumber = reader.type() == JsonReader::NUMBER;
+            // Not echoed cut short: the caller could not match the reply
+            if (idIsNumber ? !reader.numberText(id, sizeof(id)) : strlen(reader.string()) >= sizeof(id))
+            {
+                id[0] = '\0';
+                error = "id too long";
+            }
+            else if (!idIsNumber)
+            {
+                strcpy(id, reader.string());
+            }
+        }
+        else if (strcmp(reader.key(), "value") == 0)
+        {
+            value.type = reader.type();
+            value.boolean = reader.boolean();
+            if (value.type == JsonReader::NUMBER && !reader.numberText(value.number, sizeof(value.number)))
+            {
+                error = "value too long";
+            }
+            value.text = value.type == JsonReader::NUMBER ? value.number : reader.string();
+        }
+    }
+    // The reply echoes the command; a name no command has is not copied into it
+    if (strlen(command) > MAX_COMMAND_LENGTH)
+    {
+        command = "";
+    }
+    if (!reader.ok())
+    {
+        respond(command, false, "invalid JSON", -1);
+        return;
+    }
+    if (error)
+    {
+        respond(command, false, error, -1);
+        return;
+    }
+    DebugSerial.printf("MQTT command: %s\n", command);
+
+    long pending = -1;
+    long number = 0;
+    bool isNumber = value.type == JsonReader::NUMBER && atolChecked(value.text, number);
+    if (strcmp(command, "update_config") == 0)
+    {
+        if (!key || !*key)
+        {
+            error = "missing key";
+        }
+        else
+        {
+            updateConfig(key, value, error);
+        }
+    }
+    else if (strcmp(command, "set_sample_interval") == 0)
+    {
+        if (!isNumber || number < MIN_SAMPLE_INTERVAL)
+        {
+            error = "value must be at least 200 ms";
+        }
+        else if (!configManager.updateConfig("sample_interval", (int)number))
+        {
+            error = configManager.lastError();
+        }
+    }
+    else if (strcmp(command, "set_publish_interval") == 0)
+    {
+        // Shorter than a sample period, most publish cycles would be empty
+        if (!isNumber || number < configManager.getSampleInterval())
+        {
+            error = "value must be at least sample_interval";
+        }
+        else if (!configManager.updateConfig("reading_interval", (int)number))
+        {
+            error = configManager.lastError();
+        }
+    }
+    else if (strcmp(command, "flush_backlog") == 0)
+    {
+        dataSender.flushBacklog();
+        pending = dataSender.backlogPending();
+    }
+    else if (strcmp(command, "snapshot") == 0)
+    {
+        snapshotRequested = true;
+    }
+    else if (strcmp(command, "reset_config") == 0)
+    {
+        if (!configManager.resetToDefaults())
+        {
+            error = "cannot save config";
+        }
+    }
+    else if (strcmp(command, "reboot") == 0)
+    {
+        rebootPending = true;
+        rebootAt = millis();
+    }
+    else
+    {
+        error = "unknown command";
+    }
+    respond(command, error == nullptr, error, pending);
+}
+
+bool CommandProcessor::atolChecked(const char *text, long &value)
+{
+    char *rest;
+    value = strtol(text, &rest, 10);
+    return rest != text && *rest == '\0';
+}
+
+bool CommandProcessor::updateConfig(const char *key, const Value &value, const char *&error)
+{
+    bool ok = false;
+    long number;
+    switch (value.type)
+    {
+    case JsonReader::STRING:
+        ok = configManager.updateConfig(key, String(value.text));
+        break;
+    case JsonReader::BOOLEAN:
+        ok = configManager.updateConfig(key, value.boolean ? 1 : 0);
+        break;
+    case JsonReader::NUMBER:
+        // Whole numbers go to the integer keys, the others (deadbands) are parsed from text
+        ok = atolChecked(value.text, number) ? configManager.updateConfig(key, (int)number)
+                                             : configManager.updateConfig(key, String(value.text));
+        break;
+    default:
+        error = "missing value";
+        return false;
+    }
+    if (!ok)
+    {
+        error = configManager.lastError();
+    }
+    return ok;
+}
+
+void CommandProcessor::respond(const char *command, bool ok, const char *error, long pending)
+{
+    JsonWriter json(response, sizeof(response));
+    json.beginObject();
+    json.field("command", command);
+    if (id[0])
+    {
+        long number;
+        if (idIsNumber && atolChecked(id, number) && number >= 0)
+        {
+            json.field("id", (uint32_t)number);
+        }
+        else
+        {
+            json.field("id", id);
+        }
+    }
+    json.field("ok", ok);
+    if (error)
+    {
+        json.field("error", error);
+    }
+    if (pending >= 0)
+    {
+        json.field("pending", (uint32_t)pending);
+    }
+    json.endObject();
+    if (!ok)
+    {
+        DebugSerial.printf("❌ MQTT command %s: %s\n", command, error);
+    }
+    if (!json.ok() || !dataSender.publishResponse(json.c_str(), json.size()))
+    {
+        DebugSerial.println("⚠️ Không gửi được phản hồi lệnh MQTT");
+    }
+}
+
+void CommandProcessor::loop()
+{
+    if (rebootPending && millis() - rebootAt >= REBOOT_DELAY)
+    {
+        DebugSerial.println("Khởi động lại theo lệnh MQTT...");
+        ESP.restart();
+    }
+}
+
+bool CommandProcessor::takeSnapshotRequest()
+{
+    bool requested = snapshotRequested;
+    snapshotRequested = false;
+    return requested;
+}
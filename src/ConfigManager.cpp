@@ -1,41 +1,82 @@
 #include "ConfigManager.h"
+#include "DebugSerial.h"
 
-ConfigManager::ConfigManager()
+// sample_interval: one PZEM transaction per slave takes up to ~150 ms
+const ConfigManager::IntRange ConfigManager::INT_RANGES[] = {
+    {"mqtt_port", &MeterConfig::mqtt_port, 1, 65535},
+    {"reading_interval", &MeterConfig::reading_interval, 200, 86400000},
+    {"sample_interval", &MeterConfig::sample_interval, 200, 3600000},
+    {"publish_offset", &MeterConfig::publish_offset, 0, 86400000},
+    {"heartbeat_interval", &MeterConfig::heartbeat_interval, 1000, 86400000},
+    {"backlog_days", &MeterConfig::backlog_days, 1, 365},
+    {"drain_rate", &MeterConfig::drain_rate, 1, 1000},
+    {"batch_size", &MeterConfig::batch_size, 1, 8},
+};
+
+const ConfigManager::FloatRange ConfigManager::FLOAT_RANGES[] = {
+    {"deadband_voltage", &MeterConfig::deadband_voltage, 1000},
+    {"deadband_voltage_pct", &MeterConfig::deadband_voltage_pct, 100},
+    {"deadband_current", &MeterConfig::deadband_current, 100},
+    {"deadband_current_pct", &MeterConfig::deadband_current_pct, 100},
+    {"deadband_power", &MeterConfig::deadband_power, 100000},
+    {"deadband_power_pct", &MeterConfig::deadband_power_pct, 100},
+};
+
+ConfigManager::ConfigManager() : failure(nullptr), listenerCount(0), changes(CONFIG_ALL)
 {
-    setDefaults();
+    setDefaults(config);
 }
 
-void ConfigManager::setDefaults()
+void ConfigManager::setDefaults(MeterConfig &config)
 {
     config.mqtt_server = "113.161.220.166";
     config.mqtt_port = 1883;
     config.device_id = "1";
     config.serial_number = "";
     config.reading_interval = 10000;
+    config.sample_interval = 1000;
+    config.publish_offset = 0;
     config.wifi_ssid = "";
     config.wifi_password = "";
     config.mqtt_username = "";
     config.mqtt_password = "";
+    config.pzem_addresses = "";
+    config.report_by_exception = false;
+    config.deadband_voltage = 2.0f;
+    config.deadband_voltage_pct = 0;
+    config.deadband_current = 0.05f;
+    config.deadband_current_pct = 5;
+    config.deadband_power = 10.0f;
+    config.deadband_power_pct = 5;
+    config.heartbeat_interval = 300000;
+    config.backlog_days = 2;
+    config.drain_rate = 10;
+    config.batch_size = 8;
+    config.payload_format = "json";
+    config.mqtt_tls = false;
+    config.mqtt_fingerprint = "";
+    config.mqtt_pubkey = "";
 }
 
 bool ConfigManager::loadConfig()
 {
+    changes = CONFIG_ALL;
     if (!LittleFS.begin())
     {
-        Serial.println("Failed to mount LittleFS");
+        DebugSerial.println("Failed to mount LittleFS");
         return false;
     }
 
     if (!LittleFS.exists(CONFIG_FILE))
     {
-        Serial.println("Config file not found, creating default config");
+        DebugSerial.println("Config file not found, creating default config");
         return saveConfig();
     }
 
     File file = LittleFS.open(CONFIG_FILE, "r");
     if (!file)
     {
-        Serial.println("Failed to open config file");
+        DebugSerial.println("Failed to open config file");
         return false;
     }
 
@@ -45,7 +86,7 @@ bool ConfigManager::loadConfig()
 
     if (error)
     {
-        Serial.println("❌ Failed to parse config file");
+        DebugSerial.println("❌ Failed to parse config file");
         return false;
     }
 
@@ -55,12 +96,52 @@ bool ConfigManager::loadConfig()
     config.device_id = doc["device_id"] | "1";
     config.serial_number = doc["serial_number"] | "SN001";
     config.reading_interval = doc["reading_interval"] | 10000;
+    config.sample_interval = doc["sample_interval"] | 1000;
+    config.publish_offset = doc["publish_offset"] | 0;
     config.wifi_ssid = doc["wifi_ssid"] | "";
     config.wifi_password = doc["wifi_password"] | "";
     config.mqtt_username = doc["mqtt_username"] | "";
     config.mqtt_password = doc["mqtt_password"] | "";
+    config.pzem_addresses = doc["pzem_addresses"] | "";
+    config.report_by_exception = doc["report_by_exception"] | false;
+    config.deadband_voltage = doc["deadband_voltage"] | 2.0f;
+    config.deadband_voltage_pct = doc["deadband_voltage_pct"] | 0.0f;
+    config.deadband_current = doc["deadband_current"] | 0.05f;
+    config.deadband_current_pct = doc["deadband_current_pct"] | 5.0f;
+    config.deadband_power = doc["deadband_power"] | 10.0f;
+    config.deadband_power_pct = doc["deadband_power_pct"] | 5.0f;
+    config.heartbeat_interval = doc["heartbeat_interval"] | 300000;
+    config.backlog_days = doc["backlog_days"] | 2;
+    config.drain_rate = doc["drain_rate"] | 10;
+    config.batch_size = doc["batch_size"] | 8;
+    config.payload_format = doc["payload_format"] | "json";
+    config.mqtt_tls = doc["mqtt_tls"] | false;
+    config.mqtt_fingerprint = doc["mqtt_fingerprint"] | "";
+    config.mqtt_pubkey = doc["mqtt_pubkey"] | "";
+
+    // A value out of range (edited file, older firmware) falls back to its default
+    MeterConfig defaults;
+    setDefaults(defaults);
+    const char *key;
+    const char *why;
+    while ((why = rangeError(config, key)) != nullptr)
+    {
+        DebugSerial.printf("⚠️ Config: %s, using the default\n", why);
+        for (const IntRange &r : INT_RANGES)
+        {
+            if (strcmp(r.key, key) == 0)
+                config.*r.field = defaults.*r.field;
+        }
+        for (const FloatRange &r : FLOAT_RANGES)
+        {
+            if (strcmp(r.key, key) == 0)
+                config.*r.field = defaults.*r.field;
+        }
+        if (strcmp(key, "payload_format") == 0)
+            config.payload_format = defaults.payload_format;
+    }
 
-    Serial.println("Config loaded successfully");
+    DebugSerial.println("Config loaded successfully");
     printConfig();
     return true;
 }
@@ -69,14 +150,14 @@ bool ConfigManager::saveConfig()
 {
     if (!LittleFS.begin())
     {
-        Serial.println("Failed to mount LittleFS");
+        DebugSerial.println("Failed to mount LittleFS");
         return false;
     }
 
     File file = LittleFS.open(CONFIG_FILE, "w");
     if (!file)
     {
-        Serial.println("Failed to create config file");
+        DebugSerial.println("Failed to create config file");
         return false;
     }
 
@@ -86,25 +167,44 @@ bool ConfigManager::saveConfig()
     doc["device_id"] = config.device_id;
     doc["serial_number"] = config.serial_number;
     doc["reading_interval"] = config.reading_interval;
+    doc["sample_interval"] = config.sample_interval;
+    doc["publish_offset"] = config.publish_offset;
     doc["wifi_ssid"] = config.wifi_ssid;
     doc["wifi_password"] = config.wifi_password;
     doc["mqtt_username"] = config.mqtt_username;
     doc["mqtt_password"] = config.mqtt_password;
+    doc["pzem_addresses"] = config.pzem_addresses;
+    doc["report_by_exception"] = config.report_by_exception;
+    doc["deadband_voltage"] = config.deadband_voltage;
+    doc["deadband_voltage_pct"] = config.deadband_voltage_pct;
+    doc["deadband_current"] = config.deadband_current;
+    doc["deadband_current_pct"] = config.deadband_current_pct;
+    doc["deadband_power"] = config.deadband_power;
+    doc["deadband_power_pct"] = config.deadband_power_pct;
+    doc["heartbeat_interval"] = config.heartbeat_interval;
+    doc["backlog_days"] = config.backlog_days;
+    doc["drain_rate"] = config.drain_rate;
+    doc["batch_size"] = config.batch_size;
+    doc["payload_format"] = config.payload_format;
+    doc["mqtt_tls"] = config.mqtt_tls;
+    doc["mqtt_fingerprint"] = config.mqtt_fingerprint;
+    doc["mqtt_pubkey"] = config.mqtt_pubkey;
 
     if (serializeJson(doc, file) == 0)
     {
-        Serial.println("Failed to write config file");
+        DebugSerial.println("Failed to write config file");
         file.close();
         return false;
     }
 
     file.close();
-    Serial.println("Config saved successfully");
+    DebugSerial.println("Config saved successfully");
     return true;
 }
 
 bool ConfigManager::updateConfig(const String &key, const String &value)
 {
+    MeterConfig before = config;
     if (key == "mqtt_server")
     {
         config.mqtt_server = value;
@@ -133,18 +233,58 @@ bool ConfigManager::updateConfig(const String &key, const String &value)
     {
         config.mqtt_password = value;
     }
+    else if (key == "pzem_addresses")
+    {
+        config.pzem_addresses = value;
+    }
+    else if (key == "payload_format")
+    {
+        config.payload_format = value;
+    }
+    else if (key == "mqtt_fingerprint")
+    {
+        config.mqtt_fingerprint = value;
+    }
+    else if (key == "mqtt_pubkey")
+    {
+        config.mqtt_pubkey = value;
+    }
+    else if (key == "deadband_voltage")
+    {
+        config.deadband_voltage = value.toFloat();
+    }
+    else if (key == "deadband_voltage_pct")
+    {
+        config.deadband_voltage_pct = value.toFloat();
+    }
+    else if (key == "deadband_current")
+    {
+        config.deadband_current = value.toFloat();
+    }
+    else if (key == "deadband_current_pct")
+    {
+        config.deadband_current_pct = value.toFloat();
+    }
+    else if (key == "deadband_power")
+    {
+        config.deadband_power = value.toFloat();
+    }
+    else if (key == "deadband_power_pct")
+    {
+        config.deadband_power_pct = value.toFloat();
+    }
     else
     {
-        Serial.printf("Unknown config key: %s\n", key.c_str());
+        DebugSerial.printf("Unknown config key: %s\n", key.c_str());
+        failure = "unknown key";
         return false;
     }
-
-    Serial.printf("Updated config: %s = %s\n", key.c_str(), value.c_str());
-    return saveConfig();
+    return commit(before, key, value);
 }
 
 bool ConfigManager::updateConfig(const String &key, int value)
 {
+    MeterConfig before = config;
     if (key == "mqtt_port")
     {
         config.mqtt_port = value;
@@ -153,14 +293,184 @@ bool ConfigManager::updateConfig(const String &key, int value)
     {
         config.reading_interval = value;
     }
+    else if (key == "sample_interval")
+    {
+        config.sample_interval = value;
+    }
+    else if (key == "publish_offset")
+    {
+        config.publish_offset = value;
+    }
+    else if (key == "report_by_exception")
+    {
+        config.report_by_exception = value != 0;
+    }
+    else if (key == "heartbeat_interval")
+    {
+        config.heartbeat_interval = value;
+    }
+    else if (key == "backlog_days")
+    {
+        config.backlog_days = value;
+    }
+    else if (key == "drain_rate")
+    {
+        config.drain_rate = value;
+    }
+    else if (key == "batch_size")
+    {
+        config.batch_size = value;
+    }
+    else if (key == "mqtt_tls")
+    {
+        config.mqtt_tls = value != 0;
+    }
     else
     {
-        Serial.printf("Unknown config key: %s\n", key.c_str());
+        // Keys parsed from text, such as the deadbands, given a whole number
+        return updateConfig(key, String(value));
+    }
+    return commit(before, key, String(value));
+}
+
+// Takes an update that has been made to `config`, or undoes it if a value is out of range
+bool ConfigManager::commit(const MeterConfig &before, const String &key, const String &value)
+{
+    const char *field;
+    const char *why = rangeError(config, field);
+    if (why)
+    {
+        config = before;
+        failure = why;
+        DebugSerial.printf("❌ Config %s = %s refused: %s\n", key.c_str(), value.c_str(), why);
         return false;
     }
 
-    Serial.printf("Updated config: %s = %d\n", key.c_str(), value);
-    return saveConfig();
+    // The web form posts every field, most of them unchanged
+    failure = nullptr;
+    uint32_t changed = changesBetween(before, config);
+    if (changed == 0)
+    {
+        return true;
+    }
+    changes |= changed;
+    DebugSerial.printf("Updated config: %s = %s\n", key.c_str(), value.c_str());
+    if (!saveConfig())
+    {
+        failure = "cannot save config";
+        return false;
+    }
+    return true;
+}
+
+// The first setting out of range (its key in `key`) and why, nullptr if all are fine
+const char *ConfigManager::rangeError(const MeterConfig &config, const char *&key)
+{
+    for (const IntRange &r : INT_RANGES)
+    {
+        int value = config.*r.field;
+        if (value < r.min || value > r.max)
+        {
+            key = r.key;
+            snprintf(failureText, sizeof(failureText), "%s must be %d..%d", r.key, r.min, r.max);
+            return failureText;
+        }
+    }
+    for (const FloatRange &r : FLOAT_RANGES)
+    {
+        float value = config.*r.field;
+        // Also false for NAN
+        if (!(value >= 0 && value <= r.max))
+        {
+            key = r.key;
+            snprintf(failureText, sizeof(failureText), "%s must be 0..%g", r.key, r.max);
+            return failureText;
+        }
+    }
+    if (config.payload_format != "json" && config.payload_format != "binary")
+    {
+        key = "payload_format";
+        return "payload_format must be json or binary";
+    }
+    return nullptr;
+}
+
+uint32_t ConfigManager::changesBetween(const MeterConfig &a, const MeterConfig &b)
+{
+    uint32_t changed = 0;
+    if (a.mqtt_server != b.mqtt_server || a.mqtt_port != b.mqtt_port)
+        changed |= CONFIG_MQTT_SERVER;
+    if (a.mqtt_username != b.mqtt_username || a.mqtt_password != b.mqtt_password)
+        changed |= CONFIG_MQTT_AUTH;
+    if (a.mqtt_tls != b.mqtt_tls || a.mqtt_fingerprint != b.mqtt_fingerprint || a.mqtt_pubkey != b.mqtt_pubkey)
+        changed |= CONFIG_MQTT_TLS;
+    if (a.device_id != b.device_id)
+        changed |= CONFIG_DEVICE_ID;
+    if (a.serial_number != b.serial_number)
+        changed |= CONFIG_SERIAL_NUMBER;
+    if (a.sample_interval != b.sample_interval)
+        changed |= CONFIG_SAMPLE_INTERVAL;
+    if (a.reading_interval != b.reading_interval)
+        changed |= CONFIG_READING_INTERVAL;
+    if (a.publish_offset != b.publish_offset)
+        changed |= CONFIG_PUBLISH_OFFSET;
+    if (a.pzem_addresses != b.pzem_addresses)
+        changed |= CONFIG_PZEM_ADDRESSES;
+    if (a.report_by_exception != b.report_by_exception || a.heartbeat_interval != b.heartbeat_interval ||
+        a.deadband_voltage != b.deadband_voltage || a.deadband_voltage_pct != b.deadband_voltage_pct ||
+        a.deadband_current != b.deadband_current || a.deadband_current_pct != b.deadband_current_pct ||
+        a.deadband_power != b.deadband_power || a.deadband_power_pct != b.deadband_power_pct)
+        changed |= CONFIG_REPORT_POLICY;
+    if (a.backlog_days != b.backlog_days)
+        changed |= CONFIG_BACKLOG_DAYS;
+    if (a.drain_rate != b.drain_rate)
+        changed |= CONFIG_DRAIN_RATE;
+    if (a.batch_size != b.batch_size)
+        changed |= CONFIG_BATCH_SIZE;
+    if (a.payload_format != b.payload_format)
+        changed |= CONFIG_PAYLOAD_FORMAT;
+    if (a.wifi_ssid != b.wifi_ssid || a.wifi_password != b.wifi_password)
+        changed |= CONFIG_WIFI;
+    return changed;
+}
+
+void ConfigManager::onChange(uint32_t mask, ChangeListener listener)
+{
+    if (listenerCount == MAX_LISTENERS)
+    {
+        DebugSerial.println("Too many config listeners");
+        return;
+    }
+    listeners[listenerCount++] = {mask, listener};
+}
+
+void ConfigManager::applyChanges()
+{
+    if (changes == 0)
+    {
+        return;
+    }
+    // A listener may change the config again; that waits for the next call
+    uint32_t changed = changes;
+    changes = 0;
+    for (uint8_t i = 0; i < listenerCount; i++)
+    {
+        if (listeners[i].mask & changed)
+        {
+            listeners[i].callback(config, listeners[i].mask & changed);
+        }
+    }
+}
+
+ReportPolicy ConfigManager::getReportPolicy()
+{
+    ReportPolicy policy;
+    policy.byException = config.report_by_exception;
+    policy.voltage = {config.deadband_voltage, config.deadband_voltage_pct};
+    policy.current = {config.deadband_current, config.deadband_current_pct};
+    policy.power = {config.deadband_power, config.deadband_power_pct};
+    policy.heartbeat = config.heartbeat_interval;
+    return policy;
 }
 
 MeterConfig ConfigManager::getConfig()
@@ -170,18 +480,32 @@ MeterConfig ConfigManager::getConfig()
 
 void ConfigManager::printConfig()
 {
-    Serial.println("Current Configuration:");
-    Serial.printf("  MQTT Server: %s\n", config.mqtt_server.c_str());
-    Serial.printf("  MQTT Port: %d\n", config.mqtt_port);
-    Serial.printf("  Device ID: %s\n", config.device_id.c_str());
-    Serial.printf("  Serial Number: %s\n", config.serial_number.c_str());
-    Serial.printf("  Reading Interval: %d ms\n", config.reading_interval);
-    Serial.printf("  WiFi SSID: %s\n", config.wifi_ssid.c_str());
-    Serial.printf("  MQTT Username: %s\n", config.mqtt_username.c_str());
+    DebugSerial.println("Current Configuration:");
+    DebugSerial.printf("  MQTT Server: %s\n", config.mqtt_server.c_str());
+    DebugSerial.printf("  MQTT Port: %d\n", config.mqtt_port);
+    DebugSerial.printf("  Device ID: %s\n", config.device_id.c_str());
+    DebugSerial.printf("  Serial Number: %s\n", config.serial_number.c_str());
+    DebugSerial.printf("  Reading Interval: %d ms\n", config.reading_interval);
+    DebugSerial.printf("  Sample Interval: %d ms\n", config.sample_interval);
+    DebugSerial.printf("  Publish Offset: %d ms\n", config.publish_offset);
+    DebugSerial.printf("  WiFi SSID: %s\n", config.wifi_ssid.c_str());
+    DebugSerial.printf("  MQTT Username: %s\n", config.mqtt_username.c_str());
+    DebugSerial.printf("  PZEM Addresses: %s\n", config.pzem_addresses.length() ? config.pzem_addresses.c_str() : "(single)");
+    DebugSerial.printf("  Report by exception: %s (V %.2f/%.1f%%, I %.3f/%.1f%%, P %.1f/%.1f%%, heartbeat %d ms)\n",
+                       config.report_by_exception ? "on" : "off",
+                       config.deadband_voltage, config.deadband_voltage_pct,
+                       config.deadband_current, config.deadband_current_pct,
+                       config.deadband_power, config.deadband_power_pct, config.heartbeat_interval);
+    DebugSerial.printf("  Backlog: %d days, resent at %d records/s\n", config.backlog_days, config.drain_rate);
+    DebugSerial.printf("  Batch size: %d readings/message, format: %s\n", config.batch_size, config.payload_format.c_str());
+    DebugSerial.printf("  MQTT TLS: %s, pinned by %s\n", config.mqtt_tls ? "on" : "off",
+                       config.mqtt_pubkey.length() ? "public key" : config.mqtt_fingerprint.length() ? "fingerprint" : "nothing (insecure)");
 }
 
 bool ConfigManager::resetToDefaults()
 {
-    setDefaults();
+    MeterConfig before = config;
+    setDefaults(config);
+    changes |= changesBetween(before, config);
     return saveConfig();
 }
\ No newline at end of file
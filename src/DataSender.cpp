@@ -1,205 +1,916 @@
 #include "DataSender.h"
-#include <ArduinoJson.h>
 #include <ESP8266WiFi.h>
+#include "BinaryPayload.h"
 #include "ConfigManager.h"
+#include "DebugSerial.h"
+#include "WallClock.h"
+#ifdef UMM_STATS_FULL
+#include <umm_malloc/umm_malloc.h>
+#endif
 
 extern ConfigManager configManager;
 
 DataSender::DataSender()
     : mqttServer("113.161.220.166"), mqttPort(1883), deviceId("1"), serialNumber("SN001"),
-      client(wifiClient), bufferIndex(0), bufferCount(0)
+      client(wifiClient), tls(false), tlsProbed(false), tlsSessionIdLength(0), backlogCapacity(0), bootPosition{0, 0}, drainRate(10), drainTokens(0), lastDrainRefill(0),
+      draining(false), flushing(false), batchSize(1), batchHold(0), batchCount(0), batchStartedAt(0),
+      drainNext{0, 0}, drainCount(0), drainSent(0), drainAttributed(0), publishedEnd{0, 0},
+      inFlightHead(0), inFlightCount(0), deliveryStats(),
+      payloadFormat(PAYLOAD_JSON), reportPolicy(), suppressed(0), nextSeq(1), seqReserved(0),
+      link(LINK_WAITING), reconnectAttempts(0), reconnectFrom(0), reconnectDelay(0)
 {
+    for (uint8_t i = 0; i < REPORT_STREAMS; i++)
+    {
+        lastReportAt[i] = 0;
+        hasReported[i] = false;
+        pendingEnergy[i] = 0;
+    }
+    buildTopics();
     client.setCallback([this](char *topic, byte *payload, unsigned int length)
                        { this->callback(topic, payload, length); });
+    client.setAckCallback([this](uint16_t packetId)
+                          { this->onPublishAck(packetId); });
 }
 
 void DataSender::setup()
 {
     client.setServer(mqttServer.c_str(), mqttPort);
+    backlog.begin("/backlog", backlogCapacity);
+    drainNext = backlog.readPosition();
+    publishedEnd = drainNext;
+    bootPosition = backlog.writePosition();
+    loadSeq();
+    // A power cut restarts every meter at once
+    scheduleReconnect();
+}
+
+void DataSender::setTls(bool enabled, const String &fingerprint, const String &publicKey)
+{
+    tls = enabled;
+    if (!tls)
+    {
+        client.setTransport(wifiClient);
+        restartConnection();
+        return;
+    }
+    if (publicKey.length() > 0)
+    {
+        if (brokerKey.parse(publicKey.c_str()))
+        {
+            secureClient.setKnownKey(&brokerKey);
+        }
+        else
+        {
+            // Nothing is trusted: every handshake fails until the key is fixed
+            DebugSerial.println("❌ mqtt_pubkey không hợp lệ");
+        }
+    }
+    else if (fingerprint.length() > 0)
+    {
+        if (!secureClient.setFingerprint(fingerprint.c_str()))
+        {
+            DebugSerial.println("❌ mqtt_fingerprint không hợp lệ");
+        }
+    }
+    else
+    {
+        DebugSerial.println("⚠️ MQTT TLS without a pinned key: the broker is not authenticated");
+        secureClient.setInsecure();
+    }
+    secureClient.setSession(&tlsSession);
+    client.setTransport(secureClient, TLS_TIMEOUT);
+    tlsProbed = false;
+    restartConnection();
+}
+
+void DataSender::setBacklogDays(int days, unsigned long publishIntervalMs, uint8_t streams)
+{
+    if (publishIntervalMs == 0)
+    {
+        return;
+    }
+    uint32_t readings = (uint32_t)days * (86400000UL / publishIntervalMs) * streams;
+    uint32_t capacity = readings * STORED_READING_BYTES;
+    if (capacity != backlogCapacity)
+    {
+        backlogCapacity = capacity;
+        backlog.setCapacity(capacity);
+    }
+}
+
+void DataSender::buildTopics()
+{
+    snprintf(dataTopic, sizeof(dataTopic), "meter/%s/data", deviceId.c_str());
+    snprintf(binTopic, sizeof(binTopic), "meter/%s/bin", deviceId.c_str());
+    snprintf(controlTopic, sizeof(controlTopic), "meter/%s/control", deviceId.c_str());
+    snprintf(responseTopic, sizeof(responseTopic), "meter/%s/response", deviceId.c_str());
+}
+
+void DataSender::setBatchSize(uint8_t size, unsigned long publishIntervalMs)
+{
+    batchSize = constrain(size, 1, MAX_BATCH);
+    // At the normal rate a batch only groups the streams of one publish cycle
+    batchHold = batchSize > 1 && publishIntervalMs < BATCH_MAX_HOLD ? BATCH_MAX_HOLD : 0;
 }
 
 void DataSender::updateConfig(const char *mqttServer, int mqttPort, const char *deviceId, const char *serialNumber, const char *mqttPassword, const char *mqttUser)
 {
+    bool serverChanged = this->mqttServer != mqttServer || this->mqttPort != mqttPort;
+    // A new device ID moves the control topic, which needs a new subscription
+    bool sessionChanged = serverChanged || this->deviceId != deviceId || this->mqttUser != mqttUser ||
+                          this->mqttPassword != mqttPassword;
     this->mqttServer = String(mqttServer);
     this->mqttPort = mqttPort;
     this->deviceId = String(deviceId);
     this->serialNumber = String(serialNumber);
     this->mqttPassword = String(mqttPassword);
     this->mqttUser = String(mqttUser);
+    buildTopics();
 
-    if (client.connected())
+    if (sessionChanged)
     {
-        client.disconnect();
+        if (serverChanged)
+        {
+            client.setServer(this->mqttServer.c_str(), this->mqttPort);
+            tlsProbed = false;
+        }
+        restartConnection();
     }
-    client.setServer(this->mqttServer.c_str(), this->mqttPort);
 
-    Serial.printf("✅ MQTT config updated: %s:%d, Device: %s, Serial: %s\n",
+    DebugSerial.printf("✅ MQTT config updated: %s:%d, Device: %s, Serial: %s\n",
                   this->mqttServer.c_str(), this->mqttPort, this->deviceId.c_str(), this->serialNumber.c_str());
 }
 
+void DataSender::restartConnection()
+{
+    client.disconnect();
+    // A new broker or new settings are tried at once
+    link = LINK_WAITING;
+    reconnectAttempts = 0;
+    reconnectDelay = 0;
+}
+
 void DataSender::loop()
 {
-    if (!client.connected())
+    // Also moves a connection attempt on; nothing here waits for the network
+    if (client.loop())
+    {
+        if (link != LINK_UP)
+        {
+            DebugSerial.println("connected");
+            if (tls)
+            {
+                reportHandshake();
+            }
+            link = LINK_UP;
+            reconnectAttempts = 0;
+            // Subscribe to control topics
+            client.subscribe(controlTopic);
+        }
+    }
+    else
     {
+        if (link == LINK_UP)
+        {
+            // Every meter saw the broker go at the same moment
+            link = LINK_WAITING;
+            DebugSerial.printf("MQTT connection lost, rc=%d, retrying in %lu ms\n", client.state(), scheduleReconnect());
+        }
+        abandonInFlight();
         reconnect();
     }
-    client.loop();
+    if (inFlightCount > 0 && millis() - inFlight[inFlightHead].sentAt >= ACK_TIMEOUT)
+    {
+        // The broker took the message but never answered: start over on a new connection
+        DebugSerial.println("⚠️ Không nhận được PUBACK, kết nối lại MQTT");
+        client.disconnect();
+        abandonInFlight();
+    }
+    if (batchCount > 0 && (batchCount >= batchSize || millis() - batchStartedAt >= batchHold))
+    {
+        flushBatch();
+    }
 }
 
 void DataSender::reconnect()
 {
-    unsigned long now = millis();
-    if (now - lastReconnectAttempt < RECONNECT_INTERVAL)
+    if (client.connecting())
+    {
+        return;
+    }
+    if (link == LINK_CONNECTING)
+    {
+        // The attempt ended without a CONNACK
+        link = LINK_WAITING;
+        char error[64];
+        if (tls && secureClient.getLastSSLError(error, sizeof(error)) != 0)
+        {
+            DebugSerial.printf("TLS error: %s\n", error);
+        }
+        DebugSerial.printf("failed, rc=%d, retrying in %lu ms\n", client.state(), scheduleReconnect());
+        return;
+    }
+    if (millis() - reconnectFrom < reconnectDelay)
     {
         return;
     }
-    lastReconnectAttempt = now;
 
-    Serial.print("Attempting MQTT connection...");
+    DebugSerial.print("Attempting MQTT connection...");
     String clientId = "ESP8266Client-";
     clientId += String(random(0xffff), HEX);
-    Serial.printf("Client ID: %s\n", clientId.c_str());
-    Serial.printf("MQTT Server: %s, Port: %d, User: %s, Password: %s\n",
+    DebugSerial.printf("Client ID: %s\n", clientId.c_str());
+    DebugSerial.printf("MQTT Server: %s, Port: %d, User: %s, Password: %s\n",
                   mqttServer.c_str(), mqttPort, mqttUser.c_str(), mqttPassword.c_str());
-    // Attempt to connect
+    if (tls)
+    {
+        prepareTls();
+    }
+    // Starts the attempt; loop() reports how it ends
     if (client.connect(clientId.c_str(), mqttUser.c_str(), mqttPassword.c_str()))
     {
-        Serial.println("connected");
+        link = LINK_CONNECTING;
+    }
+    else
+    {
+        DebugSerial.printf("failed, rc=%d, retrying in %lu ms\n", client.state(), scheduleReconnect());
+    }
+}
 
-        // Subscribe to control topics
-        String controlTopic = "meter/" + String(deviceId) + "/control";
-        client.subscribe(controlTopic.c_str());
+void DataSender::prepareTls()
+{
+    if (!tlsProbed)
+    {
+        // Blocks for a TCP connection and a ClientHello, once per boot
+        tlsProbed = true;
+        if (BearSSL::WiFiClientSecure::probeMaxFragmentLength(mqttServer.c_str(), mqttPort, TLS_FRAGMENT))
+        {
+            secureClient.setBufferSizes(TLS_RX_BUFFER, TLS_TX_BUFFER);
+            DebugSerial.printf("TLS buffers: %d / %d bytes\n", TLS_RX_BUFFER, TLS_TX_BUFFER);
+        }
+        else
+        {
+            secureClient.setBufferSizes(BearSSL::WiFiClientSecure::DEFAULT_RX, BearSSL::WiFiClientSecure::DEFAULT_TX);
+            DebugSerial.println("⚠️ Broker không hỗ trợ max fragment length, dùng bộ đệm TLS 16 KB");
+        }
+    }
+    br_ssl_session_parameters *session = tlsSession.getSession();
+    tlsSessionIdLength = session->session_id_len;
+    memcpy(tlsSessionId, session->session_id, sizeof(tlsSessionId));
+#ifdef UMM_STATS_FULL
+    umm_free_heap_size_min_reset();
+#endif
+}
 
-        // Send buffered data if any
-        sendBufferedData();
+void DataSender::reportHandshake()
+{
+    br_ssl_session_parameters *session = tlsSession.getSession();
+    bool resumed = tlsSessionIdLength > 0 && session->session_id_len == tlsSessionIdLength &&
+                   memcmp(session->session_id, tlsSessionId, tlsSessionIdLength) == 0;
+#ifdef UMM_STATS_FULL
+    DebugSerial.printf("TLS handshake (%s): %lu ms, heap low-water %u bytes\n", resumed ? "resumed" : "full",
+                       client.connectMs(), (unsigned)umm_free_heap_size_min());
+#else
+    DebugSerial.printf("TLS handshake (%s): %lu ms\n", resumed ? "resumed" : "full", client.connectMs());
+#endif
+}
+
+// Picks the wait before the next attempt; returns it
+unsigned long DataSender::scheduleReconnect()
+{
+    unsigned long ceiling = RECONNECT_MIN << (reconnectAttempts < 6 ? reconnectAttempts : 6);
+    if (ceiling > RECONNECT_MAX)
+    {
+        ceiling = RECONNECT_MAX;
     }
-    else
+    if (reconnectAttempts < UINT8_MAX)
     {
-        Serial.print("failed, rc=");
-        Serial.print(client.state());
-        Serial.println(" retrying in 5 seconds");
+        reconnectAttempts++;
     }
+    reconnectFrom = millis();
+    reconnectDelay = random(ceiling + 1);
+    return reconnectDelay;
 }
 
 void DataSender::callback(char *topic, byte *payload, unsigned int length)
 {
-    Serial.print("Message arrived [");
-    Serial.print(topic);
-    Serial.print("] ");
-    String message;
-    for (unsigned int i = 0; i < length; i++)
+    DebugSerial.printf("Message arrived [%s] %u bytes\n", topic, length);
+    if (strcmp(topic, controlTopic) == 0 && commandHandler)
+    {
+        commandHandler(payload, length);
+    }
+}
+
+bool DataSender::publishResponse(const char *payload, size_t length)
+{
+    return client.connected() && client.publish(responseTopic, (const uint8_t *)payload, length, 0);
+}
+
+bool DataSender::outside(float value, float reference, const Deadband &band)
+{
+    if (isnan(value) || isnan(reference))
+    {
+        return isnan(value) != isnan(reference);
+    }
+    float threshold = max(band.absolute, band.relative / 100.0f * fabsf(reference));
+    return fabsf(value - reference) > threshold;
+}
+
+bool DataSender::shouldReport(MeterReadings &readings)
+{
+    uint8_t stream = readings.phase < REPORT_STREAMS ? readings.phase : 0;
+    const MeterReadings &last = lastReported[stream];
+    unsigned long now = millis();
+
+    bool report = !reportPolicy.byException || !hasReported[stream] ||
+                  now - lastReportAt[stream] >= reportPolicy.heartbeat ||
+                  readings.alarm != last.alarm;
+    // Window extremes count too, so a short spike is not hidden by the mean
+    report = report ||
+             outside(readings.voltage, last.voltage, reportPolicy.voltage) ||
+             outside(readings.voltageMin, last.voltage, reportPolicy.voltage) ||
+             outside(readings.voltageMax, last.voltage, reportPolicy.voltage) ||
+             outside(readings.current, last.current, reportPolicy.current) ||
+             outside(readings.currentMin, last.current, reportPolicy.current) ||
+             outside(readings.currentMax, last.current, reportPolicy.current) ||
+             outside(readings.power, last.power, reportPolicy.power) ||
+             outside(readings.powerMin, last.power, reportPolicy.power) ||
+             outside(readings.powerMax, last.power, reportPolicy.power);
+
+    if (!report)
+    {
+        // Energy of skipped windows goes out with the next report
+        pendingEnergy[stream] += readings.energyDelta;
+        suppressed++;
+        return false;
+    }
+
+    readings.energyDelta += pendingEnergy[stream];
+    pendingEnergy[stream] = 0;
+    lastReported[stream] = readings;
+    lastReportAt[stream] = now;
+    hasReported[stream] = true;
+    return true;
+}
+
+void DataSender::sendData(const MeterReadings &data)
+{
+    MeterReadings readings = data;
+    if (!shouldReport(readings))
+    {
+        return;
+    }
+    // Wall-clock time of its acquisition; before SNTP it is found later
+    readings.epoch = wallClock.epochAt(readings.timestamp);
+    readings.seq = nextSeq++;
+    if (nextSeq >= seqReserved)
+    {
+        reserveSeq();
+    }
+    deliveryStats.queued++;
+
+    // Without a connection the batch still fills, so it goes to flash as one record
+    if (batchCount == 0)
+    {
+        batchStartedAt = millis();
+    }
+    batch[batchCount++] = readings;
+    if (batchCount >= batchSize)
+    {
+        flushBatch();
+    }
+}
+
+#define SEQ_FILE "/seq"
+
+void DataSender::loadSeq()
+{
+    // The file holds the end of the last reserved block; written whole or not at all (littlefs).
+    // It stays open: opening a file allocates, and reserving must not in the publish path.
+    seqFile = LittleFS.open(SEQ_FILE, "r+");
+    uint32_t reserved = 0;
+    if (!seqFile || seqFile.read((uint8_t *)&reserved, sizeof(reserved)) != sizeof(reserved))
+    {
+        reserved = 0;
+    }
+    if (!seqFile)
+    {
+        seqFile = LittleFS.open(SEQ_FILE, "w");
+    }
+    nextSeq = reserved ? reserved : 1;
+    seqReserved = reserved;
+    reserveSeq();
+    DebugSerial.printf("Sequence number: %lu\n", (unsigned long)nextSeq);
+}
+
+void DataSender::reserveSeq()
+{
+    seqReserved += SEQ_BLOCK;
+    if (!seqFile || !seqFile.seek(0) ||
+        seqFile.write((const uint8_t *)&seqReserved, sizeof(seqReserved)) != sizeof(seqReserved))
+    {
+        // Numbering goes on; after a restart it would repeat this block
+        DebugSerial.println("⚠️ Không lưu được số thứ tự vào flash");
+        return;
+    }
+    seqFile.flush();
+}
+
+// Publishes the held live readings; what cannot be published goes to flash
+void DataSender::flushBatch()
+{
+    if (waitingForClock())
     {
-        message += (char)payload[i];
+        // Published from flash once SNTP has set the clock, with their true time
+        DebugSerial.println("Chưa có giờ NTP, lưu dữ liệu vào flash...");
+        addToBuffer(batch, batchCount);
+        batchCount = 0;
+        return;
     }
-    Serial.println(message);
+    for (uint8_t i = 0; i < batchCount; i++)
+    {
+        if (batch[i].epoch == 0)
+        {
+            batch[i].epoch = wallClock.epochAt(batch[i].timestamp);
+        }
+    }
+    uint8_t sent = 0;
+    while (sent < batchCount && client.connected())
+    {
+        InFlight *slot = freeSlot(0);
+        if (!slot)
+        {
+            DebugSerial.println("Đang chờ PUBACK, lưu dữ liệu vào flash...");
+            break;
+        }
+        uint8_t n = publishBatch(batch + sent, batchCount - sent, *slot);
+        if (n == 0)
+        {
+            DebugSerial.println("Failed to publish to MQTT!");
+            break;
+        }
+        slot->stored = false;
+        memcpy(slot->readings, batch + sent, n * sizeof(MeterReadings));
+        commitSlot();
+        sent += n;
+    }
+    if (sent < batchCount)
+    {
+        if (!client.connected())
+        {
+            DebugSerial.println("No MQTT connection! Lưu dữ liệu vào flash...");
+        }
+        addToBuffer(batch + sent, batchCount - sent);
+    }
+    batchCount = 0;
+}
 
-    // Handle control messages here if needed
-    // For example: restart, change reading interval, etc.
+// Publishes as many of `readings` as fit in one message at QoS 1 and fills
+// in `slot` for it; returns how many, 0 on failure
+uint8_t DataSender::publishBatch(const MeterReadings *readings, uint8_t count, InFlight &slot, bool dup)
+{
+    const char *topic = dataTopic;
+    size_t length;
+    if (payloadFormat == PAYLOAD_BINARY)
+    {
+        unsigned long heartbeat = reportPolicy.byException ? reportPolicy.heartbeat / 1000 : 0;
+        length = BinaryPayload::encode(serialNumber, heartbeat, readings, count, payload, sizeof(payload));
+        topic = binTopic;
+    }
+    else
+    {
+        length = createPayload(readings, count);
+    }
+    if (length == 0 || !client.publish(topic, payload, length, 1, &slot.packetId, dup))
+    {
+        return 0;
+    }
+    slot.acked = false;
+    slot.sentAt = millis();
+    slot.count = count;
+    DebugSerial.printf("Data sent to MQTT (%u readings, %u bytes%s, id %u)\n", count, (unsigned)length,
+                       payloadFormat == PAYLOAD_BINARY ? " binary" : "", slot.packetId);
+    return count;
 }
 
-void DataSender::sendData(float voltage, float current, float power, float energy)
+// Next slot of the in-flight window, nullptr if fewer than `reserve` would be left after it
+DataSender::InFlight *DataSender::freeSlot(uint8_t reserve)
 {
-    if (client.connected())
+    if (inFlightCount + reserve >= MAX_IN_FLIGHT)
     {
-        String topic = "meter/" + String(deviceId) + "/data";
-        String payload = createPayload(serialNumber, voltage, current, power, energy);
+        return nullptr;
+    }
+    return &inFlight[(inFlightHead + inFlightCount) % MAX_IN_FLIGHT];
+}
 
-        if (client.publish(topic.c_str(), payload.c_str()))
+void DataSender::commitSlot()
+{
+    inFlightCount++;
+}
+
+void DataSender::onPublishAck(uint16_t packetId)
+{
+    for (uint8_t i = 0; i < inFlightCount; i++)
+    {
+        InFlight &slot = inFlight[(inFlightHead + i) % MAX_IN_FLIGHT];
+        if (slot.packetId == packetId)
+        {
+            slot.acked = true;
+            break;
+        }
+    }
+    releaseAcked();
+}
+
+// Frees acknowledged messages from the front of the window. PUBACKs come in
+// publish order, so the log is acknowledged in order as well.
+void DataSender::releaseAcked()
+{
+    while (inFlightCount > 0 && inFlight[inFlightHead].acked)
+    {
+        InFlight &slot = inFlight[inFlightHead];
+        if (slot.stored && slot.records > 0)
+        {
+            backlog.acknowledge(slot.end, slot.records);
+        }
+        deliveryStats.delivered += slot.count;
+        inFlightHead = (inFlightHead + 1) % MAX_IN_FLIGHT;
+        inFlightCount--;
+    }
+}
+
+bool DataSender::storedInFlight() const
+{
+    for (uint8_t i = 0; i < inFlightCount; i++)
+    {
+        if (inFlight[(inFlightHead + i) % MAX_IN_FLIGHT].stored)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The connection dropped: live readings without a PUBACK go to flash and
+// the backlog is read again from its read position
+void DataSender::abandonInFlight()
+{
+    releaseAcked();
+    // Live readings requeued right behind what was published are resent with DUP too
+    bool allPublished = !publishedEnd.before(backlog.writePosition());
+    bool inOrder = true; // every stored message before this one was acknowledged
+    for (uint8_t i = 0; i < inFlightCount; i++)
+    {
+        InFlight &slot = inFlight[(inFlightHead + i) % MAX_IN_FLIGHT];
+        if (slot.acked)
+        {
+            deliveryStats.delivered += slot.count;
+            if (slot.stored && slot.records > 0 && inOrder)
+            {
+                backlog.acknowledge(slot.end, slot.records);
+            }
+        }
+        else if (slot.stored)
         {
-            Serial.printf("Data sent to MQTT: %s\n", payload.c_str());
-            sendBufferedData();
+            inOrder = false;
         }
         else
         {
-            Serial.println("Failed to publish to MQTT!");
-            addToBuffer(voltage, current, power, energy);
+            addToBuffer(slot.readings, slot.count);
+            deliveryStats.requeued += slot.count;
         }
     }
-    else
+    inFlightCount = 0;
+    if (allPublished)
     {
-        Serial.println("No MQTT connection! Lưu dữ liệu vào buffer...");
-        addToBuffer(voltage, current, power, energy);
+        publishedEnd = backlog.writePosition();
     }
+    drainNext = backlog.readPosition();
+    drainCount = drainSent = 0;
 }
 
-void DataSender::addToBuffer(float voltage, float current, float power, float energy)
+// Stores readings on flash, delta coded, as many per log record as fit.
+// Without the wall-clock time they keep their seconds since boot instead,
+// in a RECORD_UPTIME record.
+void DataSender::addToBuffer(const MeterReadings *readings, uint8_t count)
 {
-    if (bufferCount < BUFFER_SIZE)
+    uint8_t record[SegmentLog::MAX_RECORD];
+    bool uptime = !wallClock.synced();
+    while (count > 0)
     {
-        dataBuffer[bufferIndex].voltage = voltage;
-        dataBuffer[bufferIndex].current = current;
-        dataBuffer[bufferIndex].power = power;
-        dataBuffer[bufferIndex].energy = energy;
-        dataBuffer[bufferIndex].timestamp = millis();
-        bufferIndex = (bufferIndex + 1) % BUFFER_SIZE;
-        bufferCount++;
-        Serial.printf("Đã lưu dữ liệu vào buffer (%d/%d)\n", bufferCount, BUFFER_SIZE);
+        storedCodec.reset();
+        size_t length = 2;
+        uint8_t n = 0;
+        while (n < count)
+        {
+            MeterReadings stored = readings[n];
+            if (uptime)
+            {
+                stored.epoch = stored.timestamp / 1000;
+            }
+            else if (stored.epoch == 0)
+            {
+                stored.epoch = wallClock.epochAt(stored.timestamp);
+            }
+            size_t used = storedCodec.encode(stored, record + length, sizeof(record) - length);
+            if (used == 0)
+            {
+                break;
+            }
+            length += used;
+            n++;
+        }
+        record[0] = uptime ? RECORD_UPTIME : RECORD_VERSION;
+        record[1] = n;
+        if (backlog.append(record, length))
+        {
+            DebugSerial.printf("Đã lưu %u kết quả vào flash (%lu bản ghi chờ gửi)\n", n, (unsigned long)backlog.pending());
+        }
+        else
+        {
+            DebugSerial.println("Không ghi được vào flash! Bỏ qua dữ liệu mới.");
+        }
+        readings += n;
+        count -= n;
     }
-    else
+}
+
+// Decodes the next stored record at `pos` into `readings`; records of an
+// unknown layout are skipped. Times since boot become wall-clock time if
+// they are of this boot and the clock is set, else 0. Returns how many readings it held, 0 at the
+// end of the log or when they would not fit in `capacity`, which leaves
+// `pos` on that record. `records` counts every log record consumed.
+uint8_t DataSender::readStored(SegmentLog::Position &pos, MeterReadings *readings, uint8_t capacity, uint16_t &records)
+{
+    uint8_t record[SegmentLog::MAX_RECORD];
+    uint16_t len;
+    SegmentLog::Position next = pos;
+    while (backlog.read(next, record, sizeof(record), len))
     {
-        Serial.println("Buffer đầy! Bỏ qua dữ liệu mới.");
+        uint8_t count = 0;
+        if (len >= 2 && (record[0] == RECORD_VERSION || record[0] == RECORD_UPTIME) && record[1] <= MAX_BATCH)
+        {
+            if (record[1] > capacity)
+            {
+                return 0;
+            }
+            storedCodec.reset();
+            size_t offset = 2;
+            for (count = 0; count < record[1]; count++)
+            {
+                size_t used = storedCodec.decode(record + offset, len - offset, readings[count]);
+                if (used == 0)
+                {
+                    count = 0;
+                    break;
+                }
+                offset += used;
+            }
+            if (record[0] == RECORD_UPTIME)
+            {
+                // Only this boot's mapping is known
+                bool thisBoot = !pos.before(bootPosition);
+                for (uint8_t i = 0; i < count; i++)
+                {
+                    readings[i].epoch = thisBoot ? wallClock.epochAtUptime(readings[i].epoch) : 0;
+                }
+            }
+        }
+        pos = next;
+        records++;
+        if (count > 0)
+        {
+            return count;
+        }
     }
+    return 0;
 }
 
+// Resends the flash backlog a few records per call, paced by a token bucket
+// so recovery after an outage does not starve sampling, the web server or
+// the MQTT keepalive
 void DataSender::sendBufferedData()
 {
-    if (bufferCount == 0)
+    if (!client.connected())
+    {
         return;
+    }
+    unsigned long now = millis();
+    uint32_t refill = (now - lastDrainRefill) * drainRate; // ms x readings/s = 1/1000 readings
+    lastDrainRefill = now;
+    drainTokens = min<uint32_t>(drainTokens + refill, DRAIN_BURST * 1000UL);
+    if (flushing)
+    {
+        drainTokens = DRAIN_BURST * 1000UL;
+    }
 
-    Serial.printf("Gửi lại %d dữ liệu từ buffer...\n", bufferCount);
+    if (backlog.empty())
+    {
+        if (draining)
+        {
+            DebugSerial.println("✅ Đã gửi hết dữ liệu lưu trong flash");
+            draining = false;
+        }
+        flushing = false;
+        return;
+    }
+    if (waitingForClock())
+    {
+        return;
+    }
+    if (!draining)
+    {
+        DebugSerial.printf("Gửi lại dữ liệu từ flash (%lu bản ghi, %u kết quả/s)...\n",
+                           (unsigned long)backlog.pending(), drainRate);
+        draining = true;
+    }
 
-    for (int i = 0; i < bufferCount; i++)
+    // Records dropped to make room may have taken the read-ahead position with them
+    SegmentLog::Position tail = backlog.readPosition();
+    if (drainNext.before(tail))
     {
-        int index = (bufferIndex - bufferCount + i + BUFFER_SIZE) % BUFFER_SIZE;
+        drainNext = tail;
+        drainCount = drainSent = 0;
+    }
 
-        String topic = "meter/" + String(deviceId) + "/data";
-        String payload = createPayload(
-            serialNumber,
-            dataBuffer[index].voltage,
-            dataBuffer[index].current,
-            dataBuffer[index].power,
-            dataBuffer[index].energy);
+    for (uint8_t pass = 0; pass < DRAIN_PER_PASS; pass++)
+    {
+        if (drainSent == drainCount)
+        {
+            // Wait for tokens for a full batch rather than trickling single readings.
+            // pending() counts records, which may hold up to MAX_BATCH readings each:
+            // no more readings are read than there are tokens for
+            uint8_t limit = min<uint32_t>(batchSize, backlog.pending());
+            uint8_t allowance = min<uint32_t>(drainTokens / 1000, MAX_BATCH);
+            if (allowance < limit)
+            {
+                return;
+            }
+            SegmentLog::Position pos = drainNext;
+            uint16_t records = 0;
+            uint8_t count = 0;
+            while (count < limit)
+            {
+                uint8_t n = readStored(pos, drainBatch + count, allowance - count, records);
+                if (n == 0)
+                {
+                    break;
+                }
+                for (; n > 0; n--, count++)
+                {
+                    drainEnd[count] = pos;
+                    drainRecords[count] = records;
+                }
+            }
+            if (count == 0)
+            {
+                // Nothing left to read but what is in flight, or only unreadable
+                // records, which can go once everything before them has
+                if (records > 0 && !storedInFlight())
+                {
+                    backlog.acknowledge(pos, records);
+                    drainNext = pos;
+                }
+                return;
+            }
+            drainTokens -= count * 1000UL;
+            drainCount = count;
+            drainSent = 0;
+            drainAttributed = 0;
+        }
 
-        if (client.publish(topic.c_str(), payload.c_str()))
+        // One slot of the window stays free for live readings
+        InFlight *slot = freeSlot(1);
+        if (!slot)
         {
-            Serial.printf("Gửi lại thành công: %s\n", payload.c_str());
+            return;
         }
-        else
+        SegmentLog::Position start = drainSent ? drainEnd[drainSent - 1] : drainNext;
+        uint8_t sent = publishBatch(drainBatch + drainSent, drainCount - drainSent, *slot, start.before(publishedEnd));
+        if (sent == 0)
         {
-            Serial.println("Gửi lại thất bại");
-            break;
+            // Stays in the log; retried on a later pass
+            DebugSerial.println("Gửi lại thất bại");
+            return;
+        }
+        if (publishedEnd.before(drainEnd[drainSent + sent - 1]))
+        {
+            publishedEnd = drainEnd[drainSent + sent - 1];
+        }
+
+        // A record split over several messages leaves the log with its last one
+        uint8_t done = drainSent + sent;
+        while (done > drainSent && done < drainCount && drainRecords[done - 1] == drainRecords[done])
+        {
+            done--;
+        }
+        slot->stored = true;
+        slot->records = 0;
+        if (done > drainSent)
+        {
+            slot->end = drainEnd[done - 1];
+            slot->records = drainRecords[done - 1] - drainAttributed;
+            drainAttributed = drainRecords[done - 1];
+        }
+        commitSlot();
+
+        drainSent += sent;
+        if (drainSent == drainCount)
+        {
+            drainNext = drainEnd[drainCount - 1];
         }
-        delay(1000);
     }
+}
 
-    bufferCount = 0;
-    bufferIndex = 0;
-    Serial.println("Đã xóa buffer!");
+void DataSender::addReadingFields(JsonWriter &json, const MeterReadings &readings)
+{
+    // Means get one decimal more than the PZEM resolution
+    json.field("voltage", readings.voltage, 2);
+    json.field("current", readings.current, 4);
+    json.field("power", readings.power, 2);
+    json.field("energy", readings.energy, 3);
+    json.field("frequency", readings.frequency, 2);
+    json.field("pf", readings.pf, 3);
+    json.field("alarm", readings.alarm);
+    json.field("samples", (uint32_t)readings.samples);
+    if (readings.seq != 0)
+    {
+        json.field("seq", readings.seq);
+    }
+    json.field("voltage_min", readings.voltageMin, 1);
+    json.field("voltage_max", readings.voltageMax, 1);
+    json.field("current_min", readings.currentMin, 3);
+    json.field("current_max", readings.currentMax, 3);
+    json.field("power_min", readings.powerMin, 1);
+    json.field("power_max", readings.powerMax, 1);
+    json.field("energy_delta", readings.energyDelta, 3);
+    if (readings.phase != 0)
+    {
+        json.field("phase", (uint32_t)readings.phase);
+    }
+    // Left out while the time is unknown: the dashboard then takes the arrival time
+    if (readings.epoch != 0)
+    {
+        char timestamp[24];
+        formatTimestamp(readings.epoch, timestamp, sizeof(timestamp));
+        json.field("timestamp", timestamp);
+    }
 }
 
-String DataSender::createPayload(String serial_number, float voltage, float current, float power, float energy)
+// JSON for `count` readings into `payload`. One reading keeps the flat
+// format; several become {"serial_number", "device_id", "readings": [...]}
+// with as many as fit, and `count` is lowered to that number. Returns the
+// length, 0 if not even one reading fits.
+size_t DataSender::createPayload(const MeterReadings *readings, uint8_t &count)
 {
-    JsonDocument doc;
-    doc["serial_number"] = serial_number;
-    doc["device_id"] = deviceId;
-    doc["voltage"] = voltage;
-    doc["current"] = current;
-    doc["power"] = power;
-    doc["energy"] = energy;
-    doc["timestamp"] = getTimestamp();
+    JsonWriter json((char *)payload, sizeof(payload));
+    json.beginObject();
+    json.field("serial_number", serialNumber.c_str());
+    json.field("device_id", deviceId.c_str());
+    if (reportPolicy.byException)
+    {
+        // Longest silence in seconds, so the dashboard can tell "unchanged" from "offline"
+        json.field("heartbeat", (uint32_t)(reportPolicy.heartbeat / 1000));
+    }
+
+    if (count == 1)
+    {
+        addReadingFields(json, readings[0]);
+    }
+    else
+    {
+        json.beginArray("readings");
+        for (uint8_t i = 0; i < count; i++)
+        {
+            // Room is kept for closing the array and the object
+            JsonWriter::Mark mark = json.mark();
+            json.beginObject();
+            addReadingFields(json, readings[i]);
+            json.endObject();
+            if (!json.ok() || json.size() + 2 >= sizeof(payload) - 1)
+            {
+                json.rewind(mark);
+                count = i;
+                break;
+            }
+        }
+        json.endArray();
+    }
+    json.endObject();
+    return json.ok() && count > 0 ? json.size() : 0;
+}
 
-    String output;
-    serializeJson(doc, output);
-    return output;
+void DataSender::formatTimestamp(uint32_t epoch, char *out, size_t size)
+{
+    time_t time = epoch;
+    struct tm timeinfo;
+    gmtime_r(&time, &timeinfo);
+    strftime(out, size, "%Y-%m-%dT%H:%M:%SZ", &timeinfo);
 }
 
-String DataSender::getTimestamp()
+// Until SNTP has set the clock, or for CLOCK_WAIT after boot if it never does
+bool DataSender::waitingForClock() const
 {
-    time_t now = time(nullptr);
-    struct tm *timeinfo = gmtime(&now);
-    char buffer[30];
-    strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", timeinfo);
-    return String(buffer);
+    return !wallClock.synced() && millis() < CLOCK_WAIT;
 }
 
 bool DataSender::isConnected()
@@ -0,0 +1,164 @@
+#include "DeltaCodec.h"
+
+namespace
+{
+    // Measurements in coding order, with the number of units per unit of the reading
+    struct Measurement
+    {
+        float MeterReadings::*field;
+        float scale;
+    };
+
+    const Measurement MEASUREMENT_FIELDS[DeltaCodec::MEASUREMENTS] = {
+        {&MeterReadings::voltage, 100},
+        {&MeterReadings::current, 10000},
+        {&MeterReadings::power, 100},
+        {&MeterReadings::energy, 1000},
+        {&MeterReadings::frequency, 100},
+        {&MeterReadings::pf, 1000},
+        {&MeterReadings::voltageMin, 10},
+        {&MeterReadings::voltageMax, 10},
+        {&MeterReadings::currentMin, 1000},
+        {&MeterReadings::currentMax, 1000},
+        {&MeterReadings::powerMin, 10},
+        {&MeterReadings::powerMax, 10},
+        {&MeterReadings::energyDelta, 1000},
+    };
+
+    const float FIXED_LIMIT = 2.0e9f; // keeps scaled values inside int32_t
+}
+
+void DeltaCodec::reset()
+{
+    memset(previous, 0, sizeof(previous));
+    memset(seen, 0, sizeof(seen));
+    lastStream = -1;
+}
+
+const int64_t *DeltaCodec::reference(uint8_t stream) const
+{
+    if (seen[stream] || lastStream < 0)
+    {
+        return previous[stream];
+    }
+    return previous[lastStream];
+}
+
+uint8_t *DeltaCodec::putVarint(uint8_t *p, const uint8_t *end, uint64_t value)
+{
+    while (p && p < end)
+    {
+        if (value < 0x80)
+        {
+            *p++ = (uint8_t)value;
+            return p;
+        }
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    return nullptr;
+}
+
+const uint8_t *DeltaCodec::getVarint(const uint8_t *p, const uint8_t *end, uint64_t &value)
+{
+    value = 0;
+    for (uint8_t shift = 0; p && p < end && shift < 64; shift += 7)
+    {
+        uint8_t b = *p++;
+        value |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+size_t DeltaCodec::encode(const MeterReadings &readings, uint8_t *out, size_t size)
+{
+    uint8_t s = stream(readings.phase);
+    const int64_t *last = reference(s);
+    int64_t fields[FIELDS];
+    uint32_t header = readings.alarm ? 1 : 0;
+    fields[0] = readings.epoch;
+    fields[1] = readings.samples;
+    fields[SEQ_FIELD] = readings.seq;
+    for (uint8_t i = 0; i < MEASUREMENTS; i++)
+    {
+        float value = readings.*MEASUREMENT_FIELDS[i].field * MEASUREMENT_FIELDS[i].scale;
+        if (isnan(value))
+        {
+            header |= 2UL << i;
+            fields[HEAD_FIELDS + i] = last[HEAD_FIELDS + i];
+            continue;
+        }
+        fields[HEAD_FIELDS + i] = lroundf(constrain(value, -FIXED_LIMIT, FIXED_LIMIT));
+    }
+
+    const uint8_t *end = out + size;
+    uint8_t *p = putVarint(out, end, header);
+    p = putVarint(p, end, readings.phase);
+    for (uint8_t i = 0; i < FIELDS; i++)
+    {
+        // A missing measurement is not written and keeps its reference
+        if (i < HEAD_FIELDS || !(header & (2UL << (i - HEAD_FIELDS))))
+        {
+            p = putVarint(p, end, zigzag(fields[i] - last[i]));
+        }
+    }
+    if (!p)
+    {
+        return 0;
+    }
+    memcpy(previous[s], fields, sizeof(fields));
+    seen[s] = true;
+    lastStream = s;
+    return p - out;
+}
+
+size_t DeltaCodec::decode(const uint8_t *in, size_t size, MeterReadings &readings)
+{
+    const uint8_t *end = in + size;
+    uint64_t header, phase;
+    const uint8_t *p = getVarint(in, end, header);
+    p = getVarint(p, end, phase);
+    if (!p || header >> (1 + MEASUREMENTS) || phase > UINT8_MAX)
+    {
+        return 0;
+    }
+
+    uint8_t s = stream(phase);
+    const int64_t *last = reference(s);
+    int64_t fields[FIELDS];
+    for (uint8_t i = 0; i < FIELDS; i++)
+    {
+        fields[i] = last[i];
+        if (i < HEAD_FIELDS || !(header & (2UL << (i - HEAD_FIELDS))))
+        {
+            uint64_t delta;
+            p = getVarint(p, end, delta);
+            fields[i] += unzigzag(delta);
+        }
+    }
+    if (!p)
+    {
+        return 0;
+    }
+    memcpy(previous[s], fields, sizeof(fields));
+    seen[s] = true;
+    lastStream = s;
+
+    memset(&readings, 0, sizeof(readings));
+    readings.alarm = header & 1;
+    readings.phase = phase;
+    readings.epoch = fields[0];
+    readings.samples = fields[1];
+    readings.seq = fields[SEQ_FIELD];
+    for (uint8_t i = 0; i < MEASUREMENTS; i++)
+    {
+        readings.*MEASUREMENT_FIELDS[i].field = header & (2UL << i)
+                                                    ? NAN
+                                                    : fields[HEAD_FIELDS + i] / MEASUREMENT_FIELDS[i].scale;
+    }
+    return p - in;
+}
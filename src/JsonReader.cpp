@@ -0,0 +1,302 @@
+#include "JsonReader.h"
+
+JsonReader::JsonReader(char *buffer, size_t length)
+    : pos(buffer), end(buffer + length), failed(false), started(false), finished(false),
+      keyText(""), valueType(NONE), valueText(""), valueLength(0)
+{
+}
+
+bool JsonReader::fail()
+{
+    failed = true;
+    valueType = NONE;
+    return false;
+}
+
+void JsonReader::skipSpace()
+{
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n'))
+    {
+        pos++;
+    }
+}
+
+bool JsonReader::consume(char c)
+{
+    if (pos < end && *pos == c)
+    {
+        pos++;
+        return true;
+    }
+    return false;
+}
+
+bool JsonReader::literal(const char *text)
+{
+    size_t length = strlen(text);
+    if ((size_t)(end - pos) < length || memcmp(pos, text, length) != 0)
+    {
+        return false;
+    }
+    valueText = pos;
+    valueLength = length;
+    pos += length;
+    return true;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// At the opening quote; unescapes the string over itself. The written text
+// never runs ahead of what was read, so the terminating NUL lands at the
+// latest on the closing quote.
+char *JsonReader::readString()
+{
+    char *start = ++pos;
+    char *out = start;
+    while (pos < end)
+    {
+        char c = *pos++;
+        if (c == '"')
+        {
+            *out = '\0';
+            return start;
+        }
+        if ((uint8_t)c < 0x20)
+        {
+            return nullptr;
+        }
+        if (c != '\\')
+        {
+            *out++ = c;
+            continue;
+        }
+        if (pos >= end)
+        {
+            return nullptr;
+        }
+        c = *pos++;
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            *out++ = c;
+            break;
+        case 'b':
+            *out++ = '\b';
+            break;
+        case 'f':
+            *out++ = '\f';
+            break;
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        case 't':
+            *out++ = '\t';
+            break;
+        case 'u':
+        {
+            // Six characters in, three bytes of UTF-8 out at most
+            if (end - pos < 4)
+            {
+                return nullptr;
+            }
+            uint16_t code = 0;
+            for (uint8_t i = 0; i < 4; i++)
+            {
+                int digit = hexValue(*pos++);
+                if (digit < 0)
+                {
+                    return nullptr;
+                }
+                code = code << 4 | digit;
+            }
+            if (code < 0x80)
+            {
+                *out++ = (char)code;
+            }
+            else if (code < 0x800)
+            {
+                *out++ = (char)(0xC0 | code >> 6);
+                *out++ = (char)(0x80 | (code & 0x3F));
+            }
+            else
+            {
+                *out++ = (char)(0xE0 | code >> 12);
+                *out++ = (char)(0x80 | (code >> 6 & 0x3F));
+                *out++ = (char)(0x80 | (code & 0x3F));
+            }
+            break;
+        }
+        default:
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// After the closing brace; only white space may follow
+bool JsonReader::finish()
+{
+    skipSpace();
+    if (pos != end)
+    {
+        return fail();
+    }
+    finished = true;
+    valueType = NONE;
+    return false;
+}
+
+bool JsonReader::digits()
+{
+    const char *start = pos;
+    while (pos < end && isDigit(*pos))
+    {
+        pos++;
+    }
+    return pos != start;
+}
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?, followed by a delimiter
+bool JsonReader::readNumber()
+{
+    consume('-');
+    if (consume('0'))
+    {
+        if (pos < end && isDigit(*pos))
+        {
+            return false;
+        }
+    }
+    else if (!digits())
+    {
+        return false;
+    }
+    if (consume('.') && !digits())
+    {
+        return false;
+    }
+    if (consume('e') || consume('E'))
+    {
+        if (!consume('+'))
+        {
+            consume('-');
+        }
+        if (!digits())
+        {
+            return false;
+        }
+    }
+    // "1-2", "1x": not a number
+    return pos == end || *pos == ',' || *pos == '}' || *pos == ' ' || *pos == '\t' || *pos == '\r' || *pos == '\n';
+}
+
+bool JsonReader::next()
+{
+    if (failed || finished)
+    {
+        return false;
+    }
+    skipSpace();
+    if (!started)
+    {
+        if (!consume('{'))
+        {
+            return fail();
+        }
+        started = true;
+        skipSpace();
+        if (consume('}'))
+        {
+            return finish();
+        }
+    }
+    else
+    {
+        if (consume('}'))
+        {
+            return finish();
+        }
+        if (!consume(','))
+        {
+            return fail();
+        }
+        skipSpace();
+    }
+
+    if (pos >= end || *pos != '"' || !(keyText = readString()))
+    {
+        return fail();
+    }
+    skipSpace();
+    if (!consume(':'))
+    {
+        return fail();
+    }
+    skipSpace();
+    if (pos >= end)
+    {
+        return fail();
+    }
+
+    char c = *pos;
+    if (c == '"')
+    {
+        char *text = readString();
+        if (!text)
+        {
+            return fail();
+        }
+        valueType = STRING;
+        valueText = text;
+        valueLength = strlen(text);
+    }
+    else if (c == '-' || isDigit(c))
+    {
+        valueText = pos;
+        if (!readNumber())
+        {
+            return fail();
+        }
+        valueType = NUMBER;
+        valueLength = pos - valueText;
+    }
+    else if (literal("true") || literal("false"))
+    {
+        valueType = BOOLEAN;
+    }
+    else if (literal("null"))
+    {
+        valueType = NULL_VALUE;
+    }
+    else
+    {
+        return fail();
+    }
+    return true;
+}
+
+bool JsonReader::numberText(char *out, size_t size) const
+{
+    if (valueType != NUMBER || valueLength + 1 > size)
+    {
+        return false;
+    }
+    memcpy(out, valueText, valueLength);
+    out[valueLength] = '\0';
+    return true;
+}
+
@@ -0,0 +1,197 @@
+#include "JsonWriter.h"
+
+JsonWriter::JsonWriter(char *buffer, size_t size)
+    : buffer(buffer), capacity(size), length(0), overflow(size == 0), depth(0)
+{
+    if (size > 0)
+    {
+        buffer[0] = '\0';
+    }
+    first[0] = true;
+}
+
+void JsonWriter::raw(char c)
+{
+    // Keep room for the terminating NUL
+    if (length + 1 >= capacity)
+    {
+        overflow = true;
+        return;
+    }
+    buffer[length++] = c;
+    buffer[length] = '\0';
+}
+
+void JsonWriter::raw(const char *text)
+{
+    while (*text && !overflow)
+    {
+        raw(*text++);
+    }
+}
+
+void JsonWriter::quoted(const char *text)
+{
+    raw('"');
+    for (; *text && !overflow; text++)
+    {
+        if (*text == '"' || *text == '\\')
+        {
+            raw('\\');
+        }
+        if ((uint8_t)*text >= 0x20)
+        {
+            raw(*text);
+        }
+    }
+    raw('"');
+}
+
+void JsonWriter::number(uint64_t value)
+{
+    char digits[21];
+    char *p = digits + sizeof(digits);
+    *--p = '\0';
+    do
+    {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    raw(p);
+}
+
+void JsonWriter::separator()
+{
+    if (!first[depth])
+    {
+        raw(',');
+    }
+    first[depth] = false;
+}
+
+void JsonWriter::key(const char *name)
+{
+    separator();
+    if (name)
+    {
+        quoted(name);
+        raw(':');
+    }
+}
+
+void JsonWriter::beginObject()
+{
+    separator();
+    raw('{');
+    if (depth + 1 < MAX_DEPTH)
+    {
+        first[++depth] = true;
+    }
+}
+
+void JsonWriter::endObject()
+{
+    raw('}');
+    if (depth > 0)
+    {
+        depth--;
+    }
+}
+
+void JsonWriter::beginArray(const char *name)
+{
+    key(name);
+    raw('[');
+    if (depth + 1 < MAX_DEPTH)
+    {
+        first[++depth] = true;
+    }
+}
+
+void JsonWriter::endArray()
+{
+    raw(']');
+    if (depth > 0)
+    {
+        depth--;
+    }
+}
+
+void JsonWriter::field(const char *name, const char *value)
+{
+    key(name);
+    quoted(value);
+}
+
+void JsonWriter::field(const char *name, uint32_t value)
+{
+    key(name);
+    number(value);
+}
+
+void JsonWriter::field(const char *name, bool value)
+{
+    key(name);
+    raw(value ? "true" : "false");
+}
+
+void JsonWriter::field(const char *name, float value, uint8_t decimals)
+{
+    key(name);
+    if (isnan(value) || isinf(value))
+    {
+        raw("null");
+        return;
+    }
+    if (value < 0)
+    {
+        raw('-');
+        value = -value;
+    }
+
+    decimals = min<uint8_t>(decimals, 9);
+    uint32_t scale = 1;
+    for (uint8_t i = 0; i < decimals; i++)
+    {
+        scale *= 10;
+    }
+    if (value * scale >= 1.8e19f)
+    {
+        raw("null");
+        return;
+    }
+    uint64_t fixed = (uint64_t)(value * scale + 0.5f);
+    number(fixed / scale);
+
+    uint32_t fraction = fixed % scale;
+    while (decimals > 0 && fraction % 10 == 0)
+    {
+        fraction /= 10;
+        decimals--;
+    }
+    if (decimals == 0)
+    {
+        return;
+    }
+    char digits[10];
+    for (int8_t i = decimals - 1; i >= 0; i--)
+    {
+        digits[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+    digits[decimals] = '\0';
+    raw('.');
+    raw(digits);
+}
+
+void JsonWriter::rewind(const Mark &mark)
+{
+    if (mark.length <= length)
+    {
+        length = mark.length;
+        buffer[length] = '\0';
+        depth = mark.depth;
+        first[depth] = mark.first;
+        overflow = false;
+    }
+}
@@ -1,50 +1,299 @@
 #include <Arduino.h>
 #include <SoftwareSerial.h>
-#include <PZEM004Tv30.h>
 #include "Meter.h"
+#include "DebugSerial.h"
 #include "types/DataTypes.h"
 
+// PZEM-004T v3 input registers (function 0x04)
+#define REG_VOLTAGE 0x0000   // 0.1 V
+#define REG_CURRENT 0x0001   // 0.001 A, 32 bit
+#define REG_POWER 0x0003     // 0.1 W, 32 bit
+#define REG_ENERGY 0x0005    // 1 Wh, 32 bit
+#define REG_FREQUENCY 0x0007 // 0.1 Hz
+#define REG_PF 0x0008        // 0.01
+#define REG_ALARM 0x0009     // 0xFFFF = alarm, 0x0000 = ok
+#define REG_COUNT 10
+
 Meter::Meter(int rxPin, int txPin)
-    : pzemSerial(rxPin, txPin), pzem(pzemSerial)
+    : softSerial(new SoftwareSerial(rxPin, txPin)), hwSerial(nullptr), modbus(*softSerial),
+      slaveTotal(0), current(-1), ready(false), stats()
 {
-    pzemSerial.begin(9600);
+    pollTimer.set(POLL_INTERVAL);
+    setAddresses("");
+    invalidate(readings);
+    readings.phase = 0;
 }
 
-MeterReadings Meter::getReadings()
+Meter::Meter(HardwareSerial &uart)
+    : softSerial(nullptr), hwSerial(&uart), modbus(uart),
+      slaveTotal(0), current(-1), ready(false), stats()
+{
+    pollTimer.set(POLL_INTERVAL);
+    setAddresses("");
+    invalidate(readings);
+    readings.phase = 0;
+}
+
+Meter::~Meter()
 {
-    MeterReadings readings;
-    readings.voltage = pzem.voltage();
-    readings.current = pzem.current();
-    readings.power = pzem.power();
-    readings.energy = pzem.energy();
-    // Kiểm tra giá trị trả về
-    if (isnan(readings.voltage) || isnan(readings.current) || isnan(readings.power) || isnan(readings.energy)) {
-        readings.voltage = readings.current = readings.power = readings.energy = NAN;
+    delete softSerial;
+}
+
+void Meter::begin()
+{
+    if (hwSerial)
+    {
+        hwSerial->begin(9600);
+        // RX/TX move from GPIO3/GPIO1 to GPIO13/GPIO15, away from the USB bridge
+        hwSerial->swap();
     }
-    return readings;
+    else
+    {
+        softSerial->begin(9600);
+    }
+}
+
+bool Meter::setAddresses(const String &list)
+{
+    uint8_t addresses[MAX_SLAVES];
+    uint8_t count = 0;
+    int start = 0;
+    while (start < (int)list.length())
+    {
+        int comma = list.indexOf(',', start);
+        String item = list.substring(start, comma < 0 ? list.length() : comma);
+        item.trim();
+        start = comma < 0 ? list.length() : comma + 1;
+        if (item.length() == 0)
+        {
+            continue;
+        }
+
+        long address = item.startsWith("0x") ? strtol(item.c_str() + 2, nullptr, 16) : item.toInt();
+        if (address < 1 || address > 0xF7 || count == MAX_SLAVES)
+        {
+            DebugSerial.printf("Invalid PZEM address list: %s\n", list.c_str());
+            return false;
+        }
+        addresses[count++] = (uint8_t)address;
+    }
+
+    if (count == 0)
+    {
+        addresses[count++] = PZEM_ADDRESS;
+    }
+
+    modbus.reset();
+    current = -1;
+    slaveTotal = count;
+    for (uint8_t i = 0; i < slaveTotal; i++)
+    {
+        slaves[i].address = addresses[i];
+        slaves[i].failures = 0;
+        slaves[i].skipCycles = 0;
+        invalidate(slaves[i].readings);
+        slaves[i].readings.phase = slaveTotal > 1 ? i + 1 : 0;
+    }
+    return true;
+}
+
+void Meter::loop()
+{
+    switch (modbus.poll())
+    {
+    case PzemModbus::BUSY:
+        return;
+    case PzemModbus::DONE:
+        record(true);
+        break;
+    case PzemModbus::FAILED:
+        record(false);
+        break;
+    case PzemModbus::IDLE:
+        if (current < 0)
+        {
+            if (!pollTimer.due(millis()))
+            {
+                return;
+            }
+            startCycle();
+        }
+        break;
+    }
+
+    // Pipeline: the next slave is asked as soon as the previous one is done
+    if (!requestNext())
+    {
+        current = -1;
+        combine();
+        ready = true;
+    }
+}
+
+void Meter::setPollInterval(unsigned long ms)
+{
+    pollTimer.set(ms < MIN_POLL_INTERVAL ? MIN_POLL_INTERVAL : ms);
 }
 
-void Meter::syncTime()
+void Meter::startCycle()
 {
-    configTime(0, 0, "pool.ntp.org", "time.nist.gov"); // Set NTP servers
-    Serial.print("Syncing time");
-    time_t now = time(nullptr);
-    int retry = 0;
-    const int retry_count = 10;
-    while (now < 8 * 3600 * 2 && retry < retry_count)
+    current = 0;
+    for (uint8_t i = 0; i < slaveTotal; i++)
     {
-        delay(500);
-        Serial.print(".");
-        now = time(nullptr);
-        retry++;
+        if (slaves[i].skipCycles > 0)
+        {
+            slaves[i].skipCycles--;
+        }
     }
-    Serial.println();
-    if (now < 8 * 3600 * 2)
+}
+
+bool Meter::requestNext()
+{
+    if (current < 0)
     {
-        Serial.println("Failed to sync time");
+        return false;
+    }
+    while (current < slaveTotal && slaves[current].skipCycles > 0)
+    {
+        current++;
+    }
+    if (current >= slaveTotal)
+    {
+        return false;
+    }
+    return modbus.readInputRegisters(slaves[current].address, REG_VOLTAGE, REG_COUNT);
+}
+
+void Meter::record(bool valid)
+{
+    Slave &slave = slaves[current];
+    MeterReadings &r = slave.readings;
+
+    // All fields come from the same frame, so they describe the same instant
+    if (valid)
+    {
+        r.voltage = modbus.reg16(REG_VOLTAGE) / 10.0f;
+        r.current = modbus.reg32(REG_CURRENT) / 1000.0f;
+        r.power = modbus.reg32(REG_POWER) / 10.0f;
+        r.energy = modbus.reg32(REG_ENERGY) / 1000.0f; // kWh
+        r.frequency = modbus.reg16(REG_FREQUENCY) / 10.0f;
+        r.pf = modbus.reg16(REG_PF) / 100.0f;
+        r.alarm = modbus.reg16(REG_ALARM) != 0;
+        r.samples = 1;
+        single(r);
+        slave.failures = 0;
+        stats.frames++;
     }
     else
     {
-        Serial.println("Time synced!");
+        if (modbus.lastError() == PzemModbus::ERR_TIMEOUT)
+        {
+            stats.timeouts++;
+        }
+        else
+        {
+            stats.badFrames++;
+        }
+        invalidate(r);
+        // A dead slave must not eat a full timeout every cycle
+        if (slave.failures < OFFLINE_AFTER_FAILURES)
+        {
+            slave.failures++;
+        }
+        if (slave.failures >= OFFLINE_AFTER_FAILURES)
+        {
+            slave.skipCycles = OFFLINE_PROBE_CYCLES;
+        }
+    }
+    r.timestamp = millis();
+    modbus.reset();
+    current++;
+}
+
+void Meter::combine()
+{
+    if (slaveTotal == 1)
+    {
+        readings = slaves[0].readings;
+        return;
+    }
+
+    MeterReadings total;
+    invalidate(total);
+    total.phase = 0;
+    float apparent = 0;
+    uint8_t valid = 0;
+    for (uint8_t i = 0; i < slaveTotal; i++)
+    {
+        const MeterReadings &r = slaves[i].readings;
+        if (isnan(r.voltage))
+        {
+            continue;
+        }
+        if (valid == 0)
+        {
+            total.voltage = total.current = total.power = total.energy = total.frequency = 0;
+        }
+        valid++;
+        total.voltage += r.voltage;
+        total.current += r.current;
+        total.power += r.power;
+        total.energy += r.energy;
+        total.frequency += r.frequency;
+        total.alarm = total.alarm || r.alarm;
+        apparent += r.voltage * r.current;
     }
-}
\ No newline at end of file
+    if (valid > 0)
+    {
+        // Phase voltages and frequency are averaged, the rest adds up
+        total.voltage /= valid;
+        total.frequency /= valid;
+        total.pf = apparent > 0 ? total.power / apparent : 0;
+        total.samples = 1;
+        single(total);
+    }
+    total.timestamp = millis();
+    readings = total;
+}
+
+void Meter::invalidate(MeterReadings &r)
+{
+    r.voltage = r.current = r.power = r.energy = NAN;
+    r.frequency = r.pf = NAN;
+    r.alarm = false;
+    r.samples = 0;
+    single(r);
+    r.timestamp = millis();
+}
+
+void Meter::single(MeterReadings &r)
+{
+    r.voltageMin = r.voltageMax = r.voltage;
+    r.currentMin = r.currentMax = r.current;
+    r.powerMin = r.powerMax = r.power;
+    r.energyDelta = 0;
+}
+
+bool Meter::readingsReady()
+{
+    bool wasReady = ready;
+    ready = false;
+    return wasReady;
+}
+
+MeterReadings Meter::getReadings()
+{
+    return readings;
+}
+
+MeterReadings Meter::getPhaseReadings(uint8_t phase)
+{
+    if (phase < 1 || phase > slaveTotal)
+    {
+        MeterReadings r;
+        invalidate(r);
+        r.phase = phase;
+        return r;
+    }
+    return slaves[phase - 1].readings;
+}
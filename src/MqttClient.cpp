@@ -0,0 +1,428 @@
+#include "MqttClient.h"
+
+MqttClient::MqttClient(Client &client)
+    : client(&client), host(), port(1883), currentState(DISCONNECTED), lastPacketId(0),
+      phase(IDLE), phaseStartedAt(0), connectLength(0), lastConnectMs(0), resolved(false), resolveFailed(false), brokerAddress(),
+      lastOutbound(0), lastInbound(0), pingOutstanding(false),
+      rxState(RX_HEADER), rxHeader(0), rxLength(0), rxShift(0), rxPos(0)
+{
+    // Bounds the one step of connect() that blocks
+    client.setTimeout(TCP_TIMEOUT);
+}
+
+void MqttClient::setTransport(Client &client, unsigned long connectTimeout)
+{
+    disconnect();
+    this->client = &client;
+    client.setTimeout(connectTimeout);
+}
+
+void MqttClient::setServer(const char *host, uint16_t port)
+{
+    if (strlen(host) > MAX_HOST)
+    {
+        this->host[0] = '\0';
+    }
+    else
+    {
+        strcpy(this->host, host);
+    }
+    this->port = port;
+}
+
+uint16_t MqttClient::nextPacketId()
+{
+    // 0 is not a valid identifier
+    if (++lastPacketId == 0)
+    {
+        lastPacketId = 1;
+    }
+    return lastPacketId;
+}
+
+size_t MqttClient::putLength(uint8_t *out, size_t length)
+{
+    size_t n = 0;
+    do
+    {
+        uint8_t digit = length % 128;
+        length /= 128;
+        out[n++] = length > 0 ? digit | 0x80 : digit;
+    } while (length > 0 && n < 4);
+    return n;
+}
+
+size_t MqttClient::putString(uint8_t *out, const char *text)
+{
+    size_t length = strlen(text);
+    out[0] = length >> 8;
+    out[1] = length & 0xFF;
+    memcpy(out + 2, text, length);
+    return 2 + length;
+}
+
+bool MqttClient::send(uint8_t header, const uint8_t *body, size_t length)
+{
+    uint8_t fixed[5];
+    fixed[0] = header;
+    size_t n = 1 + putLength(fixed + 1, length);
+    if (client->write(fixed, n) != n || (length > 0 && client->write(body, length) != length))
+    {
+        lost(CONNECTION_LOST);
+        return false;
+    }
+    lastOutbound = millis();
+    return true;
+}
+
+bool MqttClient::connect(const char *clientId, const char *user, const char *password)
+{
+    if (phase != IDLE)
+    {
+        return phase == ONLINE;
+    }
+    bool credentials = user && *user;
+    size_t need = 10 + 2 + strlen(clientId) +
+                  (credentials ? 4 + strlen(user) + (password ? strlen(password) : 0) : 0);
+    if (!host[0] || need > sizeof(buffer))
+    {
+        currentState = CONNECT_FAILED;
+        return false;
+    }
+
+    // The CONNECT body is built now and waits in the buffer: nothing is
+    // received before it is sent
+    // Variable header: protocol "MQTT" level 4, flags, keepalive
+    static const uint8_t protocol[] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04};
+    size_t length = sizeof(protocol);
+    memcpy(buffer, protocol, length);
+    uint8_t flags = 0x02; // clean session
+    if (credentials)
+    {
+        flags |= password ? 0xC0 : 0x80;
+    }
+    buffer[length++] = flags;
+    buffer[length++] = KEEPALIVE >> 8;
+    buffer[length++] = KEEPALIVE & 0xFF;
+    length += putString(buffer + length, clientId);
+    if (credentials)
+    {
+        length += putString(buffer + length, user);
+        if (password)
+        {
+            length += putString(buffer + length, password);
+        }
+    }
+    connectLength = length;
+
+    currentState = DISCONNECTED;
+    phase = RESOLVING;
+    phaseStartedAt = millis();
+    resolved = false;
+    resolveFailed = false;
+    // Address literals and cached names come back at once
+    err_t err = dns_gethostbyname(host, &brokerAddress, dnsFound, this);
+    if (err == ERR_OK)
+    {
+        resolved = true;
+    }
+    else if (err != ERR_INPROGRESS)
+    {
+        phase = IDLE;
+        currentState = CONNECT_FAILED;
+        return false;
+    }
+    advanceConnect();
+    return true;
+}
+
+void MqttClient::dnsFound(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    (void)name;
+    MqttClient *self = static_cast<MqttClient *>(arg);
+    if (self->phase != RESOLVING)
+    {
+        return; // an attempt that has timed out
+    }
+    if (ipaddr)
+    {
+        self->brokerAddress = *ipaddr;
+        self->resolved = true;
+    }
+    else
+    {
+        self->resolveFailed = true;
+    }
+}
+
+void MqttClient::advanceConnect()
+{
+    unsigned long now = millis();
+    if (phase == RESOLVING)
+    {
+        if (resolveFailed || (!resolved && now - phaseStartedAt >= DNS_TIMEOUT))
+        {
+            phase = IDLE;
+            currentState = CONNECT_FAILED;
+            return;
+        }
+        if (!resolved)
+        {
+            return;
+        }
+        rxState = RX_HEADER;
+        pingOutstanding = false;
+        phase = WAIT_CONNACK;
+        phaseStartedAt = now;
+        unsigned long started = millis();
+        bool opened = client->connect(IPAddress(&brokerAddress), port);
+        lastConnectMs = millis() - started;
+        if (!opened || !send(CONNECT, buffer, connectLength))
+        {
+            client->stop();
+            phase = IDLE;
+            currentState = CONNECT_FAILED;
+        }
+        return;
+    }
+
+    // WAIT_CONNACK
+    if (!readPacket())
+    {
+        if (phase == WAIT_CONNACK && (!client->connected() || millis() - phaseStartedAt >= CONNECT_TIMEOUT))
+        {
+            lost(client->connected() ? CONNECTION_TIMEOUT : CONNECTION_LOST);
+        }
+        return;
+    }
+    if ((rxHeader & 0xF0) != CONNACK || rxLength != 2 || buffer[1] != 0)
+    {
+        lost((rxHeader & 0xF0) == CONNACK && rxLength == 2 ? (int)buffer[1] : (int)CONNECT_FAILED);
+        return;
+    }
+    phase = ONLINE;
+    currentState = CONNECTED;
+    lastInbound = millis();
+}
+
+void MqttClient::disconnect()
+{
+    if (phase == ONLINE)
+    {
+        send(DISCONNECT, nullptr, 0);
+    }
+    client->stop();
+    phase = IDLE;
+    currentState = DISCONNECTED;
+}
+
+bool MqttClient::connected()
+{
+    if (phase != ONLINE)
+    {
+        return false;
+    }
+    if (!client->connected())
+    {
+        lost(CONNECTION_LOST);
+        return false;
+    }
+    return true;
+}
+
+void MqttClient::lost(int reason)
+{
+    client->stop();
+    phase = IDLE;
+    currentState = reason;
+}
+
+// Reads what has arrived; true once a whole packet is in rxHeader / buffer
+bool MqttClient::readPacket()
+{
+    while (client->available() > 0)
+    {
+        int c = client->read();
+        if (c < 0)
+        {
+            break;
+        }
+        switch (rxState)
+        {
+        case RX_HEADER:
+            rxHeader = c;
+            rxLength = 0;
+            rxShift = 0;
+            rxPos = 0;
+            rxState = RX_LENGTH;
+            break;
+        case RX_LENGTH:
+            rxLength |= (size_t)(c & 0x7F) << rxShift;
+            rxShift += 7;
+            if (c & 0x80)
+            {
+                if (rxShift > 21)
+                {
+                    lost(CONNECTION_LOST);
+                    return false;
+                }
+                break;
+            }
+            rxState = RX_BODY;
+            if (rxLength == 0)
+            {
+                rxState = RX_HEADER;
+                return true;
+            }
+            break;
+        case RX_BODY:
+            // Bytes beyond the buffer are dropped; handlePacket() ignores such packets
+            if (rxPos < sizeof(buffer))
+            {
+                buffer[rxPos] = c;
+            }
+            if (++rxPos == rxLength)
+            {
+                rxState = RX_HEADER;
+                return true;
+            }
+            break;
+        }
+    }
+    return false;
+}
+
+void MqttClient::handlePacket()
+{
+    lastInbound = millis();
+    pingOutstanding = false;
+    bool complete = rxLength <= sizeof(buffer);
+
+    switch (rxHeader & 0xF0)
+    {
+    case PUBACK:
+        if (rxLength == 2 && ackCallback)
+        {
+            ackCallback((uint16_t)buffer[0] << 8 | buffer[1]);
+        }
+        break;
+    case PUBLISH:
+    {
+        if (rxLength < 2)
+        {
+            break;
+        }
+        uint8_t qos = (rxHeader >> 1) & 0x03;
+        size_t topicLength = (size_t)buffer[0] << 8 | buffer[1];
+        size_t offset = 2 + topicLength + (qos ? 2 : 0);
+        if (qos == 1 && offset <= rxLength && offset <= sizeof(buffer))
+        {
+            uint8_t ack[2] = {buffer[offset - 2], buffer[offset - 1]};
+            send(PUBACK, ack, sizeof(ack));
+        }
+        if (!complete || offset > rxLength || !messageCallback)
+        {
+            break;
+        }
+        // The topic moves over its length field so that it can be
+        // NUL-terminated without touching the payload
+        memmove(buffer, buffer + 2, topicLength);
+        buffer[topicLength] = '\0';
+        messageCallback((char *)buffer, buffer + offset, rxLength - offset);
+        break;
+    }
+    default:
+        // CONNACK, SUBACK, PINGRESP: nothing to do
+        break;
+    }
+}
+
+bool MqttClient::loop()
+{
+    if (connecting())
+    {
+        advanceConnect();
+    }
+    if (!connected())
+    {
+        return false;
+    }
+    // What has arrived counts before the keepalive is checked: a packet
+    // waiting in the socket is an answer, not silence
+    while (phase == ONLINE && readPacket())
+    {
+        handlePacket();
+    }
+    if (!connected())
+    {
+        return false;
+    }
+
+    unsigned long now = millis();
+    if (now - lastInbound > KEEPALIVE * 1000UL || now - lastOutbound > KEEPALIVE * 1000UL)
+    {
+        // No answer to the previous PINGREQ within a keepalive period
+        if (pingOutstanding)
+        {
+            lost(CONNECTION_TIMEOUT);
+            return false;
+        }
+        if (!send(PINGREQ, nullptr, 0))
+        {
+            return false;
+        }
+        pingOutstanding = true;
+        lastInbound = now;
+    }
+    return true;
+}
+
+bool MqttClient::subscribe(const char *topic)
+{
+    if (!connected() || strlen(topic) > MAX_TOPIC)
+    {
+        return false;
+    }
+    uint8_t body[2 + 2 + MAX_TOPIC + 1];
+    uint16_t id = nextPacketId();
+    body[0] = id >> 8;
+    body[1] = id & 0xFF;
+    size_t length = 2 + putString(body + 2, topic);
+    body[length++] = 0; // requested QoS
+    return send(SUBSCRIBE, body, length);
+}
+
+bool MqttClient::publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, uint16_t *packetId,
+                         bool dup)
+{
+    size_t topicLength = strlen(topic);
+    if (!connected() || topicLength > MAX_TOPIC)
+    {
+        return false;
+    }
+    uint8_t header[5 + 2 + MAX_TOPIC + 2];
+
+    // Fixed header, topic and packet id go out first; the payload follows as is
+    size_t variable = 2 + topicLength + (qos ? 2 : 0);
+    header[0] = PUBLISH | (qos ? 0x02 : 0) | (qos && dup ? DUP : 0);
+    size_t n = 1 + putLength(header + 1, variable + length);
+    n += putString(header + n, topic);
+    uint16_t id = 0;
+    if (qos)
+    {
+        id = nextPacketId();
+        header[n++] = id >> 8;
+        header[n++] = id & 0xFF;
+    }
+    if (client->write(header, n) != n || client->write(payload, length) != length)
+    {
+        lost(CONNECTION_LOST);
+        return false;
+    }
+    lastOutbound = millis();
+    if (packetId)
+    {
+        *packetId = id;
+    }
+    return true;
+}
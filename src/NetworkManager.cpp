@@ -1,7 +1,8 @@
 #include "NetworkManager.h"
 #include <WiFiManager.h>
+#include "DebugSerial.h"
 
-NetworkManager::NetworkManager() {}
+NetworkManager::NetworkManager() : down(false), downSince(0) {}
 
 bool NetworkManager::connect()
 {
@@ -10,26 +11,29 @@ bool NetworkManager::connect()
     // Cấu hình WiFiManager
     wm.setConfigPortalTimeout(180); // 3 phút timeout
     wm.setConnectTimeout(30); // 30 giây timeout kết nối
+#ifdef PZEM_HW_UART
+    wm.setDebugOutput(false); // WiFiManager log ra Serial, lúc này là bus PZEM
+#endif
     
     // Tạo Access Point với tên dễ nhận biết
     String apName = "PZEM_Meter_" + WiFi.macAddress().substring(12);
     apName.replace(":", "");
     
-    Serial.println("📡 Creating WiFi Access Point: " + apName);
-    Serial.println("📱 Connect to WiFi: " + apName);
-    Serial.println("🌐 Access Point IP: 192.168.4.1");
-    Serial.println("🔗 Web Config URL: http://192.168.4.1");
+    DebugSerial.println("📡 Creating WiFi Access Point: " + apName);
+    DebugSerial.println("📱 Connect to WiFi: " + apName);
+    DebugSerial.println("🌐 Access Point IP: 192.168.4.1");
+    DebugSerial.println("🔗 Web Config URL: http://192.168.4.1");
     
     bool result = wm.autoConnect(apName.c_str());
     
     if (result) {
-        Serial.println("✅ WiFi connected successfully!");
-        Serial.println("📶 SSID: " + WiFi.SSID());
-        Serial.println("🌐 IP Address: " + WiFi.localIP().toString());
-        Serial.println("🔗 Web Config: http://" + WiFi.localIP().toString());
+        DebugSerial.println("✅ WiFi connected successfully!");
+        DebugSerial.println("📶 SSID: " + WiFi.SSID());
+        DebugSerial.println("🌐 IP Address: " + WiFi.localIP().toString());
+        DebugSerial.println("🔗 Web Config: http://" + WiFi.localIP().toString());
     } else {
-        Serial.println("❌ Failed to connect WiFi");
-        Serial.println("🔄 Restarting ESP8266...");
+        DebugSerial.println("❌ Failed to connect WiFi");
+        DebugSerial.println("🔄 Restarting ESP8266...");
         ESP.restart();
     }
     
@@ -44,7 +48,7 @@ bool NetworkManager::isConnected()
 bool NetworkManager::reconnect()
 {
     if (!isConnected()) {
-        Serial.println("Đang thử kết nối lại WiFi...");
+        DebugSerial.println("Đang thử kết nối lại WiFi...");
         return connect();
     }
     return true;
@@ -56,4 +60,25 @@ bool NetworkManager::ensureConnection()
         return reconnect();
     }
     return true;
+}
+
+bool NetworkManager::supervise()
+{
+    if (isConnected()) {
+        down = false;
+        return true;
+    }
+    if (!down) {
+        down = true;
+        downSince = millis();
+    }
+    if (millis() - downSince >= PORTAL_AFTER) {
+        DebugSerial.println("⚠️ Mất WiFi quá lâu, mở cổng cấu hình...");
+        down = false;
+        if (beforePortal) {
+            beforePortal();
+        }
+        return connect();
+    }
+    return false;
 }
\ No newline at end of file
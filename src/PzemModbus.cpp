@@ -0,0 +1,128 @@
+#include "PzemModbus.h"
+
+PzemModbus::PzemModbus(Stream &port)
+    : _port(port), _status(IDLE), _error(ERR_NONE), _address(0), _function(0),
+      _expectedLen(0), _rxLen(0), _sentAt(0)
+{
+}
+
+uint16_t PzemModbus::crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+bool PzemModbus::readInputRegisters(uint8_t address, uint16_t reg, uint16_t count)
+{
+    if (_status == BUSY || count == 0 || 5 + 2 * count > MAX_FRAME)
+    {
+        return false;
+    }
+
+    // Drop late bytes from a previous timed-out exchange
+    while (_port.available())
+    {
+        _port.read();
+    }
+
+    uint8_t request[8];
+    request[0] = address;
+    request[1] = FN_READ_INPUT;
+    request[2] = reg >> 8;
+    request[3] = reg & 0xFF;
+    request[4] = count >> 8;
+    request[5] = count & 0xFF;
+    uint16_t crc = crc16(request, 6);
+    request[6] = crc & 0xFF;
+    request[7] = crc >> 8;
+    _port.write(request, sizeof(request));
+
+    _address = address;
+    _function = FN_READ_INPUT;
+    _expectedLen = (uint8_t)(5 + 2 * count);
+    _rxLen = 0;
+    _error = ERR_NONE;
+    _status = BUSY;
+    _sentAt = millis();
+    return true;
+}
+
+PzemModbus::Status PzemModbus::poll()
+{
+    if (_status != BUSY)
+    {
+        return _status;
+    }
+
+    while (_rxLen < _expectedLen && _port.available() > 0)
+    {
+        _frame[_rxLen++] = (uint8_t)_port.read();
+
+        // An exception reply is only 5 bytes long
+        if (_rxLen == 2 && _frame[1] == (_function | 0x80))
+        {
+            _expectedLen = 5;
+        }
+    }
+
+    if (_rxLen < _expectedLen)
+    {
+        if (millis() - _sentAt > RESPONSE_TIMEOUT)
+        {
+            fail(ERR_TIMEOUT);
+        }
+        return _status;
+    }
+
+    uint16_t crc = crc16(_frame, _rxLen - 2);
+    if (_frame[_rxLen - 2] != (crc & 0xFF) || _frame[_rxLen - 1] != (crc >> 8))
+    {
+        fail(ERR_CRC);
+    }
+    else if (_frame[1] == (_function | 0x80))
+    {
+        fail(ERR_EXCEPTION);
+    }
+    else if ((_address != 0xF8 && _frame[0] != _address) || _frame[1] != _function ||
+             _frame[2] != _expectedLen - 5)
+    {
+        fail(ERR_FRAME);
+    }
+    else
+    {
+        _status = DONE;
+    }
+    return _status;
+}
+
+void PzemModbus::reset()
+{
+    _status = IDLE;
+    _error = ERR_NONE;
+    _rxLen = 0;
+}
+
+void PzemModbus::fail(Error error)
+{
+    _error = error;
+    _status = FAILED;
+}
+
+uint16_t PzemModbus::reg16(uint8_t index) const
+{
+    const uint8_t *p = &_frame[3 + 2 * index];
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+uint32_t PzemModbus::reg32(uint8_t index) const
+{
+    return (uint32_t)reg16(index) | (uint32_t)reg16(index + 1) << 16;
+}
@@ -0,0 +1,126 @@
+#include "SampleWindow.h"
+
+// Fixed-point scales, matching the PZEM-004T v3 register resolution
+#define VOLTAGE_SCALE 10
+#define CURRENT_SCALE 1000
+#define POWER_SCALE 10
+#define ENERGY_SCALE 1000 // kWh -> Wh
+#define FREQUENCY_SCALE 10
+#define PF_SCALE 100
+
+void SampleWindow::Channel::add(uint32_t value)
+{
+    sum += value;
+    if (value < min)
+    {
+        min = value;
+    }
+    if (value > max)
+    {
+        max = value;
+    }
+}
+
+void SampleWindow::Channel::reset()
+{
+    sum = 0;
+    min = UINT32_MAX;
+    max = 0;
+}
+
+SampleWindow::SampleWindow() : baseEnergy(0), lastEnergy(0), haveBase(false)
+{
+    reset();
+}
+
+uint32_t SampleWindow::toFixed(float value, uint16_t scale)
+{
+    return value > 0 ? (uint32_t)(value * scale + 0.5f) : 0;
+}
+
+void SampleWindow::add(const MeterReadings &readings)
+{
+    if (isnan(readings.voltage) || samples == UINT16_MAX)
+    {
+        return;
+    }
+    voltage.add(toFixed(readings.voltage, VOLTAGE_SCALE));
+    current.add(toFixed(readings.current, CURRENT_SCALE));
+    power.add(toFixed(readings.power, POWER_SCALE));
+    frequencySum += toFixed(readings.frequency, FREQUENCY_SCALE);
+    pfSum += toFixed(readings.pf, PF_SCALE);
+
+    lastEnergy = toFixed(readings.energy, ENERGY_SCALE);
+    if (!haveBase)
+    {
+        baseEnergy = lastEnergy;
+        haveBase = true;
+    }
+    alarm = alarm || readings.alarm;
+    last = readings;
+    samples++;
+}
+
+MeterReadings SampleWindow::result() const
+{
+    MeterReadings r = last;
+    if (samples == 0)
+    {
+        r.voltage = r.current = r.power = r.energy = NAN;
+        r.frequency = r.pf = NAN;
+        r.voltageMin = r.voltageMax = r.currentMin = r.currentMax = r.powerMin = r.powerMax = NAN;
+        r.energyDelta = 0;
+        r.alarm = false;
+        r.samples = 0;
+        return r;
+    }
+
+    r.voltage = (float)voltage.sum / samples / VOLTAGE_SCALE;
+    r.voltageMin = (float)voltage.min / VOLTAGE_SCALE;
+    r.voltageMax = (float)voltage.max / VOLTAGE_SCALE;
+    r.current = (float)current.sum / samples / CURRENT_SCALE;
+    r.currentMin = (float)current.min / CURRENT_SCALE;
+    r.currentMax = (float)current.max / CURRENT_SCALE;
+    r.power = (float)power.sum / samples / POWER_SCALE;
+    r.powerMin = (float)power.min / POWER_SCALE;
+    r.powerMax = (float)power.max / POWER_SCALE;
+    r.frequency = (float)frequencySum / samples / FREQUENCY_SCALE;
+    r.pf = (float)pfSum / samples / PF_SCALE;
+
+    r.energyDelta = (float)energyDeltaWh() / ENERGY_SCALE;
+    r.alarm = alarm;
+    r.samples = samples;
+    return r;
+}
+
+uint32_t SampleWindow::energyDeltaWh() const
+{
+    if (samples == 0)
+    {
+        return 0;
+    }
+    // A counter that went backwards was reset on the PZEM
+    return lastEnergy >= baseEnergy ? lastEnergy - baseEnergy : lastEnergy;
+}
+
+void SampleWindow::reset()
+{
+    voltage.reset();
+    current.reset();
+    power.reset();
+    frequencySum = 0;
+    pfSum = 0;
+    baseEnergy = lastEnergy;
+    alarm = false;
+    last = MeterReadings();
+    last.timestamp = millis();
+    samples = 0;
+}
+
+void SampleWindow::restart()
+{
+    reset();
+    baseEnergy = 0;
+    lastEnergy = 0;
+    haveBase = false;
+}
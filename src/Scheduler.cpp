@@ -0,0 +1,115 @@
+#include "Scheduler.h"
+#include "DebugSerial.h"
+
+Scheduler::Scheduler() : tasks(), count(0), passCount(0), worstPass(0)
+{
+}
+
+int8_t Scheduler::add(const char *name, Priority priority, unsigned long periodMs, unsigned long deadlineMs,
+                      uint32_t budgetUs, TaskFunction task)
+{
+    if (count == MAX_TASKS)
+    {
+        DebugSerial.println("Too many scheduler tasks");
+        return -1;
+    }
+    Task &t = tasks[count];
+    t.function = task;
+    t.release = millis(); // the first run is due at once
+    t.lastPass = 0;
+    t.stats = {};
+    t.stats.name = name;
+    t.stats.priority = priority;
+    t.stats.period = periodMs;
+    t.stats.deadline = deadlineMs;
+    t.stats.budget = budgetUs;
+    return count++;
+}
+
+void Scheduler::run()
+{
+    uint32_t passStart = micros();
+    passCount++;
+    Task *task;
+    while ((task = next(millis())) != nullptr)
+    {
+        execute(*task, millis());
+    }
+    uint32_t us = micros() - passStart;
+    if (us > worstPass)
+    {
+        worstPass = us;
+    }
+}
+
+// The due task that has not run in this pass, by priority, then deadline
+Scheduler::Task *Scheduler::next(unsigned long now)
+{
+    Task *best = nullptr;
+    long bestSlack = 0;
+    for (uint8_t i = 0; i < count; i++)
+    {
+        Task &t = tasks[i];
+        if (t.lastPass == passCount || (long)(now - t.release) < 0)
+        {
+            continue;
+        }
+        long slack = (long)(t.release + t.stats.deadline - now);
+        if (!best || t.stats.priority < best->stats.priority ||
+            (t.stats.priority == best->stats.priority && slack < bestSlack))
+        {
+            best = &t;
+            bestSlack = slack;
+        }
+    }
+    return best;
+}
+
+void Scheduler::execute(Task &task, unsigned long now)
+{
+    TaskStats &s = task.stats;
+    unsigned long wait = now - task.release;
+    if (wait > s.deadline)
+    {
+        s.late++;
+    }
+    if (wait > s.worstWait)
+    {
+        s.worstWait = wait;
+    }
+    if (s.period)
+    {
+        task.release += s.period;
+        if ((long)(now - task.release) >= 0)
+        {
+            uint32_t behind = (now - task.release) / s.period + 1;
+            s.skipped += behind;
+            task.release += behind * s.period;
+        }
+    }
+    task.lastPass = passCount;
+
+    uint32_t start = micros();
+    task.function();
+    uint32_t us = micros() - start;
+
+    s.runs++;
+    s.totalUs += us;
+    if (us > s.budget)
+    {
+        s.overruns++;
+        if (us > s.worstUs)
+        {
+            // Only a new worst case, so a task that overruns every time does not flood the log
+            DebugSerial.printf("⚠️ Task %s: %lu us (budget %lu us)\n", s.name, (unsigned long)us, (unsigned long)s.budget);
+        }
+    }
+    if (us > s.worstUs)
+    {
+        s.worstUs = us;
+    }
+    if (!s.period)
+    {
+        task.release = millis();
+    }
+}
@@ -0,0 +1,318 @@
+#include "SegmentLog.h"
+#include "DebugSerial.h"
+
+#define RECORD_HEADER 6 // length:2 + crc32:4
+
+SegmentLog::SegmentLog()
+    : mounted(false), maxSegments(2), fsLimitSegments(2), tail{0, 0}, head(0), headBytes(0),
+      pendingRecords(0), generation(0), unsavedAcks(0), logStats()
+{
+}
+
+uint32_t SegmentLog::crc32(const uint8_t *data, size_t len, uint32_t crc)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+String SegmentLog::segmentPath(uint32_t segment) const
+{
+    char name[16];
+    snprintf(name, sizeof(name), "/%08lx.seg", (unsigned long)segment);
+    return dir + name;
+}
+
+String SegmentLog::cursorPath(uint8_t slot) const
+{
+    return dir + (slot ? "/cursor1" : "/cursor0");
+}
+
+bool SegmentLog::begin(const char *path, uint32_t capacityBytes)
+{
+    dir = path;
+    if (!LittleFS.begin() || (!LittleFS.exists(path) && !LittleFS.mkdir(path)))
+    {
+        DebugSerial.printf("❌ Cannot open log directory %s\n", path);
+        return false;
+    }
+
+    // Keep a quarter of the partition for config and filesystem metadata
+    FSInfo info;
+    if (LittleFS.info(info))
+    {
+        fsLimitSegments = info.totalBytes * 3 / 4 / SEGMENT_BYTES;
+    }
+
+    if (!loadCursor())
+    {
+        tail = {0, 0};
+    }
+    // A segment dropped after the last cursor save is simply gone
+    for (uint32_t probe = 0; !LittleFS.exists(segmentPath(tail.segment)) && probe <= fsLimitSegments; probe++)
+    {
+        tail = {tail.segment + 1, 0};
+    }
+    if (!LittleFS.exists(segmentPath(tail.segment)))
+    {
+        tail = {0, 0};
+    }
+
+    // Segments from the tail on are contiguous; count what is still pending
+    pendingRecords = 0;
+    head = tail.segment;
+    while (true)
+    {
+        uint32_t validEnd = 0;
+        uint32_t size = 0;
+        pendingRecords += scanSegment(head, head == tail.segment ? tail.offset : 0, validEnd);
+        File f = LittleFS.open(segmentPath(head), "r");
+        if (f)
+        {
+            size = f.size();
+        }
+        headBytes = validEnd;
+        if (!LittleFS.exists(segmentPath(head + 1)))
+        {
+            if (validEnd < size)
+            {
+                // Torn append before the reset: never write after it
+                DebugSerial.printf("⚠️ Log segment %lu has a damaged tail, starting a new one\n", (unsigned long)head);
+                head++;
+                headBytes = 0;
+            }
+            break;
+        }
+        head++;
+    }
+
+    mounted = true;
+    unsavedAcks = 0;
+    setCapacity(capacityBytes);
+    DebugSerial.printf("Log %s: %lu records pending in segments %lu..%lu\n", path,
+                       (unsigned long)pendingRecords, (unsigned long)tail.segment, (unsigned long)head);
+    return true;
+}
+
+void SegmentLog::setCapacity(uint32_t capacityBytes)
+{
+    uint32_t segments = capacityBytes / SEGMENT_BYTES;
+    if (segments > fsLimitSegments)
+    {
+        segments = fsLimitSegments;
+    }
+    maxSegments = segments < 2 ? 2 : segments;
+    if (mounted)
+    {
+        enforceCapacity();
+    }
+}
+
+// Counts the intact records of a segment from `from` on; validEnd is the
+// offset just past the last one
+uint32_t SegmentLog::scanSegment(uint32_t segment, uint32_t from, uint32_t &validEnd)
+{
+    validEnd = from;
+    File f = LittleFS.open(segmentPath(segment), "r");
+    if (!f || !f.seek(from))
+    {
+        validEnd = 0;
+        return 0;
+    }
+
+    uint32_t count = 0;
+    uint8_t header[RECORD_HEADER];
+    uint8_t data[MAX_RECORD];
+    while (f.read(header, RECORD_HEADER) == RECORD_HEADER)
+    {
+        uint16_t len = header[0] | header[1] << 8;
+        uint32_t crc = (uint32_t)header[2] | (uint32_t)header[3] << 8 | (uint32_t)header[4] << 16 | (uint32_t)header[5] << 24;
+        if (len > MAX_RECORD || f.read(data, len) != len || crc32(data, len) != crc)
+        {
+            break;
+        }
+        validEnd += RECORD_HEADER + len;
+        count++;
+    }
+    return count;
+}
+
+bool SegmentLog::append(const uint8_t *data, uint16_t len)
+{
+    if (!mounted || len > MAX_RECORD)
+    {
+        return false;
+    }
+
+    if (headBytes > 0 && headBytes + RECORD_HEADER + len > SEGMENT_BYTES)
+    {
+        head++;
+        headBytes = 0;
+        enforceCapacity();
+    }
+
+    uint8_t header[RECORD_HEADER];
+    uint32_t crc = crc32(data, len);
+    header[0] = len & 0xFF;
+    header[1] = len >> 8;
+    header[2] = crc & 0xFF;
+    header[3] = (crc >> 8) & 0xFF;
+    header[4] = (crc >> 16) & 0xFF;
+    header[5] = crc >> 24;
+
+    // "w" on a new segment, so a leftover file with the same number is replaced
+    File f = LittleFS.open(segmentPath(head), headBytes == 0 ? "w" : "a");
+    if (!f)
+    {
+        DebugSerial.println("❌ Cannot open log segment");
+        return false;
+    }
+    bool ok = f.write(header, RECORD_HEADER) == RECORD_HEADER && f.write(data, len) == len;
+    f.close();
+    if (!ok)
+    {
+        // The partial record fails its CRC; continue in a fresh segment
+        DebugSerial.println("❌ Log write failed");
+        head++;
+        headBytes = 0;
+        return false;
+    }
+
+    headBytes += RECORD_HEADER + len;
+    pendingRecords++;
+    logStats.appended++;
+    return true;
+}
+
+bool SegmentLog::read(Position &pos, uint8_t *buf, uint16_t bufSize, uint16_t &len)
+{
+    if (!mounted)
+    {
+        return false;
+    }
+    if (pos.segment < tail.segment || (pos.segment == tail.segment && pos.offset < tail.offset))
+    {
+        // The records under `pos` were dropped meanwhile
+        pos = tail;
+    }
+
+    while (pos.segment < head || (pos.segment == head && pos.offset < headBytes))
+    {
+        File f = LittleFS.open(segmentPath(pos.segment), "r");
+        uint8_t header[RECORD_HEADER];
+        if (!f || !f.seek(pos.offset) || f.read(header, RECORD_HEADER) != RECORD_HEADER)
+        {
+            // End of a finished segment
+            pos = {pos.segment + 1, 0};
+            continue;
+        }
+
+        len = header[0] | header[1] << 8;
+        uint32_t crc = (uint32_t)header[2] | (uint32_t)header[3] << 8 | (uint32_t)header[4] << 16 | (uint32_t)header[5] << 24;
+        if (len > MAX_RECORD || len > bufSize || f.read(buf, len) != len || crc32(buf, len) != crc)
+        {
+            // The framing after a bad record cannot be trusted: skip the rest of the segment
+            logStats.corrupt++;
+            pos = {pos.segment + 1, 0};
+            continue;
+        }
+
+        pos.offset += RECORD_HEADER + len;
+        if (pos.segment < head && pos.offset >= f.size())
+        {
+            pos = {pos.segment + 1, 0};
+        }
+        return true;
+    }
+    return false;
+}
+
+void SegmentLog::acknowledge(const Position &pos, uint16_t records)
+{
+    if (!mounted || pos.segment < tail.segment || (pos.segment == tail.segment && pos.offset <= tail.offset))
+    {
+        return;
+    }
+
+    bool segmentChanged = pos.segment != tail.segment;
+    while (tail.segment < pos.segment)
+    {
+        LittleFS.remove(segmentPath(tail.segment));
+        tail.segment++;
+    }
+    tail = pos;
+    pendingRecords = records < pendingRecords ? pendingRecords - records : 0;
+
+    unsavedAcks += records;
+    if (segmentChanged || unsavedAcks >= CURSOR_COMMIT_RECORDS || pendingRecords == 0)
+    {
+        saveCursor();
+    }
+}
+
+void SegmentLog::dropOldest()
+{
+    uint32_t validEnd;
+    uint32_t lost = scanSegment(tail.segment, tail.offset, validEnd);
+    LittleFS.remove(segmentPath(tail.segment));
+    tail = {tail.segment + 1, 0};
+    logStats.dropped += lost;
+    pendingRecords = lost < pendingRecords ? pendingRecords - lost : 0;
+    saveCursor();
+    DebugSerial.printf("⚠️ Log full, dropped %lu oldest records\n", (unsigned long)lost);
+}
+
+void SegmentLog::enforceCapacity()
+{
+    while (head - tail.segment + 1 > maxSegments && tail.segment < head)
+    {
+        dropOldest();
+    }
+}
+
+bool SegmentLog::loadCursor()
+{
+    bool found = false;
+    for (uint8_t slot = 0; slot < 2; slot++)
+    {
+        File f = LittleFS.open(cursorPath(slot), "r");
+        Cursor c;
+        if (!f || f.read((uint8_t *)&c, sizeof(c)) != sizeof(c) ||
+            crc32((const uint8_t *)&c, offsetof(Cursor, crc)) != c.crc)
+        {
+            continue;
+        }
+        if (!found || c.generation > generation)
+        {
+            generation = c.generation;
+            tail = {c.segment, c.offset};
+            found = true;
+        }
+    }
+    return found;
+}
+
+void SegmentLog::saveCursor()
+{
+    Cursor c;
+    c.generation = ++generation;
+    c.segment = tail.segment;
+    c.offset = tail.offset;
+    c.crc = crc32((const uint8_t *)&c, offsetof(Cursor, crc));
+
+    // Alternate slots: the previous cursor survives a reset during this write
+    File f = LittleFS.open(cursorPath(c.generation & 1), "w");
+    if (f)
+    {
+        f.write((const uint8_t *)&c, sizeof(c));
+        f.close();
+    }
+    unsavedAcks = 0;
+}
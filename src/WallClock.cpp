@@ -0,0 +1,109 @@
+#include "WallClock.h"
+#include <coredecls.h>
+#include <sys/time.h>
+#include "DebugSerial.h"
+
+WallClock wallClock;
+
+// lwIP SNTP asks the sketch how often to update (default one hour)
+uint32_t sntp_update_delay_MS_rfc_not_less_than_15000()
+{
+    return WallClock::SYNC_INTERVAL;
+}
+
+WallClock::WallClock()
+    : syncCount(0), anchorEpochMs(0), anchorMillis(0), offsetMs(0), driftPpm(0), driftKnown(false),
+      pending(false), pendingEpochMs(0), pendingMillis(0)
+{
+}
+
+void WallClock::begin()
+{
+    settimeofday_cb([this]()
+                    {
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        pendingEpochMs = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+        pendingMillis = millis();
+        pending = true; });
+    // Returns at once; SNTP retries by itself until WiFi is up
+    configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+}
+
+void WallClock::loop()
+{
+    if (pending)
+    {
+        pending = false;
+        takeSync(pendingEpochMs, pendingMillis);
+    }
+}
+
+void WallClock::takeSync(int64_t epochMs, unsigned long ms)
+{
+    if (epochMs < (int64_t)EPOCH_VALID * 1000)
+    {
+        return;
+    }
+    if (syncCount == 0)
+    {
+        DebugSerial.printf("🕒 Đã có giờ NTP: %lu, %lu s sau khi khởi động\n", (unsigned long)(epochMs / 1000), ms / 1000);
+    }
+    else
+    {
+        unsigned long elapsed = ms - anchorMillis;
+        offsetMs = (int32_t)(epochMs - epochMsAt(elapsed));
+        if (elapsed >= MIN_DRIFT_INTERVAL)
+        {
+            // From the two SNTP times alone, so an estimate that was off does not stay
+            float measured = (float)((epochMs - anchorEpochMs) - (int64_t)elapsed) * 1e6f / elapsed;
+            if (fabsf(measured) <= MAX_DRIFT_PPM)
+            {
+                driftPpm = driftKnown ? driftPpm + (measured - driftPpm) / DRIFT_SMOOTHING : measured;
+                driftKnown = true;
+            }
+        }
+        DebugSerial.printf("🕒 NTP: lệch %ld ms sau %lu s, trôi %.1f ppm\n", (long)offsetMs, elapsed / 1000, driftPpm);
+    }
+    anchorEpochMs = epochMs;
+    anchorMillis = ms;
+    syncCount++;
+}
+
+int64_t WallClock::epochMsAt(int64_t elapsedMs) const
+{
+    return anchorEpochMs + elapsedMs + (int64_t)(elapsedMs * driftPpm / 1e6f);
+}
+
+uint32_t WallClock::epochAt(unsigned long ms) const
+{
+    return (uint32_t)(epochMillisAt(ms) / 1000);
+}
+
+int64_t WallClock::epochMillisAt(unsigned long ms) const
+{
+    if (!synced())
+    {
+        return 0;
+    }
+    // Signed, for readings taken before the anchor
+    return epochMsAt((int32_t)(ms - anchorMillis));
+}
+
+uint32_t WallClock::epochAtUptime(uint32_t seconds) const
+{
+    if (!synced())
+    {
+        return 0;
+    }
+    return (uint32_t)(epochMsAt((int64_t)seconds * 1000 - anchorMillis) / 1000);
+}
+
+WallClock::Quality WallClock::quality() const
+{
+    if (!synced())
+    {
+        return CLOCK_UNSET;
+    }
+    return sinceSync() > STALE_AFTER ? CLOCK_STALE : CLOCK_SYNCED;
+}
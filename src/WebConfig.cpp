@@ -1,7 +1,9 @@
 #include "WebConfig.h"
+#include "DebugSerial.h"
+#include "WallClock.h"
 
-WebConfig::WebConfig(ConfigManager &configManager)
-    : server(80), configManager(configManager), configPortalActive(false)
+WebConfig::WebConfig(ConfigManager &configManager, const Scheduler &scheduler)
+    : server(80), configManager(configManager), scheduler(scheduler), configPortalActive(false)
 {
 }
 
@@ -24,7 +26,7 @@ void WebConfig::begin()
               { handleIP(); });
 
     server.begin();
-    Serial.println("Web config server started on port 80");
+    DebugSerial.println("Web config server started on port 80");
 }
 
 void WebConfig::handle()
@@ -35,13 +37,13 @@ void WebConfig::handle()
 void WebConfig::startConfigPortal()
 {
     configPortalActive = true;
-    Serial.println("Config portal activated");
+    DebugSerial.println("Config portal activated");
 }
 
 void WebConfig::stopConfigPortal()
 {
     configPortalActive = false;
-    Serial.println("Config portal deactivated");
+    DebugSerial.println("Config portal deactivated");
 }
 
 bool WebConfig::isConfigPortalActive()
@@ -107,8 +109,47 @@ void WebConfig::handleConfig()
     html += "<input type='text' id='mqtt_user' name='mqtt_user' value='" + config.mqtt_username + "' required></div>";
     html += "<div class='form-group'><label for='mqtt_password'>MQTT Password:</label>";
     html += "<input type='text' id='mqtt_password' name='mqtt_password' value='" + config.mqtt_password + "' required></div>";
+    html += "<div class='form-group'><label for='mqtt_tls'>MQTT Transport:</label>";
+    html += "<select id='mqtt_tls' name='mqtt_tls'>";
+    html += String("<option value='0'") + (config.mqtt_tls ? "" : " selected") + ">TCP (1883)</option>";
+    html += String("<option value='1'") + (config.mqtt_tls ? " selected" : "") + ">TLS (8883)</option></select></div>";
+    html += "<div class='form-group'><label for='mqtt_fingerprint'>Broker Certificate SHA-1 (hex, TLS):</label>";
+    html += "<input type='text' id='mqtt_fingerprint' name='mqtt_fingerprint' value='" + config.mqtt_fingerprint + "'></div>";
+    html += "<div class='form-group'><label for='mqtt_pubkey'>Broker Public Key (PEM, TLS, used instead of the SHA-1):</label>";
+    html += "<textarea id='mqtt_pubkey' name='mqtt_pubkey' rows='4' style='width:100%'>" + config.mqtt_pubkey + "</textarea></div>";
     html += "<div class='form-group'><label for='reading_interval'>Reading Interval (ms):</label>";
     html += "<input type='number' id='reading_interval' name='reading_interval' value='" + String(config.reading_interval) + "' required></div>";
+    html += "<div class='form-group'><label for='sample_interval'>Sample Interval (ms, averaged per reading):</label>";
+    html += "<input type='number' id='sample_interval' name='sample_interval' min='200' value='" + String(config.sample_interval) + "' required></div>";
+    html += "<div class='form-group'><label for='publish_offset'>Publish Offset (ms after each interval boundary):</label>";
+    html += "<input type='number' id='publish_offset' name='publish_offset' min='0' value='" + String(config.publish_offset) + "'></div>";
+    html += "<div class='form-group'><label for='pzem_addresses'>PZEM Addresses (1,2,3 for 3 phases, empty = single):</label>";
+    html += "<input type='text' id='pzem_addresses' name='pzem_addresses' value='" + config.pzem_addresses + "'></div>";
+    html += "<div class='form-group'><label for='report_by_exception'>Report Mode:</label>";
+    html += "<select id='report_by_exception' name='report_by_exception'>";
+    html += String("<option value='0'") + (config.report_by_exception ? "" : " selected") + ">Every reading</option>";
+    html += String("<option value='1'") + (config.report_by_exception ? " selected" : "") + ">On change (deadband)</option></select></div>";
+    html += "<div class='form-group'><label>Deadband Voltage (V / %):</label>";
+    html += "<input type='number' step='any' name='deadband_voltage' value='" + String(config.deadband_voltage) + "'>";
+    html += "<input type='number' step='any' name='deadband_voltage_pct' value='" + String(config.deadband_voltage_pct) + "'></div>";
+    html += "<div class='form-group'><label>Deadband Current (A / %):</label>";
+    html += "<input type='number' step='any' name='deadband_current' value='" + String(config.deadband_current, 3) + "'>";
+    html += "<input type='number' step='any' name='deadband_current_pct' value='" + String(config.deadband_current_pct) + "'></div>";
+    html += "<div class='form-group'><label>Deadband Power (W / %):</label>";
+    html += "<input type='number' step='any' name='deadband_power' value='" + String(config.deadband_power) + "'>";
+    html += "<input type='number' step='any' name='deadband_power_pct' value='" + String(config.deadband_power_pct) + "'></div>";
+    html += "<div class='form-group'><label for='heartbeat_interval'>Heartbeat (ms, longest silence in change mode):</label>";
+    html += "<input type='number' id='heartbeat_interval' name='heartbeat_interval' value='" + String(config.heartbeat_interval) + "'></div>";
+    html += "<div class='form-group'><label for='backlog_days'>Offline Backlog (days, limited by flash size):</label>";
+    html += "<input type='number' id='backlog_days' name='backlog_days' min='1' value='" + String(config.backlog_days) + "'></div>";
+    html += "<div class='form-group'><label for='drain_rate'>Backlog Resend Rate (records/s):</label>";
+    html += "<input type='number' id='drain_rate' name='drain_rate' min='1' value='" + String(config.drain_rate) + "'></div>";
+    html += "<div class='form-group'><label for='batch_size'>Readings per MQTT Message (1-8):</label>";
+    html += "<input type='number' id='batch_size' name='batch_size' min='1' max='8' value='" + String(config.batch_size) + "'></div>";
+    html += "<div class='form-group'><label for='payload_format'>Payload Format:</label>";
+    html += "<select id='payload_format' name='payload_format'>";
+    html += String("<option value='json'") + (config.payload_format == "binary" ? "" : " selected") + ">JSON (meter/&lt;id&gt;/data)</option>";
+    html += String("<option value='binary'") + (config.payload_format == "binary" ? " selected" : "") + ">Binary (meter/&lt;id&gt;/bin)</option></select></div>";
     html += "<div class='actions'><button type='submit' class='btn btn-primary'>Save Configuration</button></div>";
     html += "</form>";
     html += "<div class='actions'>";
@@ -122,36 +163,103 @@ void WebConfig::handleConfig()
     server.send(200, "text/html", html);
 }
 
+void WebConfig::saved(bool ok, String &errors)
+{
+    if (!ok)
+    {
+        errors += String(configManager.lastError()) + "<br>";
+    }
+}
+
 void WebConfig::handleSaveConfig()
 {
+    // Fields the config refused (out of range), each with the reason
+    String errors;
     if (server.hasArg("mqtt_server"))
     {
-        configManager.updateConfig("mqtt_server", server.arg("mqtt_server"));
+        saved(configManager.updateConfig("mqtt_server", server.arg("mqtt_server")), errors);
     }
     if (server.hasArg("mqtt_port"))
     {
-        configManager.updateConfig("mqtt_port", server.arg("mqtt_port").toInt());
+        saved(configManager.updateConfig("mqtt_port", server.arg("mqtt_port").toInt()), errors);
     }
     if (server.hasArg("device_id"))
     {
-        configManager.updateConfig("device_id", server.arg("device_id"));
+        saved(configManager.updateConfig("device_id", server.arg("device_id")), errors);
     }
     if (server.hasArg("serial_number"))
     {
-        configManager.updateConfig("serial_number", server.arg("serial_number"));
+        saved(configManager.updateConfig("serial_number", server.arg("serial_number")), errors);
     }
     if (server.hasArg("mqtt_user"))
     {
-        configManager.updateConfig("mqtt_username", server.arg("mqtt_user"));
+        saved(configManager.updateConfig("mqtt_username", server.arg("mqtt_user")), errors);
     }
     if (server.hasArg("mqtt_password"))
     {
-        configManager.updateConfig("mqtt_password", server.arg("mqtt_password"));
+        saved(configManager.updateConfig("mqtt_password", server.arg("mqtt_password")), errors);
+    }
+    if (server.hasArg("mqtt_tls"))
+    {
+        saved(configManager.updateConfig("mqtt_tls", server.arg("mqtt_tls").toInt()), errors);
+    }
+    if (server.hasArg("mqtt_fingerprint"))
+    {
+        saved(configManager.updateConfig("mqtt_fingerprint", server.arg("mqtt_fingerprint")), errors);
+    }
+    if (server.hasArg("mqtt_pubkey"))
+    {
+        saved(configManager.updateConfig("mqtt_pubkey", server.arg("mqtt_pubkey")), errors);
     }
 
     if (server.hasArg("reading_interval"))
     {
-        configManager.updateConfig("reading_interval", server.arg("reading_interval").toInt());
+        saved(configManager.updateConfig("reading_interval", server.arg("reading_interval").toInt()), errors);
+    }
+    if (server.hasArg("sample_interval"))
+    {
+        saved(configManager.updateConfig("sample_interval", server.arg("sample_interval").toInt()), errors);
+    }
+    if (server.hasArg("publish_offset"))
+    {
+        saved(configManager.updateConfig("publish_offset", server.arg("publish_offset").toInt()), errors);
+    }
+    if (server.hasArg("pzem_addresses"))
+    {
+        saved(configManager.updateConfig("pzem_addresses", server.arg("pzem_addresses")), errors);
+    }
+    if (server.hasArg("report_by_exception"))
+    {
+        saved(configManager.updateConfig("report_by_exception", server.arg("report_by_exception").toInt()), errors);
+    }
+    const char *deadbands[] = {"deadband_voltage", "deadband_voltage_pct", "deadband_current",
+                               "deadband_current_pct", "deadband_power", "deadband_power_pct"};
+    for (const char *key : deadbands)
+    {
+        if (server.hasArg(key))
+        {
+            saved(configManager.updateConfig(key, server.arg(key)), errors);
+        }
+    }
+    if (server.hasArg("heartbeat_interval"))
+    {
+        saved(configManager.updateConfig("heartbeat_interval", server.arg("heartbeat_interval").toInt()), errors);
+    }
+    if (server.hasArg("backlog_days"))
+    {
+        saved(configManager.updateConfig("backlog_days", server.arg("backlog_days").toInt()), errors);
+    }
+    if (server.hasArg("drain_rate"))
+    {
+        saved(configManager.updateConfig("drain_rate", server.arg("drain_rate").toInt()), errors);
+    }
+    if (server.hasArg("batch_size"))
+    {
+        saved(configManager.updateConfig("batch_size", server.arg("batch_size").toInt()), errors);
+    }
+    if (server.hasArg("payload_format"))
+    {
+        saved(configManager.updateConfig("payload_format", server.arg("payload_format")), errors);
     }
 
     String html = "<!DOCTYPE html><html><head><title>Configuration Saved</title>";
@@ -159,9 +267,17 @@ void WebConfig::handleSaveConfig()
     html += "<style>body{font-family:Arial,sans-serif;margin:20px;background:#f5f5f5}";
     html += ".container{max-width:600px;margin:0 auto;background:white;padding:20px;border-radius:10px;box-shadow:0 2px 10px rgba(0,0,0,0.1)}";
     html += ".success{background:#d4edda;color:#155724;padding:15px;border-radius:5px;margin:20px 0}";
+    html += ".warning{background:#fff3cd;color:#856404;padding:15px;border-radius:5px;margin:20px 0}";
     html += ".btn{display:inline-block;padding:10px 20px;background:#007bff;color:white;text-decoration:none;border-radius:5px}</style></head>";
     html += "<body><div class='container'>";
-    html += "<div class='success'>Configuration saved successfully!</div>";
+    if (errors.length())
+    {
+        html += "<div class='warning'>Not saved:<br>" + errors + "</div>";
+    }
+    else
+    {
+        html += "<div class='success'>Configuration saved successfully!</div>";
+    }
     html += "<p>Your configuration has been updated. The device will reconnect to the new MQTT server.</p>";
     html += "<a href='/config' class='btn'>Back to Configuration</a>";
     html += "</div></body></html>";
@@ -209,6 +325,32 @@ void WebConfig::handleStatus()
     html += "<div class='status-item'><div class='status-label'>Device ID:</div><div class='status-value'>" + config.device_id + "</div></div>";
     html += "<div class='status-item'><div class='status-label'>Serial Number:</div><div class='status-value'>" + config.serial_number + "</div></div>";
     html += "<div class='status-item'><div class='status-label'>Reading Interval:</div><div class='status-value'>" + String(config.reading_interval) + " ms</div></div>";
+    html += "<div class='status-item'><div class='status-label'>Sample Interval:</div><div class='status-value'>" + String(config.sample_interval) + " ms</div></div>";
+    html += "<div class='status-item'><div class='status-label'>Report Mode:</div><div class='status-value'>" + String(config.report_by_exception ? "On change, heartbeat " + String(config.heartbeat_interval / 1000) + " s" : "Every reading") + "</div></div>";
+    html += "<div class='status-item'><div class='status-label'>PZEM Addresses:</div><div class='status-value'>" + (config.pzem_addresses.length() ? config.pzem_addresses : String("single")) + "</div></div>";
+    String clock = "Not set (waiting for NTP)";
+    if (wallClock.synced())
+    {
+        char text[96];
+        snprintf(text, sizeof(text), "%s, last NTP update %lu s ago, offset %ld ms, drift %.1f ppm",
+                 wallClock.quality() == WallClock::CLOCK_STALE ? "Stale" : "Synced", wallClock.sinceSync() / 1000,
+                 (long)wallClock.lastOffset(), wallClock.drift());
+        clock = text;
+    }
+    html += "<div class='status-item'><div class='status-label'>Clock:</div><div class='status-value " + String(wallClock.quality() == WallClock::CLOCK_SYNCED ? "online" : "offline") + "'>" + clock + "</div></div>";
+    String tasks;
+    for (uint8_t i = 0; i < scheduler.taskCount(); i++)
+    {
+        const Scheduler::TaskStats &t = scheduler.stats(i);
+        char text[192];
+        snprintf(text, sizeof(text), "%s: %lu runs, mean %lu us, worst %lu us (budget %lu, %lu over), "
+                                     "worst wait %lu ms (deadline %lu, %lu late, %lu skipped)<br>",
+                 t.name, (unsigned long)t.runs, (unsigned long)(t.runs ? t.totalUs / t.runs : 0), (unsigned long)t.worstUs,
+                 (unsigned long)t.budget, (unsigned long)t.overruns, t.worstWait, t.deadline, (unsigned long)t.late,
+                 (unsigned long)t.skipped);
+        tasks += text;
+    }
+    html += "<div class='status-item'><div class='status-label'>Tasks (" + String(scheduler.passes()) + " passes, worst " + String(scheduler.worstPassUs()) + " us):</div><div class='status-value'>" + tasks + "</div></div>";
     html += "<div class='status-item'><div class='status-label'>Uptime:</div><div class='status-value'>" + String(millis() / 1000) + " seconds</div></div>";
     html += "<div class='status-item'><div class='status-label'>Free Memory:</div><div class='status-value'>" + String(ESP.getFreeHeap()) + " bytes</div></div>";
     html += "</div></body></html>";
@@ -1,138 +1,316 @@
 #include <Arduino.h>
 #include "Meter.h"
+#include "SampleWindow.h"
+#include "AlignedTimer.h"
 #include "NetworkManager.h"
 #include "DataSender.h"
 #include "ConfigManager.h"
+#include "CommandProcessor.h"
 #include "WebConfig.h"
 #include "WiFiLedStatus.h"
+#include "WallClock.h"
+#include "Scheduler.h"
+#include "DebugSerial.h"
 // #include <WiFiManager.h>
 
+#ifdef PZEM_HW_UART
+// PZEM trên UART0 (swap sang D7 = RX, D8 = TX), log qua UART1 (D4).
+// D4 cũng là LED_BUILTIN nên LED trạng thái chuyển sang LED trên board NodeMCU (D0).
+#define STATUS_LED_PIN D0
+Meter meter(Serial);
+#else
 // Define your RX and TX pins here (adjust as needed for your hardware)
 #define RX_PIN D5
 #define TX_PIN D6
-
+#define STATUS_LED_PIN LED_BUILTIN
 Meter meter(RX_PIN, TX_PIN);
+#endif
 NetworkManager networkManager;
 DataSender dataSender;
 ConfigManager configManager;
-WebConfig webConfig(configManager);
-WiFiLedStatus wifiLedStatus(LED_BUILTIN); // Sử dụng LED tích hợp trên ESP8266
+Scheduler scheduler;
+WebConfig webConfig(configManager, scheduler);
+CommandProcessor commandProcessor(configManager, dataSender);
+WiFiLedStatus wifiLedStatus(STATUS_LED_PIN); // Sử dụng LED tích hợp trên ESP8266
+
+// Mẫu giữa hai lần gửi được gộp lại: [0] = tổng / 1 PZEM, [1..3] = từng pha
+SampleWindow sampleWindows[Meter::MAX_SLAVES + 1];
 
-unsigned long lastWifiCheck = 0;
-unsigned long lastSendData = 0;
+// Chu kỳ gửi khép lại đúng mốc giờ UTC (vd :00, :10, :20 s với 10 s), như nhau trên mọi công tơ;
+// kết quả chờ thêm publish_offset rồi mới gửi để các công tơ không cùng gửi một lúc
+AlignedTimer publishTimer;
+MeterReadings closedWindows[Meter::MAX_SLAVES + 1];
+uint8_t closedCount = 0;
+unsigned long publishAt = 0;
+unsigned long publishOffset = 0;
+
+unsigned long publishInterval = 10000; // reading_interval
 const unsigned long WIFI_CHECK_INTERVAL = 10000; // Kiểm tra WiFi mỗi 10 giây
-const unsigned long SEND_INTERVAL = 10000;       // 10 giây
 
-void setup()
+// Số bản ghi gửi mỗi chu kỳ: tổng + từng pha với tủ 3 pha
+uint8_t publishStreams()
 {
-    wifiLedStatus.begin();
-    wifiLedStatus.setState(WiFiLedStatus::OFF);
-    wifiLedStatus.update();
-    Serial.begin(115200);
-    // WiFiManager wifiManager;
-    // wifiManager.resetSettings();
-
-    // Load configuration
-    configManager.loadConfig();
+    return meter.slaveCount() > 1 ? meter.slaveCount() + 1 : 1;
+}
 
-    // Update DataSender with loaded config
-    dataSender.updateConfig(
+// Mỗi phần nhận các thay đổi cấu hình liên quan đến nó, không cần khởi động lại.
+// Thứ tự đăng ký là thứ tự gọi: Meter trước, số pha quyết định số bản ghi mỗi chu kỳ.
+void subscribeToConfig()
+{
+    configManager.onChange(CONFIG_SAMPLE_INTERVAL | CONFIG_PZEM_ADDRESSES, [](const MeterConfig &config, uint32_t changed)
+                           {
+        if (changed & CONFIG_SAMPLE_INTERVAL)
+        {
+            meter.setPollInterval(config.sample_interval);
+        }
+        if (changed & CONFIG_PZEM_ADDRESSES)
+        {
+            meter.setAddresses(config.pzem_addresses);
+            // Số pha thay đổi: bỏ các mẫu đang gộp, chỉ số điện năng của đồng hồ cũ không còn dùng được
+            for (uint8_t i = 0; i <= Meter::MAX_SLAVES; i++)
+            {
+                sampleWindows[i].restart();
+            }
+        } });
 
-        configManager.getMqttServer().c_str(),
-        configManager.getMqttPort(),
-        configManager.getDeviceId().c_str(),
-        configManager.getSerialNumber().c_str(),
-        configManager.getConfig().mqtt_password.c_str(),
-        configManager.getConfig().mqtt_username.c_str());
+    // Chỉ kết nối lại MQTT khi broker, tài khoản, device ID hay TLS thay đổi
+    configManager.onChange(CONFIG_MQTT_SERVER | CONFIG_MQTT_AUTH | CONFIG_DEVICE_ID | CONFIG_SERIAL_NUMBER,
+                           [](const MeterConfig &config, uint32_t)
+                           { dataSender.updateConfig(config.mqtt_server.c_str(), config.mqtt_port, config.device_id.c_str(),
+                                                     config.serial_number.c_str(), config.mqtt_password.c_str(),
+                                                     config.mqtt_username.c_str()); });
+    configManager.onChange(CONFIG_MQTT_TLS, [](const MeterConfig &config, uint32_t)
+                           { dataSender.setTls(config.mqtt_tls, config.mqtt_fingerprint, config.mqtt_pubkey); });
 
-    networkManager.connect();
-    meter.syncTime();
-    dataSender.setup();
-    webConfig.begin();
-    delay(1000);
-    Serial.println("SSID đang kết nối: " + WiFi.SSID());
-    Serial.println("IP Address: " + WiFi.localIP().toString());
-    Serial.println("Web config available at: http://" + WiFi.localIP().toString());
-    Serial.println("MAC Address: " + WiFi.macAddress());
-    Serial.println("==================================================");
-    Serial.println("CONNECTION INFO:");
-    Serial.println("WiFi SSID: " + WiFi.SSID());
-    Serial.println("IP Address: " + WiFi.localIP().toString());
-    Serial.println("Gateway: " + WiFi.gatewayIP().toString());
-    Serial.println("Subnet: " + WiFi.subnetMask().toString());
-    Serial.println("DNS: " + WiFi.dnsIP().toString());
-    Serial.println("==================================================");
+    configManager.onChange(CONFIG_READING_INTERVAL | CONFIG_SAMPLE_INTERVAL | CONFIG_PUBLISH_OFFSET | CONFIG_PZEM_ADDRESSES |
+                               CONFIG_REPORT_POLICY | CONFIG_BACKLOG_DAYS | CONFIG_DRAIN_RATE | CONFIG_BATCH_SIZE | CONFIG_PAYLOAD_FORMAT,
+                           [](const MeterConfig &config, uint32_t changed)
+                           {
+        // Chu kỳ gửi không ngắn hơn chu kỳ lấy mẫu (và không bao giờ 0: chia cho nó bên dưới)
+        publishInterval = max<unsigned long>(max<unsigned long>(config.reading_interval, config.sample_interval),
+                                             Meter::MIN_POLL_INTERVAL);
+        if (changed & (CONFIG_READING_INTERVAL | CONFIG_SAMPLE_INTERVAL | CONFIG_PUBLISH_OFFSET))
+        {
+            publishTimer.set(publishInterval);
+            publishOffset = config.publish_offset % publishInterval;
+        }
+        if (changed & CONFIG_REPORT_POLICY)
+        {
+            dataSender.setReportPolicy(configManager.getReportPolicy());
+        }
+        if (changed & (CONFIG_BACKLOG_DAYS | CONFIG_READING_INTERVAL | CONFIG_SAMPLE_INTERVAL | CONFIG_PZEM_ADDRESSES))
+        {
+            dataSender.setBacklogDays(config.backlog_days, publishInterval, publishStreams());
+        }
+        if (changed & CONFIG_DRAIN_RATE)
+        {
+            dataSender.setDrainRate(config.drain_rate);
+        }
+        if (changed & (CONFIG_BATCH_SIZE | CONFIG_READING_INTERVAL | CONFIG_SAMPLE_INTERVAL))
+        {
+            dataSender.setBatchSize(config.batch_size, publishInterval);
+        }
+        if (changed & CONFIG_PAYLOAD_FORMAT)
+        {
+            dataSender.setPayloadFormat(configManager.getPayloadFormat());
+        } });
 }
 
 WiFiLedStatus::LedState currentLedState = WiFiLedStatus::OFF;
 
-void loop()
+// Giao các chu kỳ đã khép lại cho DataSender
+void handOverWindows()
 {
-    dataSender.loop();
-    webConfig.handle();
+    for (uint8_t i = 0; i < closedCount; i++)
+    {
+        dataSender.sendData(closedWindows[i]);
+    }
+    closedCount = 0;
+}
 
-    unsigned long now = millis();
+void setLedState(WiFiLedStatus::LedState state)
+{
+    if (currentLedState != state)
+    {
+        wifiLedStatus.setState(state);
+        currentLedState = state;
+    }
+}
 
-    // Kiểm tra WiFi định kỳ
-    if (now - lastWifiCheck > WIFI_CHECK_INTERVAL)
+// Đọc PZEM không chặn: mỗi lần chỉ xử lý các byte đã nhận được
+void acquisitionTask()
+{
+    meter.loop();
+    if (!meter.readingsReady())
     {
-        Serial.println("🔄 Kiểm tra kết nối WiFi...");
-        if (!networkManager.isConnected())
+        return;
+    }
+    MeterReadings readings = meter.getReadings();
+    if (!isnan(readings.voltage))
+    {
+        sampleWindows[0].add(readings);
+
+        // Tủ 3 pha: gộp thêm số liệu từng pha
+        for (uint8_t phase = 1; meter.slaveCount() > 1 && phase <= meter.slaveCount(); phase++)
         {
-            if (currentLedState != WiFiLedStatus::OFF)
-            {
-                wifiLedStatus.setState(WiFiLedStatus::OFF);
-                currentLedState = WiFiLedStatus::OFF;
-                wifiLedStatus.update();
-            }
-            Serial.println("⚠️ Mất kết nối WiFi! Đang thử kết nối lại...");
-            networkManager.reconnect();
+            sampleWindows[phase].add(meter.getPhaseReadings(phase));
         }
-        else
+    }
+    else
+    {
+        DebugSerial.println("⚠️ Không đọc được dữ liệu từ PZEM");
+        setLedState(WiFiLedStatus::BLINK_SLOW);
+    }
+}
+
+// Khép chu kỳ đang gom, mang giờ closedTime
+void closeWindows(unsigned long closedTime)
+{
+    handOverWindows(); // chu kỳ trước chưa đến giờ gửi (snapshot)
+    // Điện năng của tủ 3 pha là tổng điện năng từng pha trong chu kỳ, không lấy
+    // từ tổng chỉ số: tổng đó nhảy khi một pha không đọc được
+    uint32_t phaseEnergy = 0;
+    for (uint8_t phase = 1; meter.slaveCount() > 1 && phase <= meter.slaveCount(); phase++)
+    {
+        phaseEnergy += sampleWindows[phase].energyDeltaWh();
+    }
+    for (uint8_t i = 0; i <= Meter::MAX_SLAVES; i++)
+    {
+        if (sampleWindows[i].count() > 0)
         {
-            if (currentLedState != WiFiLedStatus::ON)
+            closedWindows[closedCount] = sampleWindows[i].result();
+            if (i == 0 && meter.slaveCount() > 1)
             {
-                wifiLedStatus.setState(WiFiLedStatus::ON);
-                currentLedState = WiFiLedStatus::ON;
+                closedWindows[closedCount].energyDelta = phaseEnergy / 1000.0f;
             }
-            Serial.println("✅ Kết nối WiFi ổn định.");
+            closedWindows[closedCount++].timestamp = closedTime;
         }
-        lastWifiCheck = now;
+        sampleWindows[i].reset();
     }
+}
 
-    MeterReadings readings = meter.getReadings();
-
-    if (!isnan(readings.voltage))
+// Gửi giá trị trung bình của các mẫu trong chu kỳ. Mỗi chu kỳ mang giờ của mốc
+// khép lại nó. Lệnh snapshot gửi ngay, không chờ hết chu kỳ, publish_offset hay đủ lô.
+void publishTask()
+{
+    unsigned long now = millis();
+    bool snapshot = commandProcessor.takeSnapshotRequest();
+    if (snapshot || publishTimer.due(now))
     {
-        // Serial.printf("V: %.1f | I: %.2f | P: %.1f | E: %.2f\n", readings.voltage, readings.current, readings.power, readings.energy);
-
-        // Gửi dữ liệu định kỳ, không delay trong loop
-        if (now - lastSendData > SEND_INTERVAL)
+        unsigned long closedTime = snapshot ? now : publishTimer.boundary();
+        closeWindows(closedTime);
+        publishAt = snapshot ? now : closedTime + publishOffset;
+        if (snapshot)
         {
-            dataSender.sendData(readings.voltage, readings.current, readings.power, readings.energy);
-            lastSendData = now;
+            handOverWindows();
+            dataSender.flushBatch();
         }
-
-        // Nếu trước đó là lỗi, chuyển lại LED ON
-        // if (currentLedState != WiFiLedStatus::ON)
-        //{
-        //    wifiLedStatus.setState(WiFiLedStatus::ON);
-        //    currentLedState = WiFiLedStatus::ON;
-        //}
     }
-    else
+    if (closedCount > 0 && (long)(now - publishAt) >= 0)
+    {
+        handOverWindows();
+    }
+}
+
+// Thay đổi cấu hình từ web / lệnh MQTT được áp dụng tại đây, không phải giữa lúc
+// đang xử lý MQTT hay HTTP. Giờ NTP có thể đến muộn; các mẫu đã đọc trước đó vẫn
+// được gắn đúng giờ.
+void systemTask()
+{
+    configManager.applyChanges();
+    wallClock.loop();
+    commandProcessor.loop();
+}
+
+// Kiểm tra WiFi định kỳ; không chờ kết nối lại, việc đọc PZEM vẫn tiếp tục
+void networkTask()
+{
+    if (networkManager.supervise())
     {
-        Serial.println("⚠️ Không đọc được dữ liệu từ PZEM");
-        if (currentLedState != WiFiLedStatus::BLINK_SLOW)
+        if (currentLedState == WiFiLedStatus::OFF)
         {
-            wifiLedStatus.setState(WiFiLedStatus::BLINK_SLOW);
-            currentLedState = WiFiLedStatus::BLINK_SLOW;
+            DebugSerial.println("✅ Kết nối WiFi ổn định.");
         }
+        setLedState(WiFiLedStatus::ON);
     }
+    else
+    {
+        DebugSerial.println("⚠️ Mất kết nối WiFi! Đang chờ kết nối lại...");
+        setLedState(WiFiLedStatus::OFF);
+    }
+}
+
+// Các việc trong loop() là task của scheduler: không task nào chặn (trừ cổng cấu hình
+// WiFi sau 15 phút mất mạng, xem NetworkManager::supervise), đọc PZEM và
+// khép chu kỳ chạy trước, trang web và LED chạy sau cùng. Thời gian chạy của từng
+// task, số lần quá budget và số lần trễ hạn xem ở trang /status.
+void scheduleTasks()
+{
+    // tên, ưu tiên, chu kỳ (ms, 0 = mỗi vòng), hạn (ms), budget (us), việc
+    // SoftwareSerial gửi 8 byte yêu cầu Modbus trong ~8.3 ms, nên budget của meter là 10 ms
+    scheduler.add("meter", Scheduler::PRIORITY_HIGH, 0, 10, 10000, acquisitionTask);
+    scheduler.add("publish", Scheduler::PRIORITY_HIGH, 0, 10, 5000, publishTask);
+    scheduler.add("mqtt", Scheduler::PRIORITY_NORMAL, 0, 50, 20000, []()
+                  { dataSender.loop(); });
+    scheduler.add("system", Scheduler::PRIORITY_NORMAL, 100, 100, 5000, systemTask);
+    scheduler.add("network", Scheduler::PRIORITY_NORMAL, WIFI_CHECK_INTERVAL, 1000, 5000, networkTask);
+    scheduler.add("drain", Scheduler::PRIORITY_LOW, 0, 1000, 20000, []()
+                  { dataSender.sendBufferedData(); });
+    scheduler.add("web", Scheduler::PRIORITY_LOW, 20, 200, 50000, []()
+                  { webConfig.handle(); });
+    scheduler.add("led", Scheduler::PRIORITY_LOW, 50, 50, 500, []()
+                  { wifiLedStatus.update(); });
+}
 
+void setup()
+{
+    wifiLedStatus.begin();
+    wifiLedStatus.setState(WiFiLedStatus::OFF);
     wifiLedStatus.update();
+    DebugSerial.begin(115200);
+    meter.begin();
+    // WiFiManager wifiManager;
+    // wifiManager.resetSettings();
+
+    // Load configuration
+    configManager.loadConfig();
 
-    // Không delay để LED update mượt
+    // Áp dụng cấu hình vừa đọc; các thay đổi sau đó (web, lệnh MQTT) đi theo cùng đường
+    subscribeToConfig();
+    configManager.applyChanges();
+
+    networkManager.connect();
+    // Cổng cấu hình WiFi chặn loop() tới 3 phút rồi có thể khởi động lại ESP:
+    // trước khi mở, khép chu kỳ đang gom và đưa mọi kết quả trong RAM vào flash
+    networkManager.onPortal([]()
+                            {
+        closeWindows(millis());
+        handOverWindows();
+        dataSender.flushBatch(); });
+    // NTP chạy nền, không chờ: mẫu đọc trước khi có giờ được gắn giờ sau
+    wallClock.begin();
+    dataSender.setup();
+    commandProcessor.begin();
+    webConfig.begin();
+    scheduleTasks();
+    delay(1000);
+    DebugSerial.println("SSID đang kết nối: " + WiFi.SSID());
+    DebugSerial.println("IP Address: " + WiFi.localIP().toString());
+    DebugSerial.println("Web config available at: http://" + WiFi.localIP().toString());
+    DebugSerial.println("MAC Address: " + WiFi.macAddress());
+    DebugSerial.println("==================================================");
+    DebugSerial.println("CONNECTION INFO:");
+    DebugSerial.println("WiFi SSID: " + WiFi.SSID());
+    DebugSerial.println("IP Address: " + WiFi.localIP().toString());
+    DebugSerial.println("Gateway: " + WiFi.gatewayIP().toString());
+    DebugSerial.println("Subnet: " + WiFi.subnetMask().toString());
+    DebugSerial.println("DNS: " + WiFi.dnsIP().toString());
+    DebugSerial.println("==================================================");
+}
+
+void loop()
+{
+    scheduler.run();
 }
 
 /*
@@ -148,17 +326,17 @@ void loop()
     // Kiểm tra WiFi định kỳ và tự động reconnect
     if (millis() - lastWifiCheck > WIFI_CHECK_INTERVAL)
     {
-        Serial.println("🔄 Kiểm tra kết nối WiFi...");
+        DebugSerial.println("🔄 Kiểm tra kết nối WiFi...");
         if (!networkManager.isConnected())
         {
             wifiLedStatus.setState(WiFiLedStatus::BLINK_FAST);
-            Serial.println("⚠️ Mất kết nối WiFi! Đang thử kết nối lại...");
+            DebugSerial.println("⚠️ Mất kết nối WiFi! Đang thử kết nối lại...");
             networkManager.reconnect();
         }
         else
         {
             wifiLedStatus.setState(WiFiLedStatus::ON);
-            Serial.println("✅ Kết nối WiFi ổn định.");
+            DebugSerial.println("✅ Kết nối WiFi ổn định.");
         }
         lastWifiCheck = millis();
     }
@@ -167,14 +345,14 @@ void loop()
 
     if (!isnan(readings.voltage))
     {
-        Serial.printf("V: %.1f | I: %.2f | P: %.1f | E: %.2f\n", readings.voltage, readings.current, readings.power, readings.energy);
+        DebugSerial.printf("V: %.1f | I: %.2f | P: %.1f | E: %.2f\n", readings.voltage, readings.current, readings.power, readings.energy);
 
         // Luôn gửi dữ liệu, DataSender sẽ tự xử lý MQTT và buffer
         dataSender.sendData(readings.voltage, readings.current, readings.power, readings.energy);
     }
     else
     {
-        Serial.println("⚠️ Không đọc được dữ liệu từ PZEM");
+        DebugSerial.println("⚠️ Không đọc được dữ liệu từ PZEM");
         wifiLedStatus.setState(WiFiLedStatus::BLINK_SLOW);
     }
     wifiLedStatus.update();
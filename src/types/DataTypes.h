@@ -1,11 +1,54 @@
 #ifndef DATATYPES_H
 #define DATATYPES_H
 
+#include <stdint.h>
+
+// One PZEM-004T v3 measurement block, decoded from a single Modbus frame
 struct MeterReadings {
-    float voltage;
-    float current;
-    float power;
-    float energy;
+    float voltage;            // V
+    float current;            // A
+    float power;              // W
+    float energy;             // kWh
+    float frequency;          // Hz
+    float pf;                 // power factor, 0.00 - 1.00
+    bool alarm;               // power above the PZEM alarm threshold
+    uint8_t phase;            // 1..3 for one PZEM of a multi-phase panel, 0 = single meter or panel total
+    unsigned long timestamp;  // millis() when the frame was received; for a window, the boundary that closed it
+    uint16_t samples;         // readings averaged into this one, 1 = single sample, 0 = invalid
+    uint32_t seq;             // per device, counts every reading handed to DataSender; 0 = none (older firmware)
+
+    // Spread over the publish window; equal to the value itself for a single sample
+    float voltageMin, voltageMax;
+    float currentMin, currentMax;
+    float powerMin, powerMax;
+    float energyDelta;        // kWh counted during the window
+
+    uint32_t epoch;           // wall-clock seconds at `timestamp` (WallClock), 0 = not known yet
+};
+
+// Change threshold of one field: a value is "changed" when it moved by more
+// than max(absolute, relative% of the last reported value)
+struct Deadband {
+    float absolute;
+    float relative;           // percent
+};
+
+// When DataSender publishes. With byException off every reading goes out;
+// with it on a reading is only sent when voltage, current or power left
+// its deadband (mean or window extremes), the alarm flipped, or nothing
+// was sent for heartbeat ms.
+struct ReportPolicy {
+    bool byException;
+    Deadband voltage;         // V
+    Deadband current;         // A
+    Deadband power;           // W
+    unsigned long heartbeat;  // ms, longest silence
+};
+
+// Encoding of published readings
+enum PayloadFormat {
+    PAYLOAD_JSON,             // meter/<id>/data
+    PAYLOAD_BINARY            // meter/<id>/bin, see BinaryPayload.h
 };
 
-#endif // DATATYPES_H
\ No newline at end of file
+#endif // DATATYPES_H
@@ -0,0 +1,178 @@
+// AlignedTimer: wall-clock boundaries once the clock is set, a plain
+// period from the first call before. The clock is set through
+// wallClock.takeSync(), as an SNTP update would; run with
+// `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "AlignedTimer.h"
+#include "WallClock.h"
+
+namespace
+{
+    const int64_t EPOCH_MS = 1750000020000LL; // a multiple of 10 s and 60 s
+
+    // wallClock reads `epochMs` at millis() `ms`
+    void setClock(int64_t epochMs, unsigned long ms)
+    {
+        wallClock.takeSync(epochMs, ms);
+    }
+
+    void test_set_refuses_zero()
+    {
+        AlignedTimer timer;
+        TEST_ASSERT_TRUE(timer.set(5000));
+        TEST_ASSERT_FALSE(timer.set(0));
+        TEST_ASSERT_EQUAL_UINT32(5000, timer.period());
+        TEST_ASSERT_FALSE(timer.set(0, 100));
+        TEST_ASSERT_EQUAL_UINT32(5000, timer.period());
+    }
+
+    void test_before_sync_first_call_fires()
+    {
+        AlignedTimer timer;
+        timer.set(10000);
+        TEST_ASSERT_TRUE(timer.due(1234));
+        TEST_ASSERT_EQUAL_UINT32(1234, timer.boundary());
+        TEST_ASSERT_FALSE(timer.due(1234));
+    }
+
+    void test_before_sync_every_period_from_first_call()
+    {
+        AlignedTimer timer;
+        timer.set(10000);
+        TEST_ASSERT_TRUE(timer.due(500));
+        TEST_ASSERT_FALSE(timer.due(10499));
+        TEST_ASSERT_TRUE(timer.due(10500));
+        // A late call: the period runs from when it fired
+        TEST_ASSERT_FALSE(timer.due(20499));
+        TEST_ASSERT_TRUE(timer.due(23000));
+        TEST_ASSERT_EQUAL_UINT32(23000, timer.boundary());
+        TEST_ASSERT_FALSE(timer.due(32999));
+        TEST_ASSERT_TRUE(timer.due(33000));
+    }
+
+    void test_boundaries()
+    {
+        setClock(EPOCH_MS + 3700, 1000); // millis() 7300 is a boundary
+        AlignedTimer timer;
+        timer.set(10000);
+        TEST_ASSERT_FALSE(timer.due(1000));
+        TEST_ASSERT_FALSE(timer.due(7299));
+        TEST_ASSERT_TRUE(timer.due(7300));
+        TEST_ASSERT_EQUAL_UINT32(7300, timer.boundary());
+        TEST_ASSERT_FALSE(timer.due(7301));
+        TEST_ASSERT_FALSE(timer.due(17299));
+        // Late by 40 ms: the boundary is still the one passed
+        TEST_ASSERT_TRUE(timer.due(17340));
+        TEST_ASSERT_EQUAL_UINT32(17300, timer.boundary());
+        TEST_ASSERT_FALSE(timer.due(27299));
+        TEST_ASSERT_TRUE(timer.due(27300));
+    }
+
+    void test_missed_boundaries_skipped()
+    {
+        setClock(EPOCH_MS, 0);
+        AlignedTimer timer;
+        timer.set(10000);
+        TEST_ASSERT_FALSE(timer.due(5000));
+        TEST_ASSERT_TRUE(timer.due(10000));
+        // Three boundaries pass during one long call: one firing, for the last of them
+        TEST_ASSERT_TRUE(timer.due(45000));
+        TEST_ASSERT_EQUAL_UINT32(40000, timer.boundary());
+        TEST_ASSERT_FALSE(timer.due(49999));
+        TEST_ASSERT_TRUE(timer.due(50000));
+    }
+
+    void test_offset()
+    {
+        setClock(EPOCH_MS, 0);
+        AlignedTimer timer;
+        timer.set(10000, 2500);
+        TEST_ASSERT_FALSE(timer.due(1000));
+        TEST_ASSERT_FALSE(timer.due(2499));
+        TEST_ASSERT_TRUE(timer.due(2500));
+        TEST_ASSERT_TRUE(timer.due(12500));
+
+        // Taken modulo the period
+        timer.set(10000, 32500);
+        TEST_ASSERT_FALSE(timer.due(12600));
+        TEST_ASSERT_TRUE(timer.due(22500));
+    }
+
+    void test_period_not_dividing_a_day()
+    {
+        // 7 s boundaries are multiples of 7 s since the epoch, the same on every device
+        setClock(EPOCH_MS, 0);
+        AlignedTimer timer;
+        timer.set(7000);
+        int64_t first = (EPOCH_MS / 7000 + 1) * 7000;
+        unsigned long at = (unsigned long)(first - EPOCH_MS);
+        TEST_ASSERT_FALSE(timer.due(at - 1));
+        TEST_ASSERT_TRUE(timer.due(at));
+        TEST_ASSERT_TRUE(timer.due(at + 7000));
+    }
+
+    void test_moves_onto_boundaries_once_synced()
+    {
+        AlignedTimer timer;
+        timer.set(10000);
+        TEST_ASSERT_TRUE(timer.due(1500)); // no clock yet
+        setClock(EPOCH_MS + 4000, 3000); // millis() 9000 is a boundary
+        TEST_ASSERT_FALSE(timer.due(8999));
+        TEST_ASSERT_TRUE(timer.due(9000));
+        TEST_ASSERT_EQUAL_UINT32(9000, timer.boundary());
+        TEST_ASSERT_TRUE(timer.due(19000));
+    }
+
+    void test_set_starts_over()
+    {
+        setClock(EPOCH_MS, 0);
+        AlignedTimer timer;
+        timer.set(10000);
+        TEST_ASSERT_FALSE(timer.due(5000));
+        TEST_ASSERT_TRUE(timer.due(10000));
+        timer.set(60000);
+        TEST_ASSERT_FALSE(timer.due(20000));
+        TEST_ASSERT_FALSE(timer.due(59999));
+        TEST_ASSERT_TRUE(timer.due(60000));
+    }
+
+    void test_clock_set_back()
+    {
+        setClock(EPOCH_MS, 0);
+        AlignedTimer timer;
+        timer.set(10000);
+        TEST_ASSERT_FALSE(timer.due(5000));
+        TEST_ASSERT_TRUE(timer.due(10000));
+        // SNTP steps the clock back a minute: the next boundary is found again, not waited for
+        setClock(EPOCH_MS + 15000 - 60000, 15000);
+        TEST_ASSERT_FALSE(timer.due(15000));
+        TEST_ASSERT_TRUE(timer.due(20000));
+        TEST_ASSERT_EQUAL_UINT32(20000, timer.boundary());
+    }
+
+} // namespace
+
+void setUp()
+{
+    wallClock = WallClock();
+}
+
+void tearDown() {}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_set_refuses_zero);
+    RUN_TEST(test_before_sync_first_call_fires);
+    RUN_TEST(test_before_sync_every_period_from_first_call);
+    RUN_TEST(test_boundaries);
+    RUN_TEST(test_missed_boundaries_skipped);
+    RUN_TEST(test_offset);
+    RUN_TEST(test_period_not_dividing_a_day);
+    RUN_TEST(test_moves_onto_boundaries_once_synced);
+    RUN_TEST(test_set_starts_over);
+    RUN_TEST(test_clock_set_back);
+    return UNITY_END();
+}
@@ -0,0 +1,151 @@
+// Backlog resend pacing: readings stored during a broker outage are sent
+// again at drain_rate readings per second, however many readings each
+// stored record holds. The whole firmware runs on a virtual clock with the
+// PZEM emulator; run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <stdlib.h>
+#include "Bench.h"
+#include "ConfigManager.h"
+#include "DataSender.h"
+#include "FakeBroker.h"
+
+extern ConfigManager configManager;
+extern DataSender dataSender;
+void setup();
+void loop();
+
+namespace
+{
+    const uint16_t DRAIN_RATE = 2;          // readings/s
+    const unsigned long OUTAGE_MS = 300000; // 300 readings to the backlog
+    const uint8_t BURST = 10;               // DataSender::DRAIN_BURST
+    const unsigned long RECONNECT_LIMIT_MS = 600000; // past the longest reconnect backoff
+
+    hal::SimClock simClock;
+    FakeBroker broker;
+    hal::OfflineNetwork offline;
+    uint32_t receivedReadings = 0;
+
+    void countReadings(const char *topic, const uint8_t *payload, size_t length)
+    {
+        (void)topic;
+        static const char key[] = "\"timestamp\"";
+        for (size_t i = 0; i + sizeof(key) - 1 <= length; i++)
+        {
+            if (memcmp(payload + i, key, sizeof(key) - 1) == 0)
+                receivedReadings++;
+        }
+    }
+
+    void run(unsigned long ms)
+    {
+        for (unsigned long end = simClock.millis() + ms; (long)(simClock.millis() - end) < 0;)
+        {
+            loop();
+            simClock.advance(1000);
+        }
+    }
+
+    void fillBacklog(uint8_t batchSize)
+    {
+        configManager.updateConfig("batch_size", batchSize);
+        configManager.updateConfig("reading_interval", 1000);
+        // The open connection goes with the next message, then no connect succeeds
+        broker.config().dropEvery = 1;
+        hal::setNetwork(&offline);
+        run(OUTAGE_MS);
+        broker.config().dropEvery = 0;
+        // No new readings while the backlog drains
+        configManager.updateConfig("reading_interval", 3600000);
+        run(1000);
+    }
+
+    // Readings the broker receives in `seconds` once the device reconnected
+    uint32_t drained(unsigned long seconds)
+    {
+        hal::setNetwork(&broker);
+        for (unsigned long waited = 0; !dataSender.isConnected() && waited < RECONNECT_LIMIT_MS; waited += 1000)
+        {
+            run(1000);
+        }
+        TEST_ASSERT_TRUE(dataSender.isConnected());
+        receivedReadings = 0;
+        run(seconds * 1000);
+        return receivedReadings;
+    }
+
+    void assertPaced(uint8_t storedBatch, uint8_t batchSize)
+    {
+        fillBacklog(storedBatch);
+        configManager.updateConfig("batch_size", batchSize);
+        TEST_ASSERT_TRUE(dataSender.backlogPending() > 0);
+        const unsigned long seconds = 60;
+        uint32_t sent = drained(seconds);
+        // The bucket starts full
+        TEST_ASSERT_LESS_OR_EQUAL(DRAIN_RATE * seconds + BURST, sent);
+        TEST_ASSERT_GREATER_OR_EQUAL(DRAIN_RATE * (seconds - 5), sent);
+        // The rest follows at the same rate
+        configManager.updateConfig("drain_rate", 1000);
+        run(60000);
+        TEST_ASSERT_EQUAL(0, dataSender.backlogPending());
+        configManager.updateConfig("drain_rate", DRAIN_RATE);
+        run(1000);
+    }
+
+    void test_single_readings_paced()
+    {
+        assertPaced(1, 1);
+    }
+
+    void test_batched_records_paced()
+    {
+        assertPaced(8, 8);
+    }
+
+    // Records of 8 readings each, resent one reading per message:
+    // pending() counts 1 per record, the tokens are per reading
+    void test_batched_records_paced_after_batch_size_change()
+    {
+        assertPaced(8, 1);
+    }
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main()
+{
+    char fsRoot[] = "/tmp/test_backlog_drain.XXXXXX";
+    if (!mkdtemp(fsRoot))
+    {
+        return 1;
+    }
+    hal::setFsRoot(fsRoot);
+    hal::setClock(&simClock);
+    hal::setNetwork(&broker);
+    broker.setObserver(countReadings);
+
+    SimOptions options;
+    static PzemEmulator pzem(options.pzemConfig);
+    configurePzemBus(pzem, options);
+#ifdef PZEM_HW_UART
+    hal::attachSerial(D7, &pzem);
+#else
+    hal::attachSerial(D5, &pzem);
+#endif
+
+    setup();
+    configManager.updateConfig("report_by_exception", 0);
+    configManager.updateConfig("sample_interval", 200);
+    configManager.updateConfig("drain_rate", DRAIN_RATE);
+    run(10000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_single_readings_paced);
+    RUN_TEST(test_batched_records_paced);
+    RUN_TEST(test_batched_records_paced_after_batch_size_change);
+    return UNITY_END();
+}
@@ -0,0 +1,263 @@
+// Control commands end to end: the whole firmware (setup() / loop()) on a
+// virtual clock, each command published by the in-process FakeBroker on
+// meter/<id>/control and its reply taken from meter/<id>/response.
+// Run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <string>
+#include <stdlib.h>
+#include "ConfigManager.h"
+#include "DataSender.h"
+#include "FakeBroker.h"
+
+extern ConfigManager configManager;
+extern DataSender dataSender;
+void setup();
+void loop();
+
+namespace
+{
+    const unsigned long REPLY_TIMEOUT_MS = 2000;
+
+    hal::SimClock simClock;
+    FakeBroker broker;
+    std::string controlTopic;
+    std::string reply;
+    uint32_t replies = 0;
+
+    void observe(const char *topic, const uint8_t *payload, size_t length)
+    {
+        size_t topicLength = strlen(topic);
+        if (topicLength > 9 && strcmp(topic + topicLength - 9, "/response") == 0)
+        {
+            reply.assign((const char *)payload, length);
+            replies++;
+        }
+    }
+
+    void step()
+    {
+        loop();
+        simClock.advance(1000);
+    }
+
+    // Publishes the command and returns the reply, "" if none came
+    const char *send(const char *payload, size_t length)
+    {
+        reply.clear();
+        uint32_t before = replies;
+        broker.publish(controlTopic.c_str(), (const uint8_t *)payload, length);
+        for (unsigned long ms = 0; ms < REPLY_TIMEOUT_MS && replies == before; ms++)
+        {
+            step();
+        }
+        return reply.c_str();
+    }
+
+    const char *send(const char *payload)
+    {
+        return send(payload, strlen(payload));
+    }
+
+    void test_update_config()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"update_config\",\"ok\":true}",
+                                 send("{\"command\":\"update_config\",\"key\":\"reading_interval\",\"value\":5000}"));
+        TEST_ASSERT_EQUAL(5000, configManager.getReadingInterval());
+
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"update_config\",\"ok\":true}",
+                                 send("{\"command\":\"update_config\",\"key\":\"payload_format\",\"value\":\"binary\"}"));
+        TEST_ASSERT_EQUAL(PAYLOAD_BINARY, configManager.getPayloadFormat());
+
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"update_config\",\"ok\":true}",
+                                 send("{\"command\":\"update_config\",\"key\":\"deadband_current\",\"value\":0.25}"));
+        TEST_ASSERT_EQUAL_FLOAT(0.25f, configManager.getConfig().deadband_current);
+
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"update_config\",\"ok\":true}",
+                                 send("{\"command\":\"update_config\",\"key\":\"mqtt_tls\",\"value\":false}"));
+    }
+
+    void test_update_config_errors()
+    {
+        TEST_ASSERT_EQUAL_STRING(
+            "{\"command\":\"update_config\",\"ok\":false,\"error\":\"reading_interval must be 200..86400000\"}",
+            send("{\"command\":\"update_config\",\"key\":\"reading_interval\",\"value\":0}"));
+        TEST_ASSERT_EQUAL(10000, configManager.getReadingInterval());
+
+        TEST_ASSERT_EQUAL_STRING(
+            "{\"command\":\"update_config\",\"ok\":false,\"error\":\"payload_format must be json or binary\"}",
+            send("{\"command\":\"update_config\",\"key\":\"payload_format\",\"value\":\"xml\"}"));
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"update_config\",\"ok\":false,\"error\":\"unknown key\"}",
+                                 send("{\"command\":\"update_config\",\"key\":\"colour\",\"value\":1}"));
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"update_config\",\"ok\":false,\"error\":\"missing key\"}",
+                                 send("{\"command\":\"update_config\",\"value\":1}"));
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"update_config\",\"ok\":false,\"error\":\"missing value\"}",
+                                 send("{\"command\":\"update_config\",\"key\":\"reading_interval\"}"));
+        TEST_ASSERT_EQUAL_STRING(
+            "{\"command\":\"update_config\",\"ok\":false,\"error\":\"value too long\"}",
+            send("{\"command\":\"update_config\",\"key\":\"reading_interval\",\"value\":1000000000000000000000000}"));
+        TEST_ASSERT_EQUAL(10000, configManager.getReadingInterval());
+    }
+
+    void test_set_sample_interval()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"set_sample_interval\",\"ok\":true}",
+                                 send("{\"command\":\"set_sample_interval\",\"value\":2000}"));
+        TEST_ASSERT_EQUAL(2000, configManager.getSampleInterval());
+
+        const char *tooShort =
+            "{\"command\":\"set_sample_interval\",\"ok\":false,\"error\":\"value must be at least 200 ms\"}";
+        TEST_ASSERT_EQUAL_STRING(tooShort, send("{\"command\":\"set_sample_interval\",\"value\":100}"));
+        TEST_ASSERT_EQUAL_STRING(tooShort, send("{\"command\":\"set_sample_interval\",\"value\":\"1000\"}"));
+        TEST_ASSERT_EQUAL_STRING(tooShort, send("{\"command\":\"set_sample_interval\",\"value\":1.5}"));
+        TEST_ASSERT_EQUAL_STRING(tooShort, send("{\"command\":\"set_sample_interval\"}"));
+        TEST_ASSERT_EQUAL_STRING(
+            "{\"command\":\"set_sample_interval\",\"ok\":false,\"error\":\"sample_interval must be 200..3600000\"}",
+            send("{\"command\":\"set_sample_interval\",\"value\":3600001}"));
+        TEST_ASSERT_EQUAL(2000, configManager.getSampleInterval());
+    }
+
+    void test_set_publish_interval()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"set_publish_interval\",\"ok\":true}",
+                                 send("{\"command\":\"set_publish_interval\",\"value\":60000}"));
+        TEST_ASSERT_EQUAL(60000, configManager.getReadingInterval());
+
+        TEST_ASSERT_EQUAL_STRING(
+            "{\"command\":\"set_publish_interval\",\"ok\":false,\"error\":\"value must be at least sample_interval\"}",
+            send("{\"command\":\"set_publish_interval\",\"value\":500}"));
+        TEST_ASSERT_EQUAL_STRING(
+            "{\"command\":\"set_publish_interval\",\"ok\":false,\"error\":\"reading_interval must be 200..86400000\"}",
+            send("{\"command\":\"set_publish_interval\",\"value\":86400001}"));
+        TEST_ASSERT_EQUAL(60000, configManager.getReadingInterval());
+    }
+
+    void test_flush_backlog()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"flush_backlog\",\"ok\":true,\"pending\":0}",
+                                 send("{\"command\":\"flush_backlog\"}"));
+    }
+
+    void test_snapshot()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"snapshot\",\"ok\":true}", send("{\"command\":\"snapshot\"}"));
+    }
+
+    void test_reset_config()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"reset_config\",\"ok\":true}", send("{\"command\":\"reset_config\"}"));
+        TEST_ASSERT_EQUAL(10000, configManager.getReadingInterval());
+        TEST_ASSERT_EQUAL(1000, configManager.getSampleInterval());
+    }
+
+    void test_unknown_command()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"dance\",\"ok\":false,\"error\":\"unknown command\"}",
+                                 send("{\"command\":\"dance\"}"));
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"\",\"ok\":false,\"error\":\"unknown command\"}", send("{}"));
+        // Not echoed: a long name would not leave room for the rest of the reply
+        char payload[200];
+        snprintf(payload, sizeof(payload), "{\"command\":\"%0150d\"}", 0);
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"\",\"ok\":false,\"error\":\"unknown command\"}", send(payload));
+    }
+
+    void test_invalid_json()
+    {
+        const char *invalid = "{\"command\":\"\",\"ok\":false,\"error\":\"invalid JSON\"}";
+        TEST_ASSERT_EQUAL_STRING(invalid, send("{\"command\":"));
+        TEST_ASSERT_EQUAL_STRING(invalid, send("not json"));
+        TEST_ASSERT_EQUAL_STRING(invalid, send("{\"value\":{\"nested\":1}}"));
+        TEST_ASSERT_EQUAL_STRING(invalid, send("{\"value\":1-2}"));
+        // What was read before the error is still echoed
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"snapshot\",\"ok\":false,\"error\":\"invalid JSON\"}",
+                                 send("{\"command\":\"snapshot\"} trailing"));
+    }
+
+    void test_id_echoed()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"snapshot\",\"id\":\"req-1\",\"ok\":true}",
+                                 send("{\"id\":\"req-1\",\"command\":\"snapshot\"}"));
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"snapshot\",\"id\":42,\"ok\":true}",
+                                 send("{\"command\":\"snapshot\",\"id\":42}"));
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"dance\",\"id\":7,\"ok\":false,\"error\":\"unknown command\"}",
+                                 send("{\"command\":\"dance\",\"id\":7}"));
+        // Not a reply to the previous request's id
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"snapshot\",\"ok\":true}", send("{\"command\":\"snapshot\"}"));
+    }
+
+    void test_id_too_long()
+    {
+        char payload[120];
+        snprintf(payload, sizeof(payload), "{\"command\":\"snapshot\",\"id\":\"%040d\"}", 0);
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"snapshot\",\"ok\":false,\"error\":\"id too long\"}", send(payload));
+        snprintf(payload, sizeof(payload), "{\"command\":\"snapshot\",\"id\":1%040d}", 0);
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"snapshot\",\"ok\":false,\"error\":\"id too long\"}", send(payload));
+    }
+
+    void test_oversized_payload_is_dropped()
+    {
+        // Past the MQTT client's buffer: skipped without a reply, and the connection keeps working
+        char payload[600];
+        int length = snprintf(payload, sizeof(payload), "{\"command\":\"snapshot\",\"pad\":\"");
+        memset(payload + length, 'x', sizeof(payload) - length - 2);
+        memcpy(payload + sizeof(payload) - 2, "\"}", 2);
+        TEST_ASSERT_EQUAL_STRING("", send(payload, sizeof(payload)));
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"snapshot\",\"ok\":true}", send("{\"command\":\"snapshot\"}"));
+    }
+
+    // Last: the device restarts a second after the reply
+    void test_reboot()
+    {
+        TEST_ASSERT_EQUAL_STRING("{\"command\":\"reboot\",\"ok\":true}", send("{\"command\":\"reboot\"}"));
+    }
+
+} // namespace
+
+void setUp()
+{
+    configManager.resetToDefaults();
+}
+
+void tearDown() {}
+
+int main()
+{
+    char fsRoot[] = "/tmp/test_command_processor.XXXXXX";
+    if (!mkdtemp(fsRoot))
+    {
+        return 1;
+    }
+    hal::setFsRoot(fsRoot);
+    hal::setClock(&simClock);
+    hal::setNetwork(&broker);
+    broker.setObserver(observe);
+
+    setup();
+    controlTopic = "meter/" + std::string(configManager.getDeviceId().c_str()) + "/control";
+    // Connected and subscribed
+    for (int i = 0; i < 10000 && broker.stats().connects == 0; i++)
+    {
+        step();
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        step();
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_update_config);
+    RUN_TEST(test_update_config_errors);
+    RUN_TEST(test_set_sample_interval);
+    RUN_TEST(test_set_publish_interval);
+    RUN_TEST(test_flush_backlog);
+    RUN_TEST(test_snapshot);
+    RUN_TEST(test_reset_config);
+    RUN_TEST(test_unknown_command);
+    RUN_TEST(test_invalid_json);
+    RUN_TEST(test_id_echoed);
+    RUN_TEST(test_id_too_long);
+    RUN_TEST(test_oversized_payload_is_dropped);
+    RUN_TEST(test_reboot);
+    return UNITY_END();
+}
@@ -0,0 +1,354 @@
+// ConfigManager change listeners: which ones an update reaches, with which
+// groups, and when, and DataSender's listener reconnecting on a change.
+// Run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <stdlib.h>
+#include "ConfigManager.h"
+#include "DataSender.h"
+#include "FakeBroker.h"
+
+namespace
+{
+    struct Recorder
+    {
+        uint32_t mask;
+        uint32_t calls;
+        uint32_t changed; // of the last call
+    };
+
+    // As many as ConfigManager takes; the mix main.cpp uses: single groups,
+    // a listener for two groups, one for a family of groups, and everything
+    Recorder recorders[] = {
+        {CONFIG_READING_INTERVAL, 0, 0},
+        {CONFIG_BATCH_SIZE, 0, 0},
+        {CONFIG_READING_INTERVAL | CONFIG_BATCH_SIZE, 0, 0},
+        {CONFIG_MQTT_SERVER | CONFIG_MQTT_AUTH | CONFIG_DEVICE_ID, 0, 0},
+        {CONFIG_REPORT_POLICY, 0, 0},
+        {CONFIG_ALL, 0, 0},
+    };
+    const uint8_t READING = 0, BATCH = 1, BOTH = 2, MQTT = 3, POLICY = 4, ALL = 5;
+    const uint8_t RECORDERS = sizeof(recorders) / sizeof(recorders[0]);
+
+    ConfigManager *manager;
+
+    void clear()
+    {
+        for (Recorder &r : recorders)
+        {
+            r.calls = r.changed = 0;
+        }
+    }
+
+    void assertCalled(uint8_t index, uint32_t changed)
+    {
+        char message[32];
+        snprintf(message, sizeof(message), "listener %u", index);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, recorders[index].calls, message);
+        TEST_ASSERT_EQUAL_HEX32_MESSAGE(changed, recorders[index].changed, message);
+    }
+
+    void assertNotCalled(uint8_t index)
+    {
+        char message[32];
+        snprintf(message, sizeof(message), "listener %u", index);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, recorders[index].calls, message);
+    }
+
+    void assertNoneCalled()
+    {
+        for (uint8_t i = 0; i < RECORDERS; i++)
+        {
+            assertNotCalled(i);
+        }
+    }
+
+    void test_load_reaches_every_listener()
+    {
+        ConfigManager fresh;
+        for (Recorder &r : recorders)
+        {
+            Recorder *recorder = &r;
+            fresh.onChange(r.mask, [recorder](const MeterConfig &, uint32_t changed)
+                           { recorder->calls++; recorder->changed = changed; });
+        }
+        clear();
+        TEST_ASSERT_TRUE(fresh.loadConfig());
+        fresh.applyChanges();
+        for (uint8_t i = 0; i < RECORDERS; i++)
+        {
+            assertCalled(i, recorders[i].mask);
+        }
+    }
+
+    void test_single_field()
+    {
+        TEST_ASSERT_TRUE(manager->updateConfig("reading_interval", 5000));
+        manager->applyChanges();
+        assertCalled(READING, CONFIG_READING_INTERVAL);
+        assertCalled(BOTH, CONFIG_READING_INTERVAL);
+        assertCalled(ALL, CONFIG_READING_INTERVAL);
+        assertNotCalled(BATCH);
+        assertNotCalled(MQTT);
+        assertNotCalled(POLICY);
+    }
+
+    void test_multi_field_is_one_call_per_listener()
+    {
+        TEST_ASSERT_TRUE(manager->updateConfig("reading_interval", 5000));
+        TEST_ASSERT_TRUE(manager->updateConfig("batch_size", 4));
+        TEST_ASSERT_TRUE(manager->updateConfig("mqtt_port", 8883));
+        TEST_ASSERT_TRUE(manager->updateConfig("mqtt_server", "broker.example"));
+        manager->applyChanges();
+        assertCalled(READING, CONFIG_READING_INTERVAL);
+        assertCalled(BATCH, CONFIG_BATCH_SIZE);
+        assertCalled(BOTH, CONFIG_READING_INTERVAL | CONFIG_BATCH_SIZE);
+        assertCalled(MQTT, CONFIG_MQTT_SERVER);
+        assertCalled(ALL, CONFIG_READING_INTERVAL | CONFIG_BATCH_SIZE | CONFIG_MQTT_SERVER);
+        assertNotCalled(POLICY);
+    }
+
+    void test_fields_of_one_group()
+    {
+        TEST_ASSERT_TRUE(manager->updateConfig("deadband_voltage", "3.5"));
+        TEST_ASSERT_TRUE(manager->updateConfig("heartbeat_interval", 60000));
+        TEST_ASSERT_TRUE(manager->updateConfig("report_by_exception", 0));
+        manager->applyChanges();
+        assertCalled(POLICY, CONFIG_REPORT_POLICY);
+        assertCalled(ALL, CONFIG_REPORT_POLICY);
+        assertNotCalled(READING);
+        assertNotCalled(MQTT);
+    }
+
+    void test_no_op_updates()
+    {
+        MeterConfig config = manager->getConfig();
+        TEST_ASSERT_TRUE(manager->updateConfig("reading_interval", config.reading_interval));
+        TEST_ASSERT_TRUE(manager->updateConfig("mqtt_server", config.mqtt_server));
+        TEST_ASSERT_TRUE(manager->updateConfig("payload_format", config.payload_format));
+        TEST_ASSERT_TRUE(manager->updateConfig("deadband_current", String(config.deadband_current, 3)));
+        manager->applyChanges();
+        assertNoneCalled();
+    }
+
+    void test_refused_updates()
+    {
+        TEST_ASSERT_FALSE(manager->updateConfig("reading_interval", 0));
+        TEST_ASSERT_FALSE(manager->updateConfig("batch_size", 9));
+        TEST_ASSERT_FALSE(manager->updateConfig("payload_format", "xml"));
+        TEST_ASSERT_FALSE(manager->updateConfig("no_such_key", 1));
+        manager->applyChanges();
+        assertNoneCalled();
+        TEST_ASSERT_EQUAL(10000, manager->getReadingInterval());
+    }
+
+    void test_applied_once()
+    {
+        TEST_ASSERT_TRUE(manager->updateConfig("batch_size", 2));
+        manager->applyChanges();
+        clear();
+        manager->applyChanges();
+        assertNoneCalled();
+    }
+
+    void test_nothing_before_apply()
+    {
+        TEST_ASSERT_TRUE(manager->updateConfig("batch_size", 2));
+        assertNoneCalled();
+        TEST_ASSERT_EQUAL(2, manager->getBatchSize());
+    }
+
+    void test_reset_reaches_changed_groups_only()
+    {
+        TEST_ASSERT_TRUE(manager->updateConfig("batch_size", 2));
+        TEST_ASSERT_TRUE(manager->updateConfig("device_id", "42"));
+        manager->applyChanges();
+        clear();
+        TEST_ASSERT_TRUE(manager->resetToDefaults());
+        manager->applyChanges();
+        assertCalled(BATCH, CONFIG_BATCH_SIZE);
+        assertCalled(BOTH, CONFIG_BATCH_SIZE);
+        assertCalled(MQTT, CONFIG_DEVICE_ID);
+        assertCalled(ALL, CONFIG_BATCH_SIZE | CONFIG_DEVICE_ID);
+        assertNotCalled(READING);
+        assertNotCalled(POLICY);
+    }
+
+    // Every key changes exactly its own group
+    void test_key_groups()
+    {
+        // String keys take `text`, the others `number`
+        struct KeyGroup
+        {
+            const char *key;
+            const char *text;
+            int number;
+            uint32_t group;
+        };
+        static const KeyGroup keys[] = {
+            {"mqtt_server", "broker.example", 0, CONFIG_MQTT_SERVER},
+            {"mqtt_port", nullptr, 8883, CONFIG_MQTT_SERVER},
+            {"mqtt_username", "meter", 0, CONFIG_MQTT_AUTH},
+            {"mqtt_password", "secret", 0, CONFIG_MQTT_AUTH},
+            {"mqtt_tls", nullptr, 1, CONFIG_MQTT_TLS},
+            {"mqtt_fingerprint", "00:11", 0, CONFIG_MQTT_TLS},
+            {"mqtt_pubkey", "key", 0, CONFIG_MQTT_TLS},
+            {"device_id", "42", 0, CONFIG_DEVICE_ID},
+            {"serial_number", "SN042", 0, CONFIG_SERIAL_NUMBER},
+            {"sample_interval", nullptr, 2000, CONFIG_SAMPLE_INTERVAL},
+            {"reading_interval", nullptr, 60000, CONFIG_READING_INTERVAL},
+            {"publish_offset", nullptr, 500, CONFIG_PUBLISH_OFFSET},
+            {"pzem_addresses", "1,2,3", 0, CONFIG_PZEM_ADDRESSES},
+            {"report_by_exception", nullptr, 1, CONFIG_REPORT_POLICY},
+            {"heartbeat_interval", nullptr, 60000, CONFIG_REPORT_POLICY},
+            {"deadband_voltage", "3", 0, CONFIG_REPORT_POLICY},
+            {"deadband_voltage_pct", "1", 0, CONFIG_REPORT_POLICY},
+            {"deadband_current", "0.1", 0, CONFIG_REPORT_POLICY},
+            {"deadband_current_pct", "1", 0, CONFIG_REPORT_POLICY},
+            {"deadband_power", "20", 0, CONFIG_REPORT_POLICY},
+            {"deadband_power_pct", "1", 0, CONFIG_REPORT_POLICY},
+            {"backlog_days", nullptr, 3, CONFIG_BACKLOG_DAYS},
+            {"drain_rate", nullptr, 20, CONFIG_DRAIN_RATE},
+            {"batch_size", nullptr, 4, CONFIG_BATCH_SIZE},
+            {"payload_format", "binary", 0, CONFIG_PAYLOAD_FORMAT},
+            {"wifi_ssid", "site", 0, CONFIG_WIFI},
+            {"wifi_password", "secret", 0, CONFIG_WIFI},
+        };
+        for (const KeyGroup &k : keys)
+        {
+            TEST_ASSERT_TRUE_MESSAGE(k.text ? manager->updateConfig(k.key, k.text) : manager->updateConfig(k.key, k.number),
+                                     k.key);
+            manager->applyChanges();
+            TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, recorders[ALL].calls, k.key);
+            TEST_ASSERT_EQUAL_HEX32_MESSAGE(k.group, recorders[ALL].changed, k.key);
+            clear();
+        }
+    }
+
+    // A listener's own updates wait for the next applyChanges()
+    void test_update_from_listener()
+    {
+        ConfigManager config;
+        TEST_ASSERT_TRUE(config.loadConfig());
+        uint32_t calls = 0;
+        uint32_t lastChanged = 0;
+        config.onChange(CONFIG_SAMPLE_INTERVAL | CONFIG_READING_INTERVAL,
+                        [&](const MeterConfig &c, uint32_t changed)
+                        {
+                            calls++;
+                            lastChanged = changed;
+                            if ((changed & CONFIG_SAMPLE_INTERVAL) && c.reading_interval < c.sample_interval)
+                            {
+                                config.updateConfig("reading_interval", c.sample_interval);
+                            }
+                        });
+        config.applyChanges();
+        calls = 0;
+
+        TEST_ASSERT_TRUE(config.updateConfig("sample_interval", 20000));
+        config.applyChanges();
+        TEST_ASSERT_EQUAL_UINT32(1, calls);
+        TEST_ASSERT_EQUAL_HEX32(CONFIG_SAMPLE_INTERVAL, lastChanged);
+        config.applyChanges();
+        TEST_ASSERT_EQUAL_UINT32(2, calls);
+        TEST_ASSERT_EQUAL_HEX32(CONFIG_READING_INTERVAL, lastChanged);
+        TEST_ASSERT_EQUAL(20000, config.getReadingInterval());
+    }
+
+    // Runs the sender until it is connected, for up to a minute of simulated time
+    bool connect(DataSender &sender, hal::SimClock &clock)
+    {
+        for (int i = 0; i < 6000 && !sender.isConnected(); i++)
+        {
+            sender.loop();
+            clock.advance(10000);
+        }
+        return sender.isConnected();
+    }
+
+    // A device_id change reconnects to the same broker, whose name
+    // MqttClient must not take from the String updateConfig() replaces
+    void test_device_id_change_reconnects()
+    {
+        hal::SimClock clock;
+        FakeBroker broker;
+        hal::Clock &previousClock = hal::clock();
+        hal::Network &previousNetwork = hal::network();
+        hal::setClock(&clock);
+        hal::setNetwork(&broker);
+
+        ConfigManager config;
+        DataSender sender;
+        // As in main.cpp
+        config.onChange(CONFIG_MQTT_SERVER | CONFIG_MQTT_AUTH | CONFIG_DEVICE_ID | CONFIG_SERIAL_NUMBER,
+                        [&sender](const MeterConfig &c, uint32_t)
+                        { sender.updateConfig(c.mqtt_server.c_str(), c.mqtt_port, c.device_id.c_str(),
+                                              c.serial_number.c_str(), c.mqtt_password.c_str(),
+                                              c.mqtt_username.c_str()); });
+        TEST_ASSERT_TRUE(config.loadConfig());
+        // 127.0.0.1, long enough for the host String to be on the heap
+        const char *server = "0x7f.0x0.0x0.0x1";
+        TEST_ASSERT_TRUE(config.updateConfig("mqtt_server", server));
+        config.applyChanges();
+        sender.setup();
+        TEST_ASSERT_TRUE(connect(sender, clock));
+        TEST_ASSERT_EQUAL_UINT32(1, broker.stats().connects);
+
+        TEST_ASSERT_TRUE(config.updateConfig("device_id", "meter-2"));
+        config.applyChanges();
+        // Takes the block the old server name was freed to, if it was
+        String reuse(server);
+        memset((char *)reuse.c_str(), 'x', reuse.length());
+        TEST_ASSERT_TRUE(connect(sender, clock));
+        TEST_ASSERT_EQUAL_UINT32(2, broker.stats().connects);
+
+        hal::setNetwork(&previousNetwork);
+        hal::setClock(&previousClock);
+    }
+
+} // namespace
+
+void setUp()
+{
+    manager->resetToDefaults();
+    manager->applyChanges();
+    clear();
+}
+
+void tearDown() {}
+
+int main()
+{
+    char fsRoot[] = "/tmp/test_config_changes.XXXXXX";
+    if (!mkdtemp(fsRoot))
+    {
+        return 1;
+    }
+    hal::setFsRoot(fsRoot);
+
+    static ConfigManager config;
+    manager = &config;
+    for (Recorder &r : recorders)
+    {
+        Recorder *recorder = &r;
+        config.onChange(r.mask, [recorder](const MeterConfig &, uint32_t changed)
+                        { recorder->calls++; recorder->changed = changed; });
+    }
+    config.loadConfig();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_load_reaches_every_listener);
+    RUN_TEST(test_single_field);
+    RUN_TEST(test_multi_field_is_one_call_per_listener);
+    RUN_TEST(test_fields_of_one_group);
+    RUN_TEST(test_no_op_updates);
+    RUN_TEST(test_refused_updates);
+    RUN_TEST(test_applied_once);
+    RUN_TEST(test_nothing_before_apply);
+    RUN_TEST(test_reset_reaches_changed_groups_only);
+    RUN_TEST(test_key_groups);
+    RUN_TEST(test_update_from_listener);
+    RUN_TEST(test_device_id_change_reconnects);
+    return UNITY_END();
+}
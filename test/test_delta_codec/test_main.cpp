@@ -0,0 +1,308 @@
+// DeltaCodec round trips, alone and inside a BinaryPayload batch: what is
+// decoded must be what was encoded, field for field. Inputs are at the
+// codec's resolution (see DeltaCodec.h), so nothing is lost to rounding;
+// run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <math.h>
+#include "BinaryPayload.h"
+#include "DeltaCodec.h"
+
+namespace
+{
+    const uint32_t EPOCH = 1750000000;
+
+    // A value of `units` at the codec's resolution, as the decoder rebuilds it
+    float at(int64_t units, float scale)
+    {
+        return units / scale;
+    }
+
+    MeterReadings reading(uint8_t phase, uint32_t seq, int64_t centivolts, int64_t power, int64_t energyWh)
+    {
+        MeterReadings r = MeterReadings();
+        r.phase = phase;
+        r.seq = seq;
+        r.epoch = EPOCH + seq;
+        r.samples = 10;
+        r.voltage = at(centivolts, 100);
+        r.voltageMin = at(centivolts / 10 - 5, 10);
+        r.voltageMax = at(centivolts / 10 + 5, 10);
+        r.power = at(power, 100);
+        r.powerMin = at(power / 10 - 20, 10);
+        r.powerMax = at(power / 10 + 20, 10);
+        r.current = at(power * 10000 / centivolts, 10000);
+        r.currentMin = at(power * 1000 / centivolts - 5, 1000);
+        r.currentMax = at(power * 1000 / centivolts + 5, 1000);
+        r.energy = at(energyWh, 1000);
+        r.energyDelta = at(3, 1000);
+        r.frequency = at(5001, 100);
+        r.pf = at(950, 1000);
+        return r;
+    }
+
+    // A PZEM that did not answer: every measurement NAN
+    MeterReadings offline(uint8_t phase, uint32_t seq)
+    {
+        MeterReadings r = MeterReadings();
+        r.phase = phase;
+        r.seq = seq;
+        r.epoch = EPOCH + seq;
+        float *fields[] = {&r.voltage, &r.current, &r.power, &r.energy, &r.frequency, &r.pf,
+                           &r.voltageMin, &r.voltageMax, &r.currentMin, &r.currentMax,
+                           &r.powerMin, &r.powerMax, &r.energyDelta};
+        for (float *f : fields)
+        {
+            *f = NAN;
+        }
+        return r;
+    }
+
+    void assertSameFloat(float expected, float actual, const char *field, uint8_t index)
+    {
+        char message[48];
+        snprintf(message, sizeof(message), "reading %u %s", index, field);
+        if (isnan(expected))
+        {
+            TEST_ASSERT_TRUE_MESSAGE(isnan(actual), message);
+            return;
+        }
+        // Exact: the same integer divided by the same scale
+        TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&expected, &actual, sizeof(float), message);
+    }
+
+    void assertSame(const MeterReadings &expected, const MeterReadings &actual, uint8_t index)
+    {
+        char message[32];
+        snprintf(message, sizeof(message), "reading %u", index);
+        TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected.phase, actual.phase, message);
+        TEST_ASSERT_EQUAL_MESSAGE(expected.alarm, actual.alarm, message);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected.epoch, actual.epoch, message);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected.seq, actual.seq, message);
+        TEST_ASSERT_EQUAL_UINT16_MESSAGE(expected.samples, actual.samples, message);
+        assertSameFloat(expected.voltage, actual.voltage, "voltage", index);
+        assertSameFloat(expected.current, actual.current, "current", index);
+        assertSameFloat(expected.power, actual.power, "power", index);
+        assertSameFloat(expected.energy, actual.energy, "energy", index);
+        assertSameFloat(expected.frequency, actual.frequency, "frequency", index);
+        assertSameFloat(expected.pf, actual.pf, "pf", index);
+        assertSameFloat(expected.voltageMin, actual.voltageMin, "voltageMin", index);
+        assertSameFloat(expected.voltageMax, actual.voltageMax, "voltageMax", index);
+        assertSameFloat(expected.currentMin, actual.currentMin, "currentMin", index);
+        assertSameFloat(expected.currentMax, actual.currentMax, "currentMax", index);
+        assertSameFloat(expected.powerMin, actual.powerMin, "powerMin", index);
+        assertSameFloat(expected.powerMax, actual.powerMax, "powerMax", index);
+        assertSameFloat(expected.energyDelta, actual.energyDelta, "energyDelta", index);
+    }
+
+    const uint8_t MAX_RUN = 8;
+
+    // Encodes `count` readings as one run, decodes them and compares
+    void roundTrip(const MeterReadings *readings, uint8_t count)
+    {
+        TEST_ASSERT_TRUE(count <= MAX_RUN);
+        uint8_t buffer[MAX_RUN * DeltaCodec::MAX_READING_BYTES];
+        DeltaCodec encoder;
+        size_t length = 0;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            size_t n = encoder.encode(readings[i], buffer + length, sizeof(buffer) - length);
+            TEST_ASSERT_NOT_EQUAL(0, n);
+            length += n;
+        }
+
+        DeltaCodec decoder;
+        size_t offset = 0;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            MeterReadings decoded;
+            size_t n = decoder.decode(buffer + offset, length - offset, decoded);
+            TEST_ASSERT_NOT_EQUAL(0, n);
+            offset += n;
+            assertSame(readings[i], decoded, i);
+        }
+        TEST_ASSERT_EQUAL(length, offset);
+    }
+
+    void test_single_phase_run()
+    {
+        MeterReadings readings[8];
+        for (uint8_t i = 0; i < 8; i++)
+        {
+            readings[i] = reading(0, 100 + i, 23012 + i * 7, 150000 + i * 130, 12345 + i);
+        }
+        readings[5].alarm = true;
+        roundTrip(readings, 8);
+    }
+
+    void test_negative_deltas()
+    {
+        MeterReadings readings[] = {
+            reading(0, 1, 24000, 900000, 500000),
+            reading(0, 2, 19999, 1200, 499000), // everything falls, energy too (meter reset)
+            reading(0, 3, 19998, 0, 0),
+            reading(0, 4, 25000, 2300000, 1),
+        };
+        readings[2].frequency = at(4950, 100);
+        readings[2].pf = at(0, 1000);
+        readings[3].samples = 1;
+        readings[3].epoch = readings[2].epoch - 3600; // clock stepped back
+        roundTrip(readings, 4);
+    }
+
+    // Values that restart from zero: seq past 2^32, the PZEM energy
+    // register past 9999.99 kWh, samples at the top of uint16_t
+    void test_counter_wrap()
+    {
+        MeterReadings readings[] = {
+            reading(0, 0xFFFFFFFE, 23000, 100000, 9999990),
+            reading(0, 0xFFFFFFFF, 23000, 100000, 9999999),
+            reading(0, 1, 23000, 100000, 2),
+            reading(0, 2, 23000, 100000, 15),
+        };
+        readings[1].samples = UINT16_MAX;
+        readings[2].samples = 1;
+        readings[2].epoch = 0; // time not known
+        roundTrip(readings, 4);
+    }
+
+    void test_multi_phase_panel()
+    {
+        // Two publish cycles of a 3-phase panel: phases 1..3, then the total
+        MeterReadings readings[8];
+        uint8_t n = 0;
+        for (uint8_t cycle = 0; cycle < 2; cycle++)
+        {
+            int64_t total = 0;
+            for (uint8_t phase = 1; phase <= 3; phase++)
+            {
+                int64_t power = 100000 * phase + cycle * 2500;
+                total += power;
+                readings[n] = reading(phase, n + 1, 22900 + phase * 50 + cycle, power, 40000 * phase + cycle);
+                n++;
+            }
+            readings[n] = reading(0, n + 1, 23000, total, 240000 + cycle * 3);
+            n++;
+        }
+        roundTrip(readings, n);
+    }
+
+    void test_nan_phases()
+    {
+        // Phase 2 goes offline for a cycle and comes back
+        MeterReadings readings[] = {
+            reading(1, 1, 23010, 120000, 41000),
+            reading(2, 2, 22990, 90000, 38000),
+            reading(3, 3, 23050, 60000, 12000),
+            reading(1, 4, 23011, 121000, 41002),
+            offline(2, 5),
+            reading(3, 6, 23049, 60500, 12001),
+            reading(1, 7, 23012, 122000, 41004),
+            reading(2, 8, 22995, 91000, 38003),
+        };
+        // Some measurements missing on a phase that answered
+        readings[6].pf = NAN;
+        readings[6].energyDelta = NAN;
+        roundTrip(readings, 8);
+    }
+
+    // A run that starts with a reading of nothing but NAN
+    void test_nan_first()
+    {
+        MeterReadings readings[] = {
+            offline(1, 1),
+            reading(1, 2, 23010, 120000, 41000),
+            offline(2, 3),
+        };
+        roundTrip(readings, 3);
+    }
+
+    void test_truncated_input()
+    {
+        MeterReadings r = reading(2, 77, 23012, 150000, 12345);
+        uint8_t buffer[DeltaCodec::MAX_READING_BYTES];
+        DeltaCodec encoder;
+        size_t length = encoder.encode(r, buffer, sizeof(buffer));
+        TEST_ASSERT_NOT_EQUAL(0, length);
+        for (size_t cut = 0; cut < length; cut++)
+        {
+            DeltaCodec decoder;
+            MeterReadings decoded;
+            TEST_ASSERT_EQUAL(0, decoder.decode(buffer, cut, decoded));
+        }
+        // And too little room to encode
+        DeltaCodec small;
+        TEST_ASSERT_EQUAL(0, small.encode(r, buffer, length - 1));
+    }
+
+    void test_binary_payload_batch()
+    {
+        MeterReadings readings[4];
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            readings[i] = reading(i, 500 + i, 23000 + i, 100000 + i * 1000, 7000 + i);
+        }
+        readings[2] = offline(2, 502);
+        uint8_t out[512];
+        size_t length = BinaryPayload::encode(String("SN001"), 60, readings, 4, out, sizeof(out));
+        TEST_ASSERT_NOT_EQUAL(0, length);
+
+        // Header: version, flags, heartbeat, serial, count
+        TEST_ASSERT_EQUAL_UINT8(BinaryPayload::VERSION, out[0]);
+        TEST_ASSERT_EQUAL_HEX8(BinaryPayload::FLAG_HEARTBEAT | BinaryPayload::FLAG_DELTA, out[1]);
+        TEST_ASSERT_EQUAL_UINT16(60, out[2] | out[3] << 8);
+        TEST_ASSERT_EQUAL_UINT8(5, out[4]);
+        TEST_ASSERT_EQUAL_MEMORY("SN001", out + 5, 5);
+        TEST_ASSERT_EQUAL_UINT8(4, out[10]);
+
+        DeltaCodec decoder;
+        size_t offset = 11;
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            MeterReadings decoded;
+            size_t n = decoder.decode(out + offset, length - offset, decoded);
+            TEST_ASSERT_NOT_EQUAL(0, n);
+            offset += n;
+            assertSame(readings[i], decoded, i);
+        }
+        TEST_ASSERT_EQUAL(length, offset);
+    }
+
+    void test_binary_payload_single_reading()
+    {
+        MeterReadings r = reading(1, 0x01020304, 23012, 150000, 12345);
+        r.pf = NAN;
+        uint8_t out[128];
+        size_t length = BinaryPayload::encode(String("SN001"), 0, &r, 1, out, sizeof(out));
+        // version, flags, serial length, serial, count
+        const size_t header = 3 + 5 + 1;
+        TEST_ASSERT_EQUAL(header + BinaryPayload::READING_BYTES, length);
+        TEST_ASSERT_EQUAL_HEX8(0, out[1]);
+        const uint8_t *p = out + header;
+        TEST_ASSERT_EQUAL_UINT32(r.epoch, p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        TEST_ASSERT_EQUAL_UINT32(0x01020304, p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24);
+        TEST_ASSERT_EQUAL_UINT8(1, p[8]);
+        TEST_ASSERT_EQUAL_UINT16(2301, p[12] | p[13] << 8); // 0.1 V
+        TEST_ASSERT_EQUAL_HEX8(0xFF, p[BinaryPayload::READING_BYTES - 1]); // pf not available
+    }
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_single_phase_run);
+    RUN_TEST(test_negative_deltas);
+    RUN_TEST(test_counter_wrap);
+    RUN_TEST(test_multi_phase_panel);
+    RUN_TEST(test_nan_phases);
+    RUN_TEST(test_nan_first);
+    RUN_TEST(test_truncated_input);
+    RUN_TEST(test_binary_payload_batch);
+    RUN_TEST(test_binary_payload_single_reading);
+    return UNITY_END();
+}
@@ -0,0 +1,212 @@
+// JsonReader on control payloads as they come off the wire, well formed
+// or not; run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "JsonReader.h"
+
+namespace
+{
+    // The reader unescapes in place, so each case gets its own copy
+    char buffer[600];
+
+    JsonReader reader(const char *text)
+    {
+        size_t length = strlen(text);
+        memcpy(buffer, text, length);
+        return JsonReader(buffer, length);
+    }
+
+    // Reads to the end; true if the whole text was accepted
+    bool accepted(const char *text)
+    {
+        JsonReader json = reader(text);
+        while (json.next())
+        {
+        }
+        return json.ok();
+    }
+
+    void test_members_and_types()
+    {
+        JsonReader json = reader(" { \"a\" : \"x\", \"b\":-12.5e3,\"c\":true,\"d\":false,\"e\":null } ");
+        char number[16];
+
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_EQUAL_STRING("a", json.key());
+        TEST_ASSERT_EQUAL(JsonReader::STRING, json.type());
+        TEST_ASSERT_EQUAL_STRING("x", json.string());
+
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_EQUAL(JsonReader::NUMBER, json.type());
+        TEST_ASSERT_TRUE(json.numberText(number, sizeof(number)));
+        TEST_ASSERT_EQUAL_STRING("-12.5e3", number);
+        TEST_ASSERT_EQUAL_STRING("", json.string());
+
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_EQUAL(JsonReader::BOOLEAN, json.type());
+        TEST_ASSERT_TRUE(json.boolean());
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_FALSE(json.boolean());
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_EQUAL(JsonReader::NULL_VALUE, json.type());
+
+        TEST_ASSERT_FALSE(json.next());
+        TEST_ASSERT_TRUE(json.ok());
+        TEST_ASSERT_FALSE(json.next());
+    }
+
+    void test_empty_object()
+    {
+        JsonReader json = reader("{}");
+        TEST_ASSERT_FALSE(json.next());
+        TEST_ASSERT_TRUE(json.ok());
+    }
+
+    void test_escapes()
+    {
+        JsonReader json = reader("{\"k\\\"ey\":\"a\\\\b\\/c\\n\\t\\\"\\u0041\\u00e9\\u20ac\"}");
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_EQUAL_STRING("k\"ey", json.key());
+        TEST_ASSERT_EQUAL_STRING("a\\b/c\n\t\"A\xC3\xA9\xE2\x82\xAC", json.string());
+        TEST_ASSERT_FALSE(json.next());
+        TEST_ASSERT_TRUE(json.ok());
+    }
+
+    void test_bad_escapes()
+    {
+        TEST_ASSERT_FALSE(accepted("{\"a\":\"\\x\"}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":\"\\u00g0\"}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":\"\\u12\"}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":\"\\"));
+        // A raw control character inside a string
+        TEST_ASSERT_FALSE(accepted("{\"a\":\"x\ny\"}"));
+    }
+
+    void test_truncated()
+    {
+        static const char *const cases[] = {
+            "",
+            "{",
+            "{\"a\"",
+            "{\"a\":",
+            "{\"a\":1",
+            "{\"a\":1,",
+            "{\"a\":\"unterminated",
+            "{\"a\":tru",
+            "{\"a\":nul",
+            "{\"a",
+        };
+        for (const char *text : cases)
+        {
+            TEST_ASSERT_FALSE_MESSAGE(accepted(text), text);
+        }
+    }
+
+    void test_truncated_mid_member_keeps_earlier_members()
+    {
+        JsonReader json = reader("{\"a\":1,\"b\":\"x");
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_EQUAL_STRING("a", json.key());
+        TEST_ASSERT_FALSE(json.next());
+        TEST_ASSERT_FALSE(json.ok());
+        TEST_ASSERT_EQUAL(JsonReader::NONE, json.type());
+    }
+
+    void test_nesting_rejected()
+    {
+        TEST_ASSERT_FALSE(accepted("{\"a\":{\"b\":1}}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":[1,2]}"));
+        TEST_ASSERT_FALSE(accepted("[{\"a\":1}]"));
+    }
+
+    void test_trailing_garbage()
+    {
+        TEST_ASSERT_TRUE(accepted("{\"a\":1} \r\n\t"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":1}x"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":1}}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":1}{\"b\":2}"));
+        TEST_ASSERT_FALSE(accepted("{} 1"));
+    }
+
+    void test_bad_syntax()
+    {
+        TEST_ASSERT_FALSE(accepted("{\"a\" 1}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":1 \"b\":2}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":1,}"));
+        TEST_ASSERT_FALSE(accepted("{a:1}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":'x'}"));
+        TEST_ASSERT_FALSE(accepted("{\"a\":True}"));
+    }
+
+    void test_numbers()
+    {
+        static const char *const good[] = {"0", "-0", "7", "-12", "3.25", "1e3", "1E+3", "2.5e-4", "-0.0"};
+        static const char *const bad[] = {"1-2", "1+2", "--1", "-", "+1", "01", "1.", ".5", "1e", "1e+",
+                                          "1.2.3", "1x", "0x10", "1e3e4"};
+        char text[32];
+        for (const char *number : good)
+        {
+            snprintf(text, sizeof(text), "{\"n\":%s}", number);
+            TEST_ASSERT_TRUE_MESSAGE(accepted(text), number);
+        }
+        for (const char *number : bad)
+        {
+            snprintf(text, sizeof(text), "{\"n\":%s}", number);
+            TEST_ASSERT_FALSE_MESSAGE(accepted(text), number);
+        }
+    }
+
+    void test_number_text_too_small()
+    {
+        JsonReader json = reader("{\"n\":123456}");
+        char number[6] = "x";
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_FALSE(json.numberText(number, sizeof(number)));
+        char fits[7];
+        TEST_ASSERT_TRUE(json.numberText(fits, sizeof(fits)));
+        TEST_ASSERT_EQUAL_STRING("123456", fits);
+    }
+
+    void test_oversized_payload()
+    {
+        // Bigger than any control command; read as far as it is valid, nothing past the end
+        char text[sizeof(buffer)];
+        size_t length = snprintf(text, sizeof(text), "{\"command\":\"");
+        memset(text + length, 'x', sizeof(text) - length - 3);
+        strcpy(text + sizeof(text) - 3, "\"}");
+        JsonReader json = reader(text);
+        TEST_ASSERT_TRUE(json.next());
+        TEST_ASSERT_EQUAL(sizeof(text) - 3 - length, strlen(json.string()));
+        TEST_ASSERT_FALSE(json.next());
+        TEST_ASSERT_TRUE(json.ok());
+
+        // The same cut off before its closing quote: the NUL must not be written past the buffer
+        memcpy(buffer, text, sizeof(text) - 3);
+        JsonReader cut(buffer, sizeof(text) - 3);
+        TEST_ASSERT_FALSE(cut.next());
+        TEST_ASSERT_FALSE(cut.ok());
+    }
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_members_and_types);
+    RUN_TEST(test_empty_object);
+    RUN_TEST(test_escapes);
+    RUN_TEST(test_bad_escapes);
+    RUN_TEST(test_truncated);
+    RUN_TEST(test_truncated_mid_member_keeps_earlier_members);
+    RUN_TEST(test_nesting_rejected);
+    RUN_TEST(test_trailing_garbage);
+    RUN_TEST(test_bad_syntax);
+    RUN_TEST(test_numbers);
+    RUN_TEST(test_number_text_too_small);
+    RUN_TEST(test_oversized_payload);
+    return UNITY_END();
+}
@@ -0,0 +1,545 @@
+// MqttClient's QoS 1 publishing against a scripted transport: packet
+// identifiers, PUBACK matching and the keepalive, then DataSender's
+// in-flight window and its resends with DUP after a reconnect. The
+// transport records every byte written and hands back what a test pushes,
+// on the simulated clock; run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <stdlib.h>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "DataSender.h"
+#include "MqttClient.h"
+#include "WallClock.h"
+
+namespace
+{
+    const uint8_t CONNECT = 0x10, CONNACK = 0x20, PUBLISH = 0x30, PUBACK = 0x40;
+    const uint8_t SUBSCRIBE = 0x80, PINGREQ = 0xC0, PINGRESP = 0xD0;
+    const uint8_t DUP = 0x08;
+    const uint8_t MAX_IN_FLIGHT = 4; // DataSender::MAX_IN_FLIGHT
+
+    struct Packet
+    {
+        uint8_t header;
+        std::vector<uint8_t> body;
+
+        uint8_t type() const { return header & 0xF0; }
+        uint16_t topicLength() const { return body[0] << 8 | body[1]; }
+        // PUBLISH at QoS 1
+        uint16_t packetId() const { return body[2 + topicLength()] << 8 | body[3 + topicLength()]; }
+        // The "seq" of a JSON PUBLISH, 0 if there is none
+        uint32_t seq() const
+        {
+            std::string payload(body.begin() + 4 + topicLength(), body.end());
+            size_t at = payload.find("\"seq\":");
+            return at == std::string::npos ? 0 : strtoul(payload.c_str() + at + 6, nullptr, 10);
+        }
+    };
+
+    // hal::Network with one connection at a time, driven by the test
+    class Transport : public hal::Network
+    {
+    public:
+        std::vector<uint8_t> sent; // since the connection was opened
+        std::deque<uint8_t> inbound;
+        bool open = false;
+        bool refuse = false;
+        bool autoConnack = true; // answer CONNECT at once
+        uint32_t connects = 0;
+
+        hal::Socket *connect(const char *, uint16_t) override
+        {
+            if (refuse)
+            {
+                return nullptr;
+            }
+            open = true;
+            connects++;
+            sent.clear();
+            inbound.clear();
+            return new Link(*this);
+        }
+        bool linkUp() override { return true; }
+
+        void push(std::initializer_list<uint8_t> bytes) { inbound.insert(inbound.end(), bytes); }
+        void pushAck(uint16_t id) { push({PUBACK, 2, (uint8_t)(id >> 8), (uint8_t)id}); }
+
+        // The packets written so far, whole ones only
+        std::vector<Packet> packets() const
+        {
+            std::vector<Packet> result;
+            size_t p = 0;
+            while (p + 2 <= sent.size())
+            {
+                size_t length = 0, n = 1;
+                for (uint8_t shift = 0; p + n < sent.size(); shift += 7)
+                {
+                    length |= (size_t)(sent[p + n] & 0x7F) << shift;
+                    if (!(sent[p + n++] & 0x80))
+                    {
+                        break;
+                    }
+                }
+                if (p + n + length > sent.size())
+                {
+                    break;
+                }
+                result.push_back({sent[p], std::vector<uint8_t>(sent.begin() + p + n, sent.begin() + p + n + length)});
+                p += n + length;
+            }
+            return result;
+        }
+
+        std::vector<Packet> packets(uint8_t type) const
+        {
+            std::vector<Packet> result;
+            for (const Packet &packet : packets())
+            {
+                if (packet.type() == type)
+                {
+                    result.push_back(packet);
+                }
+            }
+            return result;
+        }
+
+    private:
+        class Link : public hal::Socket
+        {
+        public:
+            explicit Link(Transport &transport) : transport(transport) {}
+            bool connected() override { return transport.open; }
+            int available() override { return transport.inbound.size(); }
+            int read(uint8_t *buf, size_t len) override
+            {
+                size_t n = 0;
+                for (; n < len && !transport.inbound.empty(); n++)
+                {
+                    buf[n] = transport.inbound.front();
+                    transport.inbound.pop_front();
+                }
+                return n;
+            }
+            size_t write(const uint8_t *data, size_t len) override
+            {
+                if (!transport.open)
+                {
+                    return 0;
+                }
+                transport.sent.insert(transport.sent.end(), data, data + len);
+                std::vector<Packet> packets = transport.packets();
+                if (transport.autoConnack && packets.size() == 1 && packets[0].type() == CONNECT && !answered)
+                {
+                    answered = true;
+                    transport.push({CONNACK, 2, 0, 0});
+                }
+                return len;
+            }
+            void close() override { transport.open = false; }
+
+        private:
+            Transport &transport;
+            bool answered = false;
+        };
+    };
+
+    hal::SimClock simClock;
+    Transport transport;
+    char fsRoot[64];
+
+    void advance(unsigned long ms)
+    {
+        simClock.advance(ms * 1000);
+    }
+
+    // MqttClient on the transport, connected
+    struct Session
+    {
+        WiFiClient wifi;
+        MqttClient mqtt;
+        std::vector<uint16_t> acks;
+
+        Session() : mqtt(wifi)
+        {
+            mqtt.setServer("127.0.0.1", 1883);
+            mqtt.setAckCallback([this](uint16_t id)
+                                { acks.push_back(id); });
+        }
+
+        void open()
+        {
+            TEST_ASSERT_TRUE(mqtt.connect("meter-test", "", nullptr));
+            mqtt.loop();
+            TEST_ASSERT_TRUE(mqtt.connected());
+        }
+
+        uint16_t publish(uint8_t qos = 1, bool dup = false)
+        {
+            static const uint8_t payload[] = "{}";
+            uint16_t id = 0xFFFF;
+            TEST_ASSERT_TRUE(mqtt.publish("meter/1/data", payload, 2, qos, &id, dup));
+            return id;
+        }
+    };
+
+    void test_connect()
+    {
+        Session s;
+        s.open();
+        std::vector<Packet> packets = transport.packets();
+        TEST_ASSERT_EQUAL(1, packets.size());
+        const std::vector<uint8_t> &body = packets[0].body;
+        const uint8_t expected[] = {0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, MqttClient::KEEPALIVE, 0, 10};
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, body.data(), sizeof(expected));
+        TEST_ASSERT_EQUAL_MEMORY("meter-test", body.data() + sizeof(expected), 10);
+        TEST_ASSERT_EQUAL(MqttClient::CONNECTED, s.mqtt.state());
+    }
+
+    void test_connect_refused()
+    {
+        transport.autoConnack = false;
+        Session s;
+        TEST_ASSERT_TRUE(s.mqtt.connect("meter-test", "", nullptr));
+        s.mqtt.loop();
+        TEST_ASSERT_TRUE(s.mqtt.connecting());
+        transport.push({CONNACK, 2, 0, 5}); // not authorized
+        s.mqtt.loop();
+        TEST_ASSERT_FALSE(s.mqtt.connected());
+        TEST_ASSERT_FALSE(s.mqtt.connecting());
+        TEST_ASSERT_EQUAL(5, s.mqtt.state());
+    }
+
+    void test_packet_ids()
+    {
+        Session s;
+        s.open();
+        TEST_ASSERT_EQUAL_UINT16(1, s.publish());
+        TEST_ASSERT_EQUAL_UINT16(2, s.publish());
+        TEST_ASSERT_EQUAL_UINT16(0, s.publish(0));
+        TEST_ASSERT_EQUAL_UINT16(3, s.publish());
+
+        std::vector<Packet> packets = transport.packets(PUBLISH);
+        TEST_ASSERT_EQUAL(4, packets.size());
+        TEST_ASSERT_EQUAL_HEX8(PUBLISH | 0x02, packets[0].header);
+        TEST_ASSERT_EQUAL_UINT16(1, packets[0].packetId());
+        TEST_ASSERT_EQUAL_UINT16(2, packets[1].packetId());
+        // QoS 0: no identifier, the payload follows the topic
+        TEST_ASSERT_EQUAL_HEX8(PUBLISH, packets[2].header);
+        TEST_ASSERT_EQUAL(2 + 12 + 2, packets[2].body.size());
+        TEST_ASSERT_EQUAL_UINT16(3, packets[3].packetId());
+    }
+
+    void test_packet_id_skips_zero()
+    {
+        Session s;
+        s.open();
+        for (uint32_t i = 1; i < 0xFFFF; i++)
+        {
+            s.publish();
+            transport.sent.clear();
+        }
+        TEST_ASSERT_EQUAL_UINT16(0xFFFF, s.publish());
+        TEST_ASSERT_EQUAL_UINT16(1, s.publish());
+    }
+
+    void test_puback_matching()
+    {
+        Session s;
+        s.open();
+        uint16_t a = s.publish(), b = s.publish(), c = s.publish();
+        transport.pushAck(b);
+        transport.pushAck(a);
+        transport.push({PUBACK, 3, 0, (uint8_t)c, 0}); // malformed: ignored
+        s.mqtt.loop();
+        TEST_ASSERT_EQUAL(2, s.acks.size());
+        TEST_ASSERT_EQUAL_UINT16(b, s.acks[0]);
+        TEST_ASSERT_EQUAL_UINT16(a, s.acks[1]);
+
+        // A PUBACK that arrives a byte at a time is reported once, when whole
+        const uint8_t ack[] = {PUBACK, 2, 0, (uint8_t)c};
+        for (uint8_t byte : ack)
+        {
+            transport.push({byte});
+            s.mqtt.loop();
+        }
+        TEST_ASSERT_EQUAL(3, s.acks.size());
+        TEST_ASSERT_EQUAL_UINT16(c, s.acks[2]);
+        TEST_ASSERT_TRUE(s.mqtt.connected());
+    }
+
+    void test_dup_flag()
+    {
+        Session s;
+        s.open();
+        s.publish(1, true);
+        s.publish(0, true); // DUP is only for QoS 1
+        s.publish(1, false);
+        std::vector<Packet> packets = transport.packets(PUBLISH);
+        TEST_ASSERT_EQUAL_HEX8(PUBLISH | DUP | 0x02, packets[0].header);
+        TEST_ASSERT_EQUAL_HEX8(PUBLISH, packets[1].header);
+        TEST_ASSERT_EQUAL_HEX8(PUBLISH | 0x02, packets[2].header);
+    }
+
+    void test_incoming_publish_acknowledged()
+    {
+        Session s;
+        std::string topic, payload;
+        s.mqtt.setCallback([&](char *t, uint8_t *p, unsigned int length)
+                           { topic = t; payload.assign((char *)p, length); });
+        s.open();
+        transport.push({PUBLISH | 0x02, 2 + 3 + 2 + 2, 0, 3, 'a', '/', 'b', 0x12, 0x34, 'o', 'k'});
+        s.mqtt.loop();
+        TEST_ASSERT_EQUAL_STRING("a/b", topic.c_str());
+        TEST_ASSERT_EQUAL_STRING("ok", payload.c_str());
+        std::vector<Packet> acks = transport.packets(PUBACK);
+        TEST_ASSERT_EQUAL(1, acks.size());
+        TEST_ASSERT_EQUAL_HEX8(0x12, acks[0].body[0]);
+        TEST_ASSERT_EQUAL_HEX8(0x34, acks[0].body[1]);
+    }
+
+    void test_pingreq_after_keepalive()
+    {
+        Session s;
+        s.open();
+        advance(MqttClient::KEEPALIVE * 1000UL);
+        s.mqtt.loop();
+        TEST_ASSERT_EQUAL(0, transport.packets(PINGREQ).size());
+        advance(1);
+        s.mqtt.loop();
+        TEST_ASSERT_EQUAL(1, transport.packets(PINGREQ).size());
+
+        // Answered: the next one a keepalive period later, no timeout
+        transport.push({PINGRESP, 0});
+        s.mqtt.loop();
+        advance(MqttClient::KEEPALIVE * 1000UL + 1);
+        TEST_ASSERT_TRUE(s.mqtt.loop());
+        TEST_ASSERT_EQUAL(2, transport.packets(PINGREQ).size());
+    }
+
+    void test_keepalive_timeout()
+    {
+        Session s;
+        s.open();
+        advance(MqttClient::KEEPALIVE * 1000UL + 1);
+        s.mqtt.loop();
+        TEST_ASSERT_EQUAL(1, transport.packets(PINGREQ).size());
+        advance(MqttClient::KEEPALIVE * 1000UL + 1);
+        TEST_ASSERT_FALSE(s.mqtt.loop());
+        TEST_ASSERT_EQUAL(MqttClient::CONNECTION_TIMEOUT, s.mqtt.state());
+        TEST_ASSERT_FALSE(transport.open);
+    }
+
+    // A packet waiting in the socket when the keepalive runs out is traffic
+    void test_waiting_packet_is_not_silence()
+    {
+        Session s;
+        s.open();
+        advance(10000);
+        uint16_t id = s.publish(); // recent outbound traffic, none inbound
+        advance(MqttClient::KEEPALIVE * 1000UL - 10000 + 1);
+        transport.pushAck(id);
+        TEST_ASSERT_TRUE(s.mqtt.loop());
+        TEST_ASSERT_EQUAL(1, s.acks.size());
+        TEST_ASSERT_EQUAL(0, transport.packets(PINGREQ).size());
+    }
+
+    void test_pingresp_waiting_at_deadline()
+    {
+        Session s;
+        s.open();
+        advance(MqttClient::KEEPALIVE * 1000UL + 1);
+        s.mqtt.loop();
+        TEST_ASSERT_EQUAL(1, transport.packets(PINGREQ).size());
+        advance(MqttClient::KEEPALIVE * 1000UL + 1);
+        transport.push({PINGRESP, 0});
+        TEST_ASSERT_TRUE(s.mqtt.loop());
+        TEST_ASSERT_TRUE(transport.open);
+    }
+
+    // DataSender on the transport, connected
+    std::unique_ptr<DataSender> startSender()
+    {
+        std::unique_ptr<DataSender> sender(new DataSender());
+        sender->setBacklogDays(1, 1000, 1);
+        sender->updateConfig("127.0.0.1", 1883, "1", "SN001", "", "");
+        sender->setup();
+        for (int i = 0; i < 1200 && !sender->isConnected(); i++)
+        {
+            sender->loop();
+            advance(100);
+        }
+        TEST_ASSERT_TRUE(sender->isConnected());
+        sender->loop(); // subscribes
+        transport.sent.clear();
+        return sender;
+    }
+
+    void send(DataSender &sender, uint8_t count)
+    {
+        MeterReadings readings = MeterReadings();
+        readings.voltage = 230.0f;
+        readings.samples = 1;
+        for (uint8_t i = 0; i < count; i++)
+        {
+            readings.timestamp = millis();
+            sender.sendData(readings);
+            sender.loop();
+            advance(100);
+        }
+    }
+
+    void ackAll(DataSender &sender, const std::vector<Packet> &publishes)
+    {
+        for (const Packet &p : publishes)
+        {
+            transport.pushAck(p.packetId());
+        }
+        sender.loop();
+    }
+
+    void drain(DataSender &sender)
+    {
+        for (int i = 0; i < 20; i++)
+        {
+            sender.sendBufferedData();
+            sender.loop();
+            advance(100);
+        }
+    }
+
+    void test_window_limit()
+    {
+        std::unique_ptr<DataSender> sender = startSender();
+        send(*sender, MAX_IN_FLIGHT + 2);
+        std::vector<Packet> publishes = transport.packets(PUBLISH);
+        // The rest waits on flash for the window
+        TEST_ASSERT_EQUAL(MAX_IN_FLIGHT, publishes.size());
+        TEST_ASSERT_EQUAL_UINT32(2, sender->backlogPending());
+
+        // No PUBACK, no room: the backlog waits too
+        drain(*sender);
+        TEST_ASSERT_EQUAL(MAX_IN_FLIGHT, transport.packets(PUBLISH).size());
+
+        ackAll(*sender, publishes);
+        TEST_ASSERT_EQUAL_UINT32(MAX_IN_FLIGHT, sender->stats().delivered);
+        drain(*sender);
+        publishes = transport.packets(PUBLISH);
+        TEST_ASSERT_EQUAL(MAX_IN_FLIGHT + 2, publishes.size());
+        // First sent from flash, so no DUP
+        TEST_ASSERT_EQUAL_HEX8(PUBLISH | 0x02, publishes[MAX_IN_FLIGHT].header);
+        TEST_ASSERT_EQUAL_UINT32(MAX_IN_FLIGHT + 1, publishes[MAX_IN_FLIGHT].seq());
+        ackAll(*sender, std::vector<Packet>(publishes.begin() + MAX_IN_FLIGHT, publishes.end()));
+        TEST_ASSERT_EQUAL_UINT32(0, sender->backlogPending());
+        TEST_ASSERT_EQUAL_UINT32(MAX_IN_FLIGHT + 2, sender->stats().delivered);
+    }
+
+    void test_resent_with_dup_after_reconnect()
+    {
+        std::unique_ptr<DataSender> sender = startSender();
+        send(*sender, 3);
+        std::vector<Packet> first = transport.packets(PUBLISH);
+        TEST_ASSERT_EQUAL(3, first.size());
+        transport.pushAck(first[0].packetId());
+        sender->loop();
+
+        // The link drops with two PUBLISHes unacknowledged
+        transport.open = false;
+        for (int i = 0; i < 1200 && transport.connects < 2; i++)
+        {
+            sender->loop();
+            advance(100);
+        }
+        sender->loop();
+        TEST_ASSERT_TRUE(sender->isConnected());
+        TEST_ASSERT_EQUAL_UINT32(2, sender->stats().requeued);
+        drain(*sender);
+
+        std::vector<Packet> resent = transport.packets(PUBLISH);
+        TEST_ASSERT_EQUAL(2, resent.size());
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            TEST_ASSERT_EQUAL_HEX8(PUBLISH | DUP | 0x02, resent[i].header);
+            TEST_ASSERT_EQUAL_UINT32(first[i + 1].seq(), resent[i].seq());
+        }
+
+        // New readings are first deliveries
+        send(*sender, 1);
+        std::vector<Packet> all = transport.packets(PUBLISH);
+        TEST_ASSERT_EQUAL(3, all.size());
+        TEST_ASSERT_EQUAL_HEX8(PUBLISH | 0x02, all[2].header);
+        TEST_ASSERT_EQUAL_UINT32(first[2].seq() + 1, all[2].seq());
+        ackAll(*sender, all);
+        TEST_ASSERT_EQUAL_UINT32(0, sender->backlogPending());
+        TEST_ASSERT_EQUAL_UINT32(4, sender->stats().delivered);
+    }
+
+    // Readings stored while the broker was away go out the first time without DUP
+    void test_stored_while_offline_not_dup()
+    {
+        std::unique_ptr<DataSender> sender = startSender();
+        transport.refuse = true;
+        transport.open = false;
+        sender->loop();
+        send(*sender, 3);
+        TEST_ASSERT_EQUAL_UINT32(3, sender->backlogPending());
+
+        transport.refuse = false;
+        for (int i = 0; i < 1200 && !sender->isConnected(); i++)
+        {
+            sender->loop();
+            advance(100);
+        }
+        TEST_ASSERT_TRUE(sender->isConnected());
+        drain(*sender);
+        std::vector<Packet> publishes = transport.packets(PUBLISH);
+        TEST_ASSERT_EQUAL(3, publishes.size());
+        for (const Packet &p : publishes)
+        {
+            TEST_ASSERT_EQUAL_HEX8(PUBLISH | 0x02, p.header);
+        }
+    }
+
+} // namespace
+
+void setUp()
+{
+    transport.open = false;
+    transport.refuse = false;
+    transport.autoConnack = true;
+    transport.connects = 0;
+    transport.sent.clear();
+    transport.inbound.clear();
+    snprintf(fsRoot, sizeof(fsRoot), "/tmp/test_mqtt_client.XXXXXX");
+    TEST_ASSERT_NOT_NULL(mkdtemp(fsRoot));
+    hal::setFsRoot(fsRoot);
+}
+
+void tearDown() {}
+
+int main()
+{
+    hal::setClock(&simClock);
+    hal::setNetwork(&transport);
+    // DataSender holds readings on flash until the clock is set
+    wallClock.takeSync(1750000000000LL, 0);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_connect);
+    RUN_TEST(test_connect_refused);
+    RUN_TEST(test_packet_ids);
+    RUN_TEST(test_packet_id_skips_zero);
+    RUN_TEST(test_puback_matching);
+    RUN_TEST(test_dup_flag);
+    RUN_TEST(test_incoming_publish_acknowledged);
+    RUN_TEST(test_pingreq_after_keepalive);
+    RUN_TEST(test_keepalive_timeout);
+    RUN_TEST(test_waiting_packet_is_not_silence);
+    RUN_TEST(test_pingresp_waiting_at_deadline);
+    RUN_TEST(test_window_limit);
+    RUN_TEST(test_resent_with_dup_after_reconnect);
+    RUN_TEST(test_stored_while_offline_not_dup);
+    return UNITY_END();
+}
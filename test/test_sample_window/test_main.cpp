@@ -0,0 +1,104 @@
+// SampleWindow statistics and the energy counted per window; run with
+// `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "SampleWindow.h"
+
+namespace
+{
+    MeterReadings reading(float voltage, float power, float energyKwh)
+    {
+        MeterReadings r = MeterReadings();
+        r.voltage = voltage;
+        r.current = power / voltage;
+        r.power = power;
+        r.energy = energyKwh;
+        r.frequency = 50.0f;
+        r.pf = 1.0f;
+        return r;
+    }
+
+    void test_min_max_mean()
+    {
+        SampleWindow window;
+        window.add(reading(230.0f, 100.0f, 1.0f));
+        window.add(reading(220.0f, 300.0f, 1.0f));
+        MeterReadings r = window.result();
+        TEST_ASSERT_EQUAL(2, r.samples);
+        TEST_ASSERT_EQUAL_FLOAT(225.0f, r.voltage);
+        TEST_ASSERT_EQUAL_FLOAT(220.0f, r.voltageMin);
+        TEST_ASSERT_EQUAL_FLOAT(230.0f, r.voltageMax);
+        TEST_ASSERT_EQUAL_FLOAT(200.0f, r.power);
+    }
+
+    void test_invalid_readings_skipped()
+    {
+        SampleWindow window;
+        window.add(reading(NAN, 100.0f, 1.0f));
+        TEST_ASSERT_EQUAL(0, window.count());
+        TEST_ASSERT_TRUE(isnan(window.result().voltage));
+        TEST_ASSERT_EQUAL(0, window.energyDeltaWh());
+    }
+
+    void test_energy_carries_across_windows()
+    {
+        SampleWindow window;
+        window.add(reading(230.0f, 100.0f, 1.000f));
+        window.add(reading(230.0f, 100.0f, 1.004f));
+        TEST_ASSERT_EQUAL(4, window.energyDeltaWh());
+        TEST_ASSERT_EQUAL_FLOAT(0.004f, window.result().energyDelta);
+
+        // The next window starts from the last sample of this one
+        window.reset();
+        window.add(reading(230.0f, 100.0f, 1.010f));
+        TEST_ASSERT_EQUAL(6, window.energyDeltaWh());
+
+        // An empty window counts nothing and loses nothing
+        window.reset();
+        TEST_ASSERT_EQUAL(0, window.energyDeltaWh());
+        window.reset();
+        window.add(reading(230.0f, 100.0f, 1.013f));
+        TEST_ASSERT_EQUAL(3, window.energyDeltaWh());
+    }
+
+    void test_counter_reset_on_pzem()
+    {
+        SampleWindow window;
+        window.add(reading(230.0f, 100.0f, 5.000f));
+        window.reset();
+        window.add(reading(230.0f, 100.0f, 0.002f));
+        TEST_ASSERT_EQUAL(2, window.energyDeltaWh());
+    }
+
+    void test_restart_forgets_the_counter()
+    {
+        SampleWindow window;
+        window.add(reading(230.0f, 100.0f, 5.000f));
+        window.reset();
+        window.add(reading(230.0f, 100.0f, 5.001f));
+
+        // Another meter, whose counter is ahead: nothing was counted yet
+        window.restart();
+        TEST_ASSERT_EQUAL(0, window.count());
+        window.add(reading(230.0f, 100.0f, 7.000f));
+        TEST_ASSERT_EQUAL(0, window.energyDeltaWh());
+        window.add(reading(230.0f, 100.0f, 7.002f));
+        TEST_ASSERT_EQUAL(2, window.energyDeltaWh());
+    }
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_min_max_mean);
+    RUN_TEST(test_invalid_readings_skipped);
+    RUN_TEST(test_energy_carries_across_windows);
+    RUN_TEST(test_counter_reset_on_pzem);
+    RUN_TEST(test_restart_forgets_the_counter);
+    return UNITY_END();
+}
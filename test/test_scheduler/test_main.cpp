@@ -0,0 +1,209 @@
+// Scheduler: run order and the per-task accounting (budget overruns, late
+// starts, skipped releases). Task bodies advance a simulated clock by the
+// time they are meant to take; run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <string>
+#include "Scheduler.h"
+
+namespace
+{
+    hal::SimClock simClock;
+    std::string order;
+
+    void advance(unsigned long ms)
+    {
+        simClock.advance(ms * 1000);
+    }
+
+    // A task body that takes us and leaves its mark in order
+    Scheduler::TaskFunction work(char mark, uint32_t us)
+    {
+        return [mark, us]()
+        {
+            order += mark;
+            simClock.advance(us);
+        };
+    }
+
+    void test_overruns_counted_against_budget()
+    {
+        Scheduler scheduler;
+        uint32_t times[] = {500, 1500, 3000, 1000};
+        uint8_t n = 0;
+        int8_t id = scheduler.add("task", Scheduler::PRIORITY_NORMAL, 0, 100, 1000,
+                                  [&]() { simClock.advance(times[n++]); });
+        for (int i = 0; i < 4; i++)
+        {
+            scheduler.run();
+        }
+        const Scheduler::TaskStats &s = scheduler.stats(id);
+        TEST_ASSERT_EQUAL_UINT32(4, s.runs);
+        TEST_ASSERT_EQUAL_UINT32(2, s.overruns); // a run of exactly the budget is not one
+        TEST_ASSERT_EQUAL_UINT32(3000, s.worstUs);
+        TEST_ASSERT_EQUAL_UINT64(6000, s.totalUs);
+    }
+
+    void test_late_start_and_worst_wait()
+    {
+        Scheduler scheduler;
+        int8_t id = scheduler.add("task", Scheduler::PRIORITY_NORMAL, 100, 10, 1000, work('a', 0));
+        scheduler.run();
+        advance(105); // 5 ms after the release, within the deadline
+        scheduler.run();
+        advance(145); // 50 ms after the release at 200
+        scheduler.run();
+        const Scheduler::TaskStats &s = scheduler.stats(id);
+        TEST_ASSERT_EQUAL_UINT32(3, s.runs);
+        TEST_ASSERT_EQUAL_UINT32(1, s.late);
+        TEST_ASSERT_EQUAL_UINT32(50, s.worstWait);
+        TEST_ASSERT_EQUAL_UINT32(0, s.skipped);
+    }
+
+    void test_releases_a_period_behind_skipped()
+    {
+        Scheduler scheduler;
+        int8_t id = scheduler.add("task", Scheduler::PRIORITY_NORMAL, 100, 10, 1000, work('a', 0));
+        scheduler.run();
+        advance(350); // the releases at 100, 200 and 300 have passed
+        scheduler.run();
+        const Scheduler::TaskStats &s = scheduler.stats(id);
+        TEST_ASSERT_EQUAL_UINT32(2, s.runs);
+        TEST_ASSERT_EQUAL_UINT32(2, s.skipped);
+        TEST_ASSERT_EQUAL_UINT32(250, s.worstWait);
+
+        // Back on the grid: the next release is at 400, not 450
+        advance(49);
+        scheduler.run();
+        TEST_ASSERT_EQUAL_UINT32(2, s.runs);
+        advance(1);
+        scheduler.run();
+        TEST_ASSERT_EQUAL_UINT32(3, s.runs);
+        TEST_ASSERT_EQUAL_UINT32(2, s.skipped);
+    }
+
+    void test_periodic_task_not_run_before_release()
+    {
+        Scheduler scheduler;
+        int8_t id = scheduler.add("task", Scheduler::PRIORITY_NORMAL, 100, 10, 1000, work('a', 0));
+        for (int i = 0; i < 10; i++)
+        {
+            scheduler.run();
+            advance(10);
+        }
+        TEST_ASSERT_EQUAL_UINT32(1, scheduler.stats(id).runs);
+        scheduler.run();
+        TEST_ASSERT_EQUAL_UINT32(2, scheduler.stats(id).runs);
+    }
+
+    void test_priority_order()
+    {
+        Scheduler scheduler;
+        order.clear();
+        scheduler.add("low", Scheduler::PRIORITY_LOW, 0, 100, 1000, work('l', 0));
+        scheduler.add("high", Scheduler::PRIORITY_HIGH, 0, 100, 1000, work('h', 0));
+        scheduler.add("normal", Scheduler::PRIORITY_NORMAL, 0, 100, 1000, work('n', 0));
+        scheduler.run();
+        TEST_ASSERT_EQUAL_STRING("hnl", order.c_str());
+    }
+
+    void test_nearest_deadline_first_within_priority()
+    {
+        Scheduler scheduler;
+        order.clear();
+        scheduler.add("loose", Scheduler::PRIORITY_NORMAL, 0, 50, 1000, work('a', 0));
+        scheduler.add("tight", Scheduler::PRIORITY_NORMAL, 0, 5, 1000, work('b', 0));
+        scheduler.run();
+        TEST_ASSERT_EQUAL_STRING("ba", order.c_str());
+    }
+
+    void test_task_due_during_pass_runs_before_lower()
+    {
+        Scheduler scheduler;
+        scheduler.add("high", Scheduler::PRIORITY_HIGH, 20, 5, 1000, work('h', 0));
+        scheduler.add("normal", Scheduler::PRIORITY_NORMAL, 0, 100, 20000, work('n', 10000));
+        scheduler.add("low", Scheduler::PRIORITY_LOW, 0, 100, 1000, work('l', 0));
+        scheduler.run();
+        advance(5); // 15 ms, high is next released at 20
+        order.clear();
+        // high is released again while normal runs
+        scheduler.run();
+        TEST_ASSERT_EQUAL_STRING("nhl", order.c_str());
+    }
+
+    void test_every_pass_task_runs_once_per_pass()
+    {
+        Scheduler scheduler;
+        int8_t id = scheduler.add("poll", Scheduler::PRIORITY_HIGH, 0, 10, 1000, work('p', 100));
+        for (int i = 0; i < 25; i++)
+        {
+            scheduler.run();
+        }
+        TEST_ASSERT_EQUAL_UINT32(25, scheduler.passes());
+        TEST_ASSERT_EQUAL_UINT32(25, scheduler.stats(id).runs);
+        TEST_ASSERT_EQUAL_UINT32(0, scheduler.stats(id).late);
+    }
+
+    // The gap between two runs of a period-0 task is measured from the end of the first
+    void test_every_pass_task_late_after_long_pass()
+    {
+        Scheduler scheduler;
+        int8_t id = scheduler.add("poll", Scheduler::PRIORITY_HIGH, 0, 10, 1000, work('p', 0));
+        scheduler.add("slow", Scheduler::PRIORITY_LOW, 0, 100, 50000, work('s', 30000));
+        scheduler.run();
+        scheduler.run();
+        const Scheduler::TaskStats &s = scheduler.stats(id);
+        TEST_ASSERT_EQUAL_UINT32(1, s.late);
+        TEST_ASSERT_EQUAL_UINT32(30, s.worstWait);
+    }
+
+    void test_worst_pass()
+    {
+        Scheduler scheduler;
+        uint32_t us = 200;
+        scheduler.add("a", Scheduler::PRIORITY_NORMAL, 0, 100, 10000, [&]() { simClock.advance(us); });
+        scheduler.add("b", Scheduler::PRIORITY_NORMAL, 0, 100, 10000, [&]() { simClock.advance(us); });
+        scheduler.run();
+        us = 3000;
+        scheduler.run();
+        us = 100;
+        scheduler.run();
+        TEST_ASSERT_EQUAL_UINT32(3, scheduler.passes());
+        TEST_ASSERT_EQUAL_UINT32(6000, scheduler.worstPassUs());
+    }
+
+    void test_add_past_max_tasks()
+    {
+        Scheduler scheduler;
+        for (uint8_t i = 0; i < Scheduler::MAX_TASKS; i++)
+        {
+            TEST_ASSERT_EQUAL_INT8(i, scheduler.add("task", Scheduler::PRIORITY_NORMAL, 0, 100, 1000, work('a', 0)));
+        }
+        TEST_ASSERT_EQUAL_INT8(-1, scheduler.add("extra", Scheduler::PRIORITY_NORMAL, 0, 100, 1000, work('x', 0)));
+        TEST_ASSERT_EQUAL_UINT8(Scheduler::MAX_TASKS, scheduler.taskCount());
+    }
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main()
+{
+    hal::setClock(&simClock);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_overruns_counted_against_budget);
+    RUN_TEST(test_late_start_and_worst_wait);
+    RUN_TEST(test_releases_a_period_behind_skipped);
+    RUN_TEST(test_periodic_task_not_run_before_release);
+    RUN_TEST(test_priority_order);
+    RUN_TEST(test_nearest_deadline_first_within_priority);
+    RUN_TEST(test_task_due_during_pass_runs_before_lower);
+    RUN_TEST(test_every_pass_task_runs_once_per_pass);
+    RUN_TEST(test_every_pass_task_late_after_long_pass);
+    RUN_TEST(test_worst_pass);
+    RUN_TEST(test_add_past_max_tasks);
+    return UNITY_END();
+}
@@ -0,0 +1,275 @@
+// SegmentLog crash safety on the host filesystem: CRC-checked records,
+// the two cursor slots, drop-oldest at capacity and the read position
+// across a remount. Damage is done to the files directly, as a reset in
+// the middle of a write would leave them; run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include "SegmentLog.h"
+
+namespace
+{
+    const char *LOG_DIR = "/log";
+    const uint16_t RECORD = 500; // 16 records fill a segment
+    char fsRoot[64];
+
+    std::string hostPath(const char *name)
+    {
+        return std::string(fsRoot) + LOG_DIR + "/" + name;
+    }
+
+    void flipByte(const std::string &path, long offset)
+    {
+        FILE *f = fopen(path.c_str(), "r+b");
+        TEST_ASSERT_NOT_NULL(f);
+        fseek(f, offset, SEEK_SET);
+        int c = fgetc(f);
+        fseek(f, offset, SEEK_SET);
+        fputc(c ^ 0xFF, f);
+        fclose(f);
+    }
+
+    // Record i: its number, then (i + j) & 0xFF; RECORD bytes long, 8 from i = 1000 on
+    uint16_t fill(uint32_t i, uint8_t *data)
+    {
+        uint16_t length = i >= 1000 ? 8 : RECORD;
+        for (uint16_t j = 0; j < length; j++)
+        {
+            data[j] = (i + j) & 0xFF;
+        }
+        memcpy(data, &i, sizeof(i));
+        return length;
+    }
+
+    void append(SegmentLog &log, uint32_t from, uint32_t count)
+    {
+        uint8_t data[RECORD];
+        for (uint32_t i = from; i < from + count; i++)
+        {
+            TEST_ASSERT_TRUE(log.append(data, fill(i, data)));
+        }
+    }
+
+    // Reads from `pos` and checks that the records come in order from `first`;
+    // returns how many were read
+    uint32_t readAll(SegmentLog &log, SegmentLog::Position &pos, uint32_t first, uint32_t max = 1000)
+    {
+        uint8_t data[SegmentLog::MAX_RECORD];
+        uint8_t expected[RECORD];
+        uint16_t length;
+        uint32_t n = 0;
+        while (n < max && log.read(pos, data, sizeof(data), length))
+        {
+            uint16_t expectedLength = fill(first + n, expected);
+            TEST_ASSERT_EQUAL_UINT16(expectedLength, length);
+            TEST_ASSERT_EQUAL_MEMORY(expected, data, length);
+            n++;
+        }
+        return n;
+    }
+
+    // Reads `count` records and acknowledges them
+    void consume(SegmentLog &log, uint32_t first, uint32_t count)
+    {
+        SegmentLog::Position pos = log.readPosition();
+        TEST_ASSERT_EQUAL_UINT32(count, readAll(log, pos, first, count));
+        log.acknowledge(pos, count);
+    }
+
+    uint32_t firstPending(SegmentLog &log)
+    {
+        uint8_t data[SegmentLog::MAX_RECORD];
+        uint16_t length;
+        SegmentLog::Position pos = log.readPosition();
+        TEST_ASSERT_TRUE(log.read(pos, data, sizeof(data), length));
+        uint32_t i;
+        memcpy(&i, data, sizeof(i));
+        return i;
+    }
+
+    void test_records_read_back_in_order()
+    {
+        SegmentLog log;
+        TEST_ASSERT_TRUE(log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES));
+        TEST_ASSERT_TRUE(log.empty());
+        append(log, 0, 40); // three segments
+        TEST_ASSERT_EQUAL_UINT32(40, log.pending());
+        SegmentLog::Position pos = log.readPosition();
+        TEST_ASSERT_EQUAL_UINT32(40, readAll(log, pos, 0));
+        // Reading ahead does not release anything
+        TEST_ASSERT_EQUAL_UINT32(40, log.pending());
+        log.acknowledge(pos, 40);
+        TEST_ASSERT_TRUE(log.empty());
+    }
+
+    void test_torn_last_record_skipped()
+    {
+        {
+            SegmentLog log;
+            log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+            append(log, 1000, 3);
+        }
+        // Reset in the middle of the third append: its data is cut short
+        std::string segment = hostPath("00000000.seg");
+        TEST_ASSERT_EQUAL(0, truncate(segment.c_str(), 2 * (6 + 8) + 6 + 3));
+
+        SegmentLog log;
+        log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+        TEST_ASSERT_EQUAL_UINT32(2, log.pending());
+        // New records go to a fresh segment, after the intact ones
+        append(log, 1002, 2);
+        TEST_ASSERT_EQUAL_UINT32(1, log.writePosition().segment);
+        SegmentLog::Position pos = log.readPosition();
+        TEST_ASSERT_EQUAL_UINT32(4, readAll(log, pos, 1000));
+        TEST_ASSERT_EQUAL_UINT32(1, log.stats().corrupt);
+    }
+
+    void test_corrupt_record_skips_rest_of_segment()
+    {
+        {
+            SegmentLog log;
+            log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+            append(log, 0, 20);
+        }
+        // A data byte of the second record
+        flipByte(hostPath("00000000.seg"), (6 + RECORD) + 6 + 100);
+
+        SegmentLog log;
+        log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+        SegmentLog::Position pos = log.readPosition();
+        TEST_ASSERT_EQUAL_UINT32(1, readAll(log, pos, 0, 1));
+        // The framing after the bad record is not trusted: on to segment 1
+        TEST_ASSERT_EQUAL_UINT32(4, readAll(log, pos, 16));
+        TEST_ASSERT_EQUAL_UINT32(1, log.stats().corrupt);
+    }
+
+    void test_read_position_survives_reopen()
+    {
+        {
+            SegmentLog log;
+            log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+            append(log, 0, 40);
+            consume(log, 0, SegmentLog::CURSOR_COMMIT_RECORDS);
+        }
+        {
+            SegmentLog log;
+            log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+            TEST_ASSERT_EQUAL_UINT32(40 - SegmentLog::CURSOR_COMMIT_RECORDS, log.pending());
+            TEST_ASSERT_EQUAL_UINT32(SegmentLog::CURSOR_COMMIT_RECORDS, firstPending(log));
+            consume(log, SegmentLog::CURSOR_COMMIT_RECORDS, 40 - SegmentLog::CURSOR_COMMIT_RECORDS);
+        }
+        // Drained: the cursor is saved even short of CURSOR_COMMIT_RECORDS
+        SegmentLog log;
+        log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+        TEST_ASSERT_TRUE(log.empty());
+    }
+
+    // Acknowledgements since the last cursor save are delivered again
+    void test_unsaved_acknowledgements_replayed()
+    {
+        {
+            SegmentLog log;
+            log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+            append(log, 0, 10);
+            consume(log, 0, 5);
+            TEST_ASSERT_EQUAL_UINT32(5, log.pending());
+        }
+        SegmentLog log;
+        log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+        TEST_ASSERT_EQUAL_UINT32(10, log.pending());
+        TEST_ASSERT_EQUAL_UINT32(0, firstPending(log));
+    }
+
+    void test_corrupt_cursor_slot_falls_back()
+    {
+        {
+            SegmentLog log;
+            log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+            append(log, 1000, 40); // all in segment 0
+            // Generation 1 (slot 1) at record 16, generation 2 (slot 0) at 32
+            consume(log, 1000, 16);
+            consume(log, 1016, 16);
+        }
+        {
+            SegmentLog log;
+            log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+            TEST_ASSERT_EQUAL_UINT32(1032, firstPending(log));
+        }
+        // A reset while slot 0 was being written: the older slot wins
+        flipByte(hostPath("cursor0"), 4);
+
+        SegmentLog log;
+        log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+        TEST_ASSERT_EQUAL_UINT32(1016, firstPending(log));
+        TEST_ASSERT_EQUAL_UINT32(24, log.pending());
+    }
+
+    void test_oldest_segment_dropped_when_full()
+    {
+        SegmentLog log;
+        log.begin(LOG_DIR, 2 * SegmentLog::SEGMENT_BYTES);
+        TEST_ASSERT_EQUAL_UINT32(2 * SegmentLog::SEGMENT_BYTES, log.capacity());
+        append(log, 0, 32);
+        TEST_ASSERT_EQUAL_UINT32(0, log.stats().dropped);
+        // The 33rd record opens a third segment
+        append(log, 32, 1);
+        TEST_ASSERT_EQUAL_UINT32(16, log.stats().dropped);
+        TEST_ASSERT_EQUAL_UINT32(17, log.pending());
+        TEST_ASSERT_EQUAL_UINT32(1, log.readPosition().segment);
+        SegmentLog::Position pos = log.readPosition();
+        TEST_ASSERT_EQUAL_UINT32(17, readAll(log, pos, 16));
+        TEST_ASSERT_FALSE(LittleFS.exists("/log/00000000.seg"));
+    }
+
+    // A read position from before the drop moves to the oldest record left
+    void test_read_ahead_position_follows_drop()
+    {
+        SegmentLog log;
+        log.begin(LOG_DIR, 2 * SegmentLog::SEGMENT_BYTES);
+        append(log, 0, 20);
+        SegmentLog::Position pos = log.readPosition();
+        TEST_ASSERT_EQUAL_UINT32(3, readAll(log, pos, 0, 3));
+        append(log, 20, 20);
+        TEST_ASSERT_EQUAL_UINT32(24, readAll(log, pos, 16));
+    }
+
+    void test_smaller_capacity_drops_at_once()
+    {
+        SegmentLog log;
+        log.begin(LOG_DIR, 64 * SegmentLog::SEGMENT_BYTES);
+        append(log, 0, 64); // segments 0..3
+        log.setCapacity(2 * SegmentLog::SEGMENT_BYTES);
+        TEST_ASSERT_EQUAL_UINT32(32, log.stats().dropped);
+        TEST_ASSERT_EQUAL_UINT32(32, firstPending(log));
+    }
+
+} // namespace
+
+void setUp()
+{
+    // Every test starts on an empty partition
+    snprintf(fsRoot, sizeof(fsRoot), "/tmp/test_segment_log.XXXXXX");
+    TEST_ASSERT_NOT_NULL(mkdtemp(fsRoot));
+    hal::setFsRoot(fsRoot);
+}
+
+void tearDown() {}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_records_read_back_in_order);
+    RUN_TEST(test_torn_last_record_skipped);
+    RUN_TEST(test_corrupt_record_skips_rest_of_segment);
+    RUN_TEST(test_read_position_survives_reopen);
+    RUN_TEST(test_unsaved_acknowledgements_replayed);
+    RUN_TEST(test_corrupt_cursor_slot_falls_back);
+    RUN_TEST(test_oldest_segment_dropped_when_full);
+    RUN_TEST(test_read_ahead_position_follows_drop);
+    RUN_TEST(test_smaller_capacity_drops_at_once);
+    return UNITY_END();
+}
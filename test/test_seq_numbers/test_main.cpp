@@ -0,0 +1,180 @@
+// Reading sequence numbers across restarts: numbers are reserved on flash
+// a block at a time and a restart goes on at the next block, so no number
+// is used twice. A restart is a new DataSender on the same filesystem;
+// numbers are read from what the broker receives. Run with
+// `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include <LittleFS.h>
+#include <stdlib.h>
+#include <memory>
+#include <vector>
+#include "DataSender.h"
+#include "FakeBroker.h"
+#include "WallClock.h"
+
+namespace
+{
+    const uint32_t SEQ_BLOCK = 1024; // DataSender::SEQ_BLOCK
+
+    hal::SimClock simClock;
+    FakeBroker broker;
+    std::unique_ptr<DataSender> sender;
+    std::vector<uint32_t> received;
+    char fsRoot[64];
+
+    void observe(const char *topic, const uint8_t *payload, size_t length)
+    {
+        (void)topic;
+        static const char key[] = "\"seq\":";
+        for (size_t i = 0; i + sizeof(key) - 1 <= length; i++)
+        {
+            if (memcmp(payload + i, key, sizeof(key) - 1) == 0)
+                received.push_back(strtoul((const char *)payload + i + sizeof(key) - 1, nullptr, 10));
+        }
+    }
+
+    void run(unsigned long ms)
+    {
+        for (unsigned long end = simClock.millis() + ms; (long)(simClock.millis() - end) < 0;)
+        {
+            sender->loop();
+            simClock.advance(1000);
+        }
+    }
+
+    // Power on: a new DataSender on the same flash, connected
+    void boot()
+    {
+        sender.reset();
+        sender.reset(new DataSender());
+        sender->setBacklogDays(1, 1000, 1);
+        sender->setup();
+        for (int i = 0; i < 60000 && !sender->isConnected(); i++)
+        {
+            run(1);
+        }
+        TEST_ASSERT_TRUE(sender->isConnected());
+        received.clear();
+    }
+
+    void send(uint32_t count)
+    {
+        MeterReadings readings = MeterReadings();
+        readings.voltage = 230.0f;
+        readings.samples = 1;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            readings.timestamp = millis();
+            sender->sendData(readings);
+            run(5);
+        }
+        run(100);
+        TEST_ASSERT_EQUAL_UINT32(count, received.size());
+    }
+
+    // The end of the reserved block, as on flash
+    uint32_t stored()
+    {
+        File file = LittleFS.open("/seq", "r");
+        uint32_t value = 0;
+        if (!file || file.read((uint8_t *)&value, sizeof(value)) != sizeof(value))
+        {
+            return 0;
+        }
+        return value;
+    }
+
+    void assertConsecutive(uint32_t first)
+    {
+        for (size_t i = 0; i < received.size(); i++)
+        {
+            TEST_ASSERT_EQUAL_UINT32(first + i, received[i]);
+        }
+    }
+
+    void test_fresh_device_starts_at_one()
+    {
+        boot();
+        TEST_ASSERT_EQUAL_UINT32(SEQ_BLOCK, stored());
+        send(3);
+        assertConsecutive(1);
+        TEST_ASSERT_EQUAL_UINT32(SEQ_BLOCK, stored());
+    }
+
+    void test_restart_goes_on_at_next_block()
+    {
+        boot();
+        send(3);
+        boot();
+        TEST_ASSERT_EQUAL_UINT32(2 * SEQ_BLOCK, stored());
+        send(3);
+        assertConsecutive(SEQ_BLOCK);
+    }
+
+    void test_restart_without_readings_skips_a_block()
+    {
+        boot();
+        boot();
+        boot();
+        send(1);
+        assertConsecutive(2 * SEQ_BLOCK);
+        TEST_ASSERT_EQUAL_UINT32(3 * SEQ_BLOCK, stored());
+    }
+
+    void test_next_block_reserved_before_it_is_used()
+    {
+        boot();
+        send(SEQ_BLOCK + 10);
+        assertConsecutive(1);
+        // The last number of the first block reserved the second
+        TEST_ASSERT_EQUAL_UINT32(2 * SEQ_BLOCK, stored());
+        boot();
+        send(1);
+        assertConsecutive(2 * SEQ_BLOCK);
+    }
+
+    // The dashboard marks a gap that ends on a block boundary as a restart
+    void test_restart_starts_on_a_multiple_of_the_block()
+    {
+        boot();
+        send(5);
+        uint32_t last = received.back();
+        boot();
+        send(1);
+        TEST_ASSERT_TRUE(received[0] > last);
+        TEST_ASSERT_EQUAL_UINT32(0, received[0] % SEQ_BLOCK);
+    }
+
+} // namespace
+
+void setUp()
+{
+    // Every test starts as a new device
+    snprintf(fsRoot, sizeof(fsRoot), "/tmp/test_seq_numbers.XXXXXX");
+    TEST_ASSERT_NOT_NULL(mkdtemp(fsRoot));
+    hal::setFsRoot(fsRoot);
+}
+
+void tearDown()
+{
+    sender.reset();
+}
+
+int main()
+{
+    hal::setClock(&simClock);
+    hal::setNetwork(&broker);
+    broker.setObserver(observe);
+    // Readings are published, not held on flash for the clock
+    wallClock.takeSync(1750000000000LL, 0);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_fresh_device_starts_at_one);
+    RUN_TEST(test_restart_goes_on_at_next_block);
+    RUN_TEST(test_restart_without_readings_skips_a_block);
+    RUN_TEST(test_next_block_reserved_before_it_is_used);
+    RUN_TEST(test_restart_starts_on_a_multiple_of_the_block);
+    return UNITY_END();
+}
@@ -0,0 +1,154 @@
+// WallClock: millis() to wall-clock time across SNTP updates, with the
+// offset and drift each update reveals. Updates are fed to takeSync() as
+// loop() would; run with `pio test -e native`.
+
+#include <Arduino.h>
+#include <unity.h>
+#include "WallClock.h"
+
+namespace
+{
+    const int64_t EPOCH_MS = 1750000000000LL; // 2025-06-15
+    const unsigned long HOUR = 3600000;
+
+    hal::SimClock simClock;
+
+    void advance(unsigned long ms)
+    {
+        for (; ms > 1000; ms -= 1000)
+        {
+            simClock.advance(1000000);
+        }
+        simClock.advance(ms * 1000);
+    }
+
+    void test_unset()
+    {
+        WallClock clock;
+        TEST_ASSERT_FALSE(clock.synced());
+        TEST_ASSERT_EQUAL(WallClock::CLOCK_UNSET, clock.quality());
+        TEST_ASSERT_EQUAL_UINT32(0, clock.epochAt(1000));
+        TEST_ASSERT_EQUAL_UINT32(0, clock.epochAtUptime(1));
+        TEST_ASSERT_TRUE(clock.epochMillisAt(1000) == 0);
+    }
+
+    void test_time_before_valid_is_ignored()
+    {
+        WallClock clock;
+        // SNTP not through yet: the system clock still counts from 1970
+        clock.takeSync(5000, 5000);
+        TEST_ASSERT_FALSE(clock.synced());
+        TEST_ASSERT_EQUAL_UINT32(0, clock.syncs());
+    }
+
+    void test_first_sync_maps_backwards()
+    {
+        WallClock clock;
+        clock.takeSync(EPOCH_MS, 10000);
+        TEST_ASSERT_TRUE(clock.synced());
+        TEST_ASSERT_TRUE(clock.epochMillisAt(10000) == EPOCH_MS);
+        // A reading taken 6 s before the clock was set gets its true time
+        TEST_ASSERT_TRUE(clock.epochMillisAt(4000) == EPOCH_MS - 6000);
+        TEST_ASSERT_EQUAL_UINT32(EPOCH_MS / 1000 - 6, clock.epochAt(4000));
+        TEST_ASSERT_EQUAL_UINT32(EPOCH_MS / 1000 - 10, clock.epochAtUptime(0));
+        TEST_ASSERT_EQUAL_INT32(0, clock.lastOffset());
+        TEST_ASSERT_EQUAL_FLOAT(0.0f, clock.drift());
+    }
+
+    void test_offset_and_drift()
+    {
+        WallClock clock;
+        clock.takeSync(EPOCH_MS, 0);
+        // millis() runs 10 ppm slow: 36 ms short after an hour
+        clock.takeSync(EPOCH_MS + HOUR + 36, HOUR);
+        TEST_ASSERT_EQUAL_INT32(36, clock.lastOffset());
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, 10.0f, clock.drift());
+        TEST_ASSERT_EQUAL_UINT32(2, clock.syncs());
+
+        // The drift now corrects the mapping between updates
+        TEST_ASSERT_INT64_WITHIN(1, EPOCH_MS + 2 * HOUR + 36 + 36, clock.epochMillisAt(2 * HOUR));
+        // and an update that agrees finds no offset
+        clock.takeSync(EPOCH_MS + 2 * HOUR + 72, 2 * HOUR);
+        TEST_ASSERT_INT_WITHIN(1, 0, clock.lastOffset());
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, 10.0f, clock.drift());
+    }
+
+    void test_drift_is_smoothed()
+    {
+        WallClock clock;
+        clock.takeSync(EPOCH_MS, 0);
+        clock.takeSync(EPOCH_MS + HOUR + 36, HOUR); // 10 ppm, taken as is
+        clock.takeSync(EPOCH_MS + 2 * HOUR + 36 + 72, 2 * HOUR); // 20 ppm: a quarter of the way
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, 12.5f, clock.drift());
+        TEST_ASSERT_INT_WITHIN(1, 36, clock.lastOffset());
+    }
+
+    void test_short_interval_keeps_drift()
+    {
+        WallClock clock;
+        clock.takeSync(EPOCH_MS, 0);
+        clock.takeSync(EPOCH_MS + HOUR + 36, HOUR);
+        // Five minutes: SNTP jitter would outweigh the drift
+        clock.takeSync(EPOCH_MS + HOUR + 300000 + 36 + 50, HOUR + 300000);
+        TEST_ASSERT_INT_WITHIN(1, 47, clock.lastOffset());
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, 10.0f, clock.drift());
+    }
+
+    void test_step_is_not_drift()
+    {
+        WallClock clock;
+        clock.takeSync(EPOCH_MS, 0);
+        clock.takeSync(EPOCH_MS + HOUR + 36, HOUR);
+        // 5 s after an hour is ~1400 ppm: the clock was stepped
+        clock.takeSync(EPOCH_MS + 2 * HOUR + 36 + 5000, 2 * HOUR);
+        TEST_ASSERT_INT_WITHIN(1, 4964, clock.lastOffset());
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, 10.0f, clock.drift());
+        // Re-anchored on the stepped time all the same
+        TEST_ASSERT_TRUE(clock.epochMillisAt(2 * HOUR) == EPOCH_MS + 2 * HOUR + 36 + 5000);
+    }
+
+    void test_millis_wrap()
+    {
+        WallClock clock;
+        unsigned long anchor = 0xFFFFF000UL;
+        clock.takeSync(EPOCH_MS, anchor);
+        // 8192 ms later, past the wrap of millis()
+        TEST_ASSERT_TRUE(clock.epochMillisAt(0x1000UL) == EPOCH_MS + 8192);
+        TEST_ASSERT_TRUE(clock.epochMillisAt(anchor - 1000) == EPOCH_MS - 1000);
+    }
+
+    void test_quality()
+    {
+        WallClock clock;
+        clock.takeSync(EPOCH_MS, simClock.millis());
+        TEST_ASSERT_EQUAL(WallClock::CLOCK_SYNCED, clock.quality());
+        advance(3 * WallClock::SYNC_INTERVAL);
+        TEST_ASSERT_EQUAL(WallClock::CLOCK_SYNCED, clock.quality());
+        // Three missed updates
+        advance(1000);
+        TEST_ASSERT_EQUAL(WallClock::CLOCK_STALE, clock.quality());
+        clock.takeSync(EPOCH_MS + 3 * HOUR + 1000, simClock.millis());
+        TEST_ASSERT_EQUAL(WallClock::CLOCK_SYNCED, clock.quality());
+        TEST_ASSERT_EQUAL(0, clock.sinceSync());
+    }
+
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+int main()
+{
+    hal::setClock(&simClock);
+    UNITY_BEGIN();
+    RUN_TEST(test_unset);
+    RUN_TEST(test_time_before_valid_is_ignored);
+    RUN_TEST(test_first_sync_maps_backwards);
+    RUN_TEST(test_offset_and_drift);
+    RUN_TEST(test_drift_is_smoothed);
+    RUN_TEST(test_short_interval_keeps_drift);
+    RUN_TEST(test_step_is_not_drift);
+    RUN_TEST(test_millis_wrap);
+    RUN_TEST(test_quality);
+    return UNITY_END();
+}